@@ -29,8 +29,12 @@
 #include "CascPort.h"
 #include "common/Common.h"
 #include "common/Array.h"
+#include "common/Arena.h"
 #include "common/ArraySparse.h"
+#include "common/ArrayChunked.h"
+#include "common/Bloom.h"
 #include "common/Map.h"
+#include "common/SortedMap.h"
 #include "common/FileTree.h"
 #include "common/FileStream.h"
 #include "common/Directory.h"
@@ -40,6 +44,8 @@
 #include "common/Path.h"
 #include "common/RootHandler.h"
 #include "common/Sockets.h"
+#include "common/Threads.h"
+#include "common/FrameCache.h"
 
 // Headers for hashes used in CascLib
 #include "hashes/md5.h"
@@ -169,6 +175,14 @@ typedef struct _CASC_ENCODING_HEADER
     DWORD  ESpecBlockSize;                          // Size of the ESpec string block, in bytes
 } CASC_ENCODING_HEADER, *PCASC_ENCODING_HEADER;
 
+// Item of the EKey index of the lazy ENCODING. Sorted by the EKey
+typedef struct _CASC_ENCODING_EKEY
+{
+    BYTE  EKey[CASC_EKEY_SIZE];                     // The first EKey of the ENCODING entry, first 9 bytes
+    BYTE  Padding[3];
+    DWORD EntryOffset;                              // Offset of the ENCODING entry in the ENCODING manifest
+} CASC_ENCODING_EKEY, *PCASC_ENCODING_EKEY;
+
 typedef struct _CASC_DOWNLOAD_HEADER
 {
     USHORT Magic;                                   // FILE_MAGIC_DOWNLOAD ('DL')
@@ -260,6 +274,17 @@ typedef struct _CASC_ARCHIVE_INFO
 //-----------------------------------------------------------------------------
 // Structures for CASC storage and CASC file
 
+struct TCascStorage;
+
+// Reference count of one loaded build. Each open file holds a reference to the build
+// it was opened in, so that the build can be freed after CascRefreshStorage replaced it
+typedef struct _CASC_BUILD_REF
+{
+    TCascStorage * hsRetired;                       // Storage object that holds the replaced build. NULL for the current build
+    DWORD dwRefCount;                               // Number of references (interlocked)
+
+} CASC_BUILD_REF, *PCASC_BUILD_REF;
+
 struct TCascStorage
 {
     TCascStorage();
@@ -268,6 +293,10 @@ struct TCascStorage
     TCascStorage * AddRef();
     TCascStorage * Release();
 
+    // References to the current build. The last release of a replaced build frees it
+    PCASC_BUILD_REF AddRefBuild();
+    void ReleaseBuild(PCASC_BUILD_REF pBuildRef);
+
     static TCascStorage * IsValid(HANDLE hStorage)
     {
         TCascStorage * hs = (TCascStorage *)hStorage;
@@ -277,6 +306,18 @@ struct TCascStorage
                 hs->ClassName == CASC_MAGIC_STORAGE) ? hs : NULL;
     }
 
+    // The flag is cleared after the deferred root handler and the key tables are complete,
+    // so when this returns false, they can be used without the root lock
+    bool IsRootDeferred()
+    {
+        return (CascInterlockedLoad(&dwRootDeferred) != 0);
+    }
+
+    // Tag bit masks are not part of the CKey entries, see TagMaskArray and CASC_CKEY_ENTRY::TagMaskIndex
+    PCASC_ALLOCATOR GetTableAllocator();
+    ULONGLONG GetTagBitMask(PCASC_CKEY_ENTRY pCKeyEntry);
+    DWORD SetTagBitMask(PCASC_CKEY_ENTRY pCKeyEntry, ULONGLONG TagBitMask);
+
     DWORD SetProductCodeName(LPCSTR szNewCodeName, size_t nLength = 0)
     {
         if(szCodeName == NULL && szNewCodeName != NULL)
@@ -330,6 +371,7 @@ struct TCascStorage
     CASC_BLOB BuildFiles;                           // List of supported build files
 
     TFileStream * DataFiles[CASC_MAX_DATA_FILES];   // Array of open data files
+    CASC_ARRAY RetiredDataFiles;                    // Data files that changed on disk and will be reopened. Kept until close, open files may refer to them
     CASC_INDEX IndexFiles[CASC_INDEX_COUNT];        // Array of found index files
     CASC_MAP IndexEKeyMap;
 
@@ -341,12 +383,21 @@ struct TCascStorage
     CASC_CKEY_ENTRY SizeFile;                       // Information about SIZE file
     CASC_CKEY_ENTRY VfsRoot;                        // The main VFS root file
     CASC_ARRAY VfsRootList;                         // List of CASC_EKEY_ENTRY for each TVFS sub-root
+    CASC_BLOB EncodingData;                         // Content of the ENCODING manifest. Only kept with CASC_FEATURE_LAZY_ENCODING
+    CASC_ENCODING_HEADER EncodingHeader;            // Captured header of the ENCODING manifest in EncodingData
+    CASC_ARRAY EncodingEKeys;                       // Array of CASC_ENCODING_EKEY. Built on the first lookup of an EKey that has no CKey entry yet
+    CASC_SORTED_MAP EncodingEKeyMap;                // Map of EKey -> EncodingEKeys
 
     TRootHandler * pRootHandler;                    // Common handler for various ROOT file formats
+    CASC_LOCK RootLock;                             // Lock for creating the root handler with CASC_FEATURE_DEFERRED_ROOT
+    CASC_RWLOCK RootLoaderLock;                     // Held exclusive while the deferred ROOT is being loaded, shared by opens by CKey/EKey
+    DWORD dwRootLocaleMask;                         // Locale mask for loading the ROOT manifest
+    DWORD dwRootDeferred;                           // Nonzero if the root handler hasn't been created yet. See IsRootDeferred
     CASC_ARRAY IndexArray;                          // Array of CASC_EKEY_ENTRY, loaded from online indexes
-    CASC_ARRAY CKeyArray;                           // Array of CASC_CKEY_ENTRY, loaded from ENCODING file
+    CASC_CHUNKED_ARRAY CKeyArray;                   // Array of CASC_CKEY_ENTRY, loaded from ENCODING file. The entries never move
     CASC_ARRAY TagsArray;                           // Array of CASC_DOWNLOAD_TAG2
-    CASC_MAP IndexMap;                              // Map of EKey -> IndexArray (for online archives)
+    CASC_ARRAY TagMaskArray;                        // Tag bit masks (ULONGLONG) of the CKey entries that have tags. Only if the storage has tags
+    CASC_SORTED_MAP IndexMap;                       // Map of EKey -> IndexArray (for online archives). IndexArray is sorted by EKey
     CASC_MAP CKeyMap;                               // Map of CKey -> CKeyArray
     CASC_MAP EKeyMap;                               // Map of EKey -> CKeyArray
     size_t LocalFiles;                              // Number of files that are present locally
@@ -355,8 +406,18 @@ struct TCascStorage
     size_t EKeyLength;                              // EKey length from the index files
     DWORD FileOffsetBits;                           // Number of bits in the storage offset which mean data segment offset
 
-    CASC_KEY_MAP KeyMap;                            // Growable map of encryption keys
+    PCASC_ALLOCATOR pAllocator;                     // Allocator of the storage content. NULL = the global allocator
+    CASC_ARENA Arena;                               // Items of the KeyMap. Only the encryption keys are allocated here
+    CASC_KEY_MAP KeyMap;                            // Growable map of encryption keys. Items are in the Arena
     ULONGLONG  LastFailKeyName;                     // The value of the encryption key that recently was NOT found.
+
+    CASC_STORAGE_OPEN_STATS OpenStats;              // Time and memory spent in each phase of loading the storage
+    ULONGLONG FileCacheBytes;                       // Memory held by frame arrays and file caches of open files (interlocked)
+    CASC_FRAME_CACHE FrameCache;                    // Decoded frames shared by all open files. Not replaced by CascRefreshStorage
+    TStreamCache * pBlockCache;                     // Cache of encoded blocks of the data files. Disabled by default
+
+    PCASC_BUILD_REF pBuildRef;                      // Reference count of the loaded build. Exchanged together with the build
+    TCascStorage * pRetired;                        // Content replaced by CascRefreshStorage. Kept until no open file refers to it
 };
 
 struct TCascFile
@@ -368,6 +429,17 @@ struct TCascFile
     void InitFileSpans(PCASC_FILE_SPAN pSpans, DWORD dwSpanCount);
     void InitCacheStrategy();
 
+    // Returns the storage object that holds the build of the CKey entries.
+    // This is not the storage handle if CascRefreshStorage replaced the build
+    TCascStorage * GetBuildStorage()
+    {
+        TCascStorage * hsRetired = NULL;
+
+        if(pBuildRef != NULL)
+            hsRetired = (TCascStorage *)CascInterlockedLoadPointer((void **)(&pBuildRef->hsRetired));
+        return (hsRetired != NULL) ? hsRetired : hs;
+    }
+
     static TCascFile * IsValid(HANDLE hFile)
     {
         TCascFile * hf = (TCascFile *)hFile;
@@ -383,6 +455,7 @@ struct TCascFile
 
     // Class members
     TCascStorage * hs;                              // Pointer to storage structure
+    PCASC_BUILD_REF pBuildRef;                      // Reference to the build that the CKey entries belong to
 
     PCASC_CKEY_ENTRY pCKeyEntry;                    // Pointer to the first CKey entry. Each entry describes one file span
     PCASC_FILE_SPAN pFileSpan;                      // Pointer to the first file span entry
@@ -399,6 +472,7 @@ struct TCascFile
     ULONGLONG FileCacheStart;                       // Starting offset of the file cached area
     ULONGLONG FileCacheEnd;                         // Ending offset of the file cached area
     LPBYTE pbFileCache;                             // Pointer to file cached area
+    ULONGLONG CacheBytes;                           // Bytes that this file has added to hs->FileCacheBytes
     CSTRTG CacheStrategy;                           // Caching strategy. See CSTRTG enum for more info
 };
 
@@ -412,6 +486,7 @@ struct TCascSearch
 
         // Init provider-specific data
         pCache = NULL;
+        PathCache.pParentNode = NULL;
         nFileIndex = 0;
         nSearchState = 0;
         bListFileUsed = false;
@@ -453,6 +528,7 @@ struct TCascSearch
 
     // Provider-specific data
     size_t nFileIndex;                              // Root-specific search context
+    CASC_PATH_CACHE PathCache;                      // Path of the last parent folder, for enumerating the file tree
     DWORD nSearchState:8;                           // The current search state (0 = listfile, 1 = nameless, 2 = done)
     DWORD bListFileUsed:1;                          // TRUE: The listfile has already been loaded
 };
@@ -464,8 +540,7 @@ inline void FreeCascBlob(PCASC_BLOB pBlob)
 {
     if(pBlob != NULL)
     {
-        CASC_FREE(pBlob->pbData);
-        pBlob->cbData = 0;
+        pBlob->Free();
     }
 }
 
@@ -486,6 +561,7 @@ DWORD LoadCdnBuildFile(TCascStorage * hs);
 
 DWORD LoadInternalFileToMemory(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, CASC_BLOB & FileData);
 DWORD LoadFileToMemory(LPCTSTR szFileName, CASC_BLOB & FileData);
+DWORD MapFileToMemory(LPCTSTR szFileName, CASC_BLOB & FileData);
 bool OpenFileByCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
 bool SetCacheStrategy(HANDLE hFile, CSTRTG CacheStrategy);
 
@@ -496,6 +572,9 @@ void * ProbeOutputBuffer(void * pvBuffer, size_t cbLength, size_t cbMinLength, s
 
 PCASC_CKEY_ENTRY FindCKeyEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex = NULL);
 PCASC_CKEY_ENTRY FindCKeyEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex = NULL);
+PCASC_CKEY_ENTRY LoadEncodingEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex = NULL);
+PCASC_CKEY_ENTRY LoadEncodingEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex = NULL);
+DWORD LoadDeferredRoot(TCascStorage * hs);
 
 size_t GetTagBitmapLength(LPBYTE pbFilePtr, LPBYTE pbFileEnd, DWORD EntryCount);
 
@@ -510,7 +589,9 @@ DWORD CascDecrypt(TCascStorage * hs, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LP
 
 bool CopyEKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry);
 
+DWORD ScanIndexDirectory(TCascStorage * hs);
 DWORD LoadIndexFiles(TCascStorage * hs);
+DWORD RefreshIndexFiles(TCascStorage * hs, bool * PtrChanged);
 void  FreeIndexFiles(TCascStorage * hs);
 
 //-----------------------------------------------------------------------------
@@ -523,6 +604,14 @@ DWORD RootHandler_CreateWoW(TCascStorage * hs, CASC_BLOB & RootFile, DWORD dwLoc
 DWORD RootHandler_CreateOverwatch(TCascStorage * hs, CASC_BLOB & RootFile);
 DWORD RootHandler_CreateStarcraft1(TCascStorage * hs, CASC_BLOB & RootFile);
 DWORD RootHandler_CreateInstall(TCascStorage * hs, CASC_BLOB & InstallFile);
+DWORD RootHandler_LoadSnapshotWoW(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd);
+DWORD RootHandler_LoadSnapshot(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd);
+
+//-----------------------------------------------------------------------------
+// Storage snapshots (CascSnapshot.cpp)
+
+DWORD LoadStorageSnapshot(TCascStorage * hs, LPCTSTR szSnapshotPath, DWORD dwLocaleMask);
+DWORD SaveStorageSnapshot(TCascStorage * hs, LPCTSTR szSnapshotPath, DWORD dwLocaleMask);
 
 //-----------------------------------------------------------------------------
 // Dumpers (CascDumpData.cpp)
@@ -654,11 +654,11 @@ static int Decrypt_Salsa20(LPBYTE pbOutBuffer, LPBYTE pbInBuffer, size_t cbInBuf
 //-----------------------------------------------------------------------------
 // Key map implementation
 
-static PCASC_ENCRYPTION_KEY2 CreateKeyItem(ULONGLONG KeyName, LPBYTE Key)
+static PCASC_ENCRYPTION_KEY2 CreateKeyItem(CASC_ARENA & Arena, ULONGLONG KeyName, LPBYTE Key)
 {
     PCASC_ENCRYPTION_KEY2 pNewItem;
 
-    if((pNewItem = new CASC_ENCRYPTION_KEY2) != NULL)
+    if((pNewItem = Arena.Alloc<CASC_ENCRYPTION_KEY2>()) != NULL)
     {
         memset(pNewItem, 0, sizeof(CASC_ENCRYPTION_KEY2));
         pNewItem->KeyName = KeyName;
@@ -673,25 +673,6 @@ CASC_KEY_MAP::CASC_KEY_MAP()
     memset(HashTable, 0, sizeof(HashTable));
 }
 
-CASC_KEY_MAP::~CASC_KEY_MAP()
-{
-    PCASC_ENCRYPTION_KEY2 pNextItem;
-    PCASC_ENCRYPTION_KEY2 pKeyItem;
-
-    for(size_t i = 0; i < CASC_KEY_TABLE_SIZE; i++)
-    {
-        if((pKeyItem = (PCASC_ENCRYPTION_KEY2)HashTable[i]) != NULL)
-        {
-            while(pKeyItem != NULL)
-            {
-                pNextItem = pKeyItem->pNext;
-                delete pKeyItem;
-                pKeyItem = pNextItem;
-            }
-        }
-    }
-}
-
 LPBYTE CASC_KEY_MAP::FindKey(ULONGLONG KeyName)
 {
     PCASC_ENCRYPTION_KEY2 pKeyItem = NULL;
@@ -710,7 +691,7 @@ LPBYTE CASC_KEY_MAP::FindKey(ULONGLONG KeyName)
     return NULL;
 }
 
-bool CASC_KEY_MAP::AddKey(ULONGLONG KeyName, LPBYTE Key)
+bool CASC_KEY_MAP::AddKey(CASC_ARENA & Arena, ULONGLONG KeyName, LPBYTE Key)
 {
     PCASC_ENCRYPTION_KEY2 pKeyItem;
     PCASC_ENCRYPTION_KEY2 pNewItem;
@@ -720,7 +701,7 @@ bool CASC_KEY_MAP::AddKey(ULONGLONG KeyName, LPBYTE Key)
     if(FindKey(KeyName) == NULL)
     {
         // Create new key item
-        if((pNewItem = CreateKeyItem(KeyName, Key)) == NULL)
+        if((pNewItem = CreateKeyItem(Arena, KeyName, Key)) == NULL)
             return false;
 
         if(HashTable[HashIndex] != NULL)
@@ -745,6 +726,23 @@ bool CASC_KEY_MAP::AddKey(ULONGLONG KeyName, LPBYTE Key)
     return true;
 }
 
+// Copies the keys that are not in this map yet. The items are created in this map's arena
+bool CASC_KEY_MAP::AddKeys(CASC_ARENA & Arena, CASC_KEY_MAP & Source)
+{
+    PCASC_ENCRYPTION_KEY2 pKeyItem;
+
+    for(size_t i = 0; i < CASC_KEY_TABLE_SIZE; i++)
+    {
+        for(pKeyItem = (PCASC_ENCRYPTION_KEY2)(Source.HashTable[i]); pKeyItem != NULL; pKeyItem = pKeyItem->pNext)
+        {
+            if(!AddKey(Arena, pKeyItem->KeyName, pKeyItem->Key))
+                return false;
+        }
+    }
+
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 // Public functions
 
@@ -752,7 +750,7 @@ DWORD CascLoadEncryptionKeys(TCascStorage * hs)
 {
     for(size_t i = 0; i < _countof(StaticCascKeys); i++)
     {
-        if(!hs->KeyMap.AddKey(StaticCascKeys[i].KeyName, StaticCascKeys[i].Key))
+        if(!hs->KeyMap.AddKey(hs->Arena, StaticCascKeys[i].KeyName, StaticCascKeys[i].Key))
         {
             return ERROR_NOT_ENOUGH_MEMORY;
         }
@@ -774,7 +772,8 @@ bool WINAPI CascAddEncryptionKey(HANDLE hStorage, ULONGLONG KeyName, LPBYTE Key)
     }
 
     // Add the key to the map and return result
-    return hs->KeyMap.AddKey(KeyName, Key);
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+    return hs->KeyMap.AddKey(hs->Arena, KeyName, Key);
 }
 
 bool WINAPI CascAddStringEncryptionKey(HANDLE hStorage, ULONGLONG KeyName, LPCSTR szKey)
@@ -817,6 +816,7 @@ LPBYTE WINAPI CascFindEncryptionKey(HANDLE hStorage, ULONGLONG KeyName)
 bool WINAPI CascGetNotFoundEncryptionKey(HANDLE hStorage, ULONGLONG * KeyName)
 {
     TCascStorage * hs;
+    ULONGLONG LastFailKeyName;
 
     // Validate the storage handle
     if((hs = TCascStorage::IsValid(hStorage)) == NULL)
@@ -826,14 +826,14 @@ bool WINAPI CascGetNotFoundEncryptionKey(HANDLE hStorage, ULONGLONG * KeyName)
     }
 
     // If there was no decryption key error, just return false with ERROR_SUCCESS
-    if(hs->LastFailKeyName == 0)
+    if((LastFailKeyName = CascInterlockedLoad64(&hs->LastFailKeyName)) == 0)
     {
         SetCascError(ERROR_SUCCESS);
         return false;
     }
 
     // Give the name of the key that failed most recently
-    KeyName[0] = hs->LastFailKeyName;
+    KeyName[0] = LastFailKeyName;
     return true;
 }
 
@@ -997,7 +997,8 @@ DWORD CascDecrypt(TCascStorage * hs, LPBYTE pbOutBuffer, PDWORD pcbOutBuffer, LP
     pbKey = hs->KeyMap.FindKey(KeyName);
     if(pbKey == NULL)
     {
-        hs->LastFailKeyName = KeyName;
+        // Frames may be decrypted on multiple threads at once
+        CascInterlockedStore64(&hs->LastFailKeyName, KeyName);
         return ERROR_FILE_ENCRYPTED;
     }
 
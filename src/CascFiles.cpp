@@ -1852,6 +1852,39 @@ DWORD LoadFileToMemory(LPCTSTR szFileName, CASC_BLOB & FileData)
     return dwErrCode;
 }
 
+// Maps a binary file to memory, so it can be parsed without copying it to a buffer.
+// The data are read-only and not zero-terminated. If the file can't be mapped, it is loaded
+// by LoadFileToMemory(). The file stays shared for writing, as the game client may update
+// the index files while the storage is open.
+DWORD MapFileToMemory(LPCTSTR szFileName, CASC_BLOB & FileData)
+{
+    TFileStream * pStream;
+    ULONGLONG FileSize = 0;
+    LPBYTE pbFileData;
+
+    // Open the file as memory-mapped stream
+    pStream = FileStream_OpenFile(szFileName, STREAM_FLAG_READ_ONLY | STREAM_FLAG_WRITE_SHARE | BASE_PROVIDER_MAP);
+    if(pStream != NULL)
+    {
+        // Do not map zero files or too large files
+        pbFileData = FileStream_GetMappedView(pStream, &FileSize);
+        if(pbFileData != NULL && 0 < FileSize && FileSize <= 0x2000000)
+        {
+            // The blob closes the stream when freed
+            FileData.Free();
+            FileData.pbData = pbFileData;
+            FileData.cbData = (size_t)FileSize;
+            FileData.pStream = pStream;
+            return ERROR_SUCCESS;
+        }
+
+        FileStream_Close(pStream);
+    }
+
+    // Fall back to reading the file
+    return LoadFileToMemory(szFileName, FileData);
+}
+
 //-----------------------------------------------------------------------------
 // Public CDN functions
 
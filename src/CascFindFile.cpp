@@ -62,7 +62,7 @@ static void SupplyFakeFileName(PCASC_FIND_DATA pFindData, PCASC_CKEY_ENTRY pCKey
     assert(false);
 }
 
-static bool CopyCKeyEntryToFindData(PCASC_FIND_DATA pFindData, PCASC_CKEY_ENTRY pCKeyEntry)
+static bool CopyCKeyEntryToFindData(TCascStorage * hs, PCASC_FIND_DATA pFindData, PCASC_CKEY_ENTRY pCKeyEntry)
 {
     ULONGLONG ContentSize = 0;
     ULONGLONG EncodedSize = 0;
@@ -72,7 +72,7 @@ static bool CopyCKeyEntryToFindData(PCASC_FIND_DATA pFindData, PCASC_CKEY_ENTRY
     CopyMemory16(pFindData->EKey, pCKeyEntry->EKey);
 
     // Supply the tag mask
-    pFindData->TagBitMask = pCKeyEntry->TagBitMask;
+    pFindData->TagBitMask = hs->GetTagBitMask(pCKeyEntry);
     
     // Supply the plain name. Only do that if the found name is not a CKey/EKey
     if(pFindData->szFileName[0] != 0)
@@ -120,7 +120,7 @@ static bool DoStorageSearch_RootFile(TCascSearch * pSearch, PCASC_FIND_DATA pFin
         assert(pCKeyEntry->RefCount != 0);
 
         // Copy the CKey entry to the find data and return it
-        return CopyCKeyEntryToFindData(pFindData, pCKeyEntry);
+        return CopyCKeyEntryToFindData(hs, pFindData, pCKeyEntry);
     }
 }
 
@@ -143,7 +143,7 @@ static bool DoStorageSearch_CKey(TCascSearch * pSearch, PCASC_FIND_DATA pFindDat
         // Only report files that are unreferenced by the ROOT handler
         if(pCKeyEntry->IsFile() && pCKeyEntry->RefCount == 0)
         {
-            return CopyCKeyEntryToFindData(pFindData, pCKeyEntry);
+            return CopyCKeyEntryToFindData(hs, pFindData, pCKeyEntry);
         }
     }
 
@@ -213,6 +213,13 @@ HANDLE WINAPI CascFindFirstFile(
     if(szMask == NULL || szMask[0] == 0)
         szMask = "*";
 
+    // The search data belong to the storage
+    CASC_ALLOCATOR_SCOPE AllocatorScope((hs != NULL) ? hs->pAllocator : NULL);
+
+    // Searching goes through the root handler. Create it, if its loading was deferred
+    if(dwErrCode == ERROR_SUCCESS && hs->IsRootDeferred())
+        dwErrCode = LoadDeferredRoot(hs);
+
     // Init the search structure and search handle
     if(dwErrCode == ERROR_SUCCESS)
     {
@@ -252,6 +259,7 @@ bool WINAPI CascFindNextFile(
     }
 
     // Perform search
+    CASC_ALLOCATOR_SCOPE AllocatorScope(pSearch->hs->pAllocator);
     return DoStorageSearch(pSearch, pFindData);
 }
 
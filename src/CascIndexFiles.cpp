@@ -22,7 +22,23 @@ static LPCTSTR szIndexFormat_V2 = _T("%02x%08x.idx");
 // Limit for "orphaned" items - those that are in index files, but are not in ENCODING manifest
 #define CASC_MAX_ORPHANED_ITEMS 0x100
 
-typedef bool (*EKEY_ENTRY_CALLBACK)(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, LPBYTE pbEKeyEntry);
+typedef bool (*EKEY_ENTRY_CALLBACK)(void * pvContext, CASC_INDEX_HEADER & InHeader, LPBYTE pbEKeyEntry);
+
+// Per-bucket state of the index loader. Each bucket is parsed into its own list of entries
+struct CASC_INDEX_BUCKET
+{
+    CASC_INDEX_HEADER InHeader;                     // Header of the index file
+    CASC_ARRAY EKeyEntries;                         // Pointers to the index entries, in the order of the file
+    DWORD dwErrCode;                                // Result of mapping and parsing the index file
+};
+
+struct CASC_INDEX_LOADER
+{
+    TCascStorage * hs;
+    CASC_INDEX_BUCKET Buckets[CASC_INDEX_COUNT];
+    CASC_THREAD_ID CallerThread;                    // Only the calling thread invokes the progress callback
+    DWORD BucketsDone;                              // Number of parsed buckets (interlocked)
+};
 
 //-----------------------------------------------------------------------------
 // Local functions
@@ -269,7 +285,7 @@ static LPBYTE CaptureGuardedBlock3(LPBYTE pbFileData, LPBYTE pbFileEnd, size_t E
     return (LPBYTE)(PtrEntryHash + 1);
 }
 
-static DWORD LoadIndexItems(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbEKeyEntry, LPBYTE pbEKeyEnd)
+static DWORD LoadIndexItems(void * pvContext, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbEKeyEntry, LPBYTE pbEKeyEnd)
 {
     size_t EntryLength = InHeader.EntryLength;
 
@@ -278,7 +294,7 @@ static DWORD LoadIndexItems(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, EKE
         // ENCODING for Starcraft II Beta
         // BREAK_ON_XKEY3(pbEKeyEntry, 0x8b, 0x0d, 0x9a);
 
-        if(!PfnEKeyEntry(hs, InHeader, pbEKeyEntry))
+        if(!PfnEKeyEntry(pvContext, InHeader, pbEKeyEntry))
             return ERROR_INDEX_PARSING_DONE;
 
         pbEKeyEntry += EntryLength;
@@ -381,18 +397,15 @@ static DWORD CaptureIndexHeader_V2(CASC_INDEX_HEADER & InHeader, LPBYTE pbFileDa
     return ERROR_SUCCESS;
 }    
 
-static DWORD LoadIndexFile_V1(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData)
+static DWORD LoadIndexFile_V1(void * pvContext, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData)
 {
     LPBYTE pbEKeyEntries = pbFileData + InHeader.HeaderLength + InHeader.HeaderPadding;
 
-    // Remember the values from the index header
-    SaveFileOffsetBitsAndEKeyLength(hs, InHeader.FileOffsetBits, InHeader.EKeyLength);
-
     // Load the entries from a continuous array
-    return LoadIndexItems(hs, InHeader, PfnEKeyEntry, pbEKeyEntries, pbFileData + cbFileData);
+    return LoadIndexItems(pvContext, InHeader, PfnEKeyEntry, pbEKeyEntries, pbFileData + cbFileData);
 }
 
-static DWORD LoadIndexFile_V2(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData)
+static DWORD LoadIndexFile_V2(void * pvContext, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData)
 {
     LPBYTE pbEKeyEntry;
     LPBYTE pbFileEnd = pbFileData + cbFileData;
@@ -401,9 +414,6 @@ static DWORD LoadIndexFile_V2(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, E
     DWORD BlockSize = 0;
     DWORD dwErrCode = ERROR_NOT_SUPPORTED;
 
-    // Remember the values from the index header
-    SaveFileOffsetBitsAndEKeyLength(hs, InHeader.FileOffsetBits, InHeader.EKeyLength);
-
     // Get the pointer to the first block of EKey entries
     if((pbEKeyEntry = CaptureGuardedBlock2(pbFilePtr, pbFileEnd, InHeader.EntryLength, &BlockSize)) != NULL)
     {
@@ -411,7 +421,7 @@ static DWORD LoadIndexFile_V2(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, E
         InHeader.HeaderPadding += sizeof(FILE_INDEX_GUARDED_BLOCK);
 
         // Load the continuous array of EKeys
-        return LoadIndexItems(hs, InHeader, PfnEKeyEntry, pbEKeyEntry, pbEKeyEntry + BlockSize);
+        return LoadIndexItems(pvContext, InHeader, PfnEKeyEntry, pbEKeyEntry, pbEKeyEntry + BlockSize);
     }
 
     // Get the pointer to the second block of EKey entries.
@@ -438,7 +448,7 @@ static DWORD LoadIndexFile_V2(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, E
                 //BREAK_ON_XKEY3(pbEKeyEntry, 0xbc, 0xe8, 0x23);
 
                 // Call the EKey entry callback
-                if(!PfnEKeyEntry(hs, InHeader, pbEKeyEntry))
+                if(!PfnEKeyEntry(pvContext, InHeader, pbEKeyEntry))
                     return ERROR_INDEX_PARSING_DONE;
 
                 pbEKeyEntry += AlignedLength;
@@ -453,62 +463,74 @@ static DWORD LoadIndexFile_V2(TCascStorage * hs, CASC_INDEX_HEADER & InHeader, E
     return dwErrCode;
 }
 
-static DWORD LoadIndexFile(TCascStorage * hs, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData, DWORD BucketIndex)
+static DWORD LoadIndexFile(void * pvContext, CASC_INDEX_HEADER & InHeader, EKEY_ENTRY_CALLBACK PfnEKeyEntry, LPBYTE pbFileData, size_t cbFileData, DWORD BucketIndex)
 {
-    CASC_INDEX_HEADER InHeader;
-
     // Check for CASC version 2
     if(CaptureIndexHeader_V2(InHeader, pbFileData, cbFileData, BucketIndex) == ERROR_SUCCESS)
-        return LoadIndexFile_V2(hs, InHeader, PfnEKeyEntry, pbFileData, cbFileData);
+        return LoadIndexFile_V2(pvContext, InHeader, PfnEKeyEntry, pbFileData, cbFileData);
 
     // Check for CASC index version 1
     if(CaptureIndexHeader_V1(InHeader, pbFileData, cbFileData, BucketIndex) == ERROR_SUCCESS)
-        return LoadIndexFile_V1(hs, InHeader, PfnEKeyEntry, pbFileData, cbFileData);
+        return LoadIndexFile_V1(pvContext, InHeader, PfnEKeyEntry, pbFileData, cbFileData);
 
     // Should never happen
     assert(false);
     return ERROR_BAD_FORMAT;
 }
 
-// Checks the EKey entry for EKey of the ENCODING manifest
-static bool InsertEncodingEKeyToMap(TCascStorage * hs, CASC_INDEX_HEADER &, LPBYTE pbEKeyEntry)
+// Appends the EKey entry to the entry list of the bucket
+static bool InsertEKeyToBucketList(void * pvContext, CASC_INDEX_HEADER &, LPBYTE pbEKeyEntry)
 {
-    hs->IndexEKeyMap.InsertObject(pbEKeyEntry, pbEKeyEntry);
+    CASC_INDEX_BUCKET * pBucket = (CASC_INDEX_BUCKET *)pvContext;
+
+    if(pBucket->EKeyEntries.Insert(&pbEKeyEntry, 1) == NULL)
+    {
+        pBucket->dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        return false;
+    }
     return true;
 }
 
-static DWORD ProcessLocalIndexFiles(TCascStorage * hs, EKEY_ENTRY_CALLBACK PfnEKeyEntry, DWORD dwIndexCount)
+// Maps and parses one index file. Called on a worker thread, so it must not touch the storage
+static DWORD LoadIndexBucket(void * pvContext, size_t nBucketIndex)
 {
-    DWORD dwErrCode = ERROR_SUCCESS;
-
-    // Load each index file
-    for(DWORD i = 0; i < dwIndexCount; i++)
+    CASC_INDEX_LOADER * pLoader = (CASC_INDEX_LOADER *)pvContext;
+    CASC_INDEX_BUCKET & Bucket = pLoader->Buckets[nBucketIndex];
+    CASC_INDEX & IndexFile = pLoader->hs->IndexFiles[nBucketIndex];
+    DWORD BucketsDone;
+
+    // WoW6 actually reads THE ENTIRE file to memory. Verified on Mac build (x64).
+    // We map it instead, as the index entries are used in-place until the index files are freed
+    if((Bucket.dwErrCode = MapFileToMemory(IndexFile.szFileName, IndexFile.FileData)) == ERROR_SUCCESS)
     {
-        CASC_INDEX & IndexFile = hs->IndexFiles[i];
-
-        // Inform the user about what we are doing
-        if(InvokeProgressCallback(hs, CascProgressLoadingIndexes, NULL, i, dwIndexCount))
+        // Parse the entries to a flat list. They are hashed only once, when merged to the storage map
+        Bucket.dwErrCode = Bucket.EKeyEntries.Create<LPBYTE>(IndexFile.FileData.cbData / sizeof(FILE_EKEY_ENTRY));
+        if(Bucket.dwErrCode == ERROR_SUCCESS)
         {
-            dwErrCode = ERROR_CANCELLED;
-            break;
-        }
+            DWORD dwErrCode = LoadIndexFile(&Bucket, Bucket.InHeader, InsertEKeyToBucketList, IndexFile.FileData.pbData, IndexFile.FileData.cbData, (DWORD)nBucketIndex);
 
-        // Load the index file
-        if((dwErrCode = LoadIndexFile(hs, PfnEKeyEntry, IndexFile.FileData.pbData, IndexFile.FileData.cbData, i)) != ERROR_SUCCESS)
-            break;
+            // The error from the entry callback takes precedence
+            if(Bucket.dwErrCode == ERROR_SUCCESS)
+                Bucket.dwErrCode = dwErrCode;
+        }
     }
 
-    // Swallow the "done parsing" error
-    if(dwErrCode == ERROR_INDEX_PARSING_DONE)
-        dwErrCode = ERROR_SUCCESS;
+    // Inform the user about what we are doing. The callback is only invoked on the calling
+    // thread; the buckets done by the worker threads are reported along with the next one
+    BucketsDone = CascInterlockedIncrement(&pLoader->BucketsDone);
+    if(CascIsCurrentThread(pLoader->CallerThread))
+    {
+        if(InvokeProgressCallback(pLoader->hs, CascProgressLoadingIndexes, NULL, BucketsDone, CASC_INDEX_COUNT))
+            return ERROR_CANCELLED;
+    }
 
-    // Remember the number of files that are present locally
-    hs->LocalFiles = hs->CKeyArray.ItemCount();
-    return dwErrCode;
+    // Other errors are evaluated by the caller, in the order of the buckets
+    return ERROR_SUCCESS;
 }
 
 static DWORD LoadLocalIndexFiles(TCascStorage * hs)
 {
+    CASC_INDEX_LOADER Loader;
     ULONGLONG TotalSize = 0;
     DWORD dwIndexCount = 0;
     DWORD dwErrCode;
@@ -518,47 +540,83 @@ static DWORD LoadLocalIndexFiles(TCascStorage * hs)
         return ERROR_CANCELLED;
 
     // Perform the directory scan
-    if((dwErrCode = ScanDirectory(hs->szIndexPath, NULL, IndexDirectory_OnFileFound, hs)) == ERROR_SUCCESS)
+    if((dwErrCode = ScanIndexDirectory(hs)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Create the names of all index files
+    for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
     {
-        // If no index file was found, we cannot load anything
-        if(hs->szIndexFormat == NULL)
-            return ERROR_FILE_NOT_FOUND;
+        CASC_INDEX & IndexFile = hs->IndexFiles[i];
 
-        // Load each index file
-        for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
-        {
-            CASC_INDEX & IndexFile = hs->IndexFiles[i];
+        if((IndexFile.szFileName = CreateIndexFileName(hs, i, IndexFile.NewSubIndex)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
 
-            // Create the file name
-            if((IndexFile.szFileName = CreateIndexFileName(hs, i, IndexFile.NewSubIndex)) == NULL)
-                return ERROR_NOT_ENOUGH_MEMORY;
+    // Map and parse all index files in parallel. Each one goes to its own list of entries
+    Loader.hs = hs;
+    Loader.CallerThread = CascGetCurrentThreadId();
+    Loader.BucketsDone = 0;
+    for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
+        Loader.Buckets[i].dwErrCode = ERROR_SUCCESS;
+    dwErrCode = CascParallelFor(LoadIndexBucket, &Loader, CASC_INDEX_COUNT);
+
+    // Check the results in the order of the buckets. Storages downloaded by Blizzget tool
+    // don't have all index files present; the buckets after the first missing one are not used
+    for(DWORD i = 0; i < CASC_INDEX_COUNT && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        CASC_INDEX_BUCKET & Bucket = Loader.Buckets[i];
 
-            // WoW6 actually reads THE ENTIRE file to memory. Verified on Mac build (x64).
-            dwErrCode = LoadFileToMemory(IndexFile.szFileName, IndexFile.FileData);
-            if(dwErrCode != ERROR_SUCCESS)
-            {
-                // Storages downloaded by Blizzget tool don't have all index files present
-                if((dwErrCode = GetCascError()) == ERROR_FILE_NOT_FOUND)
-                {
-                    dwErrCode = ERROR_SUCCESS;
-                    break;
-                }
-                return dwErrCode;
-            }
+        // Swallow the "done parsing" error
+        if(Bucket.dwErrCode == ERROR_INDEX_PARSING_DONE)
+            Bucket.dwErrCode = ERROR_SUCCESS;
 
-            // Add to the total size of the index files
-            TotalSize += IndexFile.FileData.cbData;
-            dwIndexCount++;
+        // Check the result of the index file mapping and parsing
+        if(Bucket.dwErrCode != ERROR_SUCCESS)
+        {
+            if(Bucket.dwErrCode != ERROR_FILE_NOT_FOUND)
+                dwErrCode = Bucket.dwErrCode;
+            break;
         }
 
-        // Build the map of EKey -> IndexEKeyEntry
+        // Add to the total size of the index files
+        TotalSize += hs->IndexFiles[i].FileData.cbData;
+        dwIndexCount++;
+    }
+
+    // Free the index files that are not going to be used
+    for(DWORD i = dwIndexCount; i < CASC_INDEX_COUNT; i++)
+        hs->IndexFiles[i].FileData.Free();
+
+    // Build the map of EKey -> IndexEKeyEntry
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        CASC_ALLOCATOR_SCOPE AllocatorScope(hs->GetTableAllocator());
+
         dwErrCode = hs->IndexEKeyMap.Create((size_t)(TotalSize / sizeof(FILE_EKEY_ENTRY)), CASC_EKEY_SIZE, 0);
-        if(dwErrCode == ERROR_SUCCESS)
-        {
-            dwErrCode = ProcessLocalIndexFiles(hs, InsertEncodingEKeyToMap, dwIndexCount);
-        }
+        if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_BLOOM_FILTERS))
+            dwErrCode = hs->IndexEKeyMap.CreateFilter((size_t)(TotalSize / sizeof(FILE_EKEY_ENTRY)));
     }
 
+    // Insert the entries in the order of the buckets. If an EKey is present
+    // in multiple index files, the one from the lowest bucket is used
+    for(DWORD i = 0; i < dwIndexCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        CASC_INDEX_BUCKET & Bucket = Loader.Buckets[i];
+        LPBYTE * EKeyEntries = (LPBYTE *)Bucket.EKeyEntries.ItemArray();
+
+        // Remember the values from the index header
+        SaveFileOffsetBitsAndEKeyLength(hs, Bucket.InHeader.FileOffsetBits, Bucket.InHeader.EKeyLength);
+
+        for(size_t j = 0; j < Bucket.EKeyEntries.ItemCount(); j++)
+            hs->IndexEKeyMap.InsertObject(EKeyEntries[j], EKeyEntries[j]);
+    }
+
+    // Free the lists of entries
+    for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
+        Loader.Buckets[i].EKeyEntries.Free();
+
+    // Remember the number of files that are present locally
+    hs->LocalFiles = hs->CKeyArray.ItemCount();
     return dwErrCode;
 }
 
@@ -704,31 +762,32 @@ static DWORD LoadArchiveIndexFile(TCascStorage * hs, LPBYTE pbIndexFile, size_t
     return ERROR_SUCCESS;
 }
 
+// Sorts the index entries by EKey. Entries with the same EKey are sorted by archive index,
+// so the lookup returns the one from the first archive that contains the file
+static int CompareEKeyEntries(const void * pvEntry1, const void * pvEntry2)
+{
+    PCASC_EKEY_ENTRY pEKeyEntry1 = (PCASC_EKEY_ENTRY)pvEntry1;
+    PCASC_EKEY_ENTRY pEKeyEntry2 = (PCASC_EKEY_ENTRY)pvEntry2;
+    int nResult;
+
+    if((nResult = memcmp(pEKeyEntry1->EKey, pEKeyEntry2->EKey, MD5_HASH_SIZE)) != 0)
+        return nResult;
+    if(pEKeyEntry1->StorageOffset != pEKeyEntry2->StorageOffset)
+        return (pEKeyEntry1->StorageOffset < pEKeyEntry2->StorageOffset) ? -1 : +1;
+    return 0;
+}
+
 static DWORD BuildMapOfArchiveIndices(TCascStorage * hs)
 {
-    PCASC_EKEY_ENTRY pEKeyEntry;
     size_t nItemCount = hs->IndexArray.ItemCount();
-    DWORD dwErrCode;
 
-    // Create the map
-    dwErrCode = hs->IndexMap.Create(nItemCount, MD5_HASH_SIZE, FIELD_OFFSET(CASC_EKEY_ENTRY, EKey));
-    if(dwErrCode != ERROR_SUCCESS)
-        return dwErrCode;
-
-    // Insert all items
-    for(size_t i = 0; i < nItemCount; i++)
-    {
-        pEKeyEntry = (PCASC_EKEY_ENTRY)hs->IndexArray.ItemAt(i);
-        if(pEKeyEntry != NULL)
-        {
-            if(!hs->IndexMap.InsertObject(pEKeyEntry, pEKeyEntry->EKey))
-            {
-                return ERROR_NOT_ENOUGH_MEMORY;
-            }
-        }
-    }
+    // The archive indexes are sorted, but each one separately.
+    // Sort the entire array, so that the map needs no extra memory
+    if(nItemCount != 0)
+        qsort(hs->IndexArray.ItemArray(), nItemCount, sizeof(CASC_EKEY_ENTRY), CompareEKeyEntries);
 
-    return dwErrCode;
+    // Create the map
+    return hs->IndexMap.Create(hs->IndexArray.ItemArray(), nItemCount, sizeof(CASC_EKEY_ENTRY), MD5_HASH_SIZE, FIELD_OFFSET(CASC_EKEY_ENTRY, EKey));
 }
 
 static DWORD LoadArchiveIndexFiles(TCascStorage * hs)
@@ -759,8 +818,8 @@ static DWORD LoadArchiveIndexFiles(TCascStorage * hs)
         dwErrCode = FetchCascFile(hs, PathTypeData, pbIndexHash, _T(".index"), LocalPath);
         if(dwErrCode == ERROR_SUCCESS)
         {
-            // Load the index file to memory
-            if((dwErrCode = LoadFileToMemory(LocalPath, FileData)) == ERROR_SUCCESS)
+            // Map the index file to memory
+            if((dwErrCode = MapFileToMemory(LocalPath, FileData)) == ERROR_SUCCESS)
             {
                 dwErrCode = LoadArchiveIndexFile(hs, FileData.pbData, FileData.cbData, i);
             }
@@ -777,9 +836,59 @@ static DWORD LoadArchiveIndexFiles(TCascStorage * hs)
     return dwErrCode;
 }
 
+// Exchanges the index files of the storage with a saved set. The members are moved
+// as raw bytes, the same way as when the content of the storage is replaced
+static void ExchangeIndexFiles(TCascStorage * hs, CASC_INDEX * IndexFiles, CASC_MAP & IndexEKeyMap)
+{
+    BYTE IndexBuffer[sizeof(hs->IndexFiles)];
+    BYTE MapBuffer[sizeof(CASC_MAP)];
+
+    memcpy(IndexBuffer, (void *)(hs->IndexFiles), sizeof(IndexBuffer));
+    memcpy((void *)(hs->IndexFiles), (void *)(IndexFiles), sizeof(IndexBuffer));
+    memcpy((void *)(IndexFiles), IndexBuffer, sizeof(IndexBuffer));
+
+    memcpy(MapBuffer, (void *)(&hs->IndexEKeyMap), sizeof(MapBuffer));
+    memcpy((void *)(&hs->IndexEKeyMap), (void *)(&IndexEKeyMap), sizeof(MapBuffer));
+    memcpy((void *)(&IndexEKeyMap), MapBuffer, sizeof(MapBuffer));
+}
+
+// Frees the loaded content of index files. The versions of the files are kept
+static void FreeIndexFiles(CASC_INDEX * IndexFiles, CASC_MAP & IndexEKeyMap)
+{
+    // Free the map of EKey -> Index Ekey item
+    IndexEKeyMap.Free();
+
+    // Free all loaded index files
+    for(size_t i = 0; i < CASC_INDEX_COUNT; i++)
+    {
+        CASC_INDEX & IndexFile = IndexFiles[i];
+
+        // Free the file data
+        IndexFile.FileData.Free();
+
+        // Free the file name
+        CASC_FREE(IndexFile.szFileName);
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Public functions
 
+DWORD ScanIndexDirectory(TCascStorage * hs)
+{
+    DWORD dwErrCode;
+
+    // Find the newest version of each index file
+    if((dwErrCode = ScanDirectory(hs->szIndexPath, NULL, IndexDirectory_OnFileFound, hs)) == ERROR_SUCCESS)
+    {
+        // If no index file was found, we cannot load anything
+        if(hs->szIndexFormat == NULL)
+            return ERROR_FILE_NOT_FOUND;
+    }
+
+    return dwErrCode;
+}
+
 bool CopyEKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry)
 {
     // Don't do this on online storages
@@ -817,20 +926,80 @@ DWORD LoadIndexFiles(TCascStorage * hs)
     }
 }
 
-void FreeIndexFiles(TCascStorage * hs)
+// Checks for index files that were updated since the storage has been loaded
+// (e.g. by the game launcher) and applies their content to the CKey entries.
+// The new index files are loaded with the same rules as when the storage was opened;
+// if that fails, the storage keeps the previous index files
+DWORD RefreshIndexFiles(TCascStorage * hs, bool * PtrChanged)
 {
-    // Free the map of EKey -> Index Ekey item
-    hs->IndexEKeyMap.Free();
+    CASC_INDEX IndexFiles[CASC_INDEX_COUNT] = {};
+    CASC_MAP IndexEKeyMap;
+    size_t LocalFiles = hs->LocalFiles;
+    DWORD dwErrCode;
+    bool bIndexFilesLoaded = hs->IndexEKeyMap.IsInitialized();
+    bool bChanged = false;
 
-    // Free all loaded index files
-    for(size_t i = 0; i < CASC_INDEX_COUNT; i++)
+    // Only local storages have index files that can change
+    if(hs->BuildFileType != CascBuildDb && hs->BuildFileType != CascBuildInfo)
+        return ERROR_NOT_SUPPORTED;
+
+    // Move the current index files aside, so they can be restored on failure
+    ExchangeIndexFiles(hs, IndexFiles, IndexEKeyMap);
+
+    // Find the newest version of each index file
+    if((dwErrCode = ScanIndexDirectory(hs)) == ERROR_SUCCESS)
     {
-        CASC_INDEX & IndexFile = hs->IndexFiles[i];
+        for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
+        {
+            if(hs->IndexFiles[i].NewSubIndex != IndexFiles[i].NewSubIndex)
+                bChanged = true;
+        }
+    }
 
-        // Free the file data
-        IndexFile.FileData.Free();
+    // Load the complete new set of index files and apply it to the CKey entries
+    if(dwErrCode == ERROR_SUCCESS && bChanged)
+    {
+        if((dwErrCode = LoadLocalIndexFiles(hs)) == ERROR_SUCCESS)
+        {
+            for(size_t i = 0; i < hs->CKeyArray.ItemCount(); i++)
+            {
+                PCASC_CKEY_ENTRY pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemAt(i);
 
-        // Free the file name
-        CASC_FREE(IndexFile.szFileName);
+                // Files that are not in the index files anymore are not local anymore
+                if(pCKeyEntry->Flags & CASC_CE_HAS_EKEY)
+                {
+                    if(!CopyEKeyEntry(hs, pCKeyEntry))
+                        pCKeyEntry->Flags &= ~CASC_CE_FILE_IS_LOCAL;
+                }
+            }
+        }
+    }
+
+    // On failure or if nothing changed, put the previous index files back
+    if(dwErrCode != ERROR_SUCCESS || bChanged == false)
+    {
+        FreeIndexFiles(hs);
+        ExchangeIndexFiles(hs, IndexFiles, IndexEKeyMap);
+        hs->LocalFiles = LocalFiles;
+        bChanged = false;
+    }
+
+    // The index files are only kept for lazy ENCODING or deferred ROOT
+    else if(bIndexFilesLoaded == false)
+    {
+        FreeIndexFiles(hs->IndexFiles, hs->IndexEKeyMap);
     }
+
+    // Free whatever remained from the previous index files
+    FreeIndexFiles(IndexFiles, IndexEKeyMap);
+
+    // Give the result to the caller
+    if(PtrChanged != NULL)
+        PtrChanged[0] = bChanged;
+    return dwErrCode;
+}
+
+void FreeIndexFiles(TCascStorage * hs)
+{
+    FreeIndexFiles(hs->IndexFiles, hs->IndexEKeyMap);
 }
@@ -167,6 +167,18 @@ extern "C" {
 #define CASC_FEATURE_ONLINE         0x00000400  // Load the missing files from online CDNs
 #define CASC_FEATURE_FORCE_DOWNLOAD 0x00001000  // (Online) always download "versions" and "cdns" even if it exists locally
 #define CASC_FEATURE_ALLOW_DOWNLOAD 0x00002000  // Allow downloading internal files, if they are not present locally
+#define CASC_FEATURE_LAZY_ENCODING  0x00004000  // (Open) Only create CKey entries from ENCODING when they are looked up. DOWNLOAD is not loaded
+#define CASC_FEATURE_DEFERRED_ROOT  0x00008000  // (Open) Don't load ROOT on open. It's loaded on the first lookup by name or FileDataId, or on the first search
+#define CASC_FEATURE_BLOOM_FILTERS  0x00010000  // (Open) Build Bloom filters that quickly reject lookups of absent CKeys, EKeys and file names
+#define CASC_FEATURE_HUGE_PAGES     0x00020000  // (Open) Allocate the CKey array and the key maps from huge pages, or advise the system to use transparent huge pages
+#define CASC_FEATURE_MAPPED_DATA    0x00040000  // (Open) Map the data.### files into memory and decode the file frames directly from the mapping.
+                                                // Risky while the game launcher runs: if it truncates a data file, the process gets SIGBUS
+#define CASC_FEATURE_NO_DOWNLOAD    0x00080000  // The DOWNLOAD manifest was not loaded (see CASC_FEATURE_LAZY_ENCODING), so the files have no tags
+
+// Flags returned by CascRefreshStorage. The function must not run while other threads
+// open, look up or search files in the same storage; handles of open files stay valid
+#define CASC_REFRESH_INDEX_FILES    0x00000001  // New index files were found and loaded
+#define CASC_REFRESH_BUILD          0x00000002  // The main storage file points to a different build. The whole storage content was reloaded
 
 // Macro to convert FileDataId to the argument of CascOpenFile
 #define CASC_FILE_DATA_ID(FileDataId) ((LPCSTR)(size_t)FileDataId)
@@ -200,6 +212,9 @@ typedef enum _CASC_STORAGE_INFO_CLASS
     CascStorageProduct,                         // Gives CASC_STORAGE_PRODUCT
     CascStorageTags,                            // Gives CASC_STORAGE_TAGS structure
     CascStoragePathProduct,                     // Gives Path:Product into a LPTSTR buffer
+    CascStorageOpenStats,                       // Gives CASC_STORAGE_OPEN_STATS structure
+    CascStorageMemoryUsage,                     // Gives CASC_STORAGE_MEMORY_USAGE structure
+    CascStorageFrameCache,                      // Gives CASC_FRAME_CACHE_STATS structure
     CascStorageInfoClassMax
 
 } CASC_STORAGE_INFO_CLASS, *PCASC_STORAGE_INFO_CLASS;
@@ -290,6 +305,81 @@ typedef struct _CASC_STORAGE_PRODUCT
 
 } CASC_STORAGE_PRODUCT, *PCASC_STORAGE_PRODUCT;
 
+// Phases of opening a storage, as reported by CascStorageOpenStats
+typedef enum _CASC_OPEN_PHASE
+{
+    CascOpenPhaseMainFile,                      // Loading the main storage file (".build.info", ".build.db" or "versions")
+    CascOpenPhaseBuildConfig,                   // Loading the CDN config and CDN build files
+    CascOpenPhaseSnapshot,                      // Loading or saving the storage snapshot
+    CascOpenPhaseIndexFiles,                    // Loading the index files
+    CascOpenPhaseEncoding,                      // Loading the ENCODING manifest
+    CascOpenPhaseDownload,                      // Loading the DOWNLOAD manifest
+    CascOpenPhaseRoot,                          // Loading the ROOT manifest. With CASC_FEATURE_DEFERRED_ROOT, this happens on the first lookup
+    CascOpenPhaseInstall,                       // Loading the INSTALL manifest. Only done if the ROOT manifest fails to load
+    CascOpenPhaseKeys,                          // Loading the encryption keys
+    CascOpenPhaseMax
+} CASC_OPEN_PHASE, *PCASC_OPEN_PHASE;
+
+// Statistics of one phase of opening a storage. Except for WallTime, the values are measured
+// for the whole process, because the phases use worker threads. Anything that other threads
+// do at the same time (e.g. opening another storage or reading files) is counted as well
+typedef struct _CASC_OPEN_PHASE_STATS
+{
+    ULONGLONG WallTime;                         // Elapsed time, in microseconds
+    ULONGLONG CpuTime;                          // Process-wide: CPU time consumed by all threads of the process, in microseconds
+    ULONGLONG BytesRead;                        // Process-wide: number of bytes read from files and network by all streams of the process
+    ULONGLONG PeakMemory;                       // Process-wide: peak memory usage of the process since it started, as of the end of the phase, in bytes
+
+} CASC_OPEN_PHASE_STATS, *PCASC_OPEN_PHASE_STATS;
+
+typedef struct _CASC_STORAGE_OPEN_STATS
+{
+    CASC_OPEN_PHASE_STATS Phases[CascOpenPhaseMax]; // Statistics for each phase. Phases that were not performed are zero
+    CASC_OPEN_PHASE_STATS Total;                // Statistics for the entire CascOpenStorage(Ex)
+    size_t IndexEntries;                        // Number of entries loaded from the index files
+    size_t CKeyEntries;                         // Number of CKey entries (files in the ENCODING manifest)
+    size_t FileTreeNodes;                       // Number of nodes in the file tree of the ROOT handler
+
+} CASC_STORAGE_OPEN_STATS, *PCASC_STORAGE_OPEN_STATS;
+
+// Memory held by the storage structures, in bytes
+typedef struct _CASC_STORAGE_MEMORY_USAGE
+{
+    ULONGLONG CKeyArray;                        // Array of CKey entries
+    ULONGLONG CKeyMap;                          // Hash table of CKey -> CKey entry
+    ULONGLONG EKeyMap;                          // Hash table of EKey -> CKey entry
+    ULONGLONG IndexEKeyMap;                     // Hash table of EKey -> index entry. Only kept with CASC_FEATURE_LAZY_ENCODING or CASC_FEATURE_DEFERRED_ROOT
+    ULONGLONG IndexFiles;                       // Content of the index files (loaded or memory-mapped)
+    ULONGLONG IndexArray;                       // Array and hash table of entries loaded from online indexes
+    ULONGLONG EncodingData;                     // Content of the ENCODING manifest and its EKey index. Only kept with CASC_FEATURE_LAZY_ENCODING
+    ULONGLONG TagsArray;                        // Tags from the DOWNLOAD manifest and tag masks of the files
+    ULONGLONG FileTreeNodeTable;                // Nodes of the file tree
+    ULONGLONG FileTreeNameTable;                // Names of the file tree nodes
+    ULONGLONG FileTreeFileDataIds;              // Table of FileDataId -> file tree node
+    ULONGLONG FileTreeNameMap;                  // Hash table of name hash -> file tree node
+    ULONGLONG Arena;                            // Items of the encryption key map, allocated in bulk. The ROOT handlers use their own tables
+    ULONGLONG FileCaches;                       // Frame arrays and cached frames of open files
+    ULONGLONG FrameCache;                       // Decoded frames in the storage-wide frame cache
+    ULONGLONG BlockCache;                       // Encoded blocks of the data files (see CascSetBlockCacheSize)
+    ULONGLONG Retired;                          // Content replaced by CascRefreshStorage, kept until no open file uses it
+    ULONGLONG Total;                            // Sum of all above
+    ULONGLONG HugePageAdvised;                  // Part of the total that was allocated from huge pages or advised to use transparent huge pages
+                                                // (see CASC_FEATURE_HUGE_PAGES). The system may still back the advised memory by normal pages
+
+} CASC_STORAGE_MEMORY_USAGE, *PCASC_STORAGE_MEMORY_USAGE;
+
+// Statistics of the storage-wide cache of decoded file frames (see CascSetFrameCacheSize)
+typedef struct _CASC_FRAME_CACHE_STATS
+{
+    ULONGLONG CacheSize;                        // Maximum size of the cached data, in bytes. Zero if the cache is disabled
+    ULONGLONG BytesCached;                      // Size of the currently cached data, in bytes
+    ULONGLONG FramesCached;                     // Number of currently cached frames
+    ULONGLONG Hits;                             // Number of frames taken from the cache
+    ULONGLONG Misses;                           // Number of frames that had to be decoded
+    ULONGLONG Evictions;                        // Number of frames removed from the cache to make space for newer ones
+
+} CASC_FRAME_CACHE_STATS, *PCASC_FRAME_CACHE_STATS;
+
 typedef struct _CASC_FILE_FULL_INFO
 {
     BYTE CKey[MD5_HASH_SIZE];                   // CKey
@@ -354,6 +444,17 @@ typedef bool (WINAPI * PFNPRODUCTCALLBACK)(     // Return 'true' to cancel the l
     size_t * PtrSelectedProduct                 // [out] This is the selected product to open. On input, set to 0 (aka the first product)
     );
 
+// Custom memory allocator. All internal allocations of CascLib go through it.
+// The functions may be called from multiple threads at once
+typedef struct _CASC_ALLOCATOR
+{
+    void * (WINAPI * PfnAlloc)(void * PtrUserParam, size_t cbSize);                     // Allocates a block. Must return NULL if not enough memory
+    void * (WINAPI * PfnRealloc)(void * PtrUserParam, void * pvBlock, size_t cbSize);   // Resizes a block. Must return NULL and keep the block if not enough memory
+    void   (WINAPI * PfnFree)(void * PtrUserParam, void * pvBlock);                     // Frees a block
+    void * PtrUserParam;                                                                // User-specific parameter passed to the functions
+
+} CASC_ALLOCATOR, *PCASC_ALLOCATOR;
+
 typedef struct _CASC_OPEN_STORAGE_ARGS
 {
     size_t Size;                                // Length of this structure. Initialize to sizeof(CASC_OPEN_STORAGE_ARGS)
@@ -386,6 +487,13 @@ typedef struct _CASC_OPEN_STORAGE_ARGS
     LPCTSTR szCdnHostUrl;                       // If non-null, specifies the custom CDN URL. Must contain protocol, can contain port number
                                                 // Example: http://eu.custom-wow-cdn.com:8000
 
+    LPCTSTR szSnapshotPath;                     // If non-null, specifies a directory for storage snapshots. If a valid snapshot of the same build
+                                                // and the same index files is there, the storage is loaded from it. Otherwise, the storage
+                                                // is loaded normally and a snapshot is created. Only supported for local storages.
+
+    PCASC_ALLOCATOR pAllocator;                 // If non-null, the content of the storage is allocated by this allocator instead of the global one.
+                                                // The structure must stay valid until the storage is closed.
+
 } CASC_OPEN_STORAGE_ARGS, *PCASC_OPEN_STORAGE_ARGS;
 
 //-----------------------------------------------------------------------------
@@ -396,6 +504,9 @@ bool   WINAPI CascOpenStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phS
 bool   WINAPI CascOpenOnlineStorage(LPCTSTR szParams, DWORD dwLocaleMask, HANDLE * phStorage);
 bool   WINAPI CascGetStorageInfo(HANDLE hStorage, CASC_STORAGE_INFO_CLASS InfoClass, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded);
 bool   WINAPI CascCloseStorage(HANDLE hStorage);
+bool   WINAPI CascRefreshStorage(HANDLE hStorage, PDWORD PtrRefreshFlags);
+bool   WINAPI CascSetFrameCacheSize(HANDLE hStorage, size_t cbCacheSize);
+bool   WINAPI CascSetBlockCacheSize(HANDLE hStorage, size_t cbCacheSize);
 
 bool   WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocaleFlags, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
 bool   WINAPI CascOpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle);
@@ -427,6 +538,11 @@ LPCTSTR WINAPI CascCdnGetDefault();
 LPBYTE  WINAPI CascCdnDownload(LPCTSTR szCdnHostUrl, LPCTSTR szProduct, LPCTSTR szFileName, DWORD * PtrSize);
 void    WINAPI CascCdnFree(void * buffer);
 
+//-----------------------------------------------------------------------------
+// Memory allocation support
+
+bool   WINAPI CascSetAllocator(PCASC_ALLOCATOR pAllocator);
+
 //-----------------------------------------------------------------------------
 // Error code support
 
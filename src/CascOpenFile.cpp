@@ -17,9 +17,13 @@
 
 TCascFile::TCascFile(TCascStorage * ahs, PCASC_CKEY_ENTRY apCKeyEntry)
 {
-    // Reference the storage handle
+    // Reference the storage handle and the build that the CKey entry belongs to
+    pBuildRef = NULL;
     if((hs = ahs) != NULL)
+    {
         hs->AddRef();
+        pBuildRef = hs->AddRefBuild();
+    }
     ClassName = CASC_MAGIC_FILE;
 
     FilePointer = 0;
@@ -29,6 +33,7 @@ TCascFile::TCascFile(TCascStorage * ahs, PCASC_CKEY_ENTRY apCKeyEntry)
     bVerifyIntegrity = false;
     bCloseFileStream = false;
     bFreeCKeyEntries = false;
+    CacheBytes = 0;
 
     // Allocate the array of file spans
     if((pFileSpan = CASC_ALLOC_ZERO<CASC_FILE_SPAN>(SpanCount)) != NULL)
@@ -67,9 +72,19 @@ TCascFile::~TCascFile()
     // Free the file cache
     CASC_FREE(pbFileCache);
 
-    // Close (dereference) the archive handle
+    // Remove the frames and the file cache from the storage memory usage
+    if(hs != NULL && CacheBytes != 0)
+        CascInterlockedAdd64(&hs->FileCacheBytes, (ULONGLONG)(0) - CacheBytes);
+    CacheBytes = 0;
+
+    // Close (dereference) the archive handle. If the build was replaced
+    // and this was the last file from it, the old build is freed now
     if(hs != NULL)
+    {
+        hs->ReleaseBuild(pBuildRef);
         hs = hs->Release();
+    }
+    pBuildRef = NULL;
     ClassName = 0;
 }
 
@@ -180,11 +195,19 @@ static size_t GetSpanFileCount(LPTSTR szSpanList)
 
 PCASC_CKEY_ENTRY FindCKeyEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex)
 {
+    // With lazy ENCODING, other threads may be inserting entries to the map.
+    // The lookup must then be safe against the inserts
+    if(hs->EncodingData.pbData != NULL)
+        return LoadEncodingEntry_CKey(hs, pbCKey, PtrIndex);
     return (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObject(pbCKey, PtrIndex);
 }
 
 PCASC_CKEY_ENTRY FindCKeyEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex)
 {
+    // With lazy ENCODING, other threads may be inserting entries to the map.
+    // The lookup must then be safe against the inserts
+    if(hs->EncodingData.pbData != NULL)
+        return LoadEncodingEntry_EKey(hs, pbEKey, PtrIndex);
     return (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex);
 }
 
@@ -267,7 +290,7 @@ bool OpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle
             dwErrCode = ERROR_INVALID_PARAMETER;
         }
 
-        delete [] szSpanList;
+        CASC_FREE(szSpanList);
     }
 
     // Give the output parameter, no matter what
@@ -279,6 +302,23 @@ bool OpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle
     return (dwErrCode == ERROR_SUCCESS);
 }
 
+// While the deferred ROOT is being loaded, the loader inserts entries to the key tables
+// and changes the storage features. Opening files by CKey/EKey doesn't need the root handler,
+// so it doesn't load the ROOT, but it must not run alongside the loader.
+// The opens share the loader lock, so they only wait while the loader runs.
+// Returns true if the loader lock has been taken
+static bool LockDeferredRoot(TCascStorage * hs)
+{
+    if(hs->IsRootDeferred())
+    {
+        CascLockShared(hs->RootLoaderLock);
+        if(hs->IsRootDeferred())
+            return true;
+        CascUnlockShared(hs->RootLoaderLock);
+    }
+    return false;
+}
+
 bool SetCacheStrategy(HANDLE hFile, CSTRTG CacheStrategy)
 {
     TCascFile * hf;
@@ -310,6 +350,8 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
     DWORD FileDataId = CASC_INVALID_ID;
     BYTE CKeyEKeyBuffer[MD5_HASH_SIZE];
     DWORD dwErrCode = ERROR_SUCCESS;
+    bool bRootLocked = false;
+    bool bResult = false;
 
     // This parameter is not used
     CASCLIB_UNUSED(dwLocaleFlags);
@@ -329,6 +371,9 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
         return false;
     }
 
+    // The file data belong to the storage
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+
     // Retrieve the CKey/EKey from the file name in different modes
     switch(dwOpenFlags & CASC_OPEN_TYPE_MASK)
     {
@@ -342,6 +387,13 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
                 return false;
             }
 
+            // Create the root handler, if its loading was deferred
+            if(hs->IsRootDeferred() && (dwErrCode = LoadDeferredRoot(hs)) != ERROR_SUCCESS)
+            {
+                SetCascError(dwErrCode);
+                return false;
+            }
+
             // The first chance: Try to find the file by name (using the root handler)
             pCKeyEntry = hs->pRootHandler->GetFile(hs, szFileName);
             if(pCKeyEntry != NULL)
@@ -380,6 +432,7 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
             }
 
             // Search the CKey map in order to find the CKey entry
+            bRootLocked = LockDeferredRoot(hs);
             pCKeyEntry = FindCKeyEntry_CKey(hs, (LPBYTE)pvFileName);
             break;
 
@@ -393,11 +446,19 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
             }
 
             // Search the CKey map in order to find the CKey entry
+            bRootLocked = LockDeferredRoot(hs);
             pCKeyEntry = FindCKeyEntry_EKey(hs, (LPBYTE)pvFileName);
             break;
 
         case CASC_OPEN_BY_FILEID:
 
+            // Create the root handler, if its loading was deferred
+            if(hs->IsRootDeferred() && (dwErrCode = LoadDeferredRoot(hs)) != ERROR_SUCCESS)
+            {
+                SetCascError(dwErrCode);
+                return false;
+            }
+
             // Retrieve the file CKey/EKey
             pCKeyEntry = hs->pRootHandler->GetFile(hs, CASC_FILE_DATA_ID_FROM_STRING(pvFileName));
             break;
@@ -410,13 +471,12 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
     }
 
     // Check opening unique file
-    if(dwOpenFlags & CASC_OPEN_CKEY_ONCE)
+    if(pCKeyEntry != NULL && (dwOpenFlags & CASC_OPEN_CKEY_ONCE))
     {
         // Was the file already open since CascOpenStorage?
         if(pCKeyEntry->Flags & CASC_CE_OPEN_CKEY_ONCE)
         {
-            SetCascError(ERROR_CKEY_ALREADY_OPENED);
-            return false;
+            dwErrCode = ERROR_CKEY_ALREADY_OPENED;
         }
         else
         {
@@ -425,7 +485,20 @@ bool WINAPI CascOpenFile(HANDLE hStorage, const void * pvFileName, DWORD dwLocal
     }
 
     // Perform the open operation
-    return OpenFileByCKeyEntry(hs, pCKeyEntry, dwOpenFlags, PtrFileHandle);
+    if(dwErrCode == ERROR_SUCCESS)
+        bResult = OpenFileByCKeyEntry(hs, pCKeyEntry, dwOpenFlags, PtrFileHandle);
+
+    // Let the loader of the deferred ROOT continue
+    if(bRootLocked)
+        CascUnlockShared(hs->RootLoaderLock);
+
+    // Handle last error
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        PtrFileHandle[0] = NULL;
+        SetCascError(dwErrCode);
+    }
+    return bResult;
 }
 
 bool WINAPI CascOpenLocalFile(LPCTSTR szFileName, DWORD dwOpenFlags, HANDLE * PtrFileHandle)
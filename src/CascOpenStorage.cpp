@@ -24,6 +24,40 @@
 // Limit for "additional" items in CKey table
 #define CASC_MAX_EXTRA_ITEMS 0x40
 
+// Initial size of the CKey table with lazy ENCODING. The table and both maps grow on demand
+#define CASC_LAZY_INITIAL_ITEMS 0x1000
+
+// Context for parsing the CKey pages of the ENCODING manifest on multiple threads
+struct CASC_ENCODING_PAGES
+{
+    TCascStorage * hs;                              // The storage being loaded
+    CASC_ENCODING_HEADER * pEnHeader;               // Captured header of the ENCODING manifest
+    PFILE_CKEY_PAGE pPageHeader;                    // The table of CKey pages
+    LPBYTE pbCKeyPages;                             // Pointer to the first CKey page
+    LPBYTE pbEncodingEnd;                           // End of the ENCODING data
+    PCASC_CKEY_ENTRY pCKeyEntries;                  // Range of the CKey array reserved for ENCODING entries
+    size_t * PageStart;                             // Number of entries in each page, then index of the first entry of each page
+    size_t nMaxEntries;                             // Number of reserved CKey entries
+};
+
+// Manifest that is loaded on a worker thread while the previous manifest is being parsed
+struct CASC_MANIFEST_PREFETCH
+{
+    TCascStorage * hs;                              // The storage being loaded
+    CASC_CKEY_ENTRY CKeyEntry;                      // Private copy of the CKey entry of the manifest
+    CASC_BLOB FileData;                             // Loaded content of the manifest
+    CASC_TASK Task;                                 // Worker task that loads the manifest
+    bool bStarted;                                  // If true, the task has been started
+};
+
+// Counter values captured at the beginning of a storage open phase
+struct CASC_PHASE_START
+{
+    ULONGLONG WallTime;
+    ULONGLONG CpuTime;
+    ULONGLONG BytesRead;
+};
+
 //-----------------------------------------------------------------------------
 // DEBUG functions
 
@@ -69,15 +103,33 @@ TCascStorage::TCascStorage()
 
     memset(DataFiles, 0, sizeof(DataFiles));
     memset(IndexFiles, 0, sizeof(IndexFiles));
+    memset(&EncodingHeader, 0, sizeof(CASC_ENCODING_HEADER));
+    memset(&OpenStats, 0, sizeof(CASC_STORAGE_OPEN_STATS));
+    FileCacheBytes = 0;
+    pBlockCache = FileStream_CreateCache();
+    CascAddRefWorkerPool();
     CascInitLock(StorageLock);
+    CascInitLock(RootLock);
+    CascInitRWLock(RootLoaderLock);
+    dwRootLocaleMask = 0;
+    dwRootDeferred = 0;
     dwDefaultLocale = 0;
     dwBuildNumber = 0;
     dwFeatures = 0;
     BuildFileType = CascBuildNone;
 
     LastFailKeyName = 0;
+    pRetired = NULL;
+
+    // The storage itself holds one reference to its build
+    if((pBuildRef = CASC_ALLOC<CASC_BUILD_REF>(1)) != NULL)
+    {
+        pBuildRef->hsRetired = NULL;
+        pBuildRef->dwRefCount = 1;
+    }
     LocalFiles = TotalFiles = EKeyEntries = EKeyLength = FileOffsetBits = 0;
     pArgs = NULL;
+    pAllocator = NULL;
 }
 
 TCascStorage::~TCascStorage()
@@ -94,11 +146,32 @@ TCascStorage::~TCascStorage()
         DataFiles[i] = NULL;
     }
 
+    // Close the data files that were replaced by CascRefreshStorage
+    for(size_t i = 0; i < RetiredDataFiles.ItemCount(); i++)
+    {
+        TFileStream ** PtrStream = (TFileStream **)RetiredDataFiles.ItemAt(i);
+        FileStream_Close(PtrStream[0]);
+    }
+    RetiredDataFiles.Free();
+
+    // The block cache can only be freed after all data files are closed
+    FileStream_FreeCache(pBlockCache);
+    pBlockCache = NULL;
+
     // Cleanup space occupied by index files
     FreeIndexFiles(this);
 
-    // Cleanup the lock
+    // Free the content that was replaced by CascRefreshStorage
+    if(pRetired != NULL)
+        pRetired->Release();
+    pRetired = NULL;
+    CASC_FREE(pBuildRef);
+
+    // Cleanup the locks
     CascFreeLock(StorageLock);
+    CascFreeLock(RootLock);
+    CascFreeRWLock(RootLoaderLock);
+    CascReleaseWorkerPool();
 
     // Free the file paths
     CASC_FREE(szRootPath);
@@ -150,9 +223,119 @@ TCascStorage * TCascStorage::Release()
     return this;
 }
 
+PCASC_BUILD_REF TCascStorage::AddRefBuild()
+{
+    if(pBuildRef != NULL)
+        CascInterlockedIncrement(&pBuildRef->dwRefCount);
+    return pBuildRef;
+}
+
+void TCascStorage::ReleaseBuild(PCASC_BUILD_REF pRef)
+{
+    TCascStorage * hsRetired;
+
+    // The current build is never freed here, it still has the reference from the storage
+    if(pRef != NULL && CascInterlockedDecrement(&pRef->dwRefCount) == 0)
+    {
+        // Unlink the replaced build from the chain. The lock keeps the memory usage away
+        if((hsRetired = pRef->hsRetired) != NULL)
+        {
+            CascLock(StorageLock);
+            for(TCascStorage ** PtrRetired = &pRetired; PtrRetired[0] != NULL; PtrRetired = &PtrRetired[0]->pRetired)
+            {
+                if(PtrRetired[0] == hsRetired)
+                {
+                    PtrRetired[0] = hsRetired->pRetired;
+                    break;
+                }
+            }
+            CascUnlock(StorageLock);
+
+            // Free the replaced build
+            hsRetired->pRetired = NULL;
+            hsRetired->pBuildRef = NULL;
+            hsRetired->Release();
+        }
+        CASC_FREE(pRef);
+    }
+}
+
+// Returns the allocator for the large random-access tables (CKey array, key maps).
+// Huge pages are only used if the caller didn't supply own allocator
+PCASC_ALLOCATOR TCascStorage::GetTableAllocator()
+{
+    if((dwFeatures & CASC_FEATURE_HUGE_PAGES) && pAllocator == NULL)
+        return CascGetHugePageAllocator();
+    return pAllocator;
+}
+
+// The storage must be the one that holds the build of the entry, see TCascFile::GetBuildStorage
+ULONGLONG TCascStorage::GetTagBitMask(PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    ULONGLONG * PtrTagBitMask;
+
+    // Entries without tags have no index
+    if(pCKeyEntry->TagMaskIndex != 0)
+    {
+        if((PtrTagBitMask = (ULONGLONG *)TagMaskArray.ItemAt(pCKeyEntry->TagMaskIndex - 1)) != NULL)
+            return PtrTagBitMask[0];
+    }
+    return 0;
+}
+
+DWORD TCascStorage::SetTagBitMask(PCASC_CKEY_ENTRY pCKeyEntry, ULONGLONG TagBitMask)
+{
+    ULONGLONG * PtrTagBitMask;
+    DWORD dwErrCode;
+
+    // The entry already has a tag mask
+    if(pCKeyEntry->TagMaskIndex != 0)
+    {
+        if((PtrTagBitMask = (ULONGLONG *)TagMaskArray.ItemAt(pCKeyEntry->TagMaskIndex - 1)) == NULL)
+            return ERROR_INVALID_PARAMETER;
+        PtrTagBitMask[0] = TagBitMask;
+        return ERROR_SUCCESS;
+    }
+
+    // The array of tag masks is only created when the first tag mask is set
+    if(TagMaskArray.IsInitialized() == false)
+    {
+        if((dwErrCode = TagMaskArray.Create<ULONGLONG>(CKeyArray.ItemCountMax())) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+
+    // Append the tag mask and give the entry its index
+    if((PtrTagBitMask = (ULONGLONG *)TagMaskArray.Insert(1)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    PtrTagBitMask[0] = TagBitMask;
+    pCKeyEntry->TagMaskIndex = (DWORD)TagMaskArray.ItemCount();
+    return ERROR_SUCCESS;
+}
+
 //-----------------------------------------------------------------------------
 // Local functions
 
+static void BeginOpenPhase(CASC_PHASE_START & Start)
+{
+    Start.WallTime = CascGetWallTime();
+    Start.CpuTime = CascGetCpuTime();
+    Start.BytesRead = FileStream_GetTotalBytesRead();
+}
+
+// Adds the counters of the phase to the statistics. A phase can run more than once,
+// e.g. when the INSTALL manifest is loaded because of a failure to load ROOT.
+// The counters other than the wall time are process-wide, because the phases
+// use worker threads that can't be told apart from other threads of the process
+static void EndOpenPhase(CASC_OPEN_PHASE_STATS & Stats, CASC_PHASE_START & Start)
+{
+    ULONGLONG PeakMemory = CascGetPeakMemory();
+
+    Stats.WallTime += CascGetWallTime() - Start.WallTime;
+    Stats.CpuTime += CascGetCpuTime() - Start.CpuTime;
+    Stats.BytesRead += FileStream_GetTotalBytesRead() - Start.BytesRead;
+    Stats.PeakMemory = CASCLIB_MAX(Stats.PeakMemory, PeakMemory);
+}
+
 void * ProbeOutputBuffer(void * pvBuffer, size_t cbLength, size_t cbMinLength, size_t * pcbLengthNeeded)
 {
     // Verify the output length
@@ -195,8 +378,8 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_CKEY_ENTRY & CKe
         // Check if there is an existing entry
         if((pCKeyEntry = FindCKeyEntry_CKey(hs, CKeyEntry.CKey)) == NULL)
         {
-            // Insert a new entry to the array. DO NOT ALLOW enlarge array here
-            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(1, false);
+            // Insert a new entry to the array. The array grows without moving the existing entries
+            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert();
             if(pCKeyEntry == NULL)
                 return NULL;
 
@@ -223,42 +406,27 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_CKEY_ENTRY & CKe
     return pCKeyEntry;
 }
 
-// Inserts an entry from ENCODING
-static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, PFILE_CKEY_ENTRY pFileEntry)
+// Initializes an entry from ENCODING. Only the entry itself is changed,
+// so this can be called from multiple threads at once
+static void InitCKeyEntry(TCascStorage * hs, PCASC_CKEY_ENTRY pCKeyEntry, PFILE_CKEY_ENTRY pFileEntry)
 {
-    PCASC_CKEY_ENTRY pCKeyEntry;
-
     // Stop on file-of-interest
     BREAK_ON_WATCHED(pFileEntry->EKey);
 
-    // Insert a new entry to the array. DO NOT ALLOW enlarge array here
-    pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(1, false);
-    if(pCKeyEntry != NULL)
-    {
-        // Initialize the entry
-        CopyMemory16(pCKeyEntry->CKey, pFileEntry->CKey);
-        CopyMemory16(pCKeyEntry->EKey, pFileEntry->EKey);
-        pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
-        pCKeyEntry->TagBitMask = 0;
-        pCKeyEntry->ContentSize = ConvertBytesToInteger_4(pFileEntry->ContentSize);
-        pCKeyEntry->EncodedSize = CASC_INVALID_SIZE;
-        pCKeyEntry->Flags = CASC_CE_HAS_CKEY | CASC_CE_HAS_EKEY | CASC_CE_IN_ENCODING;
-        pCKeyEntry->RefCount = 0;
-        pCKeyEntry->SpanCount = 1;
-
-        // Copy the information from index files to the CKey entry
-        CopyEKeyEntry(hs, pCKeyEntry);
-
-        // Insert the item into both maps
-        hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
-        hs->EKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->EKey);
-    }
-    else
-    {
-        assert(false);
-    }
-
-    return pCKeyEntry;
+    // Initialize the entry
+    CopyMemory16(pCKeyEntry->CKey, pFileEntry->CKey);
+    CopyMemory16(pCKeyEntry->EKey, pFileEntry->EKey);
+    pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
+    pCKeyEntry->ContentSize = ConvertBytesToInteger_4(pFileEntry->ContentSize);
+    pCKeyEntry->EncodedSize = CASC_INVALID_SIZE;
+    pCKeyEntry->Flags = CASC_CE_HAS_CKEY | CASC_CE_HAS_EKEY | CASC_CE_IN_ENCODING;
+    pCKeyEntry->RefCount = 0;
+    pCKeyEntry->SpanCount = 1;
+    pCKeyEntry->Priority = 0;
+    pCKeyEntry->TagMaskIndex = 0;
+
+    // Copy the information from index files to the CKey entry
+    CopyEKeyEntry(hs, pCKeyEntry);
 }
 
 // Inserts an entry from DOWNLOAD
@@ -272,8 +440,8 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_DOWNLOAD_ENTRY &
     // Check whether the entry is already there
     if((pCKeyEntry = FindCKeyEntry_EKey(hs, DlEntry.EKey)) == NULL)
     {
-        // Insert dummy CKey entry to the array. DO NOT allow to enlarge the array
-        pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(1, false);
+        // Insert dummy CKey entry to the array. The array grows without moving the existing entries
+        pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert();
         if(pCKeyEntry == NULL)
         {
             assert(false);
@@ -284,12 +452,12 @@ static PCASC_CKEY_ENTRY InsertCKeyEntry(TCascStorage * hs, CASC_DOWNLOAD_ENTRY &
         ZeroMemory16(pCKeyEntry->CKey);
         CopyMemory16(pCKeyEntry->EKey, DlEntry.EKey);
         pCKeyEntry->StorageOffset = CASC_INVALID_OFFS64;
-        pCKeyEntry->TagBitMask = 0;
         pCKeyEntry->ContentSize = CASC_INVALID_SIZE;
         pCKeyEntry->EncodedSize = (DWORD)DlEntry.EncodedSize;
         pCKeyEntry->Flags = CASC_CE_HAS_EKEY | CASC_CE_IN_DOWNLOAD;
         pCKeyEntry->RefCount = 0;
         pCKeyEntry->SpanCount = 1;
+        pCKeyEntry->TagMaskIndex = 0;
 
         // Copy the information from index files to the CKey entry
         CopyEKeyEntry(hs, pCKeyEntry);
@@ -367,13 +535,22 @@ static size_t GetEstimatedNumberOfFiles(TCascStorage * hs)
 
 static DWORD InitCKeyArray(TCascStorage * hs)
 {
-    size_t nNumberOfFiles = GetEstimatedNumberOfFiles(hs);
+    size_t nNumberOfFiles;
     DWORD dwErrCode;
 
+    // With lazy ENCODING, only the entries that are looked up are created,
+    // so the tables start small. Otherwise, they are created at the estimated size
+    if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
+        nNumberOfFiles = CASC_LAZY_INITIAL_ITEMS;
+    else
+        nNumberOfFiles = GetEstimatedNumberOfFiles(hs);
+
     //
     // Allocate array and map of CKey entries
     //
 
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->GetTableAllocator());
+
     // Create the array of CKey items
     dwErrCode = hs->CKeyArray.Create(sizeof(CASC_CKEY_ENTRY), nNumberOfFiles);
     if(dwErrCode != ERROR_SUCCESS)
@@ -390,6 +567,25 @@ static DWORD InitCKeyArray(TCascStorage * hs)
     if(dwErrCode != ERROR_SUCCESS)
         return dwErrCode;
 
+    // With lazy ENCODING, the entries are inserted while other threads search the maps
+    if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
+    {
+        if((dwErrCode = hs->CKeyMap.EnableConcurrentReads()) != ERROR_SUCCESS)
+            return dwErrCode;
+        if((dwErrCode = hs->EKeyMap.EnableConcurrentReads()) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+
+    // The filters are filled as the entries are inserted. Not with lazy ENCODING,
+    // where a missing entry doesn't mean that the file is not in the storage
+    if((hs->dwFeatures & CASC_FEATURE_BLOOM_FILTERS) && (hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+    {
+        if((dwErrCode = hs->CKeyMap.CreateFilter(nNumberOfFiles)) != ERROR_SUCCESS)
+            return dwErrCode;
+        if((dwErrCode = hs->EKeyMap.CreateFilter(nNumberOfFiles)) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+
     return ERROR_SUCCESS;
 }
 
@@ -417,14 +613,18 @@ int CaptureEncodingHeader(CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData, si
     return ERROR_SUCCESS;
 }
 
-static DWORD LoadEncodingCKeyPage(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbPageBegin, LPBYTE pbEndOfPage)
+// Parses one page of CKey entries. If pCKeyEntry is NULL, the entries are only counted
+static size_t ParseEncodingCKeyPage(
+    TCascStorage * hs,
+    CASC_ENCODING_HEADER & EnHeader,
+    LPBYTE pbPageBegin,
+    LPBYTE pbEndOfPage,
+    PCASC_CKEY_ENTRY pCKeyEntry,
+    size_t nMaxEntries)
 {
     PFILE_CKEY_ENTRY pFileEntry;
     LPBYTE pbFileEntry = pbPageBegin;
-
-    // Sanity checks
-    assert(hs->CKeyMap.IsInitialized());
-    assert(hs->EKeyMap.IsInitialized());
+    size_t nEntries = 0;
 
     // Parse all encoding entries
     while(pbFileEntry < pbEndOfPage)
@@ -439,16 +639,440 @@ static DWORD LoadEncodingCKeyPage(TCascStorage * hs, CASC_ENCODING_HEADER & EnHe
 //      BREAKIF(pFileEntry->EKeyCount > 1);
 //      BREAK_ON_XKEY3(pFileEntry->CKey, 0x34, 0x82, 0x1f);
 
-        // Insert the entry to the central CKey table
-        InsertCKeyEntry(hs, pFileEntry);
+        // Fill the CKey entry, if required
+        if(pCKeyEntry != NULL)
+        {
+            if(nEntries >= nMaxEntries)
+                break;
+            InitCKeyEntry(hs, pCKeyEntry++, pFileEntry);
+        }
+        nEntries++;
 
         // Move to the next encoding entry
         pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
     }
+    return nEntries;
+}
+
+// Verifies one CKey page and counts the entries in it. Called on worker threads
+static DWORD CountEncodingCKeyPage(void * pvContext, size_t nPageIndex)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvContext;
+    CASC_ENCODING_HEADER & EnHeader = *pPages->pEnHeader;
+    LPBYTE pbCKeyPage = pPages->pbCKeyPages + (nPageIndex * EnHeader.CKeyPageSize);
+
+    // Check if there is enough space in the buffer
+    if((pbCKeyPage + EnHeader.CKeyPageSize) > pPages->pbEncodingEnd)
+        return ERROR_FILE_CORRUPT;
+
+    // Check the hash of the entire segment
+    // Note that verifying takes considerable time of the storage loading
+//  if(!VerifyDataBlockHash(pbCKeyPage, EnHeader.CKeyPageSize, pPages->pPageHeader[nPageIndex].SegmentHash))
+//      return ERROR_FILE_CORRUPT;
+
+    // Check if the CKey matches with the expected first value
+    if(memcmp(((PFILE_CKEY_ENTRY)pbCKeyPage)->CKey, pPages->pPageHeader[nPageIndex].FirstKey, MD5_HASH_SIZE))
+        return ERROR_FILE_CORRUPT;
+
+    // Count the entries in the page
+    pPages->PageStart[nPageIndex] = ParseEncodingCKeyPage(pPages->hs, EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize, NULL, 0);
+    return ERROR_SUCCESS;
+}
+
+// Fills the CKey entries of one CKey page. Called on worker threads
+static DWORD LoadEncodingCKeyPage(void * pvContext, size_t nPageIndex)
+{
+    CASC_ENCODING_PAGES * pPages = (CASC_ENCODING_PAGES *)pvContext;
+    CASC_ENCODING_HEADER & EnHeader = *pPages->pEnHeader;
+    LPBYTE pbCKeyPage = pPages->pbCKeyPages + (nPageIndex * EnHeader.CKeyPageSize);
+    size_t nFirstEntry = pPages->PageStart[nPageIndex];
+
+    // Each page has its own, pre-calculated range of CKey entries
+    if(nFirstEntry < pPages->nMaxEntries)
+    {
+        ParseEncodingCKeyPage(pPages->hs,
+                              EnHeader,
+                              pbCKeyPage,
+                              pbCKeyPage + EnHeader.CKeyPageSize,
+                              pPages->pCKeyEntries + nFirstEntry,
+                              pPages->nMaxEntries - nFirstEntry);
+    }
     return ERROR_SUCCESS;
 }
 
-static DWORD LoadEncodingManifest(TCascStorage * hs)
+static DWORD LoadEncodingCKeyPages(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, LPBYTE pbFileData, size_t cbFileData)
+{
+    CASC_ENCODING_PAGES Pages;
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    size_t nTotalEntries = 0;
+    size_t nPageEntries;
+    DWORD dwErrCode;
+
+    // Nothing to do if there are no pages
+    if(EnHeader.CKeyPageCount == 0)
+        return ERROR_SUCCESS;
+
+    // Get the CKey page header and the first page
+    memset(&Pages, 0, sizeof(CASC_ENCODING_PAGES));
+    Pages.hs = hs;
+    Pages.pEnHeader = &EnHeader;
+    Pages.pPageHeader = (PFILE_CKEY_PAGE)(pbFileData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize);
+    Pages.pbCKeyPages = (LPBYTE)(Pages.pPageHeader + EnHeader.CKeyPageCount);
+    Pages.pbEncodingEnd = pbFileData + cbFileData;
+
+    // Allocate the array of page starts
+    if((Pages.PageStart = CASC_ALLOC<size_t>(EnHeader.CKeyPageCount)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Verify all pages and count the CKey entries in them
+    dwErrCode = CascParallelFor(CountEncodingCKeyPage, &Pages, EnHeader.CKeyPageCount);
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        // Convert the entry counts to indexes of the first entry in each page
+        for(DWORD i = 0; i < EnHeader.CKeyPageCount; i++)
+        {
+            nPageEntries = Pages.PageStart[i];
+            Pages.PageStart[i] = nTotalEntries;
+            nTotalEntries += nPageEntries;
+        }
+
+        // Reserve one continuous range of the CKey array for all pages.
+        // The range must fit into the last chunk, so the entries are not split.
+        // If the pages have more entries than the ENCODING header promised, the file is bad
+        if(nTotalEntries > (hs->CKeyArray.ItemCountMax() - hs->CKeyArray.ItemCount()))
+        {
+            CASC_FREE(Pages.PageStart);
+            return ERROR_BAD_FORMAT;
+        }
+
+        Pages.nMaxEntries = nTotalEntries;
+        Pages.pCKeyEntries = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(NULL, Pages.nMaxEntries);
+        if(Pages.pCKeyEntries == NULL && Pages.nMaxEntries != 0)
+        {
+            CASC_FREE(Pages.PageStart);
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        // Fill all CKey entries
+        dwErrCode = CascParallelFor(LoadEncodingCKeyPage, &Pages, EnHeader.CKeyPageCount);
+
+        // Insert the entries into both maps, in the order in which they are in the ENCODING manifest
+        for(size_t i = 0; i < Pages.nMaxEntries; i++)
+        {
+            pCKeyEntry = Pages.pCKeyEntries + i;
+            hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
+            hs->EKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->EKey);
+        }
+    }
+
+    CASC_FREE(Pages.PageStart);
+    return dwErrCode;
+}
+
+// Finds the ENCODING entry of a CKey in one CKey page
+static PFILE_CKEY_ENTRY FindEncodingEntryInPage(CASC_ENCODING_HEADER & EnHeader, LPBYTE pbPageBegin, LPBYTE pbEndOfPage, LPBYTE pbCKey)
+{
+    PFILE_CKEY_ENTRY pFileEntry;
+    LPBYTE pbFileEntry = pbPageBegin;
+
+    while(pbFileEntry < pbEndOfPage)
+    {
+        // Get pointer to the encoding entry
+        pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+        if(pFileEntry->EKeyCount == 0)
+            break;
+
+        // Compare the CKey
+        if(!memcmp(pFileEntry->CKey, pbCKey, MD5_HASH_SIZE))
+            return pFileEntry;
+
+        // Move to the next encoding entry
+        pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+    }
+    return NULL;
+}
+
+// Finds the ENCODING entry of a CKey. The CKey pages are sorted by their first CKey,
+// so we binary-search the page table and then only scan one page
+static PFILE_CKEY_ENTRY FindEncodingEntry(TCascStorage * hs, LPBYTE pbCKey)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PFILE_CKEY_PAGE pPageHeader = (PFILE_CKEY_PAGE)(hs->EncodingData.pbData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize);
+    LPBYTE pbCKeyPage;
+    DWORD nLeft = 0;
+    DWORD nRight = EnHeader.CKeyPageCount;
+    DWORD nMiddle;
+
+    // Find the first page whose first CKey is greater than the CKey we look for
+    while(nLeft < nRight)
+    {
+        nMiddle = nLeft + (nRight - nLeft) / 2;
+        if(memcmp(pPageHeader[nMiddle].FirstKey, pbCKey, MD5_HASH_SIZE) <= 0)
+            nLeft = nMiddle + 1;
+        else
+            nRight = nMiddle;
+    }
+
+    // The CKey can only be in the page before it
+    if(nLeft == 0)
+        return NULL;
+    pbCKeyPage = (LPBYTE)(pPageHeader + EnHeader.CKeyPageCount) + ((nLeft - 1) * EnHeader.CKeyPageSize);
+
+    // Check if the CKey matches with the expected first value
+    if(memcmp(((PFILE_CKEY_ENTRY)pbCKeyPage)->CKey, pPageHeader[nLeft - 1].FirstKey, MD5_HASH_SIZE))
+        return NULL;
+
+    return FindEncodingEntryInPage(EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize, pbCKey);
+}
+
+// Returns the offset of the EKey page table in the ENCODING manifest
+static ULONGLONG GetEncodingEKeyTableOffset(CASC_ENCODING_HEADER & EnHeader)
+{
+    return sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize +
+           (ULONGLONG)EnHeader.CKeyPageCount * (sizeof(FILE_CKEY_PAGE) + EnHeader.CKeyPageSize);
+}
+
+// Checks whether an EKey is in the EKey table of ENCODING. The EKey pages are sorted
+// by their first EKey, so we binary-search the page table and then only scan one page.
+// Without the EKey table, any EKey may be there
+static bool IsEncodingEKey(TCascStorage * hs, LPBYTE pbEKey)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PFILE_CKEY_PAGE pPageHeader = (PFILE_CKEY_PAGE)(hs->EncodingData.pbData + GetEncodingEKeyTableOffset(EnHeader));
+    LPBYTE pbEKeyPage;
+    LPBYTE pbEndOfPage;
+    size_t cbEntry = EnHeader.EKeyLength + 4 + 5;
+    DWORD nLeft = 0;
+    DWORD nRight = EnHeader.EKeyPageCount;
+    DWORD nMiddle;
+
+    // No EKey table in the ENCODING manifest
+    if(EnHeader.EKeyPageCount == 0)
+        return true;
+
+    // Find the first page whose first EKey is greater than the EKey we look for.
+    // Only the first CASC_EKEY_SIZE bytes of the EKey are compared, same like in the EKey map
+    while(nLeft < nRight)
+    {
+        nMiddle = nLeft + (nRight - nLeft) / 2;
+        if(memcmp(pPageHeader[nMiddle].FirstKey, pbEKey, CASC_EKEY_SIZE) <= 0)
+            nLeft = nMiddle + 1;
+        else
+            nRight = nMiddle;
+    }
+
+    // The EKey can only be in the page before it
+    if(nLeft == 0)
+        return false;
+    pbEKeyPage = (LPBYTE)(pPageHeader + EnHeader.EKeyPageCount) + ((nLeft - 1) * EnHeader.EKeyPageSize);
+    pbEndOfPage = pbEKeyPage + EnHeader.EKeyPageSize;
+
+    // Scan the page
+    for(; (pbEKeyPage + cbEntry) <= pbEndOfPage; pbEKeyPage += cbEntry)
+    {
+        if(!memcmp(pbEKeyPage, pbEKey, CASC_EKEY_SIZE))
+            return true;
+    }
+    return false;
+}
+
+static int CompareEncodingEKeys(const void * pvItem1, const void * pvItem2)
+{
+    return memcmp(pvItem1, pvItem2, CASC_EKEY_SIZE);
+}
+
+// Builds the index of the first EKeys of all ENCODING entries. ENCODING is sorted by CKey,
+// so without the index, each EKey lookup would have to go through all CKey pages.
+// The caller must hold the storage lock
+static DWORD BuildEncodingEKeyIndex(TCascStorage * hs)
+{
+    CASC_ENCODING_HEADER & EnHeader = hs->EncodingHeader;
+    PCASC_ENCODING_EKEY pEKeyItem;
+    PFILE_CKEY_ENTRY pFileEntry;
+    LPBYTE pbCKeyPages;
+    LPBYTE pbFileEntry;
+    LPBYTE pbCKeyPage;
+    LPBYTE pbEndOfPage;
+    size_t nEntryCount = 0;
+    DWORD dwErrCode;
+
+    // Go through the ENCODING entries twice. Count them first, then fill the index
+    pbCKeyPages = hs->EncodingData.pbData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize + (EnHeader.CKeyPageCount * sizeof(FILE_CKEY_PAGE));
+    for(int nPass = 0; nPass < 2; nPass++)
+    {
+        pbCKeyPage = pbCKeyPages;
+        for(DWORD i = 0; i < EnHeader.CKeyPageCount; i++, pbCKeyPage += EnHeader.CKeyPageSize)
+        {
+            pbEndOfPage = pbCKeyPage + EnHeader.CKeyPageSize;
+            pbFileEntry = pbCKeyPage;
+
+            while(pbFileEntry < pbEndOfPage)
+            {
+                // Get pointer to the encoding entry
+                pFileEntry = (PFILE_CKEY_ENTRY)pbFileEntry;
+                if(pFileEntry->EKeyCount == 0)
+                    break;
+
+                // The first pass counts the entries, the second one fills the index
+                if(nPass == 0)
+                {
+                    nEntryCount++;
+                }
+                else if((pEKeyItem = (PCASC_ENCODING_EKEY)hs->EncodingEKeys.Insert(1, false)) != NULL)
+                {
+                    memcpy(pEKeyItem->EKey, pFileEntry->EKey, CASC_EKEY_SIZE);
+                    pEKeyItem->EntryOffset = (DWORD)(pbFileEntry - hs->EncodingData.pbData);
+                }
+
+                // Move to the next encoding entry
+                pbFileEntry = pbFileEntry + 2 + 4 + EnHeader.CKeyLength + (pFileEntry->EKeyCount * EnHeader.EKeyLength);
+            }
+        }
+
+        // Allocate the index
+        if(nPass == 0 && (dwErrCode = hs->EncodingEKeys.Create<CASC_ENCODING_EKEY>(nEntryCount)) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+
+    // Sort the index by EKey and create the map over it
+    qsort(hs->EncodingEKeys.ItemArray(), hs->EncodingEKeys.ItemCount(), sizeof(CASC_ENCODING_EKEY), CompareEncodingEKeys);
+    return hs->EncodingEKeyMap.Create(hs->EncodingEKeys.ItemArray(), hs->EncodingEKeys.ItemCount(), sizeof(CASC_ENCODING_EKEY), CASC_EKEY_SIZE, 0);
+}
+
+// Finds the ENCODING entry whose first EKey is the given one. Only used for EKeys that are known
+// to be in ENCODING. The EKey index is built on the first call. The caller must hold the storage lock
+static PFILE_CKEY_ENTRY FindEncodingEntry_EKey(TCascStorage * hs, LPBYTE pbEKey)
+{
+    PCASC_ENCODING_EKEY pEKeyItem;
+
+    // Build the index, if not done yet
+    if(!hs->EncodingEKeys.IsInitialized())
+    {
+        if(BuildEncodingEKeyIndex(hs) != ERROR_SUCCESS)
+        {
+            hs->EncodingEKeys.Free();
+            return NULL;
+        }
+    }
+
+    // Find the ENCODING entry by the index
+    if((pEKeyItem = (PCASC_ENCODING_EKEY)hs->EncodingEKeyMap.FindObject(pbEKey)) == NULL)
+        return NULL;
+    return (PFILE_CKEY_ENTRY)(hs->EncodingData.pbData + pEKeyItem->EntryOffset);
+}
+
+// Creates a CKey entry from an ENCODING entry. The caller must hold the storage lock
+static PCASC_CKEY_ENTRY InsertEncodingEntry(TCascStorage * hs, PFILE_CKEY_ENTRY pFileEntry)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
+    // Insert a new entry to the array. The array grows without moving the existing entries
+    if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert()) != NULL)
+    {
+        InitCKeyEntry(hs, pCKeyEntry, pFileEntry);
+
+        // Insert the item into both maps
+        hs->CKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->CKey);
+        hs->EKeyMap.InsertObject(pCKeyEntry, pCKeyEntry->EKey);
+    }
+
+    assert(pCKeyEntry != NULL);
+    return pCKeyEntry;
+}
+
+// Keeps the ENCODING manifest in the storage, so the CKey entries can be created on demand
+static DWORD InitEncodingLookup(TCascStorage * hs, CASC_ENCODING_HEADER & EnHeader, CASC_BLOB & FileData)
+{
+    ULONGLONG CKeyPagesEnd;
+
+    // Verify that all CKey pages are within the file, so we don't need to check this on every lookup
+    CKeyPagesEnd = sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize +
+                   (ULONGLONG)EnHeader.CKeyPageCount * sizeof(FILE_CKEY_PAGE) +
+                   (ULONGLONG)EnHeader.CKeyPageCount * EnHeader.CKeyPageSize;
+    if(CKeyPagesEnd > FileData.cbData)
+        return ERROR_FILE_CORRUPT;
+
+    // Take the ownership of the ENCODING data
+    hs->EncodingHeader = EnHeader;
+
+    // The EKey table is used to reject absent EKeys. If it's not complete, we go without it
+    if(GetEncodingEKeyTableOffset(EnHeader) + (ULONGLONG)EnHeader.EKeyPageCount * (sizeof(FILE_CKEY_PAGE) + EnHeader.EKeyPageSize) > FileData.cbData)
+        hs->EncodingHeader.EKeyPageCount = 0;
+    hs->EncodingData.MoveFrom(FileData);
+    return ERROR_SUCCESS;
+}
+
+static DWORD PrefetchManifest_Worker(void * pvContext)
+{
+    CASC_MANIFEST_PREFETCH * pPrefetch = (CASC_MANIFEST_PREFETCH *)pvContext;
+
+    return LoadInternalFileToMemory(pPrefetch->hs, &pPrefetch->CKeyEntry, pPrefetch->FileData);
+}
+
+// Starts loading a manifest on a worker thread. The worker gets its own copy of the CKey entry,
+// because loading the file updates it and the entry in the CKey array may be changed meanwhile
+static void StartManifestPrefetch(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Prefetch, PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    if(Prefetch.bStarted == false && pCKeyEntry != NULL && (pCKeyEntry->Flags & CASC_CE_HAS_EKEY))
+    {
+        Prefetch.hs = hs;
+        Prefetch.CKeyEntry = *pCKeyEntry;
+        Prefetch.bStarted = true;
+        CascStartTask(Prefetch.Task, PrefetchManifest_Worker, &Prefetch);
+    }
+}
+
+// Waits for the prefetched manifest and gives its data. If the manifest was not prefetched
+// or the worker failed to load it, the caller loads the manifest the usual way
+static DWORD TakePrefetchedManifest(CASC_MANIFEST_PREFETCH & Prefetch, PCASC_CKEY_ENTRY pCKeyEntry, CASC_BLOB & FileData)
+{
+    DWORD dwErrCode;
+
+    // Was this manifest loaded by the worker?
+    if(Prefetch.bStarted == false || pCKeyEntry == NULL || memcmp(Prefetch.CKeyEntry.CKey, pCKeyEntry->CKey, MD5_HASH_SIZE))
+        return ERROR_FILE_NOT_FOUND;
+
+    // Wait until the worker is done
+    if((dwErrCode = CascWaitForTask(Prefetch.Task)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Supply the sizes that the worker found out while loading the file
+    if(pCKeyEntry->ContentSize == CASC_INVALID_SIZE)
+        pCKeyEntry->ContentSize = Prefetch.CKeyEntry.ContentSize;
+    if(pCKeyEntry->EncodedSize == CASC_INVALID_SIZE)
+        pCKeyEntry->EncodedSize = Prefetch.CKeyEntry.EncodedSize;
+
+    FileData.MoveFrom(Prefetch.FileData);
+    return ERROR_SUCCESS;
+}
+
+static void FreeManifestPrefetch(CASC_MANIFEST_PREFETCH & Prefetch)
+{
+    // Never leave the worker running
+    if(Prefetch.bStarted)
+        CascWaitForTask(Prefetch.Task);
+    Prefetch.FileData.Free();
+    Prefetch.bStarted = false;
+}
+
+// The DOWNLOAD manifest can be loaded while ENCODING is parsed, if its EKey is in the build file
+static void StartDownloadPrefetch(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Prefetch)
+{
+    CASC_CKEY_ENTRY CKeyEntry = hs->DownloadCKey;
+
+    if((CKeyEntry.Flags & CASC_CE_HAS_EKEY) && CopyEKeyEntry(hs, &CKeyEntry))
+    {
+        StartManifestPrefetch(hs, Prefetch, &CKeyEntry);
+    }
+}
+
+// Returns the CKey entry of the ROOT file. Prioritize the VFS root over legacy ROOT file, unless it's WoW
+static PCASC_CKEY_ENTRY GetRootFileEntry(TCascStorage * hs)
+{
+    return (hs->VfsRoot.ContentSize != CASC_INVALID_SIZE) ? &hs->VfsRoot : &hs->RootFile;
+}
+
+static DWORD LoadEncodingManifest(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Download)
 {
     CASC_CKEY_ENTRY & CKeyEntry = hs->EncodingCKey;
     CASC_BLOB FileData;
@@ -489,49 +1113,20 @@ static DWORD LoadEncodingManifest(TCascStorage * hs)
     {
         CASC_ENCODING_HEADER EnHeader;
 
+        // While we parse ENCODING, the DOWNLOAD manifest can be loaded from the storage.
+        // Not with lazy ENCODING, as the DOWNLOAD manifest isn't loaded at all
+        if((hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING) == 0)
+            StartDownloadPrefetch(hs, Download);
+
         // Capture the header of the ENCODING file
         dwErrCode = CaptureEncodingHeader(EnHeader, FileData.pbData, FileData.cbData);
         if(dwErrCode == ERROR_SUCCESS)
         {
-            // Get the CKey page header and the first page
-            PFILE_CKEY_PAGE pPageHeader = (PFILE_CKEY_PAGE)(FileData.pbData + sizeof(FILE_ENCODING_HEADER) + EnHeader.ESpecBlockSize);
-            LPBYTE pbEncodingEnd = FileData.pbData + FileData.cbData;
-            LPBYTE pbCKeyPage = (LPBYTE)(pPageHeader + EnHeader.CKeyPageCount);
-
-            // Go through all CKey pages and verify them
-            for(DWORD i = 0; i < EnHeader.CKeyPageCount; i++)
-            {
-                // Check if there is enough space in the buffer
-                if((pbCKeyPage + EnHeader.CKeyPageSize) > pbEncodingEnd)
-                {
-                    dwErrCode = ERROR_FILE_CORRUPT;
-                    break;
-                }
-
-                // Check the hash of the entire segment
-                // Note that verifying takes considerable time of the storage loading
-//              if(!VerifyDataBlockHash(pbCKeyPage, EnHeader.CKeyPageSize, pEncodingSegment->SegmentHash))
-//              {
-//                  dwErrCode = ERROR_FILE_CORRUPT;
-//                  break;
-//              }
-
-                // Check if the CKey matches with the expected first value
-                if(memcmp(((PFILE_CKEY_ENTRY)pbCKeyPage)->CKey, pPageHeader[i].FirstKey, MD5_HASH_SIZE))
-                {
-                    dwErrCode = ERROR_FILE_CORRUPT;
-                    break;
-                }
-
-                // Load the entire page of CKey entries.
-                // This operation will never fail, because all memory is already pre-allocated
-                dwErrCode = LoadEncodingCKeyPage(hs, EnHeader, pbCKeyPage, pbCKeyPage + EnHeader.CKeyPageSize);
-                if(dwErrCode != ERROR_SUCCESS)
-                    break;
-
-                // Move to the next CKey page
-                pbCKeyPage += EnHeader.CKeyPageSize;
-            }
+            // With lazy ENCODING, the CKey entries are only created when they are looked up
+            if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
+                dwErrCode = InitEncodingLookup(hs, EnHeader, FileData);
+            else
+                dwErrCode = LoadEncodingCKeyPages(hs, EnHeader, FileData.pbData, FileData.cbData);
         }
 
         // All CKey->EKey entries from the text build files need to be copied to the CKey array
@@ -732,6 +1327,7 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
     {
         CASC_DOWNLOAD_ENTRY DlEntry;
         PCASC_CKEY_ENTRY pCKeyEntry;
+        ULONGLONG TagBitMask = 0;
         ULONGLONG TagBit = 1;
         size_t BitMaskOffset = (i / 8);
         size_t TagItemCount = hs->TagsArray.ItemCount();
@@ -754,11 +1350,15 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
                 {
                     // Set the bit in the entry, if the tag for it is present
                     if((BitMaskOffset < TagArray[j].BitmapLength) && (TagArray[j].Bitmap[BitMaskOffset] & BitMaskBit))
-                        pCKeyEntry->TagBitMask |= TagBit;
+                        TagBitMask |= TagBit;
 
                     // Move to the next bit
                     TagBit <<= 1;
                 }
+
+                // The entry may be in the DOWNLOAD manifest more than once
+                if(TagBitMask != 0)
+                    hs->SetTagBitMask(pCKeyEntry, hs->GetTagBitMask(pCKeyEntry) | TagBitMask);
             }
         }
 
@@ -774,7 +1374,7 @@ static int LoadDownloadManifest(TCascStorage * hs, CASC_DOWNLOAD_HEADER & DlHead
     return dwErrCode;
 }
 
-static int LoadDownloadManifest(TCascStorage * hs)
+static int LoadDownloadManifest(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Download, CASC_MANIFEST_PREFETCH & Root)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = FindCKeyEntry_CKey(hs, hs->DownloadCKey.CKey);
     CASC_BLOB FileData;
@@ -785,8 +1385,11 @@ static int LoadDownloadManifest(TCascStorage * hs)
     if(InvokeProgressCallback(hs, CascProgressLoadingManifest, "DOWNLOAD", 0, 0))
         return ERROR_CANCELLED;
 
-    // Attempt to load the DOWNLOAD manifest from the local storage
-    dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
+    // Take the DOWNLOAD manifest if it has been loaded while parsing ENCODING.
+    // If not, attempt to load the DOWNLOAD manifest from the local storage
+    dwErrCode = TakePrefetchedManifest(Download, pCKeyEntry, FileData);
+    if(dwErrCode != ERROR_SUCCESS)
+        dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
 
     // If not available, try to download it
     if((dwErrCode != ERROR_SUCCESS) && (hs->dwFeatures & CASC_FEATURE_ALLOW_DOWNLOAD))
@@ -807,6 +1410,10 @@ static int LoadDownloadManifest(TCascStorage * hs)
     {
         CASC_DOWNLOAD_HEADER DlHeader;
 
+        // While we parse DOWNLOAD, the ROOT file can be loaded from the storage
+        if((hs->dwFeatures & CASC_FEATURE_DEFERRED_ROOT) == 0)
+            StartManifestPrefetch(hs, Root, FindCKeyEntry_CKey(hs, GetRootFileEntry(hs)->CKey));
+
         // Capture the header of the DOWNLOAD file
         dwErrCode = CaptureDownloadHeader(DlHeader, FileData.pbData, FileData.cbData);
         if(dwErrCode == ERROR_SUCCESS)
@@ -884,7 +1491,7 @@ static bool InsertWellKnownFile(TCascStorage * hs, const char * szFileName, CASC
     return false;
 }
 
-static DWORD LoadBuildManifest(TCascStorage * hs, DWORD dwLocaleMask)
+static DWORD LoadBuildManifest(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Root, DWORD dwLocaleMask)
 {
     PCASC_CKEY_ENTRY pCKeyEntry = &hs->RootFile;
     TRootHandler * pOldRootHandler = NULL;
@@ -905,14 +1512,16 @@ static DWORD LoadBuildManifest(TCascStorage * hs, DWORD dwLocaleMask)
     dwLocaleMask = (dwLocaleMask != 0) ? dwLocaleMask : 0xFFFFFFFF;
 
     // Prioritize the VFS root over legacy ROOT file, unless it's WoW
-    if(hs->VfsRoot.ContentSize != CASC_INVALID_SIZE)
-        pCKeyEntry = &hs->VfsRoot;
+    pCKeyEntry = GetRootFileEntry(hs);
 
 __LoadRootFile:
 
-    // Download the local copy of the ROOT file
+    // Take the ROOT file if it has been loaded while parsing DOWNLOAD.
+    // If not, load the local copy of the ROOT file
     pCKeyEntry = FindCKeyEntry_CKey(hs, pCKeyEntry->CKey);
-    dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
+    dwErrCode = TakePrefetchedManifest(Root, pCKeyEntry, FileData);
+    if(dwErrCode != ERROR_SUCCESS)
+        dwErrCode = LoadInternalFileToMemory(hs, pCKeyEntry, FileData);
 
     // If not available, try to download it
     if((dwErrCode != ERROR_SUCCESS) && (hs->dwFeatures & CASC_FEATURE_ALLOW_DOWNLOAD))
@@ -1124,46 +1733,251 @@ static bool GetStoragePathProduct(TCascStorage * hs, void * pvStorageInfo, size_
     szBuffer = (LPTSTR)ProbeOutputBuffer(pvStorageInfo, cbStorageInfo, (nLength * sizeof(TCHAR)), pcbLengthNeeded);
     if(szBuffer != NULL)
     {
-        LPTSTR szBufferEnd = szBuffer + nMaxChars;
+        LPTSTR szBufferEnd = szBuffer + nMaxChars;
+
+        // Copy the storage path
+        CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szRootPath);
+        szBuffer += _tcslen(hs->szRootPath);
+
+        // Append the product code name, if any
+        if(hs->szCodeName != NULL)
+        {
+            *szBuffer++ = _T(CASC_PARAM_SEPARATOR);
+            CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szCodeName);
+            szBuffer += _tcslen(hs->szCodeName);
+        }
+
+        // Append the product region, if any
+        if(hs->szRegion != NULL)
+        {
+            *szBuffer++ = _T(CASC_PARAM_SEPARATOR);
+            CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szRegion);
+        }
+    }
+
+    return (szBuffer != NULL);
+}
+
+// Sums the memory held by the storage content. Must be called with RootLock and StorageLock held,
+// unless the storage is retired
+static ULONGLONG GetStorageContentMemory(TCascStorage * hs, PCASC_STORAGE_MEMORY_USAGE pUsage)
+{
+    ULONGLONG * PtrValue = (ULONGLONG *)pUsage;
+    ULONGLONG Total = 0;
+
+    // Memory held by the storage structures
+    pUsage->CKeyArray += hs->CKeyArray.BytesAllocated();
+    pUsage->CKeyMap += hs->CKeyMap.BytesAllocated();
+    pUsage->EKeyMap += hs->EKeyMap.BytesAllocated();
+    pUsage->IndexEKeyMap += hs->IndexEKeyMap.BytesAllocated();
+    pUsage->IndexArray += hs->IndexArray.BytesAllocated() + hs->IndexMap.BytesAllocated();
+    pUsage->EncodingData += hs->EncodingData.cbData + hs->EncodingEKeys.BytesAllocated();
+    pUsage->TagsArray += hs->TagsArray.BytesAllocated() + hs->TagMaskArray.BytesAllocated();
+    pUsage->Arena += hs->Arena.BytesAllocated();
+    pUsage->HugePageAdvised += hs->CKeyArray.HugePageAdvisedBytes() + hs->CKeyMap.HugePageAdvisedBytes() + hs->EKeyMap.HugePageAdvisedBytes() + hs->IndexEKeyMap.HugePageAdvisedBytes();
+    for(size_t i = 0; i < CASC_INDEX_COUNT; i++)
+        pUsage->IndexFiles += hs->IndexFiles[i].FileData.cbData;
+
+    // Memory held by the root handler
+    if(hs->pRootHandler != NULL)
+        hs->pRootHandler->GetMemoryUsage(pUsage);
+
+    // Content that was replaced by CascRefreshStorage
+    if(hs->pRetired != NULL)
+    {
+        CASC_STORAGE_MEMORY_USAGE Retired = {0};
+
+        pUsage->Retired += GetStorageContentMemory(hs->pRetired, &Retired);
+        pUsage->HugePageAdvised += Retired.HugePageAdvised;
+    }
+
+    // Sum all values except the total
+    for(size_t i = 0; i < FIELD_OFFSET(CASC_STORAGE_MEMORY_USAGE, Total) / sizeof(ULONGLONG); i++)
+        Total += PtrValue[i];
+    return Total;
+}
+
+static bool GetStorageMemoryUsage(TCascStorage * hs, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded)
+{
+    PCASC_STORAGE_MEMORY_USAGE pUsage;
+
+    // Verify whether we have enough space in the buffer
+    pUsage = (PCASC_STORAGE_MEMORY_USAGE)ProbeOutputBuffer(pvStorageInfo, cbStorageInfo, sizeof(CASC_STORAGE_MEMORY_USAGE), pcbLengthNeeded);
+    if(pUsage != NULL)
+    {
+        memset(pUsage, 0, sizeof(CASC_STORAGE_MEMORY_USAGE));
+        pUsage->FileCaches = hs->FileCacheBytes;
+        pUsage->FrameCache = hs->FrameCache.BytesAllocated();
+        pUsage->BlockCache = FileStream_GetCacheBytes(hs->pBlockCache);
+
+        // Lock the root handler and the storage so the content doesn't change meanwhile
+        CascLock(hs->RootLock);
+        CascLock(hs->StorageLock);
+        pUsage->Total = GetStorageContentMemory(hs, pUsage);
+        CascUnlock(hs->StorageLock);
+        CascUnlock(hs->RootLock);
+    }
+
+    return (pUsage != NULL);
+}
+
+static bool GetStorageFrameCacheStats(TCascStorage * hs, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded)
+{
+    PCASC_FRAME_CACHE_STATS pStats;
+
+    // Verify whether we have enough space in the buffer
+    pStats = (PCASC_FRAME_CACHE_STATS)ProbeOutputBuffer(pvStorageInfo, cbStorageInfo, sizeof(CASC_FRAME_CACHE_STATS), pcbLengthNeeded);
+    if(pStats != NULL)
+        hs->FrameCache.GetStats(pStats);
+    return (pStats != NULL);
+}
+
+static bool GetStorageOpenStats(TCascStorage * hs, void * pvStorageInfo, size_t cbStorageInfo, size_t * pcbLengthNeeded)
+{
+    PCASC_STORAGE_OPEN_STATS pOpenStats;
+
+    // Verify whether we have enough space in the buffer
+    pOpenStats = (PCASC_STORAGE_OPEN_STATS)ProbeOutputBuffer(pvStorageInfo, cbStorageInfo, sizeof(CASC_STORAGE_OPEN_STATS), pcbLengthNeeded);
+    if(pOpenStats != NULL)
+    {
+        // The ROOT phase may be running on another thread (CASC_FEATURE_DEFERRED_ROOT)
+        CascLock(hs->RootLock);
+        memcpy(pOpenStats, &hs->OpenStats, sizeof(CASC_STORAGE_OPEN_STATS));
+        CascUnlock(hs->RootLock);
+    }
+
+    return (pOpenStats != NULL);
+}
+
+// Loads the ROOT manifest and creates the root handler. If ROOT can't be loaded,
+// the file names are taken from the INSTALL manifest
+static DWORD LoadRootHandler(TCascStorage * hs, CASC_MANIFEST_PREFETCH & Root, DWORD dwLocaleMask)
+{
+    CASC_PHASE_START Start;
+    DWORD dwErrCode;
+
+    // Load the build manifest ("ROOT" file)
+    BeginOpenPhase(Start);
+    dwErrCode = LoadBuildManifest(hs, Root, dwLocaleMask);
+    EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseRoot], Start);
+
+    // If we fail to load the ROOT file, we take the file names from the INSTALL manifest
+    // Beware on low memory condition - in that case, we cannot guarantee a consistent state of the root file
+    if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_NOT_ENOUGH_MEMORY)
+    {
+        BeginOpenPhase(Start);
+        dwErrCode = LoadInstallManifest(hs);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseInstall], Start);
+    }
+
+    // Insert entries for files with well-known names. Their CKeys are in the BUILD file
+    // See https://wowdev.wiki/TACT#Encoding_table for their list
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        InsertWellKnownFile(hs, "ENCODING", hs->EncodingCKey);
+        InsertWellKnownFile(hs, "DOWNLOAD", hs->DownloadCKey);
+        InsertWellKnownFile(hs, "INSTALL", hs->InstallCKey);
+        InsertWellKnownFile(hs, "PATCH", hs->PatchFile, CASC_CE_FILE_PATCH);
+        InsertWellKnownFile(hs, "ROOT", hs->RootFile);
+        InsertWellKnownFile(hs, "SIZE", hs->SizeFile);
+        hs->OpenStats.FileTreeNodes = hs->pRootHandler->GetNodeCount();
+
+        // Not all root handlers look up files by name hash
+        if(hs->dwFeatures & CASC_FEATURE_BLOOM_FILTERS)
+            hs->pRootHandler->CreateNameFilter();
+    }
+
+    return dwErrCode;
+}
+
+//
+// The manifests are loaded as a pipeline:
+//
+//   INDEX -> ENCODING (load) -> ENCODING (parse) -> DOWNLOAD (parse) -> ROOT (parse)
+//                                      |                   |
+//                                      +-> DOWNLOAD (load) +-> ROOT (load)
+//
+// Loading of DOWNLOAD and ROOT runs on worker threads, while the calling thread
+// parses the previous manifest. The progress callback is only called by the calling thread
+//
+
+static DWORD LoadStorageManifests(TCascStorage * hs, DWORD dwLocaleMask)
+{
+    CASC_MANIFEST_PREFETCH Download;
+    CASC_MANIFEST_PREFETCH Root;
+    CASC_PHASE_START Start;
+    DWORD dwErrCode;
+
+    // No manifests are being loaded yet
+    Download.bStarted = Root.bStarted = false;
+
+    // Create the array of CKey entries. Each entry represents a file in the storage
+    dwErrCode = InitCKeyArray(hs);
+
+    // Pre-load the local index files
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        BeginOpenPhase(Start);
+        dwErrCode = LoadIndexFiles(hs);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseIndexFiles], Start);
+        hs->OpenStats.IndexEntries = hs->IndexEKeyMap.ItemCount() + hs->IndexArray.ItemCount();
+    }
 
-        // Copy the storage path
-        CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szRootPath);
-        szBuffer += _tcslen(hs->szRootPath);
+    // Load the ENCODING manifest
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        BeginOpenPhase(Start);
+        dwErrCode = LoadEncodingManifest(hs, Download);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseEncoding], Start);
+    }
 
-        // Append the product code name, if any
-        if(hs->szCodeName != NULL)
+    // We need to load the DOWNLOAD manifest. Not with lazy ENCODING, as it would need all CKey entries.
+    // The caller can find out from the storage features that there are no tags
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        if(hs->dwFeatures & CASC_FEATURE_LAZY_ENCODING)
         {
-            *szBuffer++ = _T(CASC_PARAM_SEPARATOR);
-            CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szCodeName);
-            szBuffer += _tcslen(hs->szCodeName);
+            hs->dwFeatures |= CASC_FEATURE_NO_DOWNLOAD;
+        }
+        else
+        {
+            BeginOpenPhase(Start);
+            dwErrCode = LoadDownloadManifest(hs, Download, Root);
+            EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseDownload], Start);
         }
+    }
 
-        // Append the product region, if any
-        if(hs->szRegion != NULL)
+    // Load the ROOT manifest. With deferred ROOT, the root handler
+    // is created on the first lookup by name or search
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        if(hs->dwFeatures & CASC_FEATURE_DEFERRED_ROOT)
         {
-            *szBuffer++ = _T(CASC_PARAM_SEPARATOR);
-            CascStrCopy(szBuffer, (szBufferEnd - szBuffer), hs->szRegion);
+            hs->dwRootDeferred = 1;
+        }
+        else
+        {
+            dwErrCode = LoadRootHandler(hs, Root, dwLocaleMask);
         }
     }
 
-    return (szBuffer != NULL);
+    // Wait for the workers that didn't finish due to an error or cancellation
+    FreeManifestPrefetch(Download);
+    FreeManifestPrefetch(Root);
+    return dwErrCode;
 }
 
-static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, LPCTSTR szMainFile, CBLD_TYPE BuildFileType, DWORD dwFeatures)
+// Initializes the storage and loads the main storage file (".build.info", ".build.db" or "versions").
+// The main file selects the build that is going to be loaded
+static DWORD LoadStorageMainFile(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, LPCTSTR szMainFile, CBLD_TYPE BuildFileType, DWORD dwFeatures)
 {
     LPCTSTR szCdnHostUrl = NULL;
     LPCTSTR szCodeName = NULL;
     LPCTSTR szRegion = NULL;
     LPCTSTR szBuildKey = NULL;
-    DWORD dwLocaleMask = 0;
+    CASC_PHASE_START Start;
     DWORD dwErrCode = ERROR_SUCCESS;
 
-    // Pass the argument array to the storage
-    hs->pArgs = pArgs;
-
-    // Extract optional arguments
-    ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, dwLocaleMask), &dwLocaleMask);
-
     // Extract the CDN host URL
     if(ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, szCdnHostUrl), &szCdnHostUrl) && szCdnHostUrl != NULL)
         hs->szCdnHostUrl = CascNewStr(szCdnHostUrl);
@@ -1182,7 +1996,7 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
 
     // Merge features
     hs->dwFeatures |= (dwFeatures & (CASC_FEATURE_DATA_ARCHIVES | CASC_FEATURE_DATA_FILES | CASC_FEATURE_ONLINE | CASC_FEATURE_ALLOW_DOWNLOAD));
-    hs->dwFeatures |= (pArgs->dwFlags & CASC_FEATURE_FORCE_DOWNLOAD);
+    hs->dwFeatures |= (pArgs->dwFlags & (CASC_FEATURE_FORCE_DOWNLOAD | CASC_FEATURE_LAZY_ENCODING | CASC_FEATURE_DEFERRED_ROOT | CASC_FEATURE_BLOOM_FILTERS | CASC_FEATURE_HUGE_PAGES | CASC_FEATURE_MAPPED_DATA));
     hs->dwFeatures |= (BuildFileType == CascVersions) ? CASC_FEATURE_ONLINE : 0;
     hs->BuildFileType = BuildFileType;
 
@@ -1222,11 +2036,33 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
             sockets_set_caching(true);
 
         // Now, load the main storage file (".build.info", ".build.db" or "versions")
+        BeginOpenPhase(Start);
         dwErrCode = LoadMainFile(hs);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseMainFile], Start);
     }
 
+    return dwErrCode;
+}
+
+// Loads the build selected by the main storage file: CDN config, CDN build and all manifests
+// Moves the rest of the objects from the old hash tables of the key maps, once the maps
+// are complete. After that, the maps only have one hash table and can be enumerated
+static void FinishKeyMaps(TCascStorage * hs)
+{
+    hs->CKeyMap.FinishRehash();
+    hs->EKeyMap.FinishRehash();
+    hs->IndexEKeyMap.FinishRehash();
+}
+
+static DWORD LoadStorageBuild(TCascStorage * hs, DWORD dwLocaleMask, LPCTSTR szSnapshotPath)
+{
+    CASC_PHASE_START Start;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    bool bSnapshotLoaded = false;
+
     // Proceed with loading the CDN config file
-    if(dwErrCode == ERROR_SUCCESS && hs->CdnConfigKey.Valid())
+    BeginOpenPhase(Start);
+    if(hs->CdnConfigKey.Valid())
     {
         dwErrCode = LoadCdnConfigFile(hs);
         if(dwErrCode != ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_ONLINE) == 0)
@@ -1238,6 +2074,7 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
     {
         dwErrCode = LoadCdnBuildFile(hs);
     }
+    EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseBuildConfig], Start);
 
     // Make sure we have a build number. If we don't, we assign a build number
     // that is derived from the first beta TVFS build number
@@ -1252,74 +2089,302 @@ static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, L
         hs->SetProductCodeName("wow", 3);
     }
 
-    // Create the array of CKey entries. Each entry represents a file in the storage
-    if(dwErrCode == ERROR_SUCCESS)
+    // For WoW storages, multiple files are present in the storage (same name, same file data ID, different locale).
+    // Failing to select storage on them will lead to the first-in-order file in the list being loaded.
+    // Example: WoW build 32144, file: DBFilesClient\Achievement.db2, file data ID: 1260179
+    // Locales: koKR frFR deDE zhCN esES zhTW enUS&enGB esMX ruRU itIT ptBT&ptPT (in order of appearance in the build manifest)
+    dwLocaleMask = (dwLocaleMask != 0) ? dwLocaleMask : hs->dwDefaultLocale;
+    hs->dwRootLocaleMask = dwLocaleMask;
+
+    // If there is an up-to-date snapshot of the local storage, we load the storage from it
+    if(dwErrCode == ERROR_SUCCESS && szSnapshotPath != NULL && (hs->dwFeatures & CASC_FEATURE_DATA_ARCHIVES))
     {
-        dwErrCode = InitCKeyArray(hs);
+        BeginOpenPhase(Start);
+        bSnapshotLoaded = (LoadStorageSnapshot(hs, szSnapshotPath, dwLocaleMask) == ERROR_SUCCESS);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseSnapshot], Start);
     }
 
-    // Pre-load the local index files
+    // Load the storage manifests: index files, ENCODING, DOWNLOAD and ROOT
+    if(dwErrCode == ERROR_SUCCESS && bSnapshotLoaded == false)
+    {
+        dwErrCode = LoadStorageManifests(hs, dwLocaleMask);
+    }
+
+    // The key maps are complete
     if(dwErrCode == ERROR_SUCCESS)
     {
-        dwErrCode = LoadIndexFiles(hs);
+        FinishKeyMaps(hs);
     }
 
-    // Load the ENCODING manifest
+    // Save the loaded storage to the snapshot, so the next load is faster
+    if(dwErrCode == ERROR_SUCCESS && bSnapshotLoaded == false && szSnapshotPath != NULL && (hs->dwFeatures & CASC_FEATURE_DATA_ARCHIVES))
+    {
+        BeginOpenPhase(Start);
+        SaveStorageSnapshot(hs, szSnapshotPath, dwLocaleMask);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseSnapshot], Start);
+    }
+
+    // Reset the total file count. CascGetStorageInfo will update it on next call
     if(dwErrCode == ERROR_SUCCESS)
     {
-        dwErrCode = LoadEncodingManifest(hs);
+        hs->OpenStats.CKeyEntries = hs->CKeyArray.ItemCount();
+        hs->TotalFiles = 0;
     }
 
-    // We need to load the DOWNLOAD manifest
+    // Load the encryption keys
     if(dwErrCode == ERROR_SUCCESS)
     {
-        dwErrCode = LoadDownloadManifest(hs);
+        BeginOpenPhase(Start);
+        dwErrCode = CascLoadEncryptionKeys(hs);
+        EndOpenPhase(hs->OpenStats.Phases[CascOpenPhaseKeys], Start);
     }
 
-    // Load the build manifest ("ROOT" file)
+    return dwErrCode;
+}
+
+// Frees the data that are only needed while the storage is being loaded
+static void FreeStorageLoadData(TCascStorage * hs)
+{
+    // Lazy ENCODING lookup and deferred ROOT still need the index files
+    if(hs->EncodingData.pbData == NULL && hs->dwRootDeferred == 0)
+        FreeIndexFiles(hs);
+    hs->pArgs = NULL;
+}
+
+static DWORD LoadCascStorage(TCascStorage * hs, PCASC_OPEN_STORAGE_ARGS pArgs, LPCTSTR szMainFile, CBLD_TYPE BuildFileType, DWORD dwFeatures)
+{
+    CASC_PHASE_START Start;
+    LPCTSTR szSnapshotPath = NULL;
+    DWORD dwLocaleMask = 0;
+    DWORD dwErrCode;
+
+    // Pass the argument array to the storage
+    BeginOpenPhase(Start);
+    hs->pArgs = pArgs;
+
+    // Extract optional arguments
+    ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, dwLocaleMask), &dwLocaleMask);
+
+    // Extract the snapshot directory (optional). Snapshots need all CKey entries, so they don't work with lazy ENCODING
+    if((pArgs->dwFlags & CASC_FEATURE_LAZY_ENCODING) == 0)
+        ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, szSnapshotPath), &szSnapshotPath);
+
+    // Load the main storage file and then the build that it refers to
+    dwErrCode = LoadStorageMainFile(hs, pArgs, szMainFile, BuildFileType, dwFeatures);
     if(dwErrCode == ERROR_SUCCESS)
     {
-        // For WoW storages, multiple files are present in the storage (same name, same file data ID, different locale).
-        // Failing to select storage on them will lead to the first-in-order file in the list being loaded.
-        // Example: WoW build 32144, file: DBFilesClient\Achievement.db2, file data ID: 1260179
-        // Locales: koKR frFR deDE zhCN esES zhTW enUS&enGB esMX ruRU itIT ptBT&ptPT (in order of appearance in the build manifest)
-        dwLocaleMask = (dwLocaleMask != 0) ? dwLocaleMask : hs->dwDefaultLocale;
+        dwErrCode = LoadStorageBuild(hs, dwLocaleMask, szSnapshotPath);
+    }
+
+    // Cleanup and exit
+    FreeStorageLoadData(hs);
+    EndOpenPhase(hs->OpenStats.Total, Start);
+    return dwErrCode;
+}
+
+// Exchanges a member of two storage objects. The members are moved as raw bytes,
+// which is fine because none of them points to the storage object itself
+template <typename TYPE>
+static void SwapMember(TYPE & Member1, TYPE & Member2)
+{
+    BYTE Buffer[sizeof(TYPE)];
+
+    memcpy(Buffer, (void *)(&Member1), sizeof(TYPE));
+    memcpy((void *)(&Member1), (void *)(&Member2), sizeof(TYPE));
+    memcpy((void *)(&Member2), Buffer, sizeof(TYPE));
+}
+
+static bool IsSameBlob(CASC_BLOB & Blob1, CASC_BLOB & Blob2)
+{
+    if(Blob1.cbData != Blob2.cbData)
+        return false;
+    return (Blob1.cbData == 0 || !memcmp(Blob1.pbData, Blob2.pbData, Blob1.cbData));
+}
+
+// Exchanges the build-dependent content of two storages. Paths, data files, locks,
+// encryption keys and the arena stay with the storage object
+static void SwapStorageBuild(TCascStorage * hs, TCascStorage * hsNew)
+{
+    SwapMember(hs->CdnConfigKey, hsNew->CdnConfigKey);
+    SwapMember(hs->CdnBuildKey, hsNew->CdnBuildKey);
+    SwapMember(hs->ArchiveGroup, hsNew->ArchiveGroup);
+    SwapMember(hs->ArchivesKey, hsNew->ArchivesKey);
+    SwapMember(hs->PatchArchivesKey, hsNew->PatchArchivesKey);
+    SwapMember(hs->PatchArchivesGroup, hsNew->PatchArchivesGroup);
+    SwapMember(hs->BuildFiles, hsNew->BuildFiles);
+
+    SwapMember(hs->szIndexFormat, hsNew->szIndexFormat);
+    SwapMember(hs->szCdnServers, hsNew->szCdnServers);
+    SwapMember(hs->szCdnPath, hsNew->szCdnPath);
+    SwapMember(hs->dwDefaultLocale, hsNew->dwDefaultLocale);
+    SwapMember(hs->dwBuildNumber, hsNew->dwBuildNumber);
+    SwapMember(hs->dwFeatures, hsNew->dwFeatures);
+
+    SwapMember(hs->IndexFiles, hsNew->IndexFiles);
+    SwapMember(hs->IndexEKeyMap, hsNew->IndexEKeyMap);
+
+    SwapMember(hs->EncodingCKey, hsNew->EncodingCKey);
+    SwapMember(hs->DownloadCKey, hsNew->DownloadCKey);
+    SwapMember(hs->InstallCKey, hsNew->InstallCKey);
+    SwapMember(hs->PatchFile, hsNew->PatchFile);
+    SwapMember(hs->RootFile, hsNew->RootFile);
+    SwapMember(hs->SizeFile, hsNew->SizeFile);
+    SwapMember(hs->VfsRoot, hsNew->VfsRoot);
+    SwapMember(hs->VfsRootList, hsNew->VfsRootList);
+    SwapMember(hs->EncodingData, hsNew->EncodingData);
+    SwapMember(hs->EncodingHeader, hsNew->EncodingHeader);
+    SwapMember(hs->EncodingEKeys, hsNew->EncodingEKeys);
+    SwapMember(hs->EncodingEKeyMap, hsNew->EncodingEKeyMap);
+
+    SwapMember(hs->pRootHandler, hsNew->pRootHandler);
+    SwapMember(hs->dwRootLocaleMask, hsNew->dwRootLocaleMask);
+    SwapMember(hs->dwRootDeferred, hsNew->dwRootDeferred);
+    SwapMember(hs->IndexArray, hsNew->IndexArray);
+    SwapMember(hs->CKeyArray, hsNew->CKeyArray);
+    SwapMember(hs->TagsArray, hsNew->TagsArray);
+    SwapMember(hs->TagMaskArray, hsNew->TagMaskArray);
+    SwapMember(hs->IndexMap, hsNew->IndexMap);
+    SwapMember(hs->CKeyMap, hsNew->CKeyMap);
+    SwapMember(hs->EKeyMap, hsNew->EKeyMap);
+    SwapMember(hs->LocalFiles, hsNew->LocalFiles);
+    SwapMember(hs->TotalFiles, hsNew->TotalFiles);
+    SwapMember(hs->EKeyEntries, hsNew->EKeyEntries);
+    SwapMember(hs->EKeyLength, hsNew->EKeyLength);
+    SwapMember(hs->FileOffsetBits, hsNew->FileOffsetBits);
+    SwapMember(hs->OpenStats, hsNew->OpenStats);
+    SwapMember(hs->pBuildRef, hsNew->pBuildRef);
+}
 
-        // Continue loading the manifest
-        dwErrCode = LoadBuildManifest(hs, dwLocaleMask);
+// Data files whose size or time has changed on disk are reopened on the next read, because the streams
+// (the mapped ones in particular) only see the file as it was when they were opened.
+// The cached blocks of such files are dropped. The previous streams are kept
+// until the storage is closed, as open files may still use them
+static DWORD RetireChangedDataFiles(TCascStorage * hs)
+{
+    TFileStream * pStream;
+    ULONGLONG OldFileSize;
+    ULONGLONG NewFileSize;
+    ULONGLONG OldFileTime;
+    ULONGLONG NewFileTime;
 
-        // If we fail to load the ROOT file, we take the file names from the INSTALL manifest
-        // Beware on low memory condition - in that case, we cannot guarantee a consistent state of the root file
-        if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_NOT_ENOUGH_MEMORY)
+    for(size_t i = 0; i < CASC_MAX_DATA_FILES; i++)
+    {
+        if(hs->DataFiles[i] != NULL)
         {
-            dwErrCode = LoadInstallManifest(hs);
+            // Check the current size and time of the file on disk
+            OldFileSize = NewFileSize = OldFileTime = NewFileTime = 0;
+            if((pStream = FileStream_OpenFile(FileStream_GetFileName(hs->DataFiles[i]), STREAM_FLAG_READ_ONLY | STREAM_FLAG_WRITE_SHARE | STREAM_PROVIDER_FLAT | BASE_PROVIDER_FILE)) != NULL)
+            {
+                FileStream_GetSize(pStream, &NewFileSize);
+                FileStream_GetTime(pStream, &NewFileTime);
+                FileStream_Close(pStream);
+            }
+            FileStream_GetSize(hs->DataFiles[i], &OldFileSize);
+            FileStream_GetTime(hs->DataFiles[i], &OldFileTime);
+
+            // Retire the stream if the file has changed. A file rewritten in place
+            // keeps its size, so its cached blocks may be stale too
+            if(pStream == NULL || NewFileSize != OldFileSize || NewFileTime != OldFileTime)
+            {
+                if(!hs->RetiredDataFiles.IsInitialized() && hs->RetiredDataFiles.Create<TFileStream *>(CASC_MAX_DATA_FILES) != ERROR_SUCCESS)
+                    return ERROR_NOT_ENOUGH_MEMORY;
+                if(hs->RetiredDataFiles.Insert(&hs->DataFiles[i], 1) == NULL)
+                    return ERROR_NOT_ENOUGH_MEMORY;
+                FileStream_FlushCacheStream(hs->DataFiles[i]);
+                hs->DataFiles[i] = NULL;
+            }
         }
     }
 
-    // Insert entries for files with well-known names. Their CKeys are in the BUILD file
-    // See https://wowdev.wiki/TACT#Encoding_table for their list
-    if(dwErrCode == ERROR_SUCCESS)
-    {
-        InsertWellKnownFile(hs, "ENCODING", hs->EncodingCKey);
-        InsertWellKnownFile(hs, "DOWNLOAD", hs->DownloadCKey);
-        InsertWellKnownFile(hs, "INSTALL", hs->InstallCKey);
-        InsertWellKnownFile(hs, "PATCH", hs->PatchFile, CASC_CE_FILE_PATCH);
-        InsertWellKnownFile(hs, "ROOT", hs->RootFile);
-        InsertWellKnownFile(hs, "SIZE", hs->SizeFile);
+    return ERROR_SUCCESS;
+}
 
-        // Also reset the total file count. CascGetStorageInfo will update it on next call
-        hs->TotalFiles = 0;
+// Reloads the main storage file. If it refers to a different build than the one
+// that is loaded, the new build is loaded into a separate storage object and its content
+// is exchanged with the current one. The old content stays alive until the last file
+// that was opened in the old build is closed
+static DWORD RefreshStorageBuild(TCascStorage * hs, PDWORD PtrRefreshFlags)
+{
+    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_PHASE_START Start;
+    TCascStorage * hsNew;
+    LPTSTR szRegion = CascNewStrA2T(hs->szRegion);
+    LPTSTR szBuildKey = CascNewStrA2T(hs->szBuildKey);
+    DWORD dwFeatures = hs->dwFeatures & (CASC_FEATURE_DATA_ARCHIVES | CASC_FEATURE_DATA_FILES | CASC_FEATURE_ONLINE | CASC_FEATURE_ALLOW_DOWNLOAD);
+    DWORD dwErrCode;
+
+    // Create a new storage object
+    if((hsNew = new TCascStorage()) == NULL)
+    {
+        CASC_FREE(szRegion);
+        CASC_FREE(szBuildKey);
+        return ERROR_NOT_ENOUGH_MEMORY;
     }
 
-    // Load the encryption keys
+    // Reconstruct the arguments that the storage was opened with
+    OpenArgs.szLocalPath = hs->szRootPath;
+    OpenArgs.szCodeName = hs->szCodeName;
+    OpenArgs.szRegion = szRegion;
+    OpenArgs.szBuildKey = szBuildKey;
+    OpenArgs.szCdnHostUrl = hs->szCdnHostUrl;
+    OpenArgs.dwLocaleMask = hs->dwRootLocaleMask;
+    OpenArgs.dwFlags = hs->dwFeatures & (CASC_FEATURE_FORCE_DOWNLOAD | CASC_FEATURE_LAZY_ENCODING | CASC_FEATURE_DEFERRED_ROOT | CASC_FEATURE_BLOOM_FILTERS | CASC_FEATURE_HUGE_PAGES | CASC_FEATURE_MAPPED_DATA);
+    OpenArgs.pAllocator = hs->pAllocator;
+    hsNew->pAllocator = hs->pAllocator;
+    hsNew->pArgs = &OpenArgs;
+
+    // Load the main storage file and check whether it refers to the same build
+    BeginOpenPhase(Start);
+    dwErrCode = LoadStorageMainFile(hsNew, &OpenArgs, hs->szMainFile, hs->BuildFileType, dwFeatures);
     if(dwErrCode == ERROR_SUCCESS)
     {
-        dwErrCode = CascLoadEncryptionKeys(hs);
+        if(!IsSameBlob(hs->CdnBuildKey, hsNew->CdnBuildKey) || !IsSameBlob(hs->CdnConfigKey, hsNew->CdnConfigKey))
+        {
+            // Load the new build
+            dwErrCode = LoadStorageBuild(hsNew, hs->dwRootLocaleMask, NULL);
+            FreeStorageLoadData(hsNew);
+            EndOpenPhase(hsNew->OpenStats.Total, Start);
+
+            // The encryption keys belong to the storage object, not to the build.
+            // Move the keys that came with the new build to the storage
+            if(dwErrCode == ERROR_SUCCESS && !hs->KeyMap.AddKeys(hs->Arena, hsNew->KeyMap))
+                dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+            // Exchange the content. The locks only keep away the memory usage and the deferred
+            // and lazy loaders. The other lookups take no lock and the index refresh rewrites
+            // live entries, so the caller must not open or search files during the refresh
+            if(dwErrCode == ERROR_SUCCESS)
+            {
+                PCASC_BUILD_REF pOldBuildRef;
+
+                CascLock(hs->RootLock);
+                CascLock(hs->StorageLock);
+                SwapStorageBuild(hs, hsNew);
+
+                // The new storage object now holds the old content
+                if((pOldBuildRef = hsNew->pBuildRef) != NULL)
+                    CascInterlockedStorePointer((void **)(&pOldBuildRef->hsRetired), hsNew);
+                hsNew->pRetired = hs->pRetired;
+                hs->pRetired = hsNew;
+                CascUnlock(hs->StorageLock);
+                CascUnlock(hs->RootLock);
+                hsNew = NULL;
+
+                // Drop the storage's reference to the old build. If no file uses it, it is freed now
+                hs->ReleaseBuild(pOldBuildRef);
+                PtrRefreshFlags[0] |= CASC_REFRESH_BUILD;
+            }
+        }
     }
 
     // Cleanup and exit
-    FreeIndexFiles(hs);
-    hs->pArgs = NULL;
+    if(hsNew != NULL)
+    {
+        FreeStorageLoadData(hsNew);
+        hsNew->Release();
+    }
+    CASC_FREE(szRegion);
+    CASC_FREE(szBuildKey);
     return dwErrCode;
 }
 
@@ -1420,6 +2485,113 @@ static DWORD ParseOpenParams(LPTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs)
 //-----------------------------------------------------------------------------
 // Public functions
 
+// Creates the root handler that was not loaded during storage open due to CASC_FEATURE_DEFERRED_ROOT.
+// The first caller loads the ROOT manifest, other threads wait until it's done
+DWORD LoadDeferredRoot(TCascStorage * hs)
+{
+    CASC_MANIFEST_PREFETCH Root;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Lock the root handler. Can't use the storage lock, as reading files needs it
+    CascLock(hs->RootLock);
+
+    // Check whether another thread has loaded the ROOT meanwhile
+    if(hs->dwRootDeferred)
+    {
+        // Wait for the opens by CKey/EKey that are in progress and hold back the new ones
+        CascLockExclusive(hs->RootLoaderLock);
+
+        // The ROOT file is loaded the usual way
+        Root.bStarted = false;
+        dwErrCode = LoadRootHandler(hs, Root, hs->dwRootLocaleMask);
+
+        // Publish the root handler. On failure, the next lookup tries again
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            FinishKeyMaps(hs);
+            hs->TotalFiles = 0;
+
+            // Without lazy ENCODING, nothing needs the index files anymore
+            if(hs->EncodingData.pbData == NULL)
+                FreeIndexFiles(hs);
+            CascInterlockedStore(&hs->dwRootDeferred, 0);
+        }
+        else
+        {
+            delete hs->pRootHandler;
+            hs->pRootHandler = NULL;
+        }
+
+        // Let the opens by CKey/EKey continue
+        CascUnlockExclusive(hs->RootLoaderLock);
+    }
+
+    // Unlock the root handler
+    CascUnlock(hs->RootLock);
+    return dwErrCode;
+}
+
+// Finds or creates the CKey entry of a CKey with lazy ENCODING. Entries that were created
+// before are found without a lock. Otherwise, the map is searched again with the storage lock held,
+// as other threads may be inserting entries to it
+PCASC_CKEY_ENTRY LoadEncodingEntry_CKey(TCascStorage * hs, LPBYTE pbCKey, PDWORD PtrIndex)
+{
+    PFILE_CKEY_ENTRY pFileEntry;
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
+    // Most lookups are for entries that already exist. The index is only given by the locked search
+    if(PtrIndex == NULL && (pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObjectConcurrent(pbCKey)) != NULL)
+        return pCKeyEntry;
+
+    // Lock the storage to make the operation thread-safe
+    CascLock(hs->StorageLock);
+
+    // The entry may have been created before
+    if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyMap.FindObject(pbCKey, PtrIndex)) == NULL)
+    {
+        if((pFileEntry = FindEncodingEntry(hs, pbCKey)) != NULL)
+        {
+            if((pCKeyEntry = InsertEncodingEntry(hs, pFileEntry)) != NULL && PtrIndex != NULL)
+                hs->CKeyMap.FindObject(pbCKey, PtrIndex);
+        }
+    }
+
+    // Unlock the storage
+    CascUnlock(hs->StorageLock);
+    return pCKeyEntry;
+}
+
+// Finds or creates the CKey entry of an EKey with lazy ENCODING
+PCASC_CKEY_ENTRY LoadEncodingEntry_EKey(TCascStorage * hs, LPBYTE pbEKey, PDWORD PtrIndex)
+{
+    PFILE_CKEY_ENTRY pFileEntry;
+    PCASC_CKEY_ENTRY pCKeyEntry;
+
+    // Most lookups are for entries that already exist. The index is only given by the locked search
+    if(PtrIndex == NULL && (pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObjectConcurrent(pbEKey)) != NULL)
+        return pCKeyEntry;
+
+    // Lock the storage to make the operation thread-safe
+    CascLock(hs->StorageLock);
+
+    // The entry may have been created before. If not, only go through
+    // the CKey pages if the EKey table says that the EKey is there
+    if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex)) == NULL && IsEncodingEKey(hs, pbEKey))
+    {
+        if((pFileEntry = FindEncodingEntry_EKey(hs, pbEKey)) != NULL)
+        {
+            // The CKey may already have an entry. Then the EKey was not the first one of the ENCODING entry
+            if(hs->CKeyMap.FindObject(pFileEntry->CKey) == NULL)
+                InsertEncodingEntry(hs, pFileEntry);
+            pCKeyEntry = (PCASC_CKEY_ENTRY)hs->EKeyMap.FindObject(pbEKey, PtrIndex);
+        }
+    }
+
+    // Unlock the storage
+    CascUnlock(hs->StorageLock);
+    return pCKeyEntry;
+}
+
 bool WINAPI CascOpenStorageEx(LPCTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs, bool bOnlineStorage, HANDLE * phStorage)
 {
     CASC_OPEN_STORAGE_ARGS LocalArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
@@ -1473,6 +2645,10 @@ bool WINAPI CascOpenStorageEx(LPCTSTR szParams, PCASC_OPEN_STORAGE_ARGS pArgs, b
             CASC_BUILD_FILE BuildFile = {NULL};
             DWORD dwFeatures = (pArgs->dwFlags & CASC_FEATURE_ALLOW_DOWNLOAD);
 
+            // The storage content is allocated by the storage allocator, if any
+            ExtractVersionedArgument(pArgs, FIELD_OFFSET(CASC_OPEN_STORAGE_ARGS, pAllocator), &hs->pAllocator);
+            CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+
             // Check for one of the supported main files (.build.info, .build.db, versions)
             if((dwErrCode = CheckCascBuildFileExact(BuildFile, pArgs->szLocalPath)) == ERROR_SUCCESS)
             {
@@ -1564,6 +2740,9 @@ bool WINAPI CascGetStorageInfo(
         return false;
     }
 
+    // Some info classes may need to load the deferred root
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+
     // Differentiate between info classes
     switch(InfoClass)
     {
@@ -1572,13 +2751,23 @@ bool WINAPI CascGetStorageInfo(
             break;
 
         case CascStorageTotalFileCount:
+            // The CKey array may be changed by the loader of the deferred ROOT or by lazy ENCODING
+            CascLock(hs->RootLock);
+            CascLock(hs->StorageLock);
             if(hs->TotalFiles == 0)
                 hs->TotalFiles = GetStorageTotalFileCount(hs);
             dwInfoValue = (DWORD)hs->TotalFiles;
+            CascUnlock(hs->StorageLock);
+            CascUnlock(hs->RootLock);
             break;
 
         case CascStorageFeatures:
-            dwInfoValue = hs->dwFeatures | hs->pRootHandler->GetFeatures();
+            // The loader of the deferred ROOT may be changing the features
+            CascLock(hs->RootLock);
+            dwInfoValue = hs->dwFeatures;
+            if(hs->dwRootDeferred == 0)
+                dwInfoValue |= hs->pRootHandler->GetFeatures();
+            CascUnlock(hs->RootLock);
             break;
 
         case CascStorageInstalledLocales:
@@ -1594,6 +2783,15 @@ bool WINAPI CascGetStorageInfo(
         case CascStoragePathProduct:
             return GetStoragePathProduct(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
 
+        case CascStorageOpenStats:
+            return GetStorageOpenStats(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
+
+        case CascStorageMemoryUsage:
+            return GetStorageMemoryUsage(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
+
+        case CascStorageFrameCache:
+            return GetStorageFrameCacheStats(hs, pvStorageInfo, cbStorageInfo, pcbLengthNeeded);
+
         default:
             SetCascError(ERROR_INVALID_PARAMETER);
             return false;
@@ -1625,3 +2823,115 @@ bool WINAPI CascCloseStorage(HANDLE hStorage)
     hs->Release();
     return true;
 }
+
+//
+// Sets the maximum size of the decoded frames kept in the storage-wide frame cache.
+// The frames are shared by all files opened from the storage, so hot files
+// are only decoded once. Zero disables the cache. The cache is disabled by default.
+//
+bool WINAPI CascSetFrameCacheSize(HANDLE hStorage, size_t cbCacheSize)
+{
+    TCascStorage * hs;
+
+    // Verify the storage handle
+    hs = TCascStorage::IsValid(hStorage);
+    if(hs == NULL)
+    {
+        SetCascError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
+    hs->FrameCache.SetSize(cbCacheSize);
+    return true;
+}
+
+//
+// Sets the memory budget of the cache of encoded data read from the "data.###" files.
+// Small reads (e.g. single frames or BLTE headers) are then served from 64 KB blocks kept
+// in memory, so repeated partial reads of the same files don't go to the disk.
+// Zero disables the cache, which is the default.
+//
+bool WINAPI CascSetBlockCacheSize(HANDLE hStorage, size_t cbCacheSize)
+{
+    TCascStorage * hs;
+
+    // Verify the storage handle
+    hs = TCascStorage::IsValid(hStorage);
+    if(hs == NULL || hs->pBlockCache == NULL)
+    {
+        SetCascError(ERROR_INVALID_PARAMETER);
+        return false;
+    }
+
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+    return FileStream_SetCacheSize(hs->pBlockCache, cbCacheSize);
+}
+
+//
+// Checks whether the storage has been updated since it was opened (e.g. by the game launcher)
+// and loads the changes:
+//
+//  - If the main storage file refers to a new build, the whole storage content is reloaded.
+//    This is a full load of the new build and costs about as much as opening the storage.
+//    The old content is freed when the last file that was opened before the refresh is closed
+//  - Otherwise, the index files that have changed are loaded and the file locations are updated
+//
+// The function must not be called while other threads open, look up or search files in the storage.
+// The lookups (except the lazy ENCODING ones) take no lock, and the index refresh rewrites
+// the location of entries that are in use. Handles of files that were opened before remain valid.
+//
+bool WINAPI CascRefreshStorage(HANDLE hStorage, PDWORD PtrRefreshFlags)
+{
+    TCascStorage * hs;
+    DWORD dwRefreshFlags = 0;
+    DWORD dwErrCode;
+    bool bChanged = false;
+
+    // Verify the storage handle
+    hs = TCascStorage::IsValid(hStorage);
+    if(hs == NULL)
+    {
+        SetCascError(ERROR_INVALID_HANDLE);
+        return false;
+    }
+
+    // Online storages are always up-to-date
+    if(hs->dwFeatures & CASC_FEATURE_ONLINE)
+    {
+        SetCascError(ERROR_NOT_SUPPORTED);
+        return false;
+    }
+
+    // Check for a new build first
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->pAllocator);
+    dwErrCode = RefreshStorageBuild(hs, &dwRefreshFlags);
+
+    // If the build is the same, check for new index files
+    if(dwErrCode == ERROR_SUCCESS && (dwRefreshFlags & CASC_REFRESH_BUILD) == 0)
+    {
+        CascLock(hs->RootLock);
+        CascLock(hs->StorageLock);
+        dwErrCode = RefreshIndexFiles(hs, &bChanged);
+        CascUnlock(hs->StorageLock);
+        CascUnlock(hs->RootLock);
+
+        if(bChanged)
+            dwRefreshFlags |= CASC_REFRESH_INDEX_FILES;
+    }
+
+    // The data files may have been rewritten, so the open streams and their cached blocks can be stale.
+    // The cached blocks of the unchanged data files stay valid
+    if(dwErrCode == ERROR_SUCCESS && dwRefreshFlags != 0)
+    {
+        CascLock(hs->StorageLock);
+        dwErrCode = RetireChangedDataFiles(hs);
+        CascUnlock(hs->StorageLock);
+    }
+
+    // Give the flags to the caller
+    if(PtrRefreshFlags != NULL)
+        PtrRefreshFlags[0] = dwRefreshFlags;
+    if(dwErrCode != ERROR_SUCCESS)
+        SetCascError(dwErrCode);
+    return (dwErrCode == ERROR_SUCCESS);
+}
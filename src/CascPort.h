@@ -222,6 +222,7 @@
   #define stat64  stat
   #define fstat64 fstat
   #define lseek64 lseek
+  #define pread64 pread
   #define ftruncate64 ftruncate
   #define off64_t off_t
   #define O_LARGEFILE 0
@@ -350,6 +351,100 @@ inline DWORD CascInterlockedDecrement(DWORD * PtrValue)
 #endif
 }
 
+inline DWORD CascInterlockedExchange(DWORD * PtrValue, DWORD NewValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return (DWORD)InterlockedExchange((LONG *)(PtrValue), (LONG)(NewValue));
+#elif defined(__GNUC__)
+    return __atomic_exchange_n(PtrValue, NewValue, __ATOMIC_SEQ_CST);
+#else
+    DWORD OldValue = *PtrValue;
+    *PtrValue = NewValue;
+    return OldValue;
+#endif
+}
+
+// Reads a value stored by another thread with CascInterlockedStore. Everything
+// that the other thread has written before the store is visible after the load
+inline DWORD CascInterlockedLoad(DWORD * PtrValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return (DWORD)InterlockedCompareExchange((LONG *)(PtrValue), 0, 0);
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *(volatile DWORD *)(PtrValue);
+#endif
+}
+
+inline void CascInterlockedStore(DWORD * PtrValue, DWORD NewValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    InterlockedExchange((LONG *)(PtrValue), (LONG)(NewValue));
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, NewValue, __ATOMIC_RELEASE);
+#else
+    *(volatile DWORD *)(PtrValue) = NewValue;
+#endif
+}
+
+inline ULONGLONG CascInterlockedAdd64(ULONGLONG * PtrValue, ULONGLONG Addend)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return (ULONGLONG)InterlockedExchangeAdd64((LONGLONG *)(PtrValue), (LONGLONG)(Addend)) + Addend;
+#elif defined(__GNUC__)
+    return __sync_add_and_fetch(PtrValue, Addend);
+#else
+    return (*PtrValue) += Addend;
+#endif
+}
+
+inline ULONGLONG CascInterlockedLoad64(ULONGLONG * PtrValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return (ULONGLONG)InterlockedCompareExchange64((LONGLONG *)(PtrValue), 0, 0);
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *(volatile ULONGLONG *)(PtrValue);
+#endif
+}
+
+inline void CascInterlockedStore64(ULONGLONG * PtrValue, ULONGLONG NewValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    InterlockedExchange64((LONGLONG *)(PtrValue), (LONGLONG)(NewValue));
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, NewValue, __ATOMIC_RELEASE);
+#else
+    *(volatile ULONGLONG *)(PtrValue) = NewValue;
+#endif
+}
+
+// Reads a pointer stored by another thread with CascInterlockedStorePointer. Everything
+// that the other thread has written before the store is visible after the load
+inline void * CascInterlockedLoadPointer(void ** PtrValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return InterlockedCompareExchangePointer(PtrValue, NULL, NULL);
+#elif defined(__GNUC__)
+    return __atomic_load_n(PtrValue, __ATOMIC_ACQUIRE);
+#else
+    return *(void * volatile *)(PtrValue);
+#endif
+}
+
+inline void CascInterlockedStorePointer(void ** PtrValue, void * NewValue)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    InterlockedExchangePointer(PtrValue, NewValue);
+#elif defined(__GNUC__)
+    __atomic_store_n(PtrValue, NewValue, __ATOMIC_RELEASE);
+#else
+    *(void * volatile *)(PtrValue) = NewValue;
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // Lock functions
 
@@ -361,6 +456,15 @@ typedef RTL_CRITICAL_SECTION CASC_LOCK;
 #define CascLock(Lock)          EnterCriticalSection(&Lock);
 #define CascUnlock(Lock)        LeaveCriticalSection(&Lock);
 
+// Reader/writer lock. Any number of threads may hold it shared, or one thread exclusive
+typedef SRWLOCK CASC_RWLOCK;
+#define CascInitRWLock(Lock)        InitializeSRWLock(&Lock);
+#define CascFreeRWLock(Lock)        /* Nothing to free */
+#define CascLockShared(Lock)        AcquireSRWLockShared(&Lock);
+#define CascUnlockShared(Lock)      ReleaseSRWLockShared(&Lock);
+#define CascLockExclusive(Lock)     AcquireSRWLockExclusive(&Lock);
+#define CascUnlockExclusive(Lock)   ReleaseSRWLockExclusive(&Lock);
+
 #else
 
 typedef pthread_mutex_t CASC_LOCK;
@@ -369,6 +473,14 @@ typedef pthread_mutex_t CASC_LOCK;
 #define CascLock(Lock)          pthread_mutex_lock(&Lock);
 #define CascUnlock(Lock)        pthread_mutex_unlock(&Lock);
 
+typedef pthread_rwlock_t CASC_RWLOCK;
+#define CascInitRWLock(Lock)        pthread_rwlock_init(&Lock, NULL);
+#define CascFreeRWLock(Lock)        pthread_rwlock_destroy(&Lock);
+#define CascLockShared(Lock)        pthread_rwlock_rdlock(&Lock);
+#define CascUnlockShared(Lock)      pthread_rwlock_unlock(&Lock);
+#define CascLockExclusive(Lock)     pthread_rwlock_wrlock(&Lock);
+#define CascUnlockExclusive(Lock)   pthread_rwlock_unlock(&Lock);
+
 #endif
 
 //-----------------------------------------------------------------------------
@@ -12,6 +12,31 @@
 #include "CascLib.h"
 #include "CascCommon.h"
 
+//-----------------------------------------------------------------------------
+// Local structures
+
+#define CASC_PARALLEL_DECODE_MIN_SIZE   0x400000    // Spans with at least this much data are decoded by multiple threads
+#define CASC_PARALLEL_DECODE_PER_THREAD 0x100000    // Minimum amount of decoded data per thread
+
+// One frame for the parallel decoder
+struct CASC_FRAME_SLICE
+{
+    LPBYTE pbEncoded;                               // Encoded frame data
+    LPBYTE pbDecoded;                               // Slice of the user buffer for the decoded frame
+    DWORD dwErrCode;                                // Result of the decoding
+};
+
+// Parallel decoding of the frames of one file span
+struct CASC_FRAME_DECODER
+{
+    TCascFile * hf;                                 // The file being read
+    PCASC_CKEY_ENTRY pCKeyEntry;                    // CKey entry of the span
+    PCASC_FILE_FRAME pFrames;                       // The first frame to decode
+    CASC_FRAME_SLICE * pSlices;                     // One slice for each frame
+    DWORD FirstFrame;                               // Index of the first frame to decode
+    bool bUseFrameCache;                            // If true, the frames are shared through the frame cache
+};
+
 //-----------------------------------------------------------------------------
 // Local functions
 
@@ -51,8 +76,16 @@ static DWORD OpenDataStream(TCascFile * hf, PCASC_FILE_SPAN pFileSpan, PCASC_CKE
             CASC_PATH<TCHAR> DataFile(hs->szIndexPath, szPlainName, NULL);
 
             // Open the data stream with read+write sharing to prevent Battle.net agent
-            // detecting a corruption and redownloading the entire package
-            pStream = FileStream_OpenFile(DataFile, STREAM_FLAG_READ_ONLY | STREAM_FLAG_WRITE_SHARE | STREAM_PROVIDER_FLAT | STREAM_FLAG_FILL_MISSING | BASE_PROVIDER_FILE);
+            // detecting a corruption and redownloading the entire package.
+            // If required, try to map the data file first
+            if(hs->dwFeatures & CASC_FEATURE_MAPPED_DATA)
+                pStream = FileStream_OpenFile(DataFile, STREAM_FLAG_READ_ONLY | STREAM_FLAG_WRITE_SHARE | STREAM_PROVIDER_FLAT | STREAM_FLAG_FILL_MISSING | BASE_PROVIDER_MAP);
+            if(pStream == NULL)
+            {
+                // Fall back to reading the file. Unlike the mapping, this goes through the block cache
+                pStream = FileStream_OpenFile(DataFile, STREAM_FLAG_READ_ONLY | STREAM_FLAG_WRITE_SHARE | STREAM_PROVIDER_FLAT | STREAM_FLAG_FILL_MISSING | BASE_PROVIDER_FILE);
+                FileStream_SetCache(pStream, hs->pBlockCache);
+            }
             hs->DataFiles[dwArchiveIndex] = pStream;
         }
 
@@ -459,6 +492,16 @@ static DWORD LoadEncodedHeaderAndSpanFrames(PCASC_FILE_SPAN pFileSpan, PCASC_CKE
     return dwErrCode;
 }
 
+// Updates the memory held by frames and file caches of the file. See CascStorageMemoryUsage
+static void AdjustFileCacheBytes(TCascFile * hf, ULONGLONG cbRemoved, ULONGLONG cbAdded)
+{
+    if(hf->hs != NULL && cbRemoved != cbAdded)
+    {
+        CascInterlockedAdd64(&hf->hs->FileCacheBytes, cbAdded - cbRemoved);
+        hf->CacheBytes = hf->CacheBytes + cbAdded - cbRemoved;
+    }
+}
+
 static DWORD LoadSpanFrames(TCascFile * hf, PCASC_FILE_SPAN pFileSpan, PCASC_CKEY_ENTRY pCKeyEntry)
 {
     DWORD dwErrCode = ERROR_SUCCESS;
@@ -475,7 +518,10 @@ static DWORD LoadSpanFrames(TCascFile * hf, PCASC_FILE_SPAN pFileSpan, PCASC_CKE
     }
 
     // Make sure we have header area loaded
-    return LoadEncodedHeaderAndSpanFrames(pFileSpan, pCKeyEntry);
+    dwErrCode = LoadEncodedHeaderAndSpanFrames(pFileSpan, pCKeyEntry);
+    if(pFileSpan->pFrames != NULL)
+        AdjustFileCacheBytes(hf, 0, (ULONGLONG)pFileSpan->FrameCount * sizeof(CASC_FILE_FRAME));
+    return dwErrCode;
 }
 
 // Loads all file spans to memory
@@ -665,6 +711,18 @@ static DWORD DecodeFileFrame(
     return dwErrCode;
 }
 
+// Returns true if the decoded frames of the span can be shared through the storage frame cache.
+// Plain data are not worth caching. Handles that verify the data or zero the encrypted parts
+// must always decode the frame by themselves
+static bool IsFrameCacheUsable(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry)
+{
+    return (hf->hs != NULL &&
+            hf->hs->FrameCache.IsEnabled() &&
+            hf->bVerifyIntegrity == false &&
+            hf->bOvercomeEncrypted == false &&
+            (pCKeyEntry->Flags & CASC_CE_PLAIN_DATA) == 0);
+}
+
 static bool GetFileFullInfo(TCascFile * hf, void * pvFileInfo, size_t cbFileInfo, size_t * pcbLengthNeeded)
 {
     PCASC_FILE_FULL_INFO pFileInfo;
@@ -696,14 +754,15 @@ static bool GetFileFullInfo(TCascFile * hf, void * pvFileInfo, size_t cbFileInfo
         pFileInfo->StorageOffset = pCKeyEntry->StorageOffset;
         pFileInfo->SegmentOffset = hf->pFileSpan->ArchiveOffs;
         pFileInfo->FileNameHash = 0;
-        pFileInfo->TagBitMask = pCKeyEntry->TagBitMask;
+        pFileInfo->TagBitMask = hf->GetBuildStorage()->GetTagBitMask(pCKeyEntry);
         pFileInfo->ContentSize = hf->ContentSize;
         pFileInfo->EncodedSize = hf->EncodedSize;
         pFileInfo->SegmentIndex = hf->pFileSpan->ArchiveIndex;
         pFileInfo->SpanCount = hf->SpanCount;
 
-        // Supply the root-specific information
-        hs->pRootHandler->GetInfo(pCKeyEntry, pFileInfo);
+        // Supply the root-specific information. Not available until the deferred ROOT is loaded
+        if(hs->IsRootDeferred() == false)
+            hs->pRootHandler->GetInfo(pCKeyEntry, pFileInfo);
     }
 
     return (pFileInfo != NULL);
@@ -777,6 +836,97 @@ static DWORD ReadFile_Cache(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG StartOffs
     return 0;
 }
 
+// Decodes one frame of a span that is read as a whole, unless the frame cache has it
+static DWORD DecodeSpanFrame(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry, PCASC_FILE_FRAME pFileFrame, LPBYTE pbEncoded, LPBYTE pbDecoded, DWORD FrameIndex, bool bUseFrameCache, bool bLookupCache)
+{
+    DWORD dwErrCode;
+
+    // Other handles may have decoded the frame already
+    if(bUseFrameCache && bLookupCache && hf->hs->FrameCache.Get(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize))
+        return ERROR_SUCCESS;
+
+    // Decode the frame and share it with other handles
+    dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncoded, pbDecoded, FrameIndex);
+    if(dwErrCode == ERROR_SUCCESS && bUseFrameCache)
+        hf->hs->FrameCache.Put(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize);
+    return dwErrCode;
+}
+
+// Decodes one frame of the parallel decoder. Called on a worker thread
+static DWORD DecodeFrameSlice(void * pvContext, size_t nItemIndex)
+{
+    CASC_FRAME_DECODER * pDecoder = (CASC_FRAME_DECODER *)pvContext;
+    CASC_FRAME_SLICE & Slice = pDecoder->pSlices[nItemIndex];
+
+    // The first frame was already looked up in the frame cache by the caller.
+    // An error stops the loop; the results are evaluated in the order of the frames
+    Slice.dwErrCode = DecodeSpanFrame(pDecoder->hf,
+                                      pDecoder->pCKeyEntry,
+                                      pDecoder->pFrames + nItemIndex,
+                                      Slice.pbEncoded,
+                                      Slice.pbDecoded,
+                                      pDecoder->FirstFrame + (DWORD)nItemIndex,
+                                      pDecoder->bUseFrameCache,
+                                      (nItemIndex != 0));
+    return Slice.dwErrCode;
+}
+
+// Decodes the frames of a large span on multiple threads. Each frame is decoded directly
+// to its slice of the user buffer. On success, the buffer pointer is moved past the frames
+// that were decoded before the first failed one, and dwErrCode receives the error code
+// of that frame. Returns false if the frames were not decoded
+static bool DecodeSpanFramesParallel(TCascFile * hf, PCASC_CKEY_ENTRY pCKeyEntry, PCASC_FILE_SPAN pFileSpan, DWORD FrameIndex, LPBYTE pbEncoded, LPBYTE & pbBuffer, bool bUseFrameCache, DWORD & dwErrCode)
+{
+    CASC_FRAME_DECODER Decoder;
+    PCASC_FILE_FRAME pFileFrame = pFileSpan->pFrames + FrameIndex;
+    ULONGLONG DecodedSize = pFileSpan->EndOffset - pFileFrame->StartOffset;
+    DWORD FrameCount = pFileSpan->FrameCount - FrameIndex;
+    size_t nMaxThreads;
+
+    // Small spans are not worth handing over to other threads
+    if(FrameCount < 2 || DecodedSize < CASC_PARALLEL_DECODE_MIN_SIZE || CascGetProcessorCount() < 2)
+        return false;
+
+    // Allocate one slice for each frame
+    if((Decoder.pSlices = CASC_ALLOC<CASC_FRAME_SLICE>(FrameCount)) == NULL)
+        return false;
+    Decoder.hf = hf;
+    Decoder.pCKeyEntry = pCKeyEntry;
+    Decoder.pFrames = pFileFrame;
+    Decoder.FirstFrame = FrameIndex;
+    Decoder.bUseFrameCache = bUseFrameCache;
+
+    // Find out where each frame is in the encoded buffer and in the user buffer
+    for(DWORD i = 0; i < FrameCount; i++)
+    {
+        Decoder.pSlices[i].pbEncoded = pbEncoded;
+        Decoder.pSlices[i].pbDecoded = pbBuffer;
+        Decoder.pSlices[i].dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        pbEncoded += pFileFrame[i].EncodedSize;
+        pbBuffer += pFileFrame[i].ContentSize;
+    }
+    pbBuffer = Decoder.pSlices[0].pbDecoded;
+
+    // Decode the frames. Each thread gets at least CASC_PARALLEL_DECODE_PER_THREAD bytes of data.
+    // The threads come from the worker pool and are not created for each read. If other reads
+    // keep them busy, the calling thread decodes the frames alone until some of them are free
+    nMaxThreads = (size_t)CASCLIB_MIN(DecodedSize / CASC_PARALLEL_DECODE_PER_THREAD, CascGetProcessorCount());
+    CascParallelFor(DecodeFrameSlice, &Decoder, FrameCount, nMaxThreads);
+
+    // Give the data decoded before the first failure. The worker threads have their own
+    // last error, so the error code of the failed frame is given to the calling thread
+    dwErrCode = ERROR_SUCCESS;
+    for(DWORD i = 0; i < FrameCount; i++)
+    {
+        if((dwErrCode = Decoder.pSlices[i].dwErrCode) != ERROR_SUCCESS)
+            break;
+        pbBuffer += pFileFrame[i].ContentSize;
+    }
+
+    CASC_FREE(Decoder.pSlices);
+    return true;
+}
+
 // No cache at all. The entire file will be read directly to the user buffer
 static DWORD ReadFile_WholeFile(TCascFile * hf, LPBYTE pbBuffer)
 {
@@ -785,40 +935,81 @@ static DWORD ReadFile_WholeFile(TCascFile * hf, LPBYTE pbBuffer)
     LPBYTE pbSaveBuffer = pbBuffer;
     LPBYTE pbEncoded;
     LPBYTE pbEncodedPtr;
-    DWORD dwErrCode;
+    DWORD dwErrCode = ERROR_SUCCESS;
 
     for(DWORD SpanIndex = 0; SpanIndex < hf->SpanCount; SpanIndex++, pCKeyEntry++, pFileSpan++)
     {
+        PCASC_FILE_FRAME pFileFrame = pFileSpan->pFrames;
         ULONGLONG ByteOffset = pFileSpan->ArchiveOffs + pFileSpan->HeaderSize;
         DWORD EncodedSize = pCKeyEntry->EncodedSize - pFileSpan->HeaderSize;
+        DWORD FrameIndex = 0;
+        bool bUseFrameCache = IsFrameCacheUsable(hf, pCKeyEntry);
 
-        // Allocate the buffer for the entire encoded span
-        pbEncodedPtr = pbEncoded = CASC_ALLOC<BYTE>(EncodedSize);
-        if(pbEncoded == NULL)
+        // Take the leading frames from the frame cache. If all of them are there,
+        // we don't need to read the encoded span at all
+        if(bUseFrameCache)
         {
-            SetCascError(ERROR_NOT_ENOUGH_MEMORY);
-            return 0;
+            while(FrameIndex < pFileSpan->FrameCount && hf->hs->FrameCache.Get(pCKeyEntry->EKey, FrameIndex, pbBuffer, pFileFrame->ContentSize))
+            {
+                pbBuffer += pFileFrame->ContentSize;
+                pFileFrame++;
+                FrameIndex++;
+            }
+
+            if(FrameIndex >= pFileSpan->FrameCount)
+                continue;
         }
 
-        // Load the encoded buffer
-        if(FileStream_Read(pFileSpan->pStream, &ByteOffset, pbEncoded, EncodedSize))
+        // If the data file is mapped, the frames are decoded directly from the mapping.
+        // Otherwise, we allocate the buffer for the entire encoded span and load it
+        pbEncoded = NULL;
+        pbEncodedPtr = FileStream_GetMappedRange(pFileSpan->pStream, ByteOffset, EncodedSize);
+        if(pbEncodedPtr == NULL)
         {
-            PCASC_FILE_FRAME pFileFrame = pFileSpan->pFrames;
-
-            for(DWORD FrameIndex = 0; FrameIndex < pFileSpan->FrameCount; FrameIndex++, pFileFrame++)
+            pbEncodedPtr = pbEncoded = CASC_ALLOC<BYTE>(EncodedSize);
+            if(pbEncoded == NULL)
             {
-                // Decode the file frame
-                dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbBuffer, FrameIndex);
-                if(dwErrCode != ERROR_SUCCESS)
-                    break;
+                SetCascError(ERROR_NOT_ENOUGH_MEMORY);
+                return 0;
+            }
 
-                // Move pointers
-                pbEncodedPtr += pFileFrame->EncodedSize;
-                pbBuffer += pFileFrame->ContentSize;
+            // Load the encoded buffer
+            if(!FileStream_Read(pFileSpan->pStream, &ByteOffset, pbEncoded, EncodedSize))
+                pbEncodedPtr = NULL;
+        }
+
+        // Decode the frames
+        if(pbEncodedPtr != NULL)
+        {
+            // Skip the frames that were taken from the cache
+            for(PCASC_FILE_FRAME pCachedFrame = pFileSpan->pFrames; pCachedFrame < pFileFrame; pCachedFrame++)
+                pbEncodedPtr += pCachedFrame->EncodedSize;
+
+            // Large spans are decoded by multiple threads, the others frame by frame
+            if(!DecodeSpanFramesParallel(hf, pCKeyEntry, pFileSpan, FrameIndex, pbEncodedPtr, pbBuffer, bUseFrameCache, dwErrCode))
+            {
+                for(DWORD FirstMissing = FrameIndex; FrameIndex < pFileSpan->FrameCount; FrameIndex++, pFileFrame++)
+                {
+                    // Decode the file frame, unless it's in the cache. The first missing frame was already looked up
+                    dwErrCode = DecodeSpanFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbBuffer, FrameIndex, bUseFrameCache, (FrameIndex != FirstMissing));
+                    if(dwErrCode != ERROR_SUCCESS)
+                        break;
+
+                    // Move pointers
+                    pbEncodedPtr += pFileFrame->EncodedSize;
+                    pbBuffer += pFileFrame->ContentSize;
+                }
             }
         }
 
         CASC_FREE(pbEncoded);
+
+        // The data after a failed frame would land at a wrong position
+        if(dwErrCode != ERROR_SUCCESS)
+        {
+            SetCascError(dwErrCode);
+            break;
+        }
     }
 
     // Give the amount of bytes read
@@ -875,34 +1066,63 @@ static DWORD ReadFile_FrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG Sta
                         pbDecoded = pbBuffer;
                     }
 
-                    // Allocate the encoded frame
-                    if((pbEncoded = CASC_ALLOC<BYTE>(pFileFrame->EncodedSize)) == NULL)
-                    {
-                        CASC_FREE(pbDecoded);
-                        SetCascError(ERROR_NOT_ENOUGH_MEMORY);
-                        return 0;
-                    }
-
-                    // Load the frame to the encoded buffer
-                    if(FileStream_Read(pFileSpan->pStream, &pFileFrame->DataFileOffset, pbEncoded, pFileFrame->EncodedSize))
+                    // Other handles may have decoded the frame already
+                    if(IsFrameCacheUsable(hf, pCKeyEntry) && hf->hs->FrameCache.Get(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize))
                     {
                         ULONGLONG EndOfCopy = CASCLIB_MIN(pFileFrame->EndOffset, EndOffset);
                         DWORD dwBytesToCopy = (DWORD)(EndOfCopy - StartOffset);
 
-                        // Decode the frame
-                        dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncoded, pbDecoded, FrameIndex);
-                        if(dwErrCode == ERROR_SUCCESS)
+                        // Copy the data
+                        if(pbDecoded != pbBuffer)
+                            memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
+                        StartOffset += dwBytesToCopy;
+                        pbBuffer += dwBytesToCopy;
+                    }
+                    else
+                    {
+                        // If the data file is mapped, decode the frame directly from the mapping
+                        LPBYTE pbEncodedPtr = FileStream_GetMappedRange(pFileSpan->pStream, pFileFrame->DataFileOffset, pFileFrame->EncodedSize);
+
+                        if(pbEncodedPtr == NULL)
                         {
-                            // Copy the data
-                            if(pbDecoded != pbBuffer)
-                                memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
-                            StartOffset += dwBytesToCopy;
-                            pbBuffer += dwBytesToCopy;
+                            // Allocate the encoded frame
+                            if((pbEncoded = CASC_ALLOC<BYTE>(pFileFrame->EncodedSize)) == NULL)
+                            {
+                                if(bNeedFreeDecoded)
+                                    CASC_FREE(pbDecoded);
+                                SetCascError(ERROR_NOT_ENOUGH_MEMORY);
+                                return 0;
+                            }
+
+                            // Load the frame to the encoded buffer
+                            if(FileStream_Read(pFileSpan->pStream, &pFileFrame->DataFileOffset, pbEncoded, pFileFrame->EncodedSize))
+                                pbEncodedPtr = pbEncoded;
                         }
-                    }
 
-                    // Free the encoded buffer
-                    CASC_FREE(pbEncoded);
+                        if(pbEncodedPtr != NULL)
+                        {
+                            ULONGLONG EndOfCopy = CASCLIB_MIN(pFileFrame->EndOffset, EndOffset);
+                            DWORD dwBytesToCopy = (DWORD)(EndOfCopy - StartOffset);
+
+                            // Decode the frame
+                            dwErrCode = DecodeFileFrame(hf, pCKeyEntry, pFileFrame, pbEncodedPtr, pbDecoded, FrameIndex);
+                            if(dwErrCode == ERROR_SUCCESS)
+                            {
+                                // Share the decoded frame with other handles
+                                if(IsFrameCacheUsable(hf, pCKeyEntry))
+                                    hf->hs->FrameCache.Put(pCKeyEntry->EKey, FrameIndex, pbDecoded, pFileFrame->ContentSize);
+
+                                // Copy the data
+                                if(pbDecoded != pbBuffer)
+                                    memcpy(pbBuffer, pbDecoded + (DWORD)(StartOffset - pFileFrame->StartOffset), dwBytesToCopy);
+                                StartOffset += dwBytesToCopy;
+                                pbBuffer += dwBytesToCopy;
+                            }
+                        }
+
+                        // Free the encoded buffer, if any
+                        CASC_FREE(pbEncoded);
+                    }
 
                     // If we are at the end of the read area, break all loops
                     if(dwErrCode != ERROR_SUCCESS || StartOffset >= EndOffset)
@@ -921,6 +1141,7 @@ static DWORD ReadFile_FrameCached(TCascFile * hf, LPBYTE pbBuffer, ULONGLONG Sta
         // If there is some data left in the frame, we set it as cache
         if(pFileFrame != NULL && pbDecoded != NULL && EndOffset < pFileFrame->EndOffset)
         {
+            AdjustFileCacheBytes(hf, (hf->pbFileCache != NULL) ? (hf->FileCacheEnd - hf->FileCacheStart) : 0, pFileFrame->ContentSize);
             CASC_FREE(hf->pbFileCache);
 
             hf->FileCacheStart = pFileFrame->StartOffset;
@@ -975,6 +1196,9 @@ bool WINAPI CascGetFileInfo(HANDLE hFile, CASC_FILE_INFO_CLASS InfoClass, void *
         return false;
     }
 
+    // Frames and caches of the file belong to the storage
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hf->hs->pAllocator);
+
     // Differentiate between info classes
     switch(InfoClass)
     {
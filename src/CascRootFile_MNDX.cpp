@@ -2603,19 +2603,12 @@ struct TMndxHandler
 
     ~TMndxHandler()
     {
-        PMNDX_PACKAGE pPackage;
-        size_t i;
-
-        for(i = 0; i < MAR_COUNT; i++)
+        for(size_t i = 0; i < MAR_COUNT; i++)
             delete MndxInfo.MarFiles[i];
         CASC_FREE(FileNameIndexToCKeyIndex);
         pCKeyEntries = NULL;
 
-        for(i = 0; i < Packages.ItemCount(); i++)
-        {
-            pPackage = (PMNDX_PACKAGE)Packages.ItemAt(i);
-            CASC_FREE(pPackage->szFileName);
-        }
+        // The package names are freed together with the arena
         Packages.Free();
     }
 
@@ -2670,14 +2663,12 @@ struct TMndxHandler
                 // The package mut not be initialized yet
                 assert(pPackage->szFileName == NULL);
 
-                // Allocate space for the file name
-                pPackage->szFileName = CASC_ALLOC<char>(Search.cchFoundPath + 1);
+                // Copy the file name to the arena
+                pPackage->szFileName = PackageNames.NewStr(Search.szFoundPath, Search.cchFoundPath);
                 if(pPackage->szFileName == NULL)
                     return ERROR_NOT_ENOUGH_MEMORY;
 
                 // Fill the package structure
-                memcpy(pPackage->szFileName, Search.szFoundPath, Search.cchFoundPath);
-                pPackage->szFileName[Search.cchFoundPath] = 0;
                 pPackage->nLength = Search.cchFoundPath;
                 pPackage->nIndex = Search.nIndex;
             }
@@ -2916,6 +2907,7 @@ struct TMndxHandler
     PMNDX_CKEY_ENTRY * FileNameIndexToCKeyIndex;
     PMNDX_CKEY_ENTRY pCKeyEntries;
     CASC_ARRAY Packages;                        // Linear list of present packages
+    CASC_ARENA PackageNames;                    // Names of the packages
 };
 
 //-----------------------------------------------------------------------------
@@ -303,6 +303,7 @@ struct TRootHandler_OW : public TFileTreeRoot
     DWORD Load(TCascStorage * hs, CASC_CSV & Csv, size_t nFileNameIndex, size_t nCKeyIndex)
     {
         PCASC_CKEY_ENTRY pCKeyEntry;
+        CASC_PATH_CACHE PathCache;
         size_t nFileCount;
         DWORD dwErrCode = ERROR_SUCCESS;
         BYTE CKey[MD5_HASH_SIZE];
@@ -333,6 +334,7 @@ struct TRootHandler_OW : public TFileTreeRoot
 
         // Get the total file count that we loaded so far
         nFileCount = FileTree.GetCount();
+        PathCache.pParentNode = NULL;
 
         // Parse Content Manifest Files (.cmf)
         for(size_t i = 0; i < nFileCount && dwErrCode == ERROR_SUCCESS; i++)
@@ -342,7 +344,7 @@ struct TRootHandler_OW : public TFileTreeRoot
             char szFileName[MAX_PATH];
 
             // Get the n-th file
-            pFileNode = (PCASC_FILE_NODE)FileTree.PathAt(szFileName, _countof(szFileName), i);
+            pFileNode = (PCASC_FILE_NODE)FileTree.PathAt(szFileName, _countof(szFileName), i, &PathCache);
             if(pFileNode != NULL)
             {
                 if(IsManifestFolderName(szFileName, "Manifest", 8) || IsManifestFolderName(szFileName, "TactManifest", 12))
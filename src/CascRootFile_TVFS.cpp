@@ -426,8 +426,8 @@ struct TRootHandler_TVFS : public TFileTreeRoot
     {
         PCASC_CKEY_ENTRY pCKeyEntry;
 
-        // Insert a new entry to the array. DO NOT ALLOW enlarge array here
-        pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert(1, false);
+        // Insert a new entry to the array. The array grows without moving the existing entries
+        pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.Insert();
         if(pCKeyEntry != NULL)
         {
             memset(pCKeyEntry, 0, sizeof(CASC_CKEY_ENTRY));
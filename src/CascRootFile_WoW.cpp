@@ -636,6 +636,22 @@ struct TRootHandler_WoW : public TFileTreeRoot
         return TFileTreeRoot::Search(pSearch, pFindData);
     }
 
+    // Stores the root format and the file tree to the storage snapshot
+    DWORD SaveSnapshot(TCascStorage * hs, CASC_ARRAY & Snapshot)
+    {
+        DWORD SnapshotHeader[3] = {CASC_WOW_ROOT_SIGNATURE, (DWORD)RootFormat, FileCounterHashless};
+
+        if(Snapshot.Insert(SnapshotHeader, sizeof(SnapshotHeader)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        return FileTree.Save(Snapshot, hs->CKeyArray);
+    }
+
+    // The root format is captured by RootHandler_LoadSnapshotWoW; only the file tree is loaded here
+    DWORD LoadSnapshot(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd)
+    {
+        return FileTree.Load(pbDataPtr + (3 * sizeof(DWORD)), pbDataEnd, hs->CKeyArray);
+    }
+
     ROOT_FORMAT RootFormat;                 // Root file format
     FILE * fp;                              // Handle to the dump file
     DWORD FileCounterHashless;              // Number of files for which we don't have hash. Meaningless for WoW before 8.2.0
@@ -691,3 +707,35 @@ DWORD RootHandler_CreateWoW(TCascStorage * hs, CASC_BLOB & RootFile, DWORD dwLoc
     return dwErrCode;
 }
 
+DWORD RootHandler_LoadSnapshotWoW(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd)
+{
+    TRootHandler_WoW * pRootHandler = NULL;
+    DWORD SnapshotHeader[3];
+    DWORD dwErrCode = ERROR_BAD_FORMAT;
+
+    // Capture the root format and the number of hashless files
+    if((pbDataPtr + sizeof(SnapshotHeader)) > pbDataEnd)
+        return ERROR_BAD_FORMAT;
+    memcpy(SnapshotHeader, pbDataPtr, sizeof(SnapshotHeader));
+
+    // Verify the root format
+    if(SnapshotHeader[1] != RootFormatWoW_v1 && SnapshotHeader[1] != RootFormatWoW_v2)
+        return ERROR_BAD_FORMAT;
+
+    // Create the root handler
+    pRootHandler = new TRootHandler_WoW((ROOT_FORMAT)SnapshotHeader[1], SnapshotHeader[2]);
+    if(pRootHandler != NULL)
+    {
+        // Load the file tree. If load failed, we free the object
+        dwErrCode = pRootHandler->LoadSnapshot(hs, pbDataPtr, pbDataEnd);
+        if(dwErrCode != ERROR_SUCCESS)
+        {
+            delete pRootHandler;
+            pRootHandler = NULL;
+        }
+    }
+
+    // Assign the root directory (or NULL) and return error
+    hs->pRootHandler = pRootHandler;
+    return dwErrCode;
+}
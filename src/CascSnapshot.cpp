@@ -0,0 +1,448 @@
+/*****************************************************************************/
+/* CascSnapshot.cpp                       Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Persistent snapshots of loaded storages                                   */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "CascLib.h"
+#include "CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define CASC_SNAPSHOT_SIGNATURE     0x504E5343      // 'CSNP'
+#define CASC_SNAPSHOT_VERSION       5
+#define CASC_SNAPSHOT_EXTENSION     _T(".snapshot")
+
+// Number of spare items in the CKey array loaded from a snapshot
+#define CASC_SNAPSHOT_SPARE_ITEMS   0x40
+
+// Maximum size of one write to the snapshot file
+#define CASC_SNAPSHOT_WRITE_CHUNK   0x10000000
+
+// On-disk header of the storage snapshot. It is followed by:
+//  CASC_CKEY_ENTRY [CKeyCount]     Content of the CKey array
+//  DWORD [CKeyMapCount]            Indexes of the CKey entries in the CKey map
+//  DWORD [EKeyMapCount]            Indexes of the CKey entries in the EKey map
+//  BYTE [TagCount * TagEntrySize]  Content of the tags array
+//  ULONGLONG [TagMaskCount]        Tag bit masks of the CKey entries, see CASC_CKEY_ENTRY::TagMaskIndex
+//  BYTE [RootSize]                 Data saved by the root handler
+typedef struct _CASC_SNAPSHOT_HEADER
+{
+    DWORD Signature;                                // CASC_SNAPSHOT_SIGNATURE
+    DWORD Version;                                  // CASC_SNAPSHOT_VERSION
+    DWORD HeaderSize;                               // Size of this header, in bytes
+    DWORD CKeyEntrySize;                            // Size of CASC_CKEY_ENTRY in the library that created the snapshot
+    BYTE  StorageKey[MD5_HASH_SIZE];                // MD5 of build key, config key, index file names and locale mask
+    ULONGLONG FileSize;                             // Size of the entire snapshot file
+    DWORD Features;                                 // Storage features that are set while loading the storage
+    DWORD FileOffsetBits;                           // Copy of TCascStorage::FileOffsetBits
+    DWORD EKeyLength;                               // Copy of TCascStorage::EKeyLength
+    DWORD EKeyEntries;                              // Copy of TCascStorage::EKeyEntries
+    DWORD LocalFiles;                               // Copy of TCascStorage::LocalFiles
+    DWORD CKeyCount;                                // Number of CKey entries
+    DWORD CKeyMapCount;                             // Number of items in the CKey map
+    DWORD EKeyMapCount;                             // Number of items in the EKey map
+    DWORD TagCount;                                 // Number of tag entries
+    DWORD TagEntrySize;                             // Size of one tag entry, in bytes
+    DWORD TagMaskCount;                             // Number of tag bit masks
+    DWORD Reserved;                                 // Alignment to 8 bytes
+    ULONGLONG RootSize;                             // Size of the root handler data, in bytes
+} CASC_SNAPSHOT_HEADER, *PCASC_SNAPSHOT_HEADER;
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static void CalculateStorageKey(TCascStorage * hs, DWORD dwLocaleMask, LPBYTE StorageKey)
+{
+    MD5_CTX md5_ctx;
+    TCHAR szPlainName[0x40];
+
+    MD5_Init(&md5_ctx);
+
+    // Include both build key and config key
+    MD5_Update(&md5_ctx, hs->CdnBuildKey.pbData, (unsigned long)hs->CdnBuildKey.cbData);
+    MD5_Update(&md5_ctx, hs->CdnConfigKey.pbData, (unsigned long)hs->CdnConfigKey.cbData);
+
+    // Include names of the newest index files. They change on every update of the storage
+    for(DWORD i = 0; i < CASC_INDEX_COUNT; i++)
+    {
+        CascStrPrintf(szPlainName, _countof(szPlainName), hs->szIndexFormat, i, hs->IndexFiles[i].NewSubIndex);
+        MD5_Update(&md5_ctx, szPlainName, (unsigned long)(_tcslen(szPlainName) * sizeof(TCHAR)));
+    }
+
+    // Include the locale mask. The root handler may contain different files for different locales
+    MD5_Update(&md5_ctx, &dwLocaleMask, sizeof(DWORD));
+    MD5_Final(StorageKey, &md5_ctx);
+}
+
+static LPTSTR CreateSnapshotFileName(TCascStorage * hs, LPCTSTR szSnapshotPath)
+{
+    TCHAR szPlainName[MD5_STRING_SIZE + 0x10];
+
+    // Only take storages with a known build key
+    if(hs->CdnBuildKey.cbData != MD5_HASH_SIZE)
+        return NULL;
+
+    // The plain name is "<build key>.snapshot"
+    StringFromBinary(hs->CdnBuildKey.pbData, MD5_HASH_SIZE, szPlainName);
+    CascStrCopy(szPlainName + MD5_STRING_SIZE, _countof(szPlainName) - MD5_STRING_SIZE, CASC_SNAPSHOT_EXTENSION);
+
+    // Create the full path
+    CASC_PATH<TCHAR> SnapshotPath(szSnapshotPath, szPlainName, NULL);
+    return SnapshotPath.New();
+}
+
+static DWORD LoadKeyMap(TCascStorage * hs, CASC_MAP & KeyMap, size_t KeyLength, size_t KeyOffset, LPBYTE pbIndexes, DWORD dwIndexCount)
+{
+    PCASC_CKEY_ENTRY pCKeyEntry;
+    LPBYTE pbKey;
+    DWORD dwErrCode;
+    DWORD CKeyIndex;
+
+    // The maps are allocated the same way as the CKey array
+    CASC_ALLOCATOR_SCOPE AllocatorScope(hs->GetTableAllocator());
+
+    // Create the map with the same size as the CKey array
+    dwErrCode = KeyMap.Create(hs->CKeyArray.ItemCountMax(), KeyLength, KeyOffset);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Re-insert the items in the order in which they were in the original map
+    for(DWORD i = 0; i < dwIndexCount; i++, pbIndexes += sizeof(DWORD))
+    {
+        memcpy(&CKeyIndex, pbIndexes, sizeof(DWORD));
+
+        // Verify the index
+        if((pCKeyEntry = (PCASC_CKEY_ENTRY)hs->CKeyArray.ItemAt(CKeyIndex)) == NULL)
+            return ERROR_BAD_FORMAT;
+        pbKey = (LPBYTE)pCKeyEntry + KeyOffset;
+
+        // Insert the object to the map
+        if(!KeyMap.InsertObject(pCKeyEntry, pbKey))
+            return ERROR_BAD_FORMAT;
+    }
+
+    // Create the filter for absent keys, if requested
+    if(hs->dwFeatures & CASC_FEATURE_BLOOM_FILTERS)
+        return KeyMap.CreateFilter(hs->CKeyArray.ItemCountMax());
+    return ERROR_SUCCESS;
+}
+
+static DWORD SaveKeyMap(TCascStorage * hs, CASC_MAP & KeyMap, CASC_ARRAY & Snapshot, DWORD & dwIndexCount)
+{
+    void * pvCKeyEntry;
+    DWORD CKeyIndex;
+
+    // Save the indexes of the CKey entries in the order of the hash table
+    for(size_t i = 0; i < KeyMap.HashTableSize(); i++)
+    {
+        if((pvCKeyEntry = KeyMap.ItemAt(i)) != NULL)
+        {
+            // Make sure that the entry is in the CKey array
+            if((CKeyIndex = (DWORD)hs->CKeyArray.IndexOf(pvCKeyEntry)) == CASC_INVALID_INDEX)
+                return ERROR_NOT_SUPPORTED;
+
+            // Insert the index to the snapshot
+            if(Snapshot.Insert(&CKeyIndex, sizeof(DWORD)) == NULL)
+                return ERROR_NOT_ENOUGH_MEMORY;
+            dwIndexCount++;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+static DWORD LoadSnapshotData(TCascStorage * hs, LPBYTE pbSnapshot, ULONGLONG cbSnapshot, DWORD dwLocaleMask)
+{
+    PCASC_SNAPSHOT_HEADER pHeader = (PCASC_SNAPSHOT_HEADER)pbSnapshot;
+    LPBYTE pbSnapshotEnd = pbSnapshot + cbSnapshot;
+    LPBYTE pbCKeyMap;
+    LPBYTE pbEKeyMap;
+    LPBYTE pbTags;
+    LPBYTE pbTagMasks;
+    LPBYTE pbRoot;
+    ULONGLONG cbTotalSize;
+    BYTE StorageKey[MD5_HASH_SIZE];
+    DWORD dwErrCode;
+
+    // Verify the header
+    if(cbSnapshot < sizeof(CASC_SNAPSHOT_HEADER) || pHeader->Signature != CASC_SNAPSHOT_SIGNATURE || pHeader->Version != CASC_SNAPSHOT_VERSION)
+        return ERROR_BAD_FORMAT;
+    if(pHeader->HeaderSize != sizeof(CASC_SNAPSHOT_HEADER) || pHeader->CKeyEntrySize != sizeof(CASC_CKEY_ENTRY) || pHeader->FileSize != cbSnapshot)
+        return ERROR_BAD_FORMAT;
+
+    // Verify that the snapshot belongs to the current state of the storage
+    CalculateStorageKey(hs, dwLocaleMask, StorageKey);
+    if(memcmp(pHeader->StorageKey, StorageKey, MD5_HASH_SIZE))
+        return ERROR_FILE_NOT_FOUND;
+
+    // Verify the sizes of all sections
+    cbTotalSize = sizeof(CASC_SNAPSHOT_HEADER) +
+                  (ULONGLONG)pHeader->CKeyCount * sizeof(CASC_CKEY_ENTRY) +
+                  (ULONGLONG)pHeader->CKeyMapCount * sizeof(DWORD) +
+                  (ULONGLONG)pHeader->EKeyMapCount * sizeof(DWORD) +
+                  (ULONGLONG)pHeader->TagCount * pHeader->TagEntrySize +
+                  (ULONGLONG)pHeader->TagMaskCount * sizeof(ULONGLONG) +
+                  pHeader->RootSize;
+    if(cbTotalSize != cbSnapshot || pHeader->CKeyCount == 0 || pHeader->TagMaskCount > pHeader->CKeyCount)
+        return ERROR_BAD_FORMAT;
+    if(pHeader->TagCount != 0 && pHeader->TagEntrySize < sizeof(CASC_TAG_ENTRY2))
+        return ERROR_BAD_FORMAT;
+
+    // Get pointers to the sections
+    pbCKeyMap = pbSnapshot + sizeof(CASC_SNAPSHOT_HEADER) + (pHeader->CKeyCount * sizeof(CASC_CKEY_ENTRY));
+    pbEKeyMap = pbCKeyMap + (pHeader->CKeyMapCount * sizeof(DWORD));
+    pbTags = pbEKeyMap + (pHeader->EKeyMapCount * sizeof(DWORD));
+    pbTagMasks = pbTags + (pHeader->TagCount * pHeader->TagEntrySize);
+    pbRoot = pbTagMasks + (pHeader->TagMaskCount * sizeof(ULONGLONG));
+
+    // Copy the CKey entries. The CKey array must remain modifiable, so it can't live in the mapped view
+    {
+        CASC_ALLOCATOR_SCOPE AllocatorScope(hs->GetTableAllocator());
+
+        dwErrCode = hs->CKeyArray.Create(sizeof(CASC_CKEY_ENTRY), pHeader->CKeyCount + CASC_SNAPSHOT_SPARE_ITEMS);
+        if(dwErrCode != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+    hs->CKeyArray.Insert(pbSnapshot + sizeof(CASC_SNAPSHOT_HEADER), pHeader->CKeyCount);
+
+    // Rebuild both maps of CKey entries
+    dwErrCode = LoadKeyMap(hs, hs->CKeyMap, MD5_HASH_SIZE, FIELD_OFFSET(CASC_CKEY_ENTRY, CKey), pbCKeyMap, pHeader->CKeyMapCount);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+    dwErrCode = LoadKeyMap(hs, hs->EKeyMap, CASC_EKEY_SIZE, FIELD_OFFSET(CASC_CKEY_ENTRY, EKey), pbEKeyMap, pHeader->EKeyMapCount);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Copy the tags, if any
+    if(pHeader->TagCount != 0)
+    {
+        dwErrCode = hs->TagsArray.Create(pHeader->TagEntrySize, pHeader->TagCount);
+        if(dwErrCode != ERROR_SUCCESS)
+            return dwErrCode;
+        hs->TagsArray.Insert(pbTags, pHeader->TagCount, false);
+    }
+
+    // Copy the tag bit masks, if any. The CKey entries already have their indexes
+    if(pHeader->TagMaskCount != 0)
+    {
+        dwErrCode = hs->TagMaskArray.Create<ULONGLONG>(hs->CKeyArray.ItemCountMax());
+        if(dwErrCode != ERROR_SUCCESS)
+            return dwErrCode;
+        hs->TagMaskArray.Insert(pbTagMasks, pHeader->TagMaskCount, false);
+    }
+
+    // Restore the storage variables
+    hs->dwFeatures |= (pHeader->Features & CASC_FEATURE_TAGS);
+    hs->FileOffsetBits = pHeader->FileOffsetBits;
+    hs->EKeyLength = pHeader->EKeyLength;
+    hs->EKeyEntries = pHeader->EKeyEntries;
+    hs->LocalFiles = pHeader->LocalFiles;
+
+    // Load the root handler
+    dwErrCode = RootHandler_LoadSnapshot(hs, pbRoot, pbSnapshotEnd);
+    if(dwErrCode == ERROR_SUCCESS && (hs->dwFeatures & CASC_FEATURE_BLOOM_FILTERS))
+        hs->pRootHandler->CreateNameFilter();
+    return dwErrCode;
+}
+
+static void FreeSnapshotData(TCascStorage * hs)
+{
+    // Delete the root handler, if it was created
+    if(hs->pRootHandler != NULL)
+        delete hs->pRootHandler;
+    hs->pRootHandler = NULL;
+
+    // Free the arrays and maps
+    hs->TagMaskArray.Free();
+    hs->TagsArray.Free();
+    hs->EKeyMap.Free();
+    hs->CKeyMap.Free();
+    hs->CKeyArray.Free();
+
+    // Restore the storage variables
+    hs->dwFeatures &= ~CASC_FEATURE_TAGS;
+    hs->FileOffsetBits = 0;
+    hs->EKeyLength = 0;
+    hs->EKeyEntries = 0;
+    hs->LocalFiles = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD LoadStorageSnapshot(TCascStorage * hs, LPCTSTR szSnapshotPath, DWORD dwLocaleMask)
+{
+    TFileStream * pStream;
+    ULONGLONG cbSnapshot = 0;
+    LPBYTE pbSnapshot;
+    LPTSTR szFileName;
+    DWORD dwErrCode = ERROR_FILE_NOT_FOUND;
+
+    // We need the index files to verify whether the snapshot is up-to-date
+    if((dwErrCode = ScanIndexDirectory(hs)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Create the name of the snapshot file
+    if((szFileName = CreateSnapshotFileName(hs, szSnapshotPath)) == NULL)
+        return ERROR_FILE_NOT_FOUND;
+
+    // Map the entire snapshot into memory
+    if((pStream = FileStream_OpenFile(szFileName, STREAM_FLAG_READ_ONLY | BASE_PROVIDER_MAP)) != NULL)
+    {
+        // Load the snapshot from the mapped view
+        if((pbSnapshot = FileStream_GetMappedView(pStream, &cbSnapshot)) != NULL)
+        {
+            // Inform the caller about what we're doing
+            if(InvokeProgressCallback(hs, CascProgressLoadingManifest, "SNAPSHOT", 0, 0))
+                dwErrCode = ERROR_CANCELLED;
+            else
+                dwErrCode = LoadSnapshotData(hs, pbSnapshot, cbSnapshot, dwLocaleMask);
+        }
+        else
+        {
+            dwErrCode = GetCascError();
+        }
+
+        FileStream_Close(pStream);
+    }
+    else
+    {
+        dwErrCode = GetCascError();
+    }
+
+    // On failure, bring the storage to the state before the snapshot load
+    if(dwErrCode != ERROR_SUCCESS)
+        FreeSnapshotData(hs);
+    CASC_FREE(szFileName);
+    return dwErrCode;
+}
+
+DWORD SaveStorageSnapshot(TCascStorage * hs, LPCTSTR szSnapshotPath, DWORD dwLocaleMask)
+{
+    PCASC_SNAPSHOT_HEADER pHeader;
+    CASC_SNAPSHOT_HEADER Header;
+    CASC_ARRAY Snapshot;
+    TFileStream * pStream;
+    ULONGLONG ByteOffset = 0;
+    LPTSTR szFileName;
+    LPBYTE pbCKeyEntries;
+    size_t cbRootOffset;
+    DWORD dwErrCode;
+
+    // Only storages with a root handler can be saved
+    if(hs->pRootHandler == NULL)
+        return ERROR_NOT_SUPPORTED;
+
+    // Prepare the snapshot header
+    memset(&Header, 0, sizeof(CASC_SNAPSHOT_HEADER));
+    Header.Signature = CASC_SNAPSHOT_SIGNATURE;
+    Header.Version = CASC_SNAPSHOT_VERSION;
+    Header.HeaderSize = sizeof(CASC_SNAPSHOT_HEADER);
+    Header.CKeyEntrySize = sizeof(CASC_CKEY_ENTRY);
+    Header.Features = (hs->dwFeatures & CASC_FEATURE_TAGS);
+    Header.FileOffsetBits = hs->FileOffsetBits;
+    Header.EKeyLength = (DWORD)hs->EKeyLength;
+    Header.EKeyEntries = (DWORD)hs->EKeyEntries;
+    Header.LocalFiles = (DWORD)hs->LocalFiles;
+    Header.CKeyCount = (DWORD)hs->CKeyArray.ItemCount();
+    Header.TagCount = (DWORD)hs->TagsArray.ItemCount();
+    Header.TagEntrySize = (DWORD)hs->TagsArray.ItemSize();
+    Header.TagMaskCount = (DWORD)hs->TagMaskArray.ItemCount();
+    CalculateStorageKey(hs, dwLocaleMask, Header.StorageKey);
+
+    // The snapshot is built in memory first. The header is updated at the end
+    dwErrCode = Snapshot.Create<BYTE>(sizeof(CASC_SNAPSHOT_HEADER) + hs->CKeyArray.ItemCount() * sizeof(CASC_CKEY_ENTRY) * 2);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Insert the header and the CKey entries
+    if(Snapshot.Insert(&Header, sizeof(CASC_SNAPSHOT_HEADER)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    if((pbCKeyEntries = (LPBYTE)Snapshot.Insert(Header.CKeyCount * sizeof(CASC_CKEY_ENTRY))) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    hs->CKeyArray.CopyTo(pbCKeyEntries);
+
+    // Insert both maps
+    dwErrCode = SaveKeyMap(hs, hs->CKeyMap, Snapshot, Header.CKeyMapCount);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+    dwErrCode = SaveKeyMap(hs, hs->EKeyMap, Snapshot, Header.EKeyMapCount);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Insert the tags
+    if(Header.TagCount != 0)
+    {
+        if(Snapshot.Insert(hs->TagsArray.ItemArray(), Header.TagCount * Header.TagEntrySize) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Insert the tag bit masks
+    if(Header.TagMaskCount != 0)
+    {
+        if(Snapshot.Insert(hs->TagMaskArray.ItemArray(), Header.TagMaskCount * sizeof(ULONGLONG)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Insert the root handler data. Not all root handlers support this
+    cbRootOffset = Snapshot.ItemCount();
+    dwErrCode = hs->pRootHandler->SaveSnapshot(hs, Snapshot);
+    if(dwErrCode != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // Update the header
+    pHeader = (PCASC_SNAPSHOT_HEADER)Snapshot.ItemArray();
+    Header.RootSize = Snapshot.ItemCount() - cbRootOffset;
+    Header.FileSize = Snapshot.ItemCount();
+    memcpy(pHeader, &Header, sizeof(CASC_SNAPSHOT_HEADER));
+
+    // Create the snapshot file
+    if((szFileName = CreateSnapshotFileName(hs, szSnapshotPath)) == NULL)
+        return ERROR_NOT_SUPPORTED;
+
+    // Write the snapshot to a temporary file first. Other processes may have the old
+    // snapshot mapped, so it must not be overwritten; the new one replaces it when complete
+    if((pStream = FileStream_CreateTemporary(szFileName, STREAM_PROVIDER_FLAT | BASE_PROVIDER_FILE)) != NULL)
+    {
+        LPBYTE pbSnapshot = (LPBYTE)Snapshot.ItemArray();
+        size_t cbSnapshot = Snapshot.ItemCount();
+
+        // The snapshot may be larger than 4 GB, so we write it in chunks
+        while(ByteOffset < cbSnapshot)
+        {
+            DWORD dwBytesToWrite = (DWORD)CASCLIB_MIN(cbSnapshot - (size_t)ByteOffset, CASC_SNAPSHOT_WRITE_CHUNK);
+
+            if(!FileStream_Write(pStream, &ByteOffset, pbSnapshot + (size_t)ByteOffset, dwBytesToWrite))
+            {
+                dwErrCode = GetCascError();
+                break;
+            }
+            ByteOffset += dwBytesToWrite;
+        }
+
+        // Replace the old snapshot, or delete the incomplete one
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            if(!FileStream_Commit(pStream, szFileName))
+                dwErrCode = GetCascError();
+        }
+        else
+        {
+            FileStream_Discard(pStream);
+        }
+    }
+    else
+    {
+        dwErrCode = GetCascError();
+    }
+
+    CASC_FREE(szFileName);
+    return dwErrCode;
+}
@@ -0,0 +1,238 @@
+/*****************************************************************************/
+/* Arena.h                                Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Arena allocator for many small objects that are all freed at once         */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of Arena.h                         */
+/* 18.10.26  1.01  Lad  Added the grow-by-chunk mode (Append)                */
+/*****************************************************************************/
+
+#ifndef __CASC_ARENA_H__
+#define __CASC_ARENA_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+
+#define CASC_ARENA_CHUNK_SIZE   0x10000             // Size of one chunk of the arena
+#define CASC_ARENA_ALIGNMENT    8                   // All blocks are aligned to this size
+
+// Header of one chunk. The chunk data follow the header
+struct CASC_ARENA_CHUNK
+{
+    CASC_ARENA_CHUNK * pNext;                       // Next chunk in the list
+    size_t cbChunk;                                 // Size of the chunk data, in bytes
+};
+
+//
+// Blocks are taken from large chunks and can't be freed separately.
+// All chunks are freed when the arena is freed. Objects allocated
+// from the arena must not need a destructor. Not thread-safe.
+//
+// In the grow-by-chunk mode (Append), the blocks follow each other and are
+// addressed by offset, as if all chunks formed one buffer. A block never crosses
+// a chunk boundary; if it doesn't fit, the rest of the chunk is zeroed and skipped.
+// This gives a table that grows without ever being reallocated or moved.
+//
+class CASC_ARENA
+{
+    public:
+
+    CASC_ARENA()
+    {
+        m_pFirstChunk = NULL;
+        m_pbFreeSpace = NULL;
+        m_pbChunkEnd = NULL;
+        m_cbAllocated = 0;
+        m_ChunkTable = NULL;
+        m_nChunkCount = 0;
+        m_nChunkCountMax = 0;
+        m_cbAppended = 0;
+    }
+
+    ~CASC_ARENA()
+    {
+        Free();
+    }
+
+    // Allocates a new block. Returns NULL if not enough memory
+    void * Alloc(size_t cbSize)
+    {
+        LPBYTE pbBlock;
+
+        // Keep all blocks aligned
+        if((cbSize = ALIGN_TO_SIZE(cbSize, CASC_ARENA_ALIGNMENT)) == 0)
+            cbSize = CASC_ARENA_ALIGNMENT;
+
+        // Large blocks get their own chunk, so that the rest of the current chunk is not wasted
+        if(cbSize > (CASC_ARENA_CHUNK_SIZE / 4))
+            return AllocateChunk(cbSize);
+
+        // Begin a new chunk if the current one is full
+        if(cbSize > (size_t)(m_pbChunkEnd - m_pbFreeSpace))
+        {
+            if((m_pbFreeSpace = AllocateChunk(CASC_ARENA_CHUNK_SIZE)) == NULL)
+                return NULL;
+            m_pbChunkEnd = m_pbFreeSpace + CASC_ARENA_CHUNK_SIZE;
+        }
+
+        // Take the block from the current chunk
+        pbBlock = m_pbFreeSpace;
+        m_pbFreeSpace += cbSize;
+        return pbBlock;
+    }
+
+    template <typename T>
+    T * Alloc(size_t nCount = 1)
+    {
+        return (T *)Alloc(sizeof(T) * nCount);
+    }
+
+    // Creates a zero-terminated copy of the string
+    char * NewStr(const char * szString, size_t nLength)
+    {
+        char * szNewString;
+
+        if((szNewString = Alloc<char>(nLength + 1)) != NULL)
+        {
+            memcpy(szNewString, szString, nLength);
+            szNewString[nLength] = 0;
+        }
+        return szNewString;
+    }
+
+    // Returns the offset at which Append would place a block of the given size
+    size_t AppendOffset(size_t cbSize)
+    {
+        size_t cbChunkRest = CASC_ARENA_CHUNK_SIZE - (m_cbAppended % CASC_ARENA_CHUNK_SIZE);
+
+        return (cbSize > cbChunkRest) ? (m_cbAppended + cbChunkRest) : m_cbAppended;
+    }
+
+    // Appends a block to the end of the table. The block is not aligned
+    void * Append(size_t cbSize)
+    {
+        size_t nOffset = AppendOffset(cbSize);
+        size_t nChunk = nOffset / CASC_ARENA_CHUNK_SIZE;
+
+        // The block must fit into one chunk
+        if(cbSize > CASC_ARENA_CHUNK_SIZE)
+            return NULL;
+
+        // Zero the skipped rest of the current chunk
+        if(nOffset > m_cbAppended)
+            memset(m_ChunkTable[nChunk - 1] + (m_cbAppended % CASC_ARENA_CHUNK_SIZE), 0, nOffset - m_cbAppended);
+
+        // Begin a new chunk, if needed
+        if(nChunk >= m_nChunkCount && !AppendChunk())
+            return NULL;
+
+        m_cbAppended = nOffset + cbSize;
+        return m_ChunkTable[nChunk] + (nOffset % CASC_ARENA_CHUNK_SIZE);
+    }
+
+    // Converts offset of an appended block to pointer. Optionally gives the number
+    // of bytes that follow the offset in the same chunk, up to the end of the table
+    LPBYTE OffsetToPointer(size_t nOffset, size_t * PtrBytesAvailable = NULL)
+    {
+        size_t nOffsetInChunk = nOffset % CASC_ARENA_CHUNK_SIZE;
+
+        if(nOffset >= m_cbAppended)
+            return NULL;
+
+        if(PtrBytesAvailable != NULL)
+            PtrBytesAvailable[0] = CASCLIB_MIN(CASC_ARENA_CHUNK_SIZE - nOffsetInChunk, m_cbAppended - nOffset);
+        return m_ChunkTable[nOffset / CASC_ARENA_CHUNK_SIZE] + nOffsetInChunk;
+    }
+
+    // Size of the appended table, including the skipped chunk ends
+    size_t AppendedBytes()
+    {
+        return m_cbAppended;
+    }
+
+    size_t BytesAllocated()
+    {
+        return m_cbAllocated;
+    }
+
+    // Frees all blocks
+    void Free()
+    {
+        CASC_ARENA_CHUNK * pChunk;
+
+        while((pChunk = m_pFirstChunk) != NULL)
+        {
+            m_pFirstChunk = pChunk->pNext;
+            CASC_FREE(pChunk);
+        }
+
+        m_pbFreeSpace = m_pbChunkEnd = NULL;
+        m_cbAllocated = 0;
+
+        // Free the table of the appended chunks
+        CASC_FREE(m_ChunkTable);
+        m_nChunkCount = m_nChunkCountMax = 0;
+        m_cbAppended = 0;
+    }
+
+    protected:
+
+    // Adds a chunk to the table of the appended chunks
+    bool AppendChunk()
+    {
+        LPBYTE * NewChunkTable;
+        size_t nNewChunkCountMax;
+
+        // Enlarge the table of chunks, if needed. Only the table moves, never the chunks
+        if(m_nChunkCount >= m_nChunkCountMax)
+        {
+            nNewChunkCountMax = CASCLIB_MAX(m_nChunkCountMax * 2, 0x10);
+            if((NewChunkTable = CASC_ALLOC<LPBYTE>(nNewChunkCountMax)) == NULL)
+                return false;
+            if(m_ChunkTable != NULL)
+                memcpy(NewChunkTable, m_ChunkTable, m_nChunkCount * sizeof(LPBYTE));
+            CASC_FREE(m_ChunkTable);
+
+            m_cbAllocated += (nNewChunkCountMax - m_nChunkCountMax) * sizeof(LPBYTE);
+            m_ChunkTable = NewChunkTable;
+            m_nChunkCountMax = nNewChunkCountMax;
+        }
+
+        // Allocate the chunk itself
+        if((m_ChunkTable[m_nChunkCount] = AllocateChunk(CASC_ARENA_CHUNK_SIZE)) == NULL)
+            return false;
+        m_nChunkCount++;
+        return true;
+    }
+
+    // Allocates a new chunk and returns pointer to its data
+    LPBYTE AllocateChunk(size_t cbChunk)
+    {
+        CASC_ARENA_CHUNK * pChunk;
+
+        // Allocate the chunk with the header
+        if((pChunk = (CASC_ARENA_CHUNK *)CASC_ALLOC<BYTE>(sizeof(CASC_ARENA_CHUNK) + cbChunk)) == NULL)
+            return NULL;
+
+        // Link the chunk to the list
+        pChunk->pNext = m_pFirstChunk;
+        pChunk->cbChunk = cbChunk;
+        m_pFirstChunk = pChunk;
+        m_cbAllocated += sizeof(CASC_ARENA_CHUNK) + cbChunk;
+        return (LPBYTE)(pChunk + 1);
+    }
+
+    CASC_ARENA_CHUNK * m_pFirstChunk;           // List of all chunks, the newest first
+    LPBYTE m_pbFreeSpace;                       // Free space in the current chunk
+    LPBYTE m_pbChunkEnd;                        // End of the current chunk
+    size_t m_cbAllocated;                       // Total size of all chunks, in bytes
+
+    LPBYTE * m_ChunkTable;                      // Chunks of the appended table, in order
+    size_t m_nChunkCount;                       // Number of chunks of the appended table
+    size_t m_nChunkCountMax;                    // Capacity of the chunk table
+    size_t m_cbAppended;                        // Size of the appended table, in bytes
+};
+
+#endif // __CASC_ARENA_H__
@@ -170,12 +170,12 @@ class CASC_ARRAY
         m_ItemCountMax = m_ItemCount = m_ItemSize = 0;
     }
 
-#ifdef CASCLIB_DEBUG
     size_t BytesAllocated()
     {
         return m_ItemCountMax * m_ItemSize;
     }
 
+#ifdef CASCLIB_DEBUG
     void Dump(const char * szFileName)
     {
         FILE * fp;
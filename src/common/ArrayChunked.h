@@ -0,0 +1,294 @@
+/*****************************************************************************/
+/* ArrayChunked.h                         Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Variant of CASC_ARRAY that keeps the items in chunks. When the array      */
+/* grows, a new chunk is added and no item is ever moved, so pointers        */
+/* to the items stay valid for the whole life of the array.                  */
+/*                                                                           */
+/* The first chunk holds exactly as many items (F) as requested by Create.  */
+/* The next chunk holds N items (the smallest power of two not below F),    */
+/* each further chunk holds twice as many items as the one before it:       */
+/*                                                                           */
+/*  Chunk 0: items [0, F)                                                    */
+/*  Chunk 1: items [F, F + N)                                                */
+/*  Chunk 2: items [F + N, F + 3N)                                           */
+/*  Chunk K: items [F + (2^(K-1) - 1) * N, F + (2^K - 1) * N)                */
+/*                                                                           */
+/* The chunk of an item beyond the first chunk is found from the highest    */
+/* bit of ((Index - F) / N + 1).                                             */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of ArrayChunked.h                  */
+/*****************************************************************************/
+
+#ifndef __CASC_CHUNKED_ARRAY_H__
+#define __CASC_CHUNKED_ARRAY_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+
+#define CASC_MAX_ARRAY_CHUNKS   (sizeof(size_t) * 8)
+
+class CASC_CHUNKED_ARRAY
+{
+    public:
+
+    CASC_CHUNKED_ARRAY()
+    {
+        memset(m_Chunks, 0, sizeof(m_Chunks));
+        m_ChunkCount = 0;
+        m_ChunkShift = 0;
+        m_FirstChunkItems = 0;
+        m_ItemCountMax = 0;
+        m_ItemCount = 0;
+        m_ItemSize = 0;
+    }
+
+    ~CASC_CHUNKED_ARRAY()
+    {
+        Free();
+    }
+
+    // Creates an array with a custom element type
+    template<typename TYPE>
+    int Create(size_t ItemCountMax)
+    {
+        return Create(sizeof(TYPE), ItemCountMax);
+    }
+
+    // Creates an array with a custom element size. The first chunk will hold ItemCountMax items
+    int Create(size_t ItemSize, size_t ItemCountMax)
+    {
+        // Sanity check
+        assert(ItemCountMax != 0);
+
+        // The size of the chunks after the first one is a power of two
+        m_ChunkShift = 0;
+        while(((size_t)1 << m_ChunkShift) < ItemCountMax)
+            m_ChunkShift++;
+
+        m_FirstChunkItems = ItemCountMax;
+        m_ItemCount = 0;
+        m_ItemSize = ItemSize;
+        return AddChunk() ? ERROR_SUCCESS : ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Inserts one item; returns pointer to the new item
+    void * Insert()
+    {
+        void * pNewItem;
+
+        // Add new chunk, if needed
+        if(m_ItemCount >= m_ItemCountMax && !AddChunk())
+            return NULL;
+
+        // Increment the size of the array
+        pNewItem = PointerTo(m_ItemCount);
+        m_ItemCount++;
+        return pNewItem;
+    }
+
+    // Inserts one or more items; returns pointer to the first inserted item.
+    // Note that the items may be split to multiple chunks
+    void * Insert(const void * NewItems, size_t NewItemCount)
+    {
+        const BYTE * pbNewItems = (const BYTE *)NewItems;
+        void * pFirstItem = NULL;
+        LPBYTE pbItem;
+        size_t nItemCount;
+
+        while(NewItemCount > 0)
+        {
+            // Add new chunk, if needed
+            if(m_ItemCount >= m_ItemCountMax && !AddChunk())
+                return NULL;
+
+            // Copy as many items as fit in the current chunk
+            pbItem = PointerTo(m_ItemCount);
+            nItemCount = CASCLIB_MIN(NewItemCount, m_ItemCountMax - m_ItemCount);
+            if(pbNewItems != NULL)
+            {
+                memcpy(pbItem, pbNewItems, nItemCount * m_ItemSize);
+                pbNewItems += nItemCount * m_ItemSize;
+            }
+
+            pFirstItem = (pFirstItem != NULL) ? pFirstItem : pbItem;
+            m_ItemCount += nItemCount;
+            NewItemCount -= nItemCount;
+        }
+        return pFirstItem;
+    }
+
+    // Returns an item at a given index
+    void * ItemAt(size_t ItemIndex)
+    {
+        return (ItemIndex < m_ItemCount) ? PointerTo(ItemIndex) : NULL;
+    }
+
+    // Returns index of an item, or CASC_INVALID_INDEX if the item is not in the array.
+    // The newest chunks are the largest ones, so they are checked first
+    size_t IndexOf(const void * pItem)
+    {
+        LPBYTE pbItem = (LPBYTE)pItem;
+        size_t nChunk = m_ChunkCount;
+
+        while(nChunk-- > 0)
+        {
+            LPBYTE pbChunk = m_Chunks[nChunk];
+
+            if(pbChunk <= pbItem && pbItem < pbChunk + (ChunkItemCount(nChunk) * m_ItemSize))
+            {
+                assert(((pbItem - pbChunk) % m_ItemSize) == 0);
+                return ChunkFirstItem(nChunk) + ((pbItem - pbChunk) / m_ItemSize);
+            }
+        }
+        return CASC_INVALID_INDEX;
+    }
+
+    // Copies the items to a continuous buffer. The buffer must be large enough for all items
+    void CopyTo(void * pvBuffer)
+    {
+        LPBYTE pbBuffer = (LPBYTE)pvBuffer;
+        size_t nItemCount;
+
+        for(size_t i = 0; i < m_ChunkCount && ChunkFirstItem(i) < m_ItemCount; i++)
+        {
+            nItemCount = CASCLIB_MIN(ChunkItemCount(i), m_ItemCount - ChunkFirstItem(i));
+            memcpy(pbBuffer, m_Chunks[i], nItemCount * m_ItemSize);
+            pbBuffer += nItemCount * m_ItemSize;
+        }
+    }
+
+    size_t ItemCount()
+    {
+        return m_ItemCount;
+    }
+
+    size_t ItemCountMax()
+    {
+        return m_ItemCountMax;
+    }
+
+    size_t ItemSize()
+    {
+        return m_ItemSize;
+    }
+
+    bool IsInitialized()
+    {
+        return (m_ChunkCount != 0);
+    }
+
+    // Frees the array
+    void Free()
+    {
+        for(size_t i = 0; i < m_ChunkCount; i++)
+            CASC_FREE(m_Chunks[i]);
+        m_ChunkCount = m_ChunkShift = m_FirstChunkItems = 0;
+        m_ItemCountMax = m_ItemCount = m_ItemSize = 0;
+    }
+
+    size_t BytesAllocated()
+    {
+        return m_ItemCountMax * m_ItemSize;
+    }
+
+    size_t HugePageAdvisedBytes()
+    {
+        size_t cbAdvised = 0;
+
+        for(size_t i = 0; i < m_ChunkCount; i++)
+            cbAdvised += CascGetHugePageAdvisedBytes(m_Chunks[i]);
+        return cbAdvised;
+    }
+
+    protected:
+
+    // Index of the first item of the chunk
+    size_t ChunkFirstItem(size_t nChunk)
+    {
+        return (nChunk != 0) ? m_FirstChunkItems + ((((size_t)1 << (nChunk - 1)) - 1) << m_ChunkShift) : 0;
+    }
+
+    size_t ChunkItemCount(size_t nChunk)
+    {
+        return (nChunk != 0) ? (size_t)1 << (nChunk - 1 + m_ChunkShift) : m_FirstChunkItems;
+    }
+
+    LPBYTE PointerTo(size_t ItemIndex)
+    {
+        size_t nChunk;
+
+        // Items of the first chunk
+        if(ItemIndex < m_FirstChunkItems)
+            return m_Chunks[0] + (ItemIndex * m_ItemSize);
+
+        // Items of the other chunks
+        nChunk = GetHighestBitIndex(((ItemIndex - m_FirstChunkItems) >> m_ChunkShift) + 1) + 1;
+        return m_Chunks[nChunk] + ((ItemIndex - ChunkFirstItem(nChunk)) * m_ItemSize);
+    }
+
+    bool AddChunk()
+    {
+        size_t nItemCount;
+
+        // We expect the array to be created
+        assert(m_ItemSize != 0);
+
+        // Check the limits. The total item count must not overflow
+        if(m_ChunkCount + m_ChunkShift + 1 >= CASC_MAX_ARRAY_CHUNKS)
+            return false;
+        nItemCount = ChunkItemCount(m_ChunkCount);
+
+        // Allocate the chunk. The chunks come from the allocator of the first one, no matter which thread inserts
+        if(m_ChunkCount != 0)
+        {
+            CASC_ALLOCATOR_SCOPE AllocatorScope(CascGetBlockAllocator(m_Chunks[0]));
+            m_Chunks[m_ChunkCount] = CASC_ALLOC<BYTE>(nItemCount * m_ItemSize);
+        }
+        else
+        {
+            m_Chunks[m_ChunkCount] = CASC_ALLOC<BYTE>(nItemCount * m_ItemSize);
+        }
+        if(m_Chunks[m_ChunkCount] == NULL)
+            return false;
+
+        m_ItemCountMax += nItemCount;
+        m_ChunkCount++;
+        return true;
+    }
+
+    static size_t GetHighestBitIndex(size_t Value)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long Index;
+
+        _BitScanReverse64(&Index, Value);
+        return Index;
+#elif defined(_MSC_VER)
+        unsigned long Index;
+
+        _BitScanReverse(&Index, Value);
+        return Index;
+#elif defined(__GNUC__)
+        return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(Value);
+#else
+        size_t Index = 0;
+
+        while(Value >>= 1)
+            Index++;
+        return Index;
+#endif
+    }
+
+    LPBYTE m_Chunks[CASC_MAX_ARRAY_CHUNKS];     // Pointers to the chunks
+    size_t m_ChunkCount;                        // Number of allocated chunks
+    size_t m_ChunkShift;                        // The second chunk holds (1 << m_ChunkShift) items
+    size_t m_FirstChunkItems;                   // The first chunk holds this many items
+    size_t m_ItemCountMax;                      // Total capacity of all chunks
+    size_t m_ItemCount;                         // Current item count
+    size_t m_ItemSize;                          // Size of an item
+};
+
+#endif // __CASC_CHUNKED_ARRAY_H__
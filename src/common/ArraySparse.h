@@ -31,7 +31,8 @@
 
 //-----------------------------------------------------------------------------
 // Structure of the 256-item sub-table. Each table item contains either
-// pointer to the lower sub-table (if present) or the pointer to the target item
+// pointer to the lower sub-table (if present) or the pointer to the target item.
+// The sub-tables are allocated from the arena of the array and freed all at once
 
 struct CASC_ARRAY_256
 {
@@ -78,27 +79,6 @@ struct CASC_ARRAY_256
         }
     }
 
-    void Free(size_t nLevel)
-    {
-        CASC_ARRAY_256 * pLower;
-
-        // For levels 0, 1, 2, free the sub-items, if any
-        if(nLevel < 3)
-        {
-            for(size_t i = 0; i < _countof(Pointers); i++)
-            {
-                if((pLower = GetLowerLevel(i)) != NULL)
-                {
-                    pLower->Free(nLevel + 1);
-                    delete pLower;
-                }
-            }
-        }
-
-        // Set all pointers to NULL
-        memset(Pointers, 0, sizeof(CASC_ARRAY_256));
-    }
-
     void * Pointers[0x100];
 };
 
@@ -111,7 +91,6 @@ class CASC_SPARSE_ARRAY
 
     CASC_SPARSE_ARRAY()
     {
-        m_LevelsAllocated = 0;
         m_ItemCount = 0;
         m_pLevel0 = NULL;
     }
@@ -125,11 +104,8 @@ class CASC_SPARSE_ARRAY
     template<typename TYPE>
     DWORD Create(size_t /* ItemCountMax */)
     {
-        if((m_pLevel0 = new CASC_ARRAY_256()) != NULL)
-        {
-            m_LevelsAllocated++;
+        if((m_pLevel0 = NewTable()) != NULL)
             return ERROR_SUCCESS;
-        }
         return ERROR_NOT_ENOUGH_MEMORY;
     }
 
@@ -199,14 +175,11 @@ class CASC_SPARSE_ARRAY
         }
     }
 
-    // Frees the array
+    // Frees the array. All sub-tables go with the arena
     void Free()
     {
-        if(m_pLevel0 != NULL)
-        {
-            m_pLevel0->Free(0);
-            delete m_pLevel0;
-        }
+        m_Arena.Free();
+        m_pLevel0 = NULL;
     }
 
     size_t ItemCount()
@@ -229,12 +202,12 @@ class CASC_SPARSE_ARRAY
         return (m_pLevel0 != NULL);
     }
 
-#ifdef CASCLIB_DEBUG
     size_t BytesAllocated()
     {
-        return m_LevelsAllocated * sizeof(CASC_ARRAY_256);
+        return m_Arena.BytesAllocated();
     }
 
+#ifdef CASCLIB_DEBUG
     void Dump(const char * szFileName)
     {
         FILE * fp;
@@ -270,16 +243,22 @@ class CASC_SPARSE_ARRAY
 
         // Is there an item?
         if(SubTable[0] == NULL)
-        {
-            SubTable[0] = new CASC_ARRAY_256();
-            m_LevelsAllocated++;
-        }
+            SubTable[0] = NewTable();
         return SubTable[0];
     }
 
+    CASC_ARRAY_256 * NewTable()
+    {
+        CASC_ARRAY_256 * pTable;
+
+        if((pTable = m_Arena.Alloc<CASC_ARRAY_256>()) != NULL)
+            memset(pTable->Pointers, 0, sizeof(pTable->Pointers));
+        return pTable;
+    }
+
     // Level-0 subitem table
+    CASC_ARENA m_Arena;                         // Arena of all CASC_ARRAY_256's
     CASC_ARRAY_256 * m_pLevel0;                 // Array of level 0 of pointers
-    size_t m_LevelsAllocated;                   // Number of CASC_ARRAY_256's allocated (for debugging purposes)
     size_t m_ItemCount;                         // The number of items inserted
 };
 
@@ -0,0 +1,133 @@
+/*****************************************************************************/
+/* Bloom.h                                Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Blocked Bloom filter for fast rejection of keys that are not in a map     */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of Bloom.h                         */
+/*****************************************************************************/
+
+#ifndef __CASC_BLOOM_H__
+#define __CASC_BLOOM_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+
+#define CASC_BLOOM_BITS_PER_ITEM    10              // With 8 bits set per item, this gives about 1% false positives
+#define CASC_BLOOM_BLOCK_WORDS      8               // Number of 64-bit words in one block (64 bytes, one cache line)
+
+// One block of the filter. All bits of one key are in the same block
+struct CASC_BLOOM_BLOCK
+{
+    ULONGLONG Words[CASC_BLOOM_BLOCK_WORDS];
+};
+
+//
+// Each key sets one bit in every word of one block. The block is selected
+// by the upper 32 bits of the hash, the bits by the lower 32 bits.
+// The hash must be uniformly distributed, e.g. leading bytes of MD5 or Jenkins hash.
+//
+class CASC_BLOOM_FILTER
+{
+    public:
+
+    CASC_BLOOM_FILTER()
+    {
+        m_pbAllocated = NULL;
+        m_Blocks = NULL;
+        m_BlockCount = 0;
+    }
+
+    ~CASC_BLOOM_FILTER()
+    {
+        Free();
+    }
+
+    DWORD Create(size_t MaxItems)
+    {
+        size_t nBitCount = CASCLIB_MAX(MaxItems, 1) * CASC_BLOOM_BITS_PER_ITEM;
+        size_t nBlockBits = sizeof(CASC_BLOOM_BLOCK) * 8;
+
+        // The block index is taken from 32 bits of the hash
+        m_BlockCount = CASCLIB_MIN((nBitCount + nBlockBits - 1) / nBlockBits, 0xFFFFFFFF);
+
+        // Allocate one extra block, so that the blocks can be aligned to the cache line
+        if((m_pbAllocated = CASC_ALLOC_ZERO<BYTE>((m_BlockCount + 1) * sizeof(CASC_BLOOM_BLOCK))) == NULL)
+        {
+            m_BlockCount = 0;
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        m_Blocks = (CASC_BLOOM_BLOCK *)ALIGN_TO_SIZE((size_t)m_pbAllocated, sizeof(CASC_BLOOM_BLOCK));
+        return ERROR_SUCCESS;
+    }
+
+    void Insert(ULONGLONG HashValue)
+    {
+        CASC_BLOOM_BLOCK & Block = BlockOf(HashValue);
+
+        for(size_t i = 0; i < CASC_BLOOM_BLOCK_WORDS; i++)
+            Block.Words[i] |= BitOf(HashValue, i);
+    }
+
+    // Returns false if the key is surely not present. True means "maybe"
+    bool MayContain(ULONGLONG HashValue)
+    {
+        CASC_BLOOM_BLOCK & Block = BlockOf(HashValue);
+
+        for(size_t i = 0; i < CASC_BLOOM_BLOCK_WORDS; i++)
+        {
+            if((Block.Words[i] & BitOf(HashValue, i)) == 0)
+                return false;
+        }
+        return true;
+    }
+
+    size_t BytesAllocated()
+    {
+        return (m_pbAllocated != NULL) ? (m_BlockCount + 1) * sizeof(CASC_BLOOM_BLOCK) : 0;
+    }
+
+    size_t HugePageAdvisedBytes()
+    {
+        return CascGetHugePageAdvisedBytes(m_pbAllocated);
+    }
+
+    bool IsInitialized()
+    {
+        return (m_Blocks != NULL);
+    }
+
+    void Free()
+    {
+        CASC_FREE(m_pbAllocated);
+        m_Blocks = NULL;
+        m_BlockCount = 0;
+    }
+
+    protected:
+
+    CASC_BLOOM_BLOCK & BlockOf(ULONGLONG HashValue)
+    {
+        return m_Blocks[(size_t)(((HashValue >> 32) * m_BlockCount) >> 32)];
+    }
+
+    // Multiplying by an odd constant gives independent bit positions for each word
+    static ULONGLONG BitOf(ULONGLONG HashValue, size_t nWordIndex)
+    {
+        static const DWORD Salt[CASC_BLOOM_BLOCK_WORDS] =
+        {
+            0x47B6137B, 0x44974D91, 0x8824AD5B, 0xA2B7289D,
+            0x705495C7, 0x2DF1424B, 0x9EFC4947, 0x5C6BFB31
+        };
+
+        return (ULONGLONG)1 << (((DWORD)HashValue * Salt[nWordIndex]) >> 26);
+    }
+
+    LPBYTE m_pbAllocated;                       // Allocated memory
+    CASC_BLOOM_BLOCK * m_Blocks;                // Array of blocks, aligned to the size of the block
+    size_t m_BlockCount;                        // Number of blocks
+};
+
+#endif // __CASC_BLOOM_H__
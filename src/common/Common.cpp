@@ -12,6 +12,17 @@
 #include "../CascLib.h"
 #include "../CascCommon.h"
 
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")           // GetProcessMemoryInfo
+#endif
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
 //-----------------------------------------------------------------------------
 // Conversion to uppercase/lowercase
 
@@ -74,6 +85,314 @@ unsigned char AsciiToHexTable[128] =
 
 unsigned char IntToHexChar[] = "0123456789abcdef";
 
+//-----------------------------------------------------------------------------
+// Memory management
+
+// Header in front of each memory block. It remembers the allocator of the block.
+// Its size keeps the blocks aligned the same way as malloc does
+union CASC_BLOCK_HEADER
+{
+    PCASC_ALLOCATOR pAllocator;
+    BYTE Alignment[0x10];
+};
+
+static void * WINAPI Default_Alloc(void * /* PtrUserParam */, size_t cbSize)
+{
+    return malloc(cbSize);
+}
+
+static void * WINAPI Default_Realloc(void * /* PtrUserParam */, void * pvBlock, size_t cbSize)
+{
+    return realloc(pvBlock, cbSize);
+}
+
+static void WINAPI Default_Free(void * /* PtrUserParam */, void * pvBlock)
+{
+    free(pvBlock);
+}
+
+static CASC_ALLOCATOR DefaultAllocator = {Default_Alloc, Default_Realloc, Default_Free, NULL};
+static PCASC_ALLOCATOR GlobalAllocator = &DefaultAllocator;
+
+//-----------------------------------------------------------------------------
+// Huge page allocator. Blocks of at least CASC_HUGE_PAGE_SIZE bytes are allocated
+// from explicit huge pages if the system has them reserved. Otherwise, they are
+// mapped aligned to the huge page size and the system is advised to use transparent
+// huge pages. Smaller blocks, and all blocks on systems without huge pages, are malloc-ed.
+
+#define CASC_HUGE_PAGE_SIZE     0x200000        // Huge page size on x86/x64 and ARM64 Linux
+
+#define CASC_BLOCK_MALLOC       0               // The block was allocated by malloc
+#define CASC_BLOCK_MAPPED       1               // The block was mapped, but the system refused huge pages
+#define CASC_BLOCK_HUGE         2               // The block was mapped from explicit huge pages, or advised to use transparent huge pages
+
+// Header of each block of the huge page allocator
+union CASC_HUGE_BLOCK
+{
+    struct
+    {
+        size_t cbBlock;                         // Size of the block, without the header
+        size_t cbMapping;                       // Size of the mapping. Only if the block was mapped
+        DWORD dwType;                           // CASC_BLOCK_XXX
+    } Info;
+
+    BYTE Alignment[0x20];
+};
+
+static CASC_HUGE_BLOCK * MapHugeBlock(size_t cbMapping)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS)
+    CASC_HUGE_BLOCK * pBlock;
+    size_t cbLargePage = GetLargePageMinimum();
+
+    // Large pages need the SeLockMemoryPrivilege. Without it, VirtualAlloc fails
+    if(cbLargePage != 0 && (cbMapping % cbLargePage) == 0)
+    {
+        if((pBlock = (CASC_HUGE_BLOCK *)VirtualAlloc(NULL, cbMapping, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)) != NULL)
+        {
+            pBlock->Info.dwType = CASC_BLOCK_HUGE;
+            return pBlock;
+        }
+    }
+    return NULL;
+#elif defined(MAP_ANONYMOUS) && !defined(CASCLIB_PLATFORM_MAC)
+    CASC_HUGE_BLOCK * pBlock;
+    LPBYTE pbMapping;
+    size_t cbHead;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages. Only works if the system has them reserved
+    pBlock = (CASC_HUGE_BLOCK *)mmap(NULL, cbMapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(pBlock != (CASC_HUGE_BLOCK *)MAP_FAILED)
+    {
+        pBlock->Info.dwType = CASC_BLOCK_HUGE;
+        return pBlock;
+    }
+#endif
+
+    // Map one huge page more, so the mapping can be aligned to the huge page size
+    pbMapping = (LPBYTE)mmap(NULL, cbMapping + CASC_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pbMapping == (LPBYTE)MAP_FAILED)
+        return NULL;
+
+    // Unmap the unaligned head and the tail
+    cbHead = ALIGN_TO_SIZE((size_t)pbMapping, CASC_HUGE_PAGE_SIZE) - (size_t)pbMapping;
+    if(cbHead != 0)
+        munmap(pbMapping, cbHead);
+    munmap(pbMapping + cbHead + cbMapping, CASC_HUGE_PAGE_SIZE - cbHead);
+    pBlock = (CASC_HUGE_BLOCK *)(pbMapping + cbHead);
+
+    // Ask for transparent huge pages
+#ifdef MADV_HUGEPAGE
+    pBlock->Info.dwType = (madvise(pBlock, cbMapping, MADV_HUGEPAGE) == 0) ? CASC_BLOCK_HUGE : CASC_BLOCK_MAPPED;
+#else
+    pBlock->Info.dwType = CASC_BLOCK_MAPPED;
+#endif
+    return pBlock;
+#else
+    CASCLIB_UNUSED(cbMapping);
+    return NULL;
+#endif
+}
+
+static void UnmapHugeBlock(CASC_HUGE_BLOCK * pBlock)
+{
+#if defined(CASCLIB_PLATFORM_WINDOWS)
+    VirtualFree(pBlock, 0, MEM_RELEASE);
+#elif defined(MAP_ANONYMOUS) && !defined(CASCLIB_PLATFORM_MAC)
+    munmap(pBlock, pBlock->Info.cbMapping);
+#else
+    CASCLIB_UNUSED(pBlock);
+#endif
+}
+
+static void * WINAPI HugePage_Alloc(void * /* PtrUserParam */, size_t cbSize)
+{
+    CASC_HUGE_BLOCK * pBlock = NULL;
+    size_t cbMapping;
+
+    // Check for overflow
+    if(cbSize > ((size_t)(-1) - sizeof(CASC_HUGE_BLOCK) - CASC_HUGE_PAGE_SIZE * 2))
+        return NULL;
+
+    // Large blocks are mapped
+    if(cbSize >= CASC_HUGE_PAGE_SIZE)
+    {
+        cbMapping = ALIGN_TO_SIZE(sizeof(CASC_HUGE_BLOCK) + cbSize, CASC_HUGE_PAGE_SIZE);
+        if((pBlock = MapHugeBlock(cbMapping)) != NULL)
+        {
+            pBlock->Info.cbMapping = cbMapping;
+        }
+    }
+
+    // Small blocks, or if the mapping failed
+    if(pBlock == NULL)
+    {
+        if((pBlock = (CASC_HUGE_BLOCK *)malloc(sizeof(CASC_HUGE_BLOCK) + cbSize)) == NULL)
+            return NULL;
+        pBlock->Info.cbMapping = 0;
+        pBlock->Info.dwType = CASC_BLOCK_MALLOC;
+    }
+
+    pBlock->Info.cbBlock = cbSize;
+    return pBlock + 1;
+}
+
+static void WINAPI HugePage_Free(void * /* PtrUserParam */, void * pvBlock)
+{
+    CASC_HUGE_BLOCK * pBlock = (CASC_HUGE_BLOCK *)pvBlock - 1;
+
+    if(pBlock->Info.dwType == CASC_BLOCK_MALLOC)
+        free(pBlock);
+    else
+        UnmapHugeBlock(pBlock);
+}
+
+static void * WINAPI HugePage_Realloc(void * PtrUserParam, void * pvBlock, size_t cbSize)
+{
+    CASC_HUGE_BLOCK * pBlock = (CASC_HUGE_BLOCK *)pvBlock - 1;
+    void * pvNewBlock;
+
+    // Small malloc-ed blocks stay malloc-ed
+    if(pBlock->Info.dwType == CASC_BLOCK_MALLOC && cbSize < CASC_HUGE_PAGE_SIZE)
+    {
+        if((pBlock = (CASC_HUGE_BLOCK *)realloc(pBlock, sizeof(CASC_HUGE_BLOCK) + cbSize)) == NULL)
+            return NULL;
+        pBlock->Info.cbBlock = cbSize;
+        return pBlock + 1;
+    }
+
+    // Otherwise, allocate new block and move the data
+    if((pvNewBlock = HugePage_Alloc(PtrUserParam, cbSize)) == NULL)
+        return NULL;
+    memcpy(pvNewBlock, pvBlock, CASCLIB_MIN(cbSize, pBlock->Info.cbBlock));
+    HugePage_Free(PtrUserParam, pvBlock);
+    return pvNewBlock;
+}
+
+static CASC_ALLOCATOR HugePageAllocator = {HugePage_Alloc, HugePage_Realloc, HugePage_Free, NULL};
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+static __declspec(thread) PCASC_ALLOCATOR ThreadAllocator = NULL;
+#else
+static __thread PCASC_ALLOCATOR ThreadAllocator = NULL;
+#endif
+
+void * CascAllocBlock(size_t cbSize)
+{
+    PCASC_ALLOCATOR pAllocator = (ThreadAllocator != NULL) ? ThreadAllocator : GlobalAllocator;
+    CASC_BLOCK_HEADER * pHeader;
+
+    // Check for overflow
+    if(cbSize > ((size_t)(-1) - sizeof(CASC_BLOCK_HEADER)))
+        return NULL;
+
+    // Allocate the block and remember its allocator
+    if((pHeader = (CASC_BLOCK_HEADER *)pAllocator->PfnAlloc(pAllocator->PtrUserParam, sizeof(CASC_BLOCK_HEADER) + cbSize)) == NULL)
+        return NULL;
+    pHeader->pAllocator = pAllocator;
+    return pHeader + 1;
+}
+
+void * CascReallocBlock(void * pvBlock, size_t cbSize)
+{
+    PCASC_ALLOCATOR pAllocator;
+    CASC_BLOCK_HEADER * pHeader;
+
+    // Reallocating NULL is the same like allocating
+    if(pvBlock == NULL)
+        return CascAllocBlock(cbSize);
+
+    // Check for overflow
+    if(cbSize > ((size_t)(-1) - sizeof(CASC_BLOCK_HEADER)))
+        return NULL;
+
+    // The block stays with the allocator that allocated it
+    pHeader = (CASC_BLOCK_HEADER *)pvBlock - 1;
+    pAllocator = pHeader->pAllocator;
+    if((pHeader = (CASC_BLOCK_HEADER *)pAllocator->PfnRealloc(pAllocator->PtrUserParam, pHeader, sizeof(CASC_BLOCK_HEADER) + cbSize)) == NULL)
+        return NULL;
+    return pHeader + 1;
+}
+
+void CascFreeBlock(void * pvBlock)
+{
+    CASC_BLOCK_HEADER * pHeader;
+
+    if(pvBlock != NULL)
+    {
+        pHeader = (CASC_BLOCK_HEADER *)pvBlock - 1;
+        pHeader->pAllocator->PfnFree(pHeader->pAllocator->PtrUserParam, pHeader);
+    }
+}
+
+PCASC_ALLOCATOR CascGetHugePageAllocator()
+{
+    return &HugePageAllocator;
+}
+
+// Returns the number of bytes of the block that were allocated from huge pages or advised to use
+// transparent huge pages. Whether the system actually backs the advised memory by huge pages
+// is only visible in /proc/self/smaps (AnonHugePages), so the advised size is returned
+size_t CascGetHugePageAdvisedBytes(const void * pvBlock)
+{
+    const CASC_BLOCK_HEADER * pHeader;
+    const CASC_HUGE_BLOCK * pBlock;
+
+    if(pvBlock != NULL)
+    {
+        pHeader = (const CASC_BLOCK_HEADER *)pvBlock - 1;
+        if(pHeader->pAllocator == &HugePageAllocator)
+        {
+            pBlock = (const CASC_HUGE_BLOCK *)pHeader - 1;
+            if(pBlock->Info.dwType == CASC_BLOCK_HUGE)
+                return pBlock->Info.cbBlock;
+        }
+    }
+    return 0;
+}
+
+// Returns the allocator that has allocated the block
+PCASC_ALLOCATOR CascGetBlockAllocator(const void * pvBlock)
+{
+    return (pvBlock != NULL) ? ((const CASC_BLOCK_HEADER *)pvBlock - 1)->pAllocator : NULL;
+}
+
+PCASC_ALLOCATOR CascGetThreadAllocator()
+{
+    return ThreadAllocator;
+}
+
+PCASC_ALLOCATOR CascSetThreadAllocator(PCASC_ALLOCATOR pAllocator)
+{
+    PCASC_ALLOCATOR pSavedAllocator = ThreadAllocator;
+
+    ThreadAllocator = pAllocator;
+    return pSavedAllocator;
+}
+
+//
+// Sets the global allocator. NULL restores the default one (malloc/realloc/free).
+// Blocks that were already allocated are still freed by their original allocator,
+// so the previous allocator structure must stay valid as long as they exist.
+// Should be called before any storage is opened.
+//
+bool WINAPI CascSetAllocator(PCASC_ALLOCATOR pAllocator)
+{
+    // All functions must be present
+    if(pAllocator != NULL)
+    {
+        if(pAllocator->PfnAlloc == NULL || pAllocator->PfnRealloc == NULL || pAllocator->PfnFree == NULL)
+        {
+            SetCascError(ERROR_INVALID_PARAMETER);
+            return false;
+        }
+    }
+
+    GlobalAllocator = (pAllocator != NULL) ? pAllocator : &DefaultAllocator;
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 // GetCascError/SetCascError support for non-Windows platform
 
@@ -99,6 +418,19 @@ void SetCascError(DWORD dwErrCode)
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// CASC_BLOB support
+
+void CASC_BLOB::Free()
+{
+    // Mapped view is released by closing the stream
+    if(pStream != NULL)
+        FileStream_Close(pStream);
+    else if(pbData != NULL)
+        CASC_FREE(pbData);
+    Reset();
+}
+
 //-----------------------------------------------------------------------------
 // Linear data stream manipulation
 
@@ -621,3 +953,64 @@ void CascHash_SHA1(const void * pvDataBlock, size_t cbDataBlock, LPBYTE sha1_has
     SHA1_Update(&sha1_ctx, pvDataBlock, (u32)(cbDataBlock));
     SHA1_Final(&sha1_ctx, sha1_hash);
 }
+
+//-----------------------------------------------------------------------------
+// Process counters
+
+ULONGLONG CascGetWallTime()
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Counter;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Counter);
+    return (ULONGLONG)(Counter.QuadPart / Frequency.QuadPart) * 1000000 + (ULONGLONG)(Counter.QuadPart % Frequency.QuadPart) * 1000000 / Frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000 + (ULONGLONG)ts.tv_nsec / 1000;
+#endif
+}
+
+ULONGLONG CascGetCpuTime()
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    FILETIME CreationTime, ExitTime, KernelTime, UserTime;
+
+    if(!GetProcessTimes(GetCurrentProcess(), &CreationTime, &ExitTime, &KernelTime, &UserTime))
+        return 0;
+
+    // The times are in 100-nanosecond units
+    return ((((ULONGLONG)KernelTime.dwHighDateTime << 32) | KernelTime.dwLowDateTime) +
+            (((ULONGLONG)UserTime.dwHighDateTime << 32) | UserTime.dwLowDateTime)) / 10;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000 + (ULONGLONG)ts.tv_nsec / 1000;
+#endif
+}
+
+ULONGLONG CascGetPeakMemory()
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    PROCESS_MEMORY_COUNTERS Counters = {sizeof(PROCESS_MEMORY_COUNTERS)};
+
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(PROCESS_MEMORY_COUNTERS)))
+        return 0;
+    return Counters.PeakWorkingSetSize;
+#else
+    struct rusage Usage;
+
+    if(getrusage(RUSAGE_SELF, &Usage) != 0)
+        return 0;
+
+#ifdef CASCLIB_PLATFORM_MAC
+    return (ULONGLONG)Usage.ru_maxrss;              // Bytes on macOS
+#else
+    return (ULONGLONG)Usage.ru_maxrss * 1024;       // Kilobytes on Linux
+#endif
+#endif
+}
@@ -73,7 +73,10 @@ typedef struct _CASC_EKEY_ENTRY
 #define CASC_CE_PLAIN_DATA         0x0800           // The file data is not BLTE encoded, but in plain format
 #define CASC_CE_OPEN_CKEY_ONCE     0x1000           // Used by CascLib test program - only opens a file with given CKey once, regardless on how many file names does it have
 
-// In-memory representation of a single entry. 
+// In-memory representation of a single entry. Pointers to the entries are held
+// by the root handlers and open files, so the entries never move. Rarely needed
+// information, like the tag bit mask, is kept apart in TCascStorage; the entry
+// only has the index of it.
 struct CASC_CKEY_ENTRY
 {
     CASC_CKEY_ENTRY()
@@ -110,13 +113,13 @@ struct CASC_CKEY_ENTRY
     BYTE CKey[MD5_HASH_SIZE];                       // Content key of the full length
     BYTE EKey[MD5_HASH_SIZE];                       // Encoded key of the full length
     ULONGLONG StorageOffset;                        // Linear offset over the entire storage. 0 if not present
-    ULONGLONG TagBitMask;                           // Bitmap for the tags. 0 ig tags are not supported
     DWORD ContentSize;                              // Content size of the file
     DWORD EncodedSize;                              // Encoded size of the file
     DWORD RefCount;                                 // This is the number of file names referencing this entry
     USHORT Flags;                                   // See CASC_CE_XXX
     BYTE SpanCount;                                 // Number of spans for the file
     BYTE Priority;                                  // Number of spans for the file
+    DWORD TagMaskIndex;                             // Index of the tag bit mask in TCascStorage::TagMaskArray plus one. 0 if the file has no tags
 };
 typedef CASC_CKEY_ENTRY *PCASC_CKEY_ENTRY;
 
@@ -131,28 +134,41 @@ extern unsigned char IntToHexChar[];
 //-----------------------------------------------------------------------------
 // Memory management
 //
-// We use our own macros for allocating/freeing memory. If you want
-// to redefine them, please keep the following rules:
+// All memory is allocated by the allocator that is active in the calling thread.
+// This is either the global allocator (see CascSetAllocator) or the allocator
+// of the storage whose API function is running (see CASC_ALLOCATOR_SCOPE).
+// Each block remembers its allocator, so it can be freed from anywhere.
 //
-//  - The memory allocation must return NULL if not enough memory
+//  - The memory allocation returns NULL if not enough memory
 //    (i.e not to throw exception)
-//  - The allocating function does not need to fill the allocated buffer with zeros
-//  - The reallocating function must support NULL as the previous block
-//  - Memory freeing function must check for NULL pointer and do nothing if so
+//  - The allocating function does not fill the allocated buffer with zeros
+//  - The reallocating function supports NULL as the previous block
+//  - Memory freeing function checks for NULL pointer and does nothing if so
 //
 
+void * CascAllocBlock(size_t cbSize);
+void * CascReallocBlock(void * pvBlock, size_t cbSize);
+void   CascFreeBlock(void * pvBlock);
+
+PCASC_ALLOCATOR CascGetHugePageAllocator();
+size_t CascGetHugePageAdvisedBytes(const void * pvBlock);
+PCASC_ALLOCATOR CascGetBlockAllocator(const void * pvBlock);
+
+PCASC_ALLOCATOR CascGetThreadAllocator();
+PCASC_ALLOCATOR CascSetThreadAllocator(PCASC_ALLOCATOR pAllocator);
+
 template <typename T>
 T * CASC_REALLOC(T * old_ptr, size_t count)
 {
     // Note: If realloc fails, then the old buffer remains unfreed!
     // The caller needs to handle this
-    return (T *)realloc(old_ptr, count * sizeof(T));
+    return (T *)CascReallocBlock(old_ptr, count * sizeof(T));
 }
 
 template <typename T>
 T * CASC_ALLOC(size_t nCount)
 {
-    return (T *)malloc(nCount * sizeof(T));
+    return (T *)CascAllocBlock(nCount * sizeof(T));
 }
 
 template <typename T>
@@ -169,10 +185,31 @@ template <typename T>
 void CASC_FREE(T *& ptr)
 {
     if (ptr != NULL)
-        free(ptr);
+        CascFreeBlock((void *)ptr);
     ptr = NULL;
 }
 
+// Makes an allocator active in the calling thread, until the end of the scope.
+// NULL means the global allocator
+class CASC_ALLOCATOR_SCOPE
+{
+    public:
+
+    CASC_ALLOCATOR_SCOPE(PCASC_ALLOCATOR pAllocator)
+    {
+        m_pSavedAllocator = CascSetThreadAllocator(pAllocator);
+    }
+
+    ~CASC_ALLOCATOR_SCOPE()
+    {
+        CascSetThreadAllocator(m_pSavedAllocator);
+    }
+
+    protected:
+
+    PCASC_ALLOCATOR m_pSavedAllocator;
+};
+
 //-----------------------------------------------------------------------------
 // 32-bit ROL
 
@@ -260,6 +297,17 @@ inline ULONGLONG ConvertBytesToInteger_5(LPBYTE ValueAsBytes)
     return Value;
 }
 
+// Read the 64-bit big-endian value into ULONGLONG
+inline ULONGLONG ConvertBytesToInteger_8(LPBYTE ValueAsBytes)
+{
+    ULONGLONG Value = 0;
+
+    for(size_t i = 0; i < 8; i++)
+        Value = (Value << 0x08) | ValueAsBytes[i];
+
+    return Value;
+}
+
 inline void ConvertIntegerToBytes_4(DWORD Value, LPBYTE ValueAsBytes)
 {
     ValueAsBytes[0] = (BYTE)((Value >> 0x18) & 0xFF);
@@ -503,6 +551,7 @@ struct CASC_BLOB
         // Take the source data
         pbData = Source.pbData;
         cbData = Source.cbData;
+        pStream = Source.pStream;
 
         // Reset the source data without freeing
         Source.Reset();
@@ -533,15 +582,11 @@ struct CASC_BLOB
     {
         pbData = NULL;
         cbData = 0;
+        pStream = NULL;
     }
 
-    void Free()
-    {
-        if(pbData != NULL)
-            CASC_FREE(pbData);
-        pbData = NULL;
-        cbData = 0;
-    }
+    // Frees the data buffer or unmaps the file
+    void Free();
 
     LPBYTE End() const
     {
@@ -555,6 +600,7 @@ struct CASC_BLOB
 
     LPBYTE pbData;
     size_t cbData;
+    struct TFileStream * pStream;               // If not NULL, the data are a read-only mapped view of this stream
 };
 typedef CASC_BLOB *PCASC_BLOB;
 
@@ -612,6 +658,13 @@ void CascHash_MD5(const void * pvDataBlock, size_t cbDataBlock, LPBYTE md5_hash)
 void CascHash_SHA1(const void * pvDataBlock, size_t cbDataBlock, LPBYTE sha1_hash);
 bool CascVerifyDataBlockHash(void * pvDataBlock, size_t cbDataBlock, LPBYTE expected_md5);
 
+//-----------------------------------------------------------------------------
+// Process counters
+
+ULONGLONG CascGetWallTime();                        // Monotonic time, in microseconds
+ULONGLONG CascGetCpuTime();                         // CPU time of all threads of the process, in microseconds
+ULONGLONG CascGetPeakMemory();                      // Peak memory usage (working set) of the process since it started, in bytes
+
 //-----------------------------------------------------------------------------
 // Argument structure versioning
 // Safely retrieves field value from a structure
@@ -21,6 +21,11 @@
 #pragma warning(disable: 4800)                  // 'BOOL' : forcing value to bool 'true' or 'false' (performance warning)
 #endif
 
+//-----------------------------------------------------------------------------
+// Local variables
+
+static ULONGLONG TotalBytesRead = 0;            // Number of bytes read by all streams. See FileStream_GetTotalBytesRead
+
 //-----------------------------------------------------------------------------
 // Local functions - platform-specific functions
 
@@ -158,6 +163,72 @@ static bool BaseFile_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStr
     return true;
 }
 
+// If the number of bytes read doesn't match to required amount, return false
+// However, Blizzard's CASC handlers read encoded data so that if less than expected
+// was read, then they fill the rest with zeros
+static bool BaseFile_CheckBytesRead(TFileStream * pStream, void * pvBuffer, DWORD dwBytesToRead, DWORD dwBytesRead)
+{
+    if(dwBytesRead < dwBytesToRead)
+    {
+        if(pStream->dwFlags & STREAM_FLAG_FILL_MISSING)
+        {
+            memset((LPBYTE)pvBuffer + dwBytesRead, 0, (dwBytesToRead - dwBytesRead));
+            dwBytesRead = dwBytesToRead;
+        }
+        else
+        {
+            SetCascError(ERROR_HANDLE_EOF);
+        }
+    }
+
+    return (dwBytesRead == dwBytesToRead);
+}
+
+// Reads the data from the given offset of the file. On Linux and Mac, this is done by pread64,
+// which neither needs the stream lock nor changes the file position, so more threads can read
+// from the same file at once
+static bool BaseFile_ReadAt(TFileStream * pStream, HANDLE hFile, ULONGLONG ByteOffset, void * pvBuffer, DWORD dwBytesToRead)
+{
+    DWORD dwBytesRead = 0;
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    {
+        OVERLAPPED Overlapped = {0};
+
+        Overlapped.OffsetHigh = (DWORD)(ByteOffset >> 32);
+        Overlapped.Offset = (DWORD)ByteOffset;
+        if(!ReadFile(hFile, pvBuffer, dwBytesToRead, &dwBytesRead, &Overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+            return false;
+    }
+#endif
+
+#if defined(CASCLIB_PLATFORM_MAC) || defined(CASCLIB_PLATFORM_LINUX)
+    {
+        ssize_t bytes_read;
+
+        // The call may read less than requested even before the end of the file
+        while(dwBytesRead < dwBytesToRead)
+        {
+            bytes_read = pread64((intptr_t)hFile, (LPBYTE)pvBuffer + dwBytesRead, (size_t)(dwBytesToRead - dwBytesRead), (off64_t)(ByteOffset + dwBytesRead));
+            if(bytes_read == -1)
+            {
+                if(errno == EINTR)
+                    continue;
+                SetCascError(errno);
+                return false;
+            }
+
+            // End of the file
+            if(bytes_read == 0)
+                break;
+            dwBytesRead += (DWORD)(size_t)bytes_read;
+        }
+    }
+#endif
+
+    return BaseFile_CheckBytesRead(pStream, pvBuffer, dwBytesToRead, dwBytesRead);
+}
+
 static bool BaseFile_Read(
     TFileStream * pStream,                  // Pointer to an open stream
     ULONGLONG * pByteOffset,                // Pointer to file byte offset. If NULL, it reads from the current position
@@ -166,6 +237,13 @@ static bool BaseFile_Read(
 {
     DWORD dwBytesRead = 0;                  // Must be set by platform-specific code
 
+#if defined(CASCLIB_PLATFORM_MAC) || defined(CASCLIB_PLATFORM_LINUX)
+    // Reads from an explicit offset don't need the lock. Zero-length reads
+    // are still done below, because they are used to set the file position
+    if(pByteOffset != NULL && dwBytesToRead != 0)
+        return BaseFile_ReadAt(pStream, pStream->Base.File.hFile, pByteOffset[0], pvBuffer, dwBytesToRead);
+#endif
+
     // Synchronize the access to the TFileStream structure
     CascLock(pStream->Lock);
     {
@@ -236,23 +314,7 @@ static bool BaseFile_Read(
     }
     CascUnlock(pStream->Lock);
 
-    // If the number of bytes read doesn't match to required amount, return false
-    // However, Blizzard's CASC handlers read encoded data so that if less than expected
-    // was read, then they fill the rest with zeros
-    if(dwBytesRead < dwBytesToRead)
-    {
-        if(pStream->dwFlags & STREAM_FLAG_FILL_MISSING)
-        {
-            memset((LPBYTE)pvBuffer + dwBytesRead, 0, (dwBytesToRead - dwBytesRead));
-            dwBytesRead = dwBytesToRead;
-        }
-        else
-        {
-            SetCascError(ERROR_HANDLE_EOF);
-        }
-    }
-        
-    return (dwBytesRead == dwBytesToRead);
+    return BaseFile_CheckBytesRead(pStream, pvBuffer, dwBytesToRead, dwBytesRead);
 }
 
 /**
@@ -465,32 +527,34 @@ static void BaseFile_Init(TFileStream * pStream)
 
 static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStreamFlags)
 {
+    // The file handle is only kept if the file can grow after being mapped
+    pStream->Base.Map.hFile = INVALID_HANDLE_VALUE;
+
 #ifdef CASCLIB_PLATFORM_WINDOWS
 
     ULARGE_INTEGER FileSize;
+    DWORD dwWriteShare = (dwStreamFlags & STREAM_FLAG_WRITE_SHARE) ? FILE_SHARE_WRITE : 0;
     HANDLE hFile;
     HANDLE hMap;
     bool bResult = false;
 
-    // Keep compiler happy
-    dwStreamFlags = dwStreamFlags;
-
     // Open the file for read access
-    hFile = CreateFile(szFileName, FILE_READ_DATA, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    hFile = CreateFile(szFileName, FILE_READ_DATA, FILE_SHARE_READ | dwWriteShare, NULL, OPEN_EXISTING, 0, NULL);
     if(hFile != INVALID_HANDLE_VALUE)
     {
-        // Retrieve file size. Don't allow mapping file of a zero size.
+        // Retrieve file size. Don't allow mapping file of a zero size,
+        // nor a file that can't fit into the address space
         FileSize.LowPart = GetFileSize(hFile, &FileSize.HighPart);
-        if(FileSize.QuadPart != 0)
+        if(FileSize.QuadPart != 0 && (ULONGLONG)(size_t)FileSize.QuadPart == FileSize.QuadPart)
         {
             // Now create mapping object
-            hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, FileSize.HighPart, FileSize.LowPart, NULL);
             if(hMap != NULL)
             {
                 // Map the entire view into memory
                 // Note that this operation will fail if the file can't fit
                 // into usermode address space
-                pStream->Base.Map.pbFile = (LPBYTE)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+                pStream->Base.Map.pbFile = (LPBYTE)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, (size_t)FileSize.QuadPart);
                 if(pStream->Base.Map.pbFile != NULL)
                 {
                     // Retrieve file time
@@ -507,8 +571,11 @@ static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStre
             }
         }
 
-        // Close the file handle
-        CloseHandle(hFile);
+        // Keep the file handle if the file is shared for writing
+        if(bResult && dwWriteShare)
+            pStream->Base.Map.hFile = hFile;
+        else
+            CloseHandle(hFile);
     }
 
     // If the file is not there and is not available for random access,
@@ -523,13 +590,15 @@ static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStre
     bool bResult = false;
 
     // Open the file
-    handle = open(szFileName, O_RDONLY);
+    handle = open(szFileName, O_RDONLY | O_LARGEFILE);
     if(handle != -1)
     {
-        // Get the file size
-        if(fstat64(handle, &fileinfo) != -1)
+        // Get the file size. Files that can't fit into the address space are not mapped
+        if(fstat64(handle, &fileinfo) != -1 && (ULONGLONG)(size_t)fileinfo.st_size == (ULONGLONG)fileinfo.st_size)
         {
             pStream->Base.Map.pbFile = (LPBYTE)mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+            if(pStream->Base.Map.pbFile == (LPBYTE)MAP_FAILED)
+                pStream->Base.Map.pbFile = NULL;
             if(pStream->Base.Map.pbFile != NULL)
             {
                 // time_t is number of seconds since 1.1.1970, UTC.
@@ -541,7 +610,12 @@ static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStre
                 bResult = true;
             }
         }
-        close(handle);
+
+        // Keep the file handle if the file is shared for writing
+        if(bResult && (dwStreamFlags & STREAM_FLAG_WRITE_SHARE))
+            pStream->Base.Map.hFile = (HANDLE)handle;
+        else
+            close(handle);
     }
 
     // Did the mapping fail?
@@ -555,6 +629,35 @@ static bool BaseMap_Open(TFileStream * pStream, LPCTSTR szFileName, DWORD dwStre
     return true;
 }
 
+// Returns the part of the mapped view that is still backed by the file. Another process
+// (e.g. the game launcher) may truncate a file that is shared for writing, and accessing
+// the mapped pages past the new end of the file raises SIGBUS. Windows refuses to truncate
+// a mapped file, but the check is done there too. Files that are not shared for writing
+// are assumed to keep their size
+static ULONGLONG BaseMap_GetValidSize(TFileStream * pStream)
+{
+    ULONGLONG FileSize = pStream->Base.Map.FileSize;
+
+    if(pStream->Base.Map.hFile != INVALID_HANDLE_VALUE)
+    {
+#ifdef CASCLIB_PLATFORM_WINDOWS
+        LARGE_INTEGER CurrentSize;
+
+        if(GetFileSizeEx(pStream->Base.Map.hFile, &CurrentSize))
+            FileSize = CASCLIB_MIN(FileSize, (ULONGLONG)CurrentSize.QuadPart);
+#endif
+
+#if defined(CASCLIB_PLATFORM_MAC) || defined(CASCLIB_PLATFORM_LINUX)
+        struct stat64 fileinfo;
+
+        if(fstat64((intptr_t)pStream->Base.Map.hFile, &fileinfo) != -1)
+            FileSize = CASCLIB_MIN(FileSize, (ULONGLONG)fileinfo.st_size);
+#endif
+    }
+
+    return FileSize;
+}
+
 static bool BaseMap_Read(
     TFileStream * pStream,                  // Pointer to an open stream
     ULONGLONG * pByteOffset,                // Pointer to file byte offset. If NULL, it reads from the current position
@@ -562,20 +665,44 @@ static bool BaseMap_Read(
     DWORD dwBytesToRead)                    // Number of bytes to read from the file
 {
     ULONGLONG ByteOffset = GetByteOffset(pByteOffset, pStream->Base.Map.FilePos);
+    ULONGLONG FileSize;
+    DWORD dwBytesInView = 0;
 
     // Do we have to read anything at all?
     if(dwBytesToRead != 0)
     {
-        // Don't allow reading past file size
-        if((ByteOffset + dwBytesToRead) > pStream->Base.Map.FileSize)
-            return false;
+        // Copy the part of the data that is in the mapped view and still in the file
+        FileSize = BaseMap_GetValidSize(pStream);
+        if(ByteOffset < FileSize)
+        {
+            dwBytesInView = (DWORD)CASCLIB_MIN((ULONGLONG)dwBytesToRead, FileSize - ByteOffset);
+            memcpy(pvBuffer, pStream->Base.Map.pbFile + (size_t)ByteOffset, dwBytesInView);
+        }
 
-        // Copy the required data
-        memcpy(pvBuffer, pStream->Base.Map.pbFile + (size_t)ByteOffset, dwBytesToRead);
+        // The rest is past the end of the view. If the file is shared for writing,
+        // it may have grown or shrunk since it was mapped, so we read the rest from the file
+        if(dwBytesInView < dwBytesToRead)
+        {
+            LPBYTE pbBuffer = (LPBYTE)pvBuffer + dwBytesInView;
+            DWORD dwBytesRest = dwBytesToRead - dwBytesInView;
+
+            if(pStream->Base.Map.hFile != INVALID_HANDLE_VALUE)
+            {
+                if(!BaseFile_ReadAt(pStream, pStream->Base.Map.hFile, ByteOffset + dwBytesInView, pbBuffer, dwBytesRest))
+                    return false;
+            }
+            else
+            {
+                if(!BaseFile_CheckBytesRead(pStream, pbBuffer, dwBytesRest, 0))
+                    return false;
+            }
+        }
     }
 
-    // Move the current file position
-    pStream->Base.Map.FilePos += dwBytesToRead;
+    // Move the current file position. Reads from an explicit offset don't do that,
+    // so that more threads can read from the mapped file at once
+    if(pByteOffset == NULL || dwBytesToRead == 0)
+        pStream->Base.Map.FilePos = ByteOffset + dwBytesToRead;
     return true;
 }
 
@@ -584,13 +711,18 @@ static void BaseMap_Close(TFileStream * pStream)
 #ifdef CASCLIB_PLATFORM_WINDOWS
     if(pStream->Base.Map.pbFile != NULL)
         UnmapViewOfFile(pStream->Base.Map.pbFile);
+    if(pStream->Base.Map.hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(pStream->Base.Map.hFile);
 #endif
 
 #if defined(CASCLIB_PLATFORM_MAC) || defined(CASCLIB_PLATFORM_LINUX)
     if(pStream->Base.Map.pbFile != NULL)
         munmap(pStream->Base.Map.pbFile, (size_t )pStream->Base.Map.FileSize);
+    if(pStream->Base.Map.hFile != INVALID_HANDLE_VALUE)
+        close((intptr_t)pStream->Base.Map.hFile);
 #endif
 
+    pStream->Base.Map.hFile = INVALID_HANDLE_VALUE;
     pStream->Base.Map.pbFile = NULL;
 }
 
@@ -2365,6 +2497,194 @@ static TFileStream * Block4Stream_Open(LPCTSTR szFileName, DWORD dwStreamFlags)
     return pStream;
 }
 
+//-----------------------------------------------------------------------------
+// Local functions - block cache support
+
+// Reads the data directly from the stream
+static bool StreamReadDirect(TFileStream * pStream, ULONGLONG * pByteOffset, void * pvBuffer, DWORD dwBytesToRead)
+{
+    assert(pStream->StreamRead != NULL);
+    if(!pStream->StreamRead(pStream, pByteOffset, pvBuffer, dwBytesToRead))
+        return false;
+
+    CascInterlockedAdd64(&TotalBytesRead, dwBytesToRead);
+    return true;
+}
+
+static DWORD StreamCache_Bucket(TStreamCache * pCache, TFileStream * pStream, ULONGLONG BlockOffset)
+{
+    ULONGLONG HashValue = ((ULONGLONG)(size_t)pStream + (BlockOffset / STREAM_CACHE_BLOCK_SIZE)) * 0x9E3779B97F4A7C15ULL;
+
+    return (DWORD)((HashValue >> 32) & pCache->BucketMask);
+}
+
+static DWORD StreamCache_Find(TStreamCache * pCache, TFileStream * pStream, ULONGLONG BlockOffset)
+{
+    DWORD BlockIndex = pCache->HashTable[StreamCache_Bucket(pCache, pStream, BlockOffset)];
+
+    while(BlockIndex != STREAM_CACHE_INVALID)
+    {
+        TStreamCacheBlock & Block = pCache->Blocks[BlockIndex];
+
+        if(Block.pStream == pStream && Block.BlockOffset == BlockOffset)
+            break;
+        BlockIndex = Block.NextInBucket;
+    }
+    return BlockIndex;
+}
+
+// Removes the block from its hash bucket. The block data stay allocated for reuse
+static void StreamCache_Unlink(TStreamCache * pCache, DWORD BlockIndex)
+{
+    TStreamCacheBlock & Block = pCache->Blocks[BlockIndex];
+    PDWORD RefIndex = &pCache->HashTable[StreamCache_Bucket(pCache, Block.pStream, Block.BlockOffset)];
+
+    while(RefIndex[0] != BlockIndex)
+        RefIndex = &pCache->Blocks[RefIndex[0]].NextInBucket;
+    RefIndex[0] = Block.NextInBucket;
+    Block.pStream = NULL;
+}
+
+// Finds a free block. If there is none, the clock hand goes over the blocks,
+// gives a second chance to the referenced ones and evicts the first unreferenced one
+static DWORD StreamCache_Evict(TStreamCache * pCache)
+{
+    for(;;)
+    {
+        DWORD BlockIndex = (DWORD)pCache->ClockHand;
+        TStreamCacheBlock & Block = pCache->Blocks[BlockIndex];
+
+        pCache->ClockHand = (pCache->ClockHand + 1) % pCache->BlockCount;
+        if(Block.pStream == NULL)
+            return BlockIndex;
+
+        if(Block.bReferenced == 0)
+        {
+            StreamCache_Unlink(pCache, BlockIndex);
+            return BlockIndex;
+        }
+        Block.bReferenced = 0;
+    }
+}
+
+// Copies data from the cached block. Returns false if the block is not cached
+// or if the requested range goes beyond the valid data of the last block
+static bool StreamCache_Copy(TStreamCache * pCache, TFileStream * pStream, ULONGLONG BlockOffset, DWORD dwOffsetInBlock, LPBYTE pbBuffer, DWORD dwBytesToCopy)
+{
+    DWORD BlockIndex;
+    bool bResult = false;
+
+    CascLock(pCache->Lock);
+    if(pCache->BlockCount != 0 && (BlockIndex = StreamCache_Find(pCache, pStream, BlockOffset)) != STREAM_CACHE_INVALID)
+    {
+        TStreamCacheBlock & Block = pCache->Blocks[BlockIndex];
+
+        if((dwOffsetInBlock + dwBytesToCopy) <= Block.cbData)
+        {
+            memcpy(pbBuffer, Block.pbData + dwOffsetInBlock, dwBytesToCopy);
+            Block.bReferenced = 1;
+            bResult = true;
+        }
+    }
+    CascUnlock(pCache->Lock);
+    return bResult;
+}
+
+static void StreamCache_Insert(TStreamCache * pCache, TFileStream * pStream, ULONGLONG BlockOffset, LPBYTE pbData, DWORD cbData)
+{
+    DWORD BlockIndex;
+    DWORD Bucket;
+
+    CascLock(pCache->Lock);
+
+    // Another thread may have loaded the same block meanwhile
+    if(pCache->BlockCount != 0 && StreamCache_Find(pCache, pStream, BlockOffset) == STREAM_CACHE_INVALID)
+    {
+        TStreamCacheBlock & Block = pCache->Blocks[BlockIndex = StreamCache_Evict(pCache)];
+
+        // Allocate the block data on the first use
+        if(Block.pbData == NULL)
+            Block.pbData = CASC_ALLOC<BYTE>(STREAM_CACHE_BLOCK_SIZE);
+
+        if(Block.pbData != NULL)
+        {
+            memcpy(Block.pbData, pbData, cbData);
+            Block.pStream = pStream;
+            Block.BlockOffset = BlockOffset;
+            Block.cbData = cbData;
+            Block.bReferenced = 0;
+
+            // Link the block to the hash bucket
+            Bucket = StreamCache_Bucket(pCache, pStream, BlockOffset);
+            Block.NextInBucket = pCache->HashTable[Bucket];
+            pCache->HashTable[Bucket] = BlockIndex;
+        }
+    }
+
+    CascUnlock(pCache->Lock);
+}
+
+// Removes all blocks of the stream from the cache
+static void StreamCache_Purge(TStreamCache * pCache, TFileStream * pStream)
+{
+    CascLock(pCache->Lock);
+    for(size_t i = 0; i < pCache->BlockCount; i++)
+    {
+        if(pCache->Blocks[i].pStream == pStream)
+            StreamCache_Unlink(pCache, (DWORD)i);
+    }
+    CascUnlock(pCache->Lock);
+}
+
+// Reads the data through the block cache. The parts of blocks beyond the end
+// of the stream are never cached, as the file may grow later
+static bool StreamCache_Read(TFileStream * pStream, ULONGLONG ByteOffset, LPBYTE pbBuffer, DWORD dwBytesToRead)
+{
+    TStreamCache * pCache = pStream->pCache;
+    ULONGLONG StreamSize = 0;
+    LPBYTE pbBlock = NULL;
+    bool bResult = true;
+
+    FileStream_GetSize(pStream, &StreamSize);
+
+    while(dwBytesToRead != 0 && bResult)
+    {
+        ULONGLONG BlockOffset = ByteOffset & ~(ULONGLONG)(STREAM_CACHE_BLOCK_SIZE - 1);
+        DWORD dwOffsetInBlock = (DWORD)(ByteOffset - BlockOffset);
+        DWORD dwBytesInBlock = CASCLIB_MIN(dwBytesToRead, STREAM_CACHE_BLOCK_SIZE - dwOffsetInBlock);
+
+        if(!StreamCache_Copy(pCache, pStream, BlockOffset, dwOffsetInBlock, pbBuffer, dwBytesInBlock))
+        {
+            ULONGLONG ReadOffset = BlockOffset;
+            DWORD cbBlock;
+
+            // Read the rest directly if it goes beyond the end of the stream
+            // or if we can't allocate the block buffer
+            if((ByteOffset + dwBytesInBlock) > StreamSize || (pbBlock == NULL && (pbBlock = CASC_ALLOC<BYTE>(STREAM_CACHE_BLOCK_SIZE)) == NULL))
+            {
+                bResult = StreamReadDirect(pStream, &ByteOffset, pbBuffer, dwBytesToRead);
+                break;
+            }
+
+            // Load the entire block and insert it to the cache
+            cbBlock = (DWORD)CASCLIB_MIN(StreamSize - BlockOffset, STREAM_CACHE_BLOCK_SIZE);
+            if((bResult = StreamReadDirect(pStream, &ReadOffset, pbBlock, cbBlock)) == true)
+            {
+                memcpy(pbBuffer, pbBlock + dwOffsetInBlock, dwBytesInBlock);
+                StreamCache_Insert(pCache, pStream, BlockOffset, pbBlock, cbBlock);
+            }
+        }
+
+        // Move to the next block
+        ByteOffset += dwBytesInBlock;
+        pbBuffer += dwBytesInBlock;
+        dwBytesToRead -= dwBytesInBlock;
+    }
+
+    CASC_FREE(pbBlock);
+    return bResult;
+}
+
 //-----------------------------------------------------------------------------
 // Public functions
 
@@ -2617,8 +2937,12 @@ bool FileStream_SetCallback(TFileStream * pStream, STREAM_DOWNLOAD_CALLBACK pfnC
  */
 bool FileStream_Read(TFileStream * pStream, ULONGLONG * pByteOffset, void * pvBuffer, DWORD dwBytesToRead)
 {
-    assert(pStream->StreamRead != NULL);
-    return pStream->StreamRead(pStream, pByteOffset, pvBuffer, dwBytesToRead);
+    // Small reads at an explicit offset go through the block cache, if the stream has one.
+    // Note that cache hits don't move the current file position
+    if(pStream->pCache != NULL && pStream->pCache->BlockCount != 0 && pByteOffset != NULL && dwBytesToRead <= STREAM_CACHE_MAX_READ)
+        return StreamCache_Read(pStream, pByteOffset[0], (LPBYTE)pvBuffer, dwBytesToRead);
+
+    return StreamReadDirect(pStream, pByteOffset, pvBuffer, dwBytesToRead);
 }
 
 /**
@@ -2699,6 +3023,74 @@ bool FileStream_GetTime(TFileStream * pStream, ULONGLONG * pFileTime)
     return true;
 }
 
+/**
+ * Returns pointer to the mapped view of the file. Only works for flat streams
+ * open with BASE_PROVIDER_MAP, returns NULL for all other streams.
+ * The view is valid until the stream is closed
+ *
+ * \a pStream Pointer to an open stream
+ * \a pFileSize Pointer where to store the size of the mapped view
+ */
+LPBYTE FileStream_GetMappedView(TFileStream * pStream, ULONGLONG * pFileSize)
+{
+    // Only supported on flat, memory-mapped files
+    if((pStream->dwFlags & STREAM_PROVIDERS_MASK) != (STREAM_PROVIDER_FLAT | BASE_PROVIDER_MAP))
+    {
+        SetCascError(ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+
+    // The caller is going to access the whole view, so we count it as read
+    CascInterlockedAdd64(&TotalBytesRead, pStream->Base.Map.FileSize);
+
+    // Give the size of the view
+    if(pFileSize != NULL)
+        pFileSize[0] = pStream->Base.Map.FileSize;
+    return pStream->Base.Map.pbFile;
+}
+
+/**
+ * Returns pointer to a range of the mapped view of the file, so that the caller
+ * can use the data without copying them. Returns NULL if the stream is not
+ * a flat, memory-mapped file, or if the range doesn't lie entirely in the view.
+ * The pointer is valid until the stream is closed.
+ *
+ * If the file is shared for writing, the function also checks that the range
+ * is still in the file. Another process may truncate the file at any time, though,
+ * and reading the mapped pages past the end of the file then raises SIGBUS.
+ * The check only makes that window short; it can't close it
+ *
+ * \a pStream Pointer to an open stream
+ * \a ByteOffset Offset of the range in the file
+ * \a dwLength Length of the range, in bytes
+ */
+LPBYTE FileStream_GetMappedRange(TFileStream * pStream, ULONGLONG ByteOffset, DWORD dwLength)
+{
+    ULONGLONG FileSize;
+
+    // Only supported on flat, memory-mapped files
+    if((pStream->dwFlags & STREAM_PROVIDERS_MASK) != (STREAM_PROVIDER_FLAT | BASE_PROVIDER_MAP))
+        return NULL;
+
+    // The range must be in the mapped view and in the file. Data appended after the file was mapped must be read
+    FileSize = BaseMap_GetValidSize(pStream);
+    if(ByteOffset > FileSize || dwLength > (FileSize - ByteOffset))
+        return NULL;
+
+    // The caller is going to access the range, so we count it as read
+    CascInterlockedAdd64(&TotalBytesRead, dwLength);
+    return pStream->Base.Map.pbFile + (size_t)ByteOffset;
+}
+
+/**
+ * Returns the number of bytes read by all streams in the process,
+ * including the mapped views given by FileStream_GetMappedView and FileStream_GetMappedRange
+ */
+ULONGLONG FileStream_GetTotalBytesRead()
+{
+    return TotalBytesRead;
+}
+
 /**
  * Returns the stream flags
  *
@@ -2755,6 +3147,100 @@ bool FileStream_Replace(TFileStream * pStream, TFileStream * pNewStream)
     return true;
 }
 
+/**
+ * Creates a new temporary file in the same directory as the given file.
+ * When the data are written, FileStream_Commit replaces the given file with it.
+ * FileStream_Discard closes and deletes the temporary file
+ *
+ * \a szFileName Name of the file that will be replaced by the temporary file
+ * \a dwStreamFlags Stream flags. Must be STREAM_PROVIDER_FLAT | BASE_PROVIDER_FILE
+ */
+TFileStream * FileStream_CreateTemporary(LPCTSTR szFileName, DWORD dwStreamFlags)
+{
+    static DWORD TempFileCounter = 0;
+    TFileStream * pStream;
+    LPTSTR szTempName;
+    size_t ccTempName = _tcslen(szFileName) + 0x30;
+    DWORD dwProcessId;
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    dwProcessId = GetCurrentProcessId();
+#else
+    dwProcessId = (DWORD)getpid();
+#endif
+
+    // The name must be unique for each writer, even within one process
+    if((szTempName = CASC_ALLOC<TCHAR>(ccTempName)) == NULL)
+    {
+        SetCascError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    CascStrPrintf(szTempName, ccTempName, _T("%s.%08X%08X.tmp"), szFileName, dwProcessId, CascInterlockedIncrement(&TempFileCounter));
+
+    pStream = FileStream_CreateFile(szTempName, dwStreamFlags);
+    CASC_FREE(szTempName);
+    return pStream;
+}
+
+/**
+ * Flushes the temporary file to the disk, closes it and renames it to the target file.
+ * If the target file exists, it is replaced at once, so that other processes either
+ * see the old file or the complete new one. The old file stays valid for anyone
+ * who has it open or mapped. On failure, the temporary file is deleted.
+ * The stream is closed in all cases
+ *
+ * \a pStream Stream created by FileStream_CreateTemporary
+ * \a szFileName Name of the target file
+ */
+bool FileStream_Commit(TFileStream * pStream, LPCTSTR szFileName)
+{
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Only supported on flat files
+    assert((pStream->dwFlags & STREAM_PROVIDERS_MASK) == (STREAM_PROVIDER_FLAT | BASE_PROVIDER_FILE));
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    if(!FlushFileBuffers(pStream->Base.File.hFile))
+        dwErrCode = GetCascError();
+    pStream->BaseClose(pStream);
+
+    if(dwErrCode == ERROR_SUCCESS && !MoveFileEx(pStream->szFileName, szFileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        dwErrCode = GetCascError();
+#endif
+
+#if defined(CASCLIB_PLATFORM_MAC) || defined(CASCLIB_PLATFORM_LINUX)
+    if(fsync((intptr_t)pStream->Base.File.hFile) == -1)
+        dwErrCode = errno;
+    pStream->BaseClose(pStream);
+
+    // "rename" replaces the existing file atomically
+    if(dwErrCode == ERROR_SUCCESS && rename(pStream->szFileName, szFileName) == -1)
+        dwErrCode = errno;
+#endif
+
+    // Delete the temporary file on failure
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        _tremove(pStream->szFileName);
+        SetCascError(dwErrCode);
+    }
+
+    FileStream_Close(pStream);
+    return (dwErrCode == ERROR_SUCCESS);
+}
+
+/**
+ * Closes and deletes a temporary file created by FileStream_CreateTemporary
+ *
+ * \a pStream Stream created by FileStream_CreateTemporary
+ */
+void FileStream_Discard(TFileStream * pStream)
+{
+    pStream->BaseClose(pStream);
+    _tremove(pStream->szFileName);
+    FileStream_Close(pStream);
+}
+
 /**
  * This function closes an archive file and frees any data buffers
  * that have been allocated for stream management. The function must also
@@ -2773,6 +3259,11 @@ void FileStream_Close(TFileStream * pStream)
             FileStream_Close(pStream->pMaster);
         pStream->pMaster = NULL;
 
+        // Remove the stream's blocks from the cache, as another stream may get the same address
+        if(pStream->pCache != NULL)
+            StreamCache_Purge(pStream->pCache, pStream);
+        pStream->pCache = NULL;
+
         // Close the stream provider.
         if(pStream->StreamClose != NULL)
             pStream->StreamClose(pStream);
@@ -2788,3 +3279,123 @@ void FileStream_Close(TFileStream * pStream)
         CASC_FREE(pStream);
     }
 }
+
+//-----------------------------------------------------------------------------
+// Public functions - block cache
+
+// Creates an empty (disabled) block cache
+TStreamCache * FileStream_CreateCache()
+{
+    TStreamCache * pCache;
+
+    if((pCache = CASC_ALLOC<TStreamCache>(1)) != NULL)
+    {
+        memset(pCache, 0, sizeof(TStreamCache));
+        CascInitLock(pCache->Lock);
+    }
+    return pCache;
+}
+
+// Sets the memory budget of the cache. All cached blocks are dropped. Zero disables the cache
+bool FileStream_SetCacheSize(TStreamCache * pCache, size_t cbCacheSize)
+{
+    size_t BlockCount = cbCacheSize / STREAM_CACHE_BLOCK_SIZE;
+    size_t BucketCount = 1;
+    bool bResult = true;
+
+    CascLock(pCache->Lock);
+
+    // Free the current blocks
+    for(size_t i = 0; i < pCache->BlockCount; i++)
+        CASC_FREE(pCache->Blocks[i].pbData);
+    CASC_FREE(pCache->HashTable);
+    CASC_FREE(pCache->Blocks);
+    pCache->BlockCount = pCache->BucketMask = pCache->ClockHand = 0;
+
+    // Allocate the new blocks. Their data are allocated on first use
+    if(BlockCount != 0 && BlockCount < STREAM_CACHE_INVALID)
+    {
+        while(BucketCount < BlockCount)
+            BucketCount <<= 1;
+
+        pCache->Blocks = CASC_ALLOC<TStreamCacheBlock>(BlockCount);
+        pCache->HashTable = CASC_ALLOC<DWORD>(BucketCount);
+        if(pCache->Blocks != NULL && pCache->HashTable != NULL)
+        {
+            memset(pCache->Blocks, 0, BlockCount * sizeof(TStreamCacheBlock));
+            memset(pCache->HashTable, 0xFF, BucketCount * sizeof(DWORD));
+            pCache->BlockCount = BlockCount;
+            pCache->BucketMask = BucketCount - 1;
+        }
+        else
+        {
+            CASC_FREE(pCache->HashTable);
+            CASC_FREE(pCache->Blocks);
+            SetCascError(ERROR_NOT_ENOUGH_MEMORY);
+            bResult = false;
+        }
+    }
+
+    CascUnlock(pCache->Lock);
+    return bResult;
+}
+
+// Drops all cached blocks, e.g. when the files may have been changed. The memory stays allocated
+void FileStream_FlushCache(TStreamCache * pCache)
+{
+    if(pCache != NULL)
+    {
+        CascLock(pCache->Lock);
+        for(size_t i = 0; i < pCache->BlockCount; i++)
+            pCache->Blocks[i].pStream = NULL;
+        if(pCache->HashTable != NULL)
+            memset(pCache->HashTable, 0xFF, (pCache->BucketMask + 1) * sizeof(DWORD));
+        CascUnlock(pCache->Lock);
+    }
+}
+
+// Drops the cached blocks of one stream, e.g. when its file has been rewritten
+void FileStream_FlushCacheStream(TFileStream * pStream)
+{
+    if(pStream != NULL && pStream->pCache != NULL)
+        StreamCache_Purge(pStream->pCache, pStream);
+}
+
+// Gives the memory held by the cache
+size_t FileStream_GetCacheBytes(TStreamCache * pCache)
+{
+    size_t cbAllocated = 0;
+
+    if(pCache != NULL)
+    {
+        CascLock(pCache->Lock);
+        if(pCache->BlockCount != 0)
+        {
+            cbAllocated = (pCache->BlockCount * sizeof(TStreamCacheBlock)) + ((pCache->BucketMask + 1) * sizeof(DWORD));
+            for(size_t i = 0; i < pCache->BlockCount; i++)
+                cbAllocated += (pCache->Blocks[i].pbData != NULL) ? STREAM_CACHE_BLOCK_SIZE : 0;
+        }
+        CascUnlock(pCache->Lock);
+    }
+    return cbAllocated;
+}
+
+// Frees the cache. All streams that use the cache must be closed before
+void FileStream_FreeCache(TStreamCache * pCache)
+{
+    if(pCache != NULL)
+    {
+        FileStream_SetCacheSize(pCache, 0);
+        CascFreeLock(pCache->Lock);
+        CASC_FREE(pCache);
+    }
+}
+
+// Attaches the cache to the stream. The cache must stay valid until the stream is closed
+void FileStream_SetCache(TFileStream * pStream, TStreamCache * pCache)
+{
+    if(pStream != NULL)
+    {
+        pStream->pCache = pCache;
+    }
+}
@@ -168,6 +168,7 @@ union TBaseProviderData
         ULONGLONG FilePos;                  // Current file position
         ULONGLONG FileTime;                 // Last write time
         LPBYTE pbFile;                      // Pointer to mapped view
+        HANDLE hFile;                       // File handle, kept for reading past the view. Can be INVALID_HANDLE_VALUE
     } Map;
 
     struct
@@ -215,6 +216,7 @@ struct TFileStream
 
     ULONGLONG StreamSize;                   // Stream size (can be less than file size)
     ULONGLONG StreamPos;                    // Stream position
+    struct TStreamCache * pCache;           // Cache of the stream blocks. Can be shared by more streams
     DWORD BuildNumber;                      // Game build number
     DWORD dwFlags;                          // Stream flags
 
@@ -246,6 +248,35 @@ struct TEncryptedStream : public TBlockStream
     BYTE Key[ENCRYPTED_CHUNK_SIZE];         // File key
 };
 
+//-----------------------------------------------------------------------------
+// Structures for the cache of stream blocks. One cache can be shared by more streams.
+// Small reads at an explicit offset are served from aligned blocks kept in memory;
+// when the cache is full, blocks are evicted by the clock algorithm
+
+#define STREAM_CACHE_BLOCK_SIZE     0x00010000  // Size of one cached block. Blocks are aligned to their size
+#define STREAM_CACHE_MAX_READ       0x00040000  // Larger reads bypass the cache
+#define STREAM_CACHE_INVALID        0xFFFFFFFF  // Invalid index of a cache block
+
+struct TStreamCacheBlock
+{
+    TFileStream * pStream;                  // Stream the block belongs to. NULL if the block is free
+    ULONGLONG BlockOffset;                  // Offset of the block in the stream
+    LPBYTE pbData;                          // Data of the block. Allocated on first use
+    DWORD cbData;                           // Number of valid bytes in the block
+    DWORD NextInBucket;                     // Next block in the same hash bucket
+    DWORD bReferenced;                      // Nonzero if the block was used since the clock hand passed it
+};
+
+struct TStreamCache
+{
+    CASC_LOCK Lock;                         // Lock for the entire cache
+    TStreamCacheBlock * Blocks;             // Array of cache blocks
+    PDWORD HashTable;                       // Hash table of (stream, offset) -> block index
+    size_t BlockCount;                      // Number of blocks. Zero if the cache is disabled
+    size_t BucketMask;                      // Number of hash buckets minus one
+    size_t ClockHand;                       // Next block to be checked for eviction
+};
+
 //-----------------------------------------------------------------------------
 // Public functions for file stream
 
@@ -263,8 +294,22 @@ bool FileStream_GetSize(TFileStream * pStream, ULONGLONG * pFileSize);
 bool FileStream_GetPos(TFileStream * pStream, ULONGLONG * pByteOffset);
 bool FileStream_GetTime(TFileStream * pStream, ULONGLONG * pFT);
 bool FileStream_GetFlags(TFileStream * pStream, PDWORD pdwStreamFlags);
+LPBYTE FileStream_GetMappedView(TFileStream * pStream, ULONGLONG * pFileSize);
+LPBYTE FileStream_GetMappedRange(TFileStream * pStream, ULONGLONG ByteOffset, DWORD dwLength);
+ULONGLONG FileStream_GetTotalBytesRead();
 bool FileStream_Replace(TFileStream * pStream, TFileStream * pNewStream);
+TFileStream * FileStream_CreateTemporary(LPCTSTR szFileName, DWORD dwStreamFlags);
+bool FileStream_Commit(TFileStream * pStream, LPCTSTR szFileName);
+void FileStream_Discard(TFileStream * pStream);
 void FileStream_Close(TFileStream * pStream);
 
+TStreamCache * FileStream_CreateCache();
+bool FileStream_SetCacheSize(TStreamCache * pCache, size_t cbCacheSize);
+void FileStream_FlushCache(TStreamCache * pCache);
+void FileStream_FlushCacheStream(TFileStream * pStream);
+size_t FileStream_GetCacheBytes(TStreamCache * pCache);
+void FileStream_FreeCache(TStreamCache * pCache);
+void FileStream_SetCache(TFileStream * pStream, TStreamCache * pCache);
+
 
 #endif // __FILESTREAM_H__
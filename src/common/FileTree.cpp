@@ -32,6 +32,33 @@ static BYTE PathSeparators[256] =
 
 #define START_ITEM_COUNT          0x4000
 
+// The node names are front-coded. Each entry in the name table begins with a byte
+// with the number of leading chars shared with the last full name (the "base name").
+// If zero, then the full name follows, and the entry becomes the new base name.
+// Otherwise, a distance to the base name entry follows (7 bits per byte, the highest
+// bit set if more bytes follow) and then the rest of the name. The length of the name
+// is in the file node. Names are only coded against a full name, never against
+// another coded name, so every name is decoded in O(length).
+#define NAME_MIN_SHARED_CHARS     4                 // Shorter shared prefixes are not worth coding
+#define NAME_MAX_SHARED_CHARS     0xFF              // The shared length must fit into one byte
+
+// Header of the file tree, as stored in the storage snapshot. The header is followed by:
+// CASC_FILE_NODE[NodeCount] with pCKeyEntry set to NULL
+// DWORD[NodeCount] with indexes of the CKey entries (CASC_INVALID_INDEX if none)
+// char[NameLength] with the content of the (front-coded) name table
+typedef struct _FILE_TREE_SNAPSHOT
+{
+    DWORD Flags;                                    // FTREE_FLAG_XXX the tree has been created with
+    DWORD KeyLength;                                // Length of the key supported by the root handler
+    DWORD NodeSize;                                 // Size of one file node, including extra values
+    DWORD NodeCount;                                // Number of file nodes
+    DWORD NameLength;                               // Length of the name table, in bytes
+    DWORD FolderNodes;                              // Number of folder nodes
+    DWORD FileNodes;                                // Number of file nodes
+    DWORD Reserved;                                 // Alignment to 8 bytes
+
+} FILE_TREE_SNAPSHOT, *PFILE_TREE_SNAPSHOT;
+
 inline DWORD GET_NODE_INT32(void * node, size_t offset)
 {
     PDWORD PtrValue = (PDWORD)((LPBYTE)node + offset);
@@ -72,7 +99,7 @@ inline void SET_NODE_INT32(void * node, size_t offset, DWORD value)
 // Protected functions
 
 // Inserts a new file node to the file tree.
-// If the pointer to file node array changes, the function also rebuilds all maps
+// The nodes never move, so the maps stay valid when the node table grows
 PCASC_FILE_NODE CASC_FILE_TREE::InsertNew(PCASC_CKEY_ENTRY pCKeyEntry)
 {
     PCASC_FILE_NODE pFileNode;
@@ -93,10 +120,10 @@ PCASC_FILE_NODE CASC_FILE_TREE::InsertNew(PCASC_CKEY_ENTRY pCKeyEntry)
 PCASC_FILE_NODE CASC_FILE_TREE::InsertNew()
 {
     PCASC_FILE_NODE pFileNode;
-    void * SaveItemArray = NodeTable.ItemArray();   // We need to save the array pointers. If it changes, we must rebuild both maps
+    size_t SaveItemCountMax = NodeTable.ItemCountMax();
 
     // Create a brand new node
-    pFileNode = (PCASC_FILE_NODE)NodeTable.Insert(1);
+    pFileNode = (PCASC_FILE_NODE)NodeTable.Insert();
     if(pFileNode != NULL)
     {
         // Initialize the file node
@@ -111,11 +138,11 @@ PCASC_FILE_NODE CASC_FILE_TREE::InsertNew()
         // will use the uninitialized one
         SetExtras(pFileNode, CASC_INVALID_ID, CASC_INVALID_ID, CASC_INVALID_ID);
 
-        // If the array pointer changed or we are close to the size of the array, we need to rebuild the maps
-        if(NodeTable.ItemArray() != SaveItemArray || (NodeTable.ItemCount() * 3 / 2) > NameMap.HashTableSize())
+        // The name map grows by itself, but the Bloom filter has fixed capacity.
+        // If the node table has grown, the filter must be re-created for the new capacity
+        if(bNameFilter && NodeTable.ItemCountMax() != SaveItemCountMax)
         {
-            // Rebuild both maps. Note that rebuilding also inserts all items to the maps, so no need to insert them here
-            if(!RebuildNameMaps())
+            if(NameMap.CreateFilter(NodeTable.ItemCountMax()) != ERROR_SUCCESS)
             {
                 pFileNode = NULL;
                 assert(false);
@@ -165,22 +192,106 @@ bool CASC_FILE_TREE::InsertToIdTable(PCASC_FILE_NODE pFileNode)
 
 bool CASC_FILE_TREE::SetNodePlainName(PCASC_FILE_NODE pFileNode, const char * szPlainName, const char * szPlainNameEnd)
 {
-    char * szNodeName;
+    const char * szBaseName;
+    LPBYTE pbEntry;
     size_t nLength = (szPlainNameEnd - szPlainName);
+    size_t nNameIndex;
+    size_t nDistance;
+    size_t nShared = 0;
+    BYTE Header[6];
+    BYTE * pbHeader = Header;
+
+    // Count the chars shared with the base name
+    if(NameBaseIndex != CASC_INVALID_INDEX)
+    {
+        szBaseName = (const char *)NameTable.OffsetToPointer(NameBaseIndex + 1);
+        while(nShared < NameBaseLength && nShared < nLength && nShared < NAME_MAX_SHARED_CHARS && szBaseName[nShared] == szPlainName[nShared])
+            nShared++;
+    }
 
-    // Insert all chars to the name array
-    szNodeName = (char *)NameTable.Insert(nLength);
-    if(szNodeName != NULL)
+    // Shorter shared parts are not worth coding
+    if(nShared < NAME_MIN_SHARED_CHARS)
+        nShared = 0;
+
+    // Prepare the header of the entry. The entry can't cross a chunk of the name table;
+    // if it doesn't fit, it moves to the next chunk, which changes the distance to the base name
+    for(nNameIndex = NameTable.AppendedBytes(); ; nNameIndex = NameTable.AppendOffset(pbHeader - Header + nLength - nShared))
     {
-        // Copy the plain name to the node. Do not include the string terminator
-        memcpy(szNodeName, szPlainName, nLength);
+        pbHeader = Header;
+        *pbHeader++ = (BYTE)nShared;
+        if(nShared != 0)
+        {
+            for(nDistance = nNameIndex - NameBaseIndex; nDistance >= 0x80; nDistance >>= 7)
+                *pbHeader++ = (BYTE)(nDistance | 0x80);
+            *pbHeader++ = (BYTE)nDistance;
+        }
 
-        // Supply the file name to the file node
-        pFileNode->NameIndex = (DWORD)NameTable.IndexOf(szNodeName);
-        pFileNode->NameLength = (USHORT)nLength;
-        return true;
+        if(NameTable.AppendOffset(pbHeader - Header + nLength - nShared) == nNameIndex)
+            break;
     }
-    return false;
+
+    // Insert the header and the rest of the name. Do not include the string terminator
+    if((pbEntry = (LPBYTE)NameTable.Append((pbHeader - Header) + (nLength - nShared))) == NULL)
+        return false;
+    memcpy(pbEntry, Header, (pbHeader - Header));
+    memcpy(pbEntry + (pbHeader - Header), szPlainName + nShared, nLength - nShared);
+
+    // A full name becomes the base for the next names
+    if(nShared == 0)
+    {
+        NameBaseIndex = nNameIndex;
+        NameBaseLength = nLength;
+    }
+
+    // Supply the file name to the file node
+    pFileNode->NameIndex = (DWORD)nNameIndex;
+    pFileNode->NameLength = (USHORT)nLength;
+    return true;
+}
+
+// Decodes the plain name of the node. Returns the length of the name, or 0 if it doesn't fit.
+// The entries may come from a storage snapshot, so they are verified before use
+size_t CASC_FILE_TREE::GetNodePlainName(char * szBuffer, char * szBufferEnd, PCASC_FILE_NODE pFileNode)
+{
+    LPBYTE pbEntry;
+    LPBYTE pbEntryEnd;
+    LPBYTE pbBaseName;
+    size_t nLength = pFileNode->NameLength;
+    size_t cbBaseName = 0;
+    size_t cbEntry = 0;
+    size_t nDistance = 0;
+    size_t nShared;
+
+    // Nodes without name have nothing in the name table. No entry crosses the end of a chunk
+    pbEntry = NameTable.OffsetToPointer(pFileNode->NameIndex, &cbEntry);
+    if(pbEntry == NULL || nLength == 0 || (szBuffer + nLength) >= szBufferEnd)
+        return 0;
+    pbEntryEnd = pbEntry + cbEntry;
+    nShared = *pbEntry++;
+
+    // Copy the part shared with the base name
+    if(nShared != 0)
+    {
+        for(DWORD nShift = 0; pbEntry < pbEntryEnd && nShift < 32; nShift += 7)
+        {
+            nDistance |= (size_t)(pbEntry[0] & 0x7F) << nShift;
+            if((*pbEntry++ & 0x80) == 0)
+                break;
+        }
+
+        if(nShared > nLength || nDistance == 0 || nDistance > pFileNode->NameIndex)
+            return 0;
+        pbBaseName = NameTable.OffsetToPointer(pFileNode->NameIndex - nDistance + 1, &cbBaseName);
+        if(pbBaseName == NULL || nShared > cbBaseName)
+            return 0;
+        memcpy(szBuffer, pbBaseName, nShared);
+    }
+
+    // Copy the rest of the name
+    if((pbEntry + nLength - nShared) > pbEntryEnd)
+        return 0;
+    memcpy(szBuffer + nShared, pbEntry, nLength - nShared);
+    return nLength;
 }
 
 bool CASC_FILE_TREE::SetKeyLength(DWORD aKeyLength)
@@ -191,6 +302,20 @@ bool CASC_FILE_TREE::SetKeyLength(DWORD aKeyLength)
     return true;
 }
 
+DWORD CASC_FILE_TREE::CreateNameFilter()
+{
+    bNameFilter = true;
+    return NameMap.CreateFilter(NodeTable.ItemCountMax());
+}
+
+void CASC_FILE_TREE::GetMemoryUsage(PCASC_STORAGE_MEMORY_USAGE pUsage)
+{
+    pUsage->FileTreeNodeTable += NodeTable.BytesAllocated();
+    pUsage->FileTreeNameTable += NameTable.BytesAllocated();
+    pUsage->FileTreeFileDataIds += FileDataIds.BytesAllocated();
+    pUsage->FileTreeNameMap += NameMap.BytesAllocated();
+}
+
 DWORD CASC_FILE_TREE::GetNextFileDataId()
 {
     if(FileDataIds.IsInitialized())
@@ -209,6 +334,8 @@ bool CASC_FILE_TREE::RebuildNameMaps()
     // Create new map map "FullName -> CASC_FILE_NODE"
     if(NameMap.Create(nMaxItems, sizeof(ULONGLONG), FIELD_OFFSET(CASC_FILE_NODE, FileNameHash)) != ERROR_SUCCESS)
         return false;
+    if(bNameFilter && NameMap.CreateFilter(nMaxItems) != ERROR_SUCCESS)
+        return false;
 
     // Reset the entire array, but buffers allocated
     FileDataIds.Reset();
@@ -243,6 +370,7 @@ DWORD CASC_FILE_TREE::Create(DWORD Flags)
 
     // Initialize the file tree
     memset(this, 0, sizeof(CASC_FILE_TREE));
+    NameBaseIndex = CASC_INVALID_INDEX;
     KeyLength = MD5_HASH_SIZE;
 
     // Shall we use the data ID in the tree node?
@@ -275,24 +403,20 @@ DWORD CASC_FILE_TREE::Create(DWORD Flags)
     FileNodeSize = ALIGN_TO_SIZE(FileNodeSize, 8);
 
     // Initialize the dynamic array
+    // The name table needs no creating, it gets its first chunk with the first name
     dwErrCode = NodeTable.Create(FileNodeSize, START_ITEM_COUNT);
     if(dwErrCode == ERROR_SUCCESS)
     {
-        // Create the dynamic array that will hold the node names
-        dwErrCode = NameTable.Create<char>(START_ITEM_COUNT);
-        if(dwErrCode == ERROR_SUCCESS)
+        // Insert the first "root" node, without name
+        pRootNode = (PCASC_FILE_NODE)NodeTable.Insert();
+        if(pRootNode != NULL)
         {
-            // Insert the first "root" node, without name
-            pRootNode = (PCASC_FILE_NODE)NodeTable.Insert(1);
-            if(pRootNode != NULL)
-            {
-                // Initialize the node
-                memset(pRootNode, 0, NodeTable.ItemSize());
-                pRootNode->Parent = CASC_INVALID_INDEX;
-                pRootNode->NameIndex = CASC_INVALID_INDEX;
-                pRootNode->Flags = CFN_FLAG_FOLDER;
-                SetExtras(pRootNode, CASC_INVALID_ID, CASC_INVALID_ID, CASC_INVALID_ID);
-            }
+            // Initialize the node
+            memset(pRootNode, 0, NodeTable.ItemSize());
+            pRootNode->Parent = CASC_INVALID_INDEX;
+            pRootNode->NameIndex = CASC_INVALID_INDEX;
+            pRootNode->Flags = CFN_FLAG_FOLDER;
+            SetExtras(pRootNode, CASC_INVALID_ID, CASC_INVALID_ID, CASC_INVALID_ID);
         }
     }
 
@@ -424,7 +548,7 @@ PCASC_FILE_NODE CASC_FILE_TREE::ItemAt(size_t nItemIndex)
     return (PCASC_FILE_NODE)NodeTable.ItemAt(nItemIndex);
 }
 
-PCASC_FILE_NODE CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, size_t nItemIndex)
+PCASC_FILE_NODE CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, size_t nItemIndex, PCASC_PATH_CACHE pCache)
 {
     PCASC_FILE_NODE * RefFileNode;
     PCASC_FILE_NODE pFileNode = NULL;
@@ -444,16 +568,16 @@ PCASC_FILE_NODE CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, size_t
     }
 
     // Construct the full path
-    PathAt(szBuffer, cchBuffer, pFileNode);
+    PathAt(szBuffer, cchBuffer, pFileNode, pCache);
     return pFileNode;
 }
 
-size_t CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, PCASC_FILE_NODE pFileNode)
+size_t CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, PCASC_FILE_NODE pFileNode, PCASC_PATH_CACHE pCache)
 {
     PCASC_FILE_NODE pParentNode;
-    const char * szNamePtr;
     char * szSaveBuffer = szBuffer;
     char * szBufferEnd = szBuffer + cchBuffer - 1;
+    size_t nLength;
 
     if(pFileNode != NULL && pFileNode->Parent != CASC_INVALID_INDEX)
     {
@@ -461,18 +585,32 @@ size_t CASC_FILE_TREE::PathAt(char * szBuffer, size_t cchBuffer, PCASC_FILE_NODE
         pParentNode = (PCASC_FILE_NODE)NodeTable.ItemAt(pFileNode->Parent);
         if(pParentNode != NULL)
         {
-            // Query the parent and move the buffer
-            szBuffer = szBuffer + PathAt(szBuffer, cchBuffer, pParentNode);
+            // Use the cached parent path, if it was built for the same buffer size
+            if(pCache != NULL && pCache->pParentNode == pParentNode && pCache->cchBuffer == cchBuffer)
+            {
+                memcpy(szBuffer, pCache->szPath, pCache->nLength);
+                szBuffer += pCache->nLength;
+            }
+            else
+            {
+                // Query the parent and move the buffer
+                nLength = PathAt(szBuffer, cchBuffer, pParentNode);
+
+                // Remember the parent path for the next node
+                if(pCache != NULL && nLength < _countof(pCache->szPath))
+                {
+                    memcpy(pCache->szPath, szBuffer, nLength);
+                    pCache->pParentNode = pParentNode;
+                    pCache->cchBuffer = cchBuffer;
+                    pCache->nLength = nLength;
+                }
+                szBuffer += nLength;
+            }
         }
 
-        // Retrieve the node name
-        szNamePtr = (const char *)NameTable.ItemAt(pFileNode->NameIndex);
-
-        // Check whether we have enough space
-        if((szBuffer + pFileNode->NameLength) < szBufferEnd)
+        // Copy the node name, if we have enough space
+        if(pFileNode->NameLength == 0 || (nLength = GetNodePlainName(szBuffer, szBufferEnd, pFileNode)) != 0)
         {
-            // Copy the path part
-            memcpy(szBuffer, szNamePtr, pFileNode->NameLength);
             szBuffer += pFileNode->NameLength;
 
             // Append backslash
@@ -738,3 +876,131 @@ void CASC_FILE_TREE::SetExtras(PCASC_FILE_NODE pFileNode, DWORD FileDataId, DWOR
         SET_NODE_INT32(pFileNode, ContentFlagsOffset, ContentFlags);
     }
 }
+
+DWORD CASC_FILE_TREE::Save(CASC_ARRAY & Snapshot, CASC_CHUNKED_ARRAY & CKeyArray)
+{
+    FILE_TREE_SNAPSHOT TreeHeader;
+    PCASC_FILE_NODE pFileNode;
+    CASC_FILE_NODE FileNode;
+    LPBYTE pbChunk;
+    size_t nNodeCount = NodeTable.ItemCount();
+    size_t nNodeSize = NodeTable.ItemSize();
+    size_t cbChunk = 0;
+    DWORD CKeyIndex;
+
+    // Sanity check
+    assert(nNodeSize <= sizeof(CASC_FILE_NODE));
+
+    // Prepare the header of the tree
+    memset(&TreeHeader, 0, sizeof(FILE_TREE_SNAPSHOT));
+    TreeHeader.Flags |= (FileDataIdOffset != 0) ? FTREE_FLAG_USE_DATA_ID : 0;
+    TreeHeader.Flags |= (LocaleFlagsOffset != 0) ? FTREE_FLAG_USE_LOCALE_FLAGS : 0;
+    TreeHeader.Flags |= (ContentFlagsOffset != 0) ? FTREE_FLAG_USE_CONTENT_FLAGS : 0;
+    TreeHeader.KeyLength = KeyLength;
+    TreeHeader.NodeSize = (DWORD)nNodeSize;
+    TreeHeader.NodeCount = (DWORD)nNodeCount;
+    TreeHeader.NameLength = (DWORD)NameTable.AppendedBytes();
+    TreeHeader.FolderNodes = (DWORD)FolderNodes;
+    TreeHeader.FileNodes = (DWORD)FileNodes;
+    if(Snapshot.Insert(&TreeHeader, sizeof(FILE_TREE_SNAPSHOT)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+
+    // Store the file nodes without the CKey entry pointers
+    for(size_t i = 0; i < nNodeCount; i++)
+    {
+        memcpy(&FileNode, NodeTable.ItemAt(i), nNodeSize);
+        FileNode.pCKeyEntry = NULL;
+
+        if(Snapshot.Insert(&FileNode, nNodeSize) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Store the CKey entry pointers as indexes to the CKey array.
+    // If the node points to a CKey entry outside the array, we can't store the tree
+    for(size_t i = 0; i < nNodeCount; i++)
+    {
+        pFileNode = (PCASC_FILE_NODE)NodeTable.ItemAt(i);
+        CKeyIndex = CASC_INVALID_INDEX;
+
+        if(pFileNode->pCKeyEntry != NULL)
+        {
+            if((CKeyIndex = (DWORD)CKeyArray.IndexOf(pFileNode->pCKeyEntry)) == CASC_INVALID_INDEX)
+                return ERROR_NOT_SUPPORTED;
+        }
+
+        if(Snapshot.Insert(&CKeyIndex, sizeof(DWORD)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Store the name table, chunk by chunk. The skipped ends of the chunks are stored too
+    for(size_t nOffset = 0; nOffset < TreeHeader.NameLength; nOffset += cbChunk)
+    {
+        if((pbChunk = NameTable.OffsetToPointer(nOffset, &cbChunk)) == NULL)
+            return ERROR_BAD_FORMAT;
+        if(Snapshot.Insert(pbChunk, cbChunk) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return ERROR_SUCCESS;
+}
+
+DWORD CASC_FILE_TREE::Load(LPBYTE pbDataPtr, LPBYTE pbDataEnd, CASC_CHUNKED_ARRAY & CKeyArray)
+{
+    FILE_TREE_SNAPSHOT TreeHeader;
+    PCASC_FILE_NODE pFileNode;
+    LPBYTE pbCKeyIndexes;
+    LPBYTE pbFileNodes;
+    LPBYTE pbNameTable;
+    LPBYTE pbChunk;
+    size_t cbChunk;
+    DWORD CKeyIndex;
+    DWORD dwErrCode;
+
+    // Capture the header of the tree
+    if((pbDataPtr + sizeof(FILE_TREE_SNAPSHOT)) > pbDataEnd)
+        return ERROR_BAD_FORMAT;
+    memcpy(&TreeHeader, pbDataPtr, sizeof(FILE_TREE_SNAPSHOT));
+
+    // Verify the size of the tree data
+    pbFileNodes = pbDataPtr + sizeof(FILE_TREE_SNAPSHOT);
+    pbCKeyIndexes = pbFileNodes + ((size_t)TreeHeader.NodeSize * TreeHeader.NodeCount);
+    pbNameTable = pbCKeyIndexes + ((size_t)TreeHeader.NodeCount * sizeof(DWORD));
+    if(TreeHeader.NodeCount == 0 || (pbNameTable + TreeHeader.NameLength) > pbDataEnd)
+        return ERROR_BAD_FORMAT;
+
+    // Re-create the tree with the same flags. This will give us the same node size
+    Free();
+    if((dwErrCode = Create(TreeHeader.Flags)) != ERROR_SUCCESS)
+        return dwErrCode;
+    if(NodeTable.ItemSize() != TreeHeader.NodeSize || !SetKeyLength(TreeHeader.KeyLength))
+        return ERROR_BAD_FORMAT;
+
+    // Allocate the node table large enough to hold all items at once
+    NodeTable.Free();
+    if((dwErrCode = NodeTable.Create(TreeHeader.NodeSize, CASCLIB_MAX(TreeHeader.NodeCount, START_ITEM_COUNT))) != ERROR_SUCCESS)
+        return dwErrCode;
+    NodeTable.Insert(pbFileNodes, TreeHeader.NodeCount);
+
+    // Copy the name table chunk by chunk, so that the names keep their offsets
+    for(size_t nOffset = 0; nOffset < TreeHeader.NameLength; nOffset += cbChunk)
+    {
+        cbChunk = CASCLIB_MIN(TreeHeader.NameLength - nOffset, CASC_ARENA_CHUNK_SIZE - (nOffset % CASC_ARENA_CHUNK_SIZE));
+        if((pbChunk = (LPBYTE)NameTable.Append(cbChunk)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        memcpy(pbChunk, pbNameTable + nOffset, cbChunk);
+    }
+
+    // Convert the CKey indexes back to pointers
+    for(DWORD i = 0; i < TreeHeader.NodeCount; i++)
+    {
+        memcpy(&CKeyIndex, pbCKeyIndexes + (i * sizeof(DWORD)), sizeof(DWORD));
+        pFileNode = (PCASC_FILE_NODE)NodeTable.ItemAt(i);
+        pFileNode->pCKeyEntry = (PCASC_CKEY_ENTRY)CKeyArray.ItemAt(CKeyIndex);
+    }
+
+    // Restore the counters
+    FolderNodes = TreeHeader.FolderNodes;
+    FileNodes = TreeHeader.FileNodes;
+
+    // Rebuild the map of names and the array of file data ids
+    return RebuildNameMaps() ? ERROR_SUCCESS : ERROR_NOT_ENOUGH_MEMORY;
+}
@@ -37,6 +37,17 @@ typedef struct _CASC_FILE_NODE
                                                     // ContentFlags: Only if FTREE_FLAG_USE_CONTENT_FLAGS specified at create
 } CASC_FILE_NODE, *PCASC_FILE_NODE;
 
+// Cache of the most recently built parent path. When enumerating the tree,
+// neighbouring nodes mostly share the parent folder, so PathAt only appends
+// the node name to the cached path instead of walking all the parents again
+typedef struct _CASC_PATH_CACHE
+{
+    PCASC_FILE_NODE pParentNode;                    // Parent node whose path is cached. NULL if none
+    size_t cchBuffer;                               // Size of the buffer the path was built for (affects truncation)
+    size_t nLength;                                 // Length of the cached path, including the trailing separator
+    char szPath[MAX_PATH];                          // The cached path of the parent node
+} CASC_PATH_CACHE, *PCASC_PATH_CACHE;
+
 // Main structure for the file tree
 class CASC_FILE_TREE
 {
@@ -51,10 +62,11 @@ class CASC_FILE_TREE
     PCASC_FILE_NODE InsertByHash(PCASC_CKEY_ENTRY pCKeyEntry, ULONGLONG FileNameHash, DWORD FileDataId, DWORD LocaleFlags = CASC_INVALID_ID, DWORD ContentFlags = CASC_INVALID_ID);
     PCASC_FILE_NODE InsertById(PCASC_CKEY_ENTRY pCKeyEntry, DWORD FileDataId, DWORD LocaleFlags = CASC_INVALID_ID, DWORD ContentFlags = CASC_INVALID_ID);
 
-    // Returns an item at the given index. The PathAt also builds the full path of the node
+    // Returns an item at the given index. The PathAt also builds the full path of the node.
+    // The optional path cache speeds up building paths of many nodes in a row
     PCASC_FILE_NODE ItemAt(size_t nItemIndex);
-    PCASC_FILE_NODE PathAt(char * szBuffer, size_t cchBuffer, size_t nItemIndex);
-    size_t PathAt(char * szBuffer, size_t cchBuffer, PCASC_FILE_NODE pFileNode);
+    PCASC_FILE_NODE PathAt(char * szBuffer, size_t cchBuffer, size_t nItemIndex, PCASC_PATH_CACHE pCache = NULL);
+    size_t PathAt(char * szBuffer, size_t cchBuffer, PCASC_FILE_NODE pFileNode, PCASC_PATH_CACHE pCache = NULL);
 
     // Finds a file using its full path, FileDataId or CKey/EKey
     PCASC_FILE_NODE Find(const char * szFullPath, DWORD FileDataId, struct _CASC_FIND_DATA * pFindData);
@@ -82,6 +94,17 @@ class CASC_FILE_TREE
     // Retrieve the maximum FileDataId ever inserted
     DWORD GetNextFileDataId();
 
+    // Creates a Bloom filter for lookups by name hash. It's kept when the name map is rebuilt
+    DWORD CreateNameFilter();
+
+    // Adds the memory held by the tree to the storage memory usage
+    void GetMemoryUsage(struct _CASC_STORAGE_MEMORY_USAGE * pUsage);
+
+    // Saves the tree to a storage snapshot or restores it from a snapshot.
+    // The CKey entry pointers are stored as indexes to the given CKey array
+    DWORD Save(CASC_ARRAY & Snapshot, CASC_CHUNKED_ARRAY & CKeyArray);
+    DWORD Load(LPBYTE pbDataPtr, LPBYTE pbDataEnd, CASC_CHUNKED_ARRAY & CKeyArray);
+
 #ifdef CASCLIB_DEBUG
     void DumpFileDataIds(const char * szFileName)
     {
@@ -97,10 +120,11 @@ class CASC_FILE_TREE
     bool InsertToIdTable(PCASC_FILE_NODE pFileNode);
 
     bool SetNodePlainName(PCASC_FILE_NODE pFileNode, const char * szPlainName, const char * szPlainNameEnd);
+    size_t GetNodePlainName(char * szBuffer, char * szBufferEnd, PCASC_FILE_NODE pFileNode);
     bool RebuildNameMaps();
 
-    CASC_ARRAY NodeTable;                           // Dynamic array that holds all CASC_FILE_NODEs
-    CASC_ARRAY NameTable;                           // Dynamic array that holds all node names
+    CASC_CHUNKED_ARRAY NodeTable;                   // Dynamic array that holds all CASC_FILE_NODEs. The nodes never move
+    CASC_ARENA NameTable;                           // All node names, front-coded. Grows by chunks (CASC_ARENA::Append), the names never move
 
     CASC_SPARSE_ARRAY FileDataIds;                  // Dynamic array that maps FileDataId -> CASC_FILE_NODE
     //CASC_ARRAY FileDataIds;                         // Dynamic array that maps FileDataId -> CASC_FILE_NODE
@@ -109,9 +133,12 @@ class CASC_FILE_TREE
     size_t FileDataIdOffset;                        // If nonzero, this is the offset of the "FileDataId" field in the CASC_FILE_NODE
     size_t LocaleFlagsOffset;                       // If nonzero, this is the offset of the "LocaleFlags" field in the CASC_FILE_NODE
     size_t ContentFlagsOffset;                      // If nonzero, this is the offset of the "ContentFlags" field in the CASC_FILE_NODE
+    size_t NameBaseIndex;                           // Offset of the last full name in the name table. Newer names are coded against it
+    size_t NameBaseLength;                          // Length of the last full name
     size_t FolderNodes;                             // Number of folder nodes
     size_t FileNodes;                               // Number of file nodes
     DWORD KeyLength;                                // Actual length of the key supported by the root handler
+    bool bNameFilter;                               // If true, the name map has a Bloom filter
 };
 
 typedef CASC_FILE_TREE * PCASC_FILE_TREE;
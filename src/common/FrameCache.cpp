@@ -0,0 +1,250 @@
+/*****************************************************************************/
+/* FrameCache.cpp                         Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Storage-wide cache of decoded file frames, shared by all file handles     */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of FrameCache.cpp                  */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "../CascLib.h"
+#include "../CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+inline LPBYTE FRAME_DATA(CASC_FRAME_CACHE_ENTRY * pEntry)
+{
+    return (LPBYTE)(pEntry + 1);
+}
+
+// The EKey is a MD5 hash, so its first bytes are random enough
+DWORD CASC_FRAME_CACHE::HashOf(LPBYTE EKey, DWORD FrameIndex)
+{
+    DWORD HashValue;
+
+    memcpy(&HashValue, EKey, sizeof(DWORD));
+    return HashValue ^ (FrameIndex * 0x9E3779B1);
+}
+
+// Returns pointer to the reference to the entry, or pointer to the end of the bucket chain
+CASC_FRAME_CACHE_ENTRY ** CASC_FRAME_CACHE::FindEntry(CASC_FRAME_CACHE_SHARD & Shard, DWORD HashValue, LPBYTE EKey, DWORD FrameIndex)
+{
+    CASC_FRAME_CACHE_ENTRY ** RefEntry = &Shard.Buckets[(HashValue / CASC_FRAME_CACHE_SHARDS) % CASC_FRAME_CACHE_BUCKETS];
+    CASC_FRAME_CACHE_ENTRY * pEntry;
+
+    while((pEntry = RefEntry[0]) != NULL)
+    {
+        if(pEntry->FrameIndex == FrameIndex && !memcmp(pEntry->EKey, EKey, MD5_HASH_SIZE))
+            break;
+        RefEntry = &pEntry->pNextInBucket;
+    }
+    return RefEntry;
+}
+
+void CASC_FRAME_CACHE::UnlinkEntry(CASC_FRAME_CACHE_SHARD & Shard, CASC_FRAME_CACHE_ENTRY * pEntry)
+{
+    if(pEntry->pNewer != NULL)
+        pEntry->pNewer->pOlder = pEntry->pOlder;
+    else
+        Shard.pNewest = pEntry->pOlder;
+
+    if(pEntry->pOlder != NULL)
+        pEntry->pOlder->pNewer = pEntry->pNewer;
+    else
+        Shard.pOldest = pEntry->pNewer;
+}
+
+void CASC_FRAME_CACHE::LinkNewest(CASC_FRAME_CACHE_SHARD & Shard, CASC_FRAME_CACHE_ENTRY * pEntry)
+{
+    pEntry->pNewer = NULL;
+    pEntry->pOlder = Shard.pNewest;
+
+    if(Shard.pNewest != NULL)
+        Shard.pNewest->pNewer = pEntry;
+    else
+        Shard.pOldest = pEntry;
+    Shard.pNewest = pEntry;
+}
+
+void CASC_FRAME_CACHE::EvictOldest(CASC_FRAME_CACHE_SHARD & Shard)
+{
+    CASC_FRAME_CACHE_ENTRY * pEntry = Shard.pOldest;
+    CASC_FRAME_CACHE_ENTRY ** RefEntry;
+
+    // Remove the entry from the hash bucket and from the LRU list
+    RefEntry = FindEntry(Shard, HashOf(pEntry->EKey, pEntry->FrameIndex), pEntry->EKey, pEntry->FrameIndex);
+    assert(RefEntry[0] == pEntry);
+    RefEntry[0] = pEntry->pNextInBucket;
+    UnlinkEntry(Shard, pEntry);
+
+    // Update the counters and free the entry
+    Shard.cbCached -= pEntry->cbData;
+    Shard.nFrames--;
+    CASC_FREE(pEntry);
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+CASC_FRAME_CACHE::CASC_FRAME_CACHE()
+{
+    for(size_t i = 0; i < CASC_FRAME_CACHE_SHARDS; i++)
+    {
+        CASC_FRAME_CACHE_SHARD & Shard = m_Shards[i];
+
+        memset(Shard.Buckets, 0, sizeof(Shard.Buckets));
+        Shard.pNewest = Shard.pOldest = NULL;
+        Shard.cbShardMax = CASC_FRAME_CACHE_DEFAULT_SIZE / CASC_FRAME_CACHE_SHARDS;
+        Shard.cbCached = Shard.nFrames = 0;
+        Shard.Hits = Shard.Misses = Shard.Evictions = 0;
+        CascInitLock(Shard.Lock);
+    }
+
+    m_dwEnabled = (CASC_FRAME_CACHE_DEFAULT_SIZE / CASC_FRAME_CACHE_SHARDS) ? 1 : 0;
+}
+
+CASC_FRAME_CACHE::~CASC_FRAME_CACHE()
+{
+    for(size_t i = 0; i < CASC_FRAME_CACHE_SHARDS; i++)
+    {
+        CASC_FRAME_CACHE_SHARD & Shard = m_Shards[i];
+
+        while(Shard.pOldest != NULL)
+            EvictOldest(Shard);
+        CascFreeLock(Shard.Lock);
+    }
+}
+
+void CASC_FRAME_CACHE::SetSize(size_t cbCacheSize)
+{
+    size_t cbShardMax = cbCacheSize / CASC_FRAME_CACHE_SHARDS;
+
+    // Set the new limit and free the frames that are over it
+    for(size_t i = 0; i < CASC_FRAME_CACHE_SHARDS; i++)
+    {
+        CASC_FRAME_CACHE_SHARD & Shard = m_Shards[i];
+
+        CascLock(Shard.Lock);
+        Shard.cbShardMax = cbShardMax;
+        while(Shard.pOldest != NULL && Shard.cbCached > Shard.cbShardMax)
+            EvictOldest(Shard);
+        CascUnlock(Shard.Lock);
+    }
+
+    // Let the lookups skip the locks if the cache is disabled
+    CascInterlockedStore(&m_dwEnabled, (cbShardMax != 0) ? 1 : 0);
+}
+
+bool CASC_FRAME_CACHE::Get(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbBuffer, DWORD cbBuffer)
+{
+    CASC_FRAME_CACHE_ENTRY * pEntry;
+    DWORD HashValue = HashOf(EKey, FrameIndex);
+    CASC_FRAME_CACHE_SHARD & Shard = ShardOf(HashValue);
+    bool bResult = false;
+
+    // Don't bother locking if the cache is disabled
+    if(!IsEnabled())
+        return false;
+
+    CascLock(Shard.Lock);
+    pEntry = FindEntry(Shard, HashValue, EKey, FrameIndex)[0];
+    if(pEntry != NULL && pEntry->cbData == cbBuffer)
+    {
+        // Copy the data and make the entry the most recently used one
+        memcpy(pbBuffer, FRAME_DATA(pEntry), cbBuffer);
+        UnlinkEntry(Shard, pEntry);
+        LinkNewest(Shard, pEntry);
+        Shard.Hits++;
+        bResult = true;
+    }
+    else
+    {
+        Shard.Misses++;
+    }
+    CascUnlock(Shard.Lock);
+    return bResult;
+}
+
+void CASC_FRAME_CACHE::Put(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbData, DWORD cbData)
+{
+    CASC_FRAME_CACHE_ENTRY ** RefEntry;
+    CASC_FRAME_CACHE_ENTRY * pEntry;
+    DWORD HashValue = HashOf(EKey, FrameIndex);
+    CASC_FRAME_CACHE_SHARD & Shard = ShardOf(HashValue);
+
+    // Don't bother copying the frame if the cache is disabled
+    if(cbData == 0 || !IsEnabled())
+        return;
+
+    // Prepare the new entry outside of the lock
+    if((pEntry = (CASC_FRAME_CACHE_ENTRY *)CASC_ALLOC<BYTE>(sizeof(CASC_FRAME_CACHE_ENTRY) + cbData)) == NULL)
+        return;
+    memcpy(pEntry->EKey, EKey, MD5_HASH_SIZE);
+    memcpy(FRAME_DATA(pEntry), pbData, cbData);
+    pEntry->FrameIndex = FrameIndex;
+    pEntry->cbData = cbData;
+
+    CascLock(Shard.Lock);
+
+    // Another thread may have inserted the same frame meanwhile.
+    // Frames that would take more than the whole shard are not cached
+    RefEntry = FindEntry(Shard, HashValue, EKey, FrameIndex);
+    if(RefEntry[0] == NULL && cbData <= Shard.cbShardMax)
+    {
+        // Make space for the new frame
+        while(Shard.pOldest != NULL && (Shard.cbCached + cbData) > Shard.cbShardMax)
+        {
+            EvictOldest(Shard);
+            Shard.Evictions++;
+        }
+
+        // The eviction may have changed the bucket chain
+        RefEntry = FindEntry(Shard, HashValue, EKey, FrameIndex);
+        pEntry->pNextInBucket = NULL;
+        RefEntry[0] = pEntry;
+        LinkNewest(Shard, pEntry);
+        Shard.cbCached += cbData;
+        Shard.nFrames++;
+        pEntry = NULL;
+    }
+
+    CascUnlock(Shard.Lock);
+    CASC_FREE(pEntry);
+}
+
+void CASC_FRAME_CACHE::GetStats(PCASC_FRAME_CACHE_STATS pStats)
+{
+    memset(pStats, 0, sizeof(CASC_FRAME_CACHE_STATS));
+
+    for(size_t i = 0; i < CASC_FRAME_CACHE_SHARDS; i++)
+    {
+        CASC_FRAME_CACHE_SHARD & Shard = m_Shards[i];
+
+        CascLock(Shard.Lock);
+        pStats->CacheSize += Shard.cbShardMax;
+        pStats->BytesCached += Shard.cbCached;
+        pStats->FramesCached += Shard.nFrames;
+        pStats->Hits += Shard.Hits;
+        pStats->Misses += Shard.Misses;
+        pStats->Evictions += Shard.Evictions;
+        CascUnlock(Shard.Lock);
+    }
+}
+
+size_t CASC_FRAME_CACHE::BytesAllocated()
+{
+    size_t cbAllocated = 0;
+
+    for(size_t i = 0; i < CASC_FRAME_CACHE_SHARDS; i++)
+    {
+        CASC_FRAME_CACHE_SHARD & Shard = m_Shards[i];
+
+        CascLock(Shard.Lock);
+        cbAllocated += Shard.cbCached + (Shard.nFrames * sizeof(CASC_FRAME_CACHE_ENTRY));
+        CascUnlock(Shard.Lock);
+    }
+    return cbAllocated;
+}
@@ -0,0 +1,97 @@
+/*****************************************************************************/
+/* FrameCache.h                           Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Storage-wide cache of decoded file frames, shared by all file handles     */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of FrameCache.h                    */
+/*****************************************************************************/
+
+#ifndef __CASC_FRAME_CACHE_H__
+#define __CASC_FRAME_CACHE_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+
+#define CASC_FRAME_CACHE_SHARDS         0x10            // Number of shards. Each shard has its own lock
+#define CASC_FRAME_CACHE_BUCKETS        0x100           // Number of hash buckets in one shard
+#define CASC_FRAME_CACHE_DEFAULT_SIZE   0               // Default size of the cache. Disabled until CascSetFrameCacheSize
+
+// One cached frame. The decoded data follow the header
+struct CASC_FRAME_CACHE_ENTRY
+{
+    CASC_FRAME_CACHE_ENTRY * pNewer;                    // Newer entry in the LRU list
+    CASC_FRAME_CACHE_ENTRY * pOlder;                    // Older entry in the LRU list
+    CASC_FRAME_CACHE_ENTRY * pNextInBucket;             // Next entry in the same hash bucket
+    BYTE EKey[MD5_HASH_SIZE];                           // EKey of the file span
+    DWORD FrameIndex;                                   // Index of the frame within the span
+    DWORD cbData;                                       // Size of the decoded frame
+};
+
+// One shard of the cache, with its own lock, hash table and LRU list
+struct CASC_FRAME_CACHE_SHARD
+{
+    CASC_LOCK Lock;                                     // Lock for the shard
+    CASC_FRAME_CACHE_ENTRY * Buckets[CASC_FRAME_CACHE_BUCKETS];
+    CASC_FRAME_CACHE_ENTRY * pNewest;                   // The most recently used entry
+    CASC_FRAME_CACHE_ENTRY * pOldest;                   // The least recently used entry. Evicted first
+    size_t cbShardMax;                                  // Maximum size of data in the shard
+    size_t cbCached;                                    // Size of the cached data, in bytes
+    size_t nFrames;                                     // Number of cached frames
+    ULONGLONG Hits;                                     // Number of lookups that found the frame
+    ULONGLONG Misses;                                   // Number of lookups that didn't find the frame
+    ULONGLONG Evictions;                                // Number of frames removed to make space for newer ones
+};
+
+//
+// Decoded frames are keyed by (EKey, FrameIndex). Frames are spread over shards
+// by their hash, so that threads reading different frames rarely wait for each other.
+// Each shard holds at most (CacheSize / CASC_FRAME_CACHE_SHARDS) bytes of data and
+// evicts the least recently used frames when full. The limit is only accessed under
+// the shard lock. The cached data are copied in and out, so no frame is ever
+// referenced outside of the cache. Thread-safe.
+//
+class CASC_FRAME_CACHE
+{
+    public:
+
+    CASC_FRAME_CACHE();
+    ~CASC_FRAME_CACHE();
+
+    // Sets the maximum size of the cached data. Zero disables the cache
+    void SetSize(size_t cbCacheSize);
+
+    // Copies the frame to the buffer. Returns false if the frame is not cached
+    bool Get(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbBuffer, DWORD cbBuffer);
+
+    // Inserts a copy of the decoded frame to the cache
+    void Put(LPBYTE EKey, DWORD FrameIndex, LPBYTE pbData, DWORD cbData);
+
+    // Returns true if the cache has nonzero size
+    bool IsEnabled()
+    {
+        return (CascInterlockedLoad(&m_dwEnabled) != 0);
+    }
+
+    void GetStats(PCASC_FRAME_CACHE_STATS pStats);
+    size_t BytesAllocated();
+
+    protected:
+
+    CASC_FRAME_CACHE_SHARD & ShardOf(DWORD HashValue)
+    {
+        return m_Shards[HashValue % CASC_FRAME_CACHE_SHARDS];
+    }
+
+    static DWORD HashOf(LPBYTE EKey, DWORD FrameIndex);
+    static CASC_FRAME_CACHE_ENTRY ** FindEntry(CASC_FRAME_CACHE_SHARD & Shard, DWORD HashValue, LPBYTE EKey, DWORD FrameIndex);
+    static void UnlinkEntry(CASC_FRAME_CACHE_SHARD & Shard, CASC_FRAME_CACHE_ENTRY * pEntry);
+    static void LinkNewest(CASC_FRAME_CACHE_SHARD & Shard, CASC_FRAME_CACHE_ENTRY * pEntry);
+    static void EvictOldest(CASC_FRAME_CACHE_SHARD & Shard);
+
+    CASC_FRAME_CACHE_SHARD m_Shards[CASC_FRAME_CACHE_SHARDS];
+    DWORD m_dwEnabled;                                  // Nonzero if the cache has nonzero size (interlocked)
+};
+
+#endif // __CASC_FRAME_CACHE_H__
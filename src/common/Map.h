@@ -11,10 +11,34 @@
 #ifndef __CASC_MAP_H__
 #define __CASC_MAP_H__
 
+// The map stores a control byte for each slot of the hash table: either CASC_MAP_EMPTY
+// or a 7-bit tag taken from the hash of the key. Lookups scan a whole group of control bytes
+// at once and only touch the objects whose tag matches. With SSE2 or AVX2, the group is scanned
+// with one vector compare; otherwise, 8 control bytes are scanned as one 64-bit integer
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CASC_MAP_GROUP_SIZE     32              // Number of control bytes scanned at once
+#define CASC_MAP_SLOT_SHIFT     0               // Shift of the match mask bit index -> slot index
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CASC_MAP_GROUP_SIZE     16
+#define CASC_MAP_SLOT_SHIFT     0
+#define CASC_MAP_SSE2
+#else
+#define CASC_MAP_GROUP_SIZE     8
+#define CASC_MAP_SLOT_SHIFT     3
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 //-----------------------------------------------------------------------------
 // Structures
 
-#define MIN_HASH_TABLE_SIZE     0x00000100      // The smallest size of the hash table.
+#define MIN_HASH_TABLE_SIZE     0x00000100      // The smallest size of the hash table. Must be a multiple of CASC_MAP_GROUP_SIZE
+#define CASC_MAP_EMPTY          0x80            // Control byte of an empty slot
+#define CASC_MAP_REHASH_STEP    0x10            // Number of slots moved from the old hash table on each insert
 
 typedef int   (*PFNCOMPAREFUNC)(const void * pvObjectKey, const void * pvKey, size_t nKeyLength);
 typedef DWORD (*PFNHASHFUNC)(void * pvKey, size_t nKeyLength);
@@ -70,9 +94,94 @@ inline DWORD CalcHashValue_String(const char * szString, const char * szStringEn
     return dwHash;
 }
 
+//-----------------------------------------------------------------------------
+// Scanning of control byte groups. The masks have one bit (vector scan)
+// or one byte (64-bit integer scan) for each slot of the group
+
+inline DWORD GetLowestBitIndex(ULONGLONG Mask)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long Index;
+
+    _BitScanForward64(&Index, Mask);
+    return Index;
+#elif defined(_MSC_VER)
+    unsigned long Index;
+
+    if((DWORD)(Mask) != 0)
+    {
+        _BitScanForward(&Index, (DWORD)(Mask));
+        return Index;
+    }
+
+    _BitScanForward(&Index, (DWORD)(Mask >> 32));
+    return Index + 32;
+#elif defined(__GNUC__)
+    return (DWORD)__builtin_ctzll(Mask);
+#else
+    DWORD Index = 0;
+
+    while((Mask & 1) == 0)
+    {
+        Mask >>= 1;
+        Index++;
+    }
+    return Index;
+#endif
+}
+
+// Returns a mask of slots in the group whose control byte is equal to the tag
+inline ULONGLONG MatchControlTag(LPBYTE pbGroup, BYTE Tag)
+{
+#if defined(__AVX2__)
+    __m256i Control = _mm256_loadu_si256((const __m256i *)pbGroup);
+    return (DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Control, _mm256_set1_epi8((char)Tag)));
+#elif defined(CASC_MAP_SSE2)
+    __m128i Control = _mm_loadu_si128((const __m128i *)pbGroup);
+    return (DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(Control, _mm_set1_epi8((char)Tag)));
+#else
+    ULONGLONG Control;
+
+    // Bytes that are equal to the tag become zero. This may produce a false match
+    // for a byte above a true match, which is harmless because the keys are compared anyway
+    memcpy(&Control, pbGroup, sizeof(ULONGLONG));
+    Control = BSWAP_INT64_UNSIGNED(Control) ^ (0x0101010101010101ULL * Tag);
+    return (Control - 0x0101010101010101ULL) & ~Control & 0x8080808080808080ULL;
+#endif
+}
+
+// Returns a mask of empty slots in the group
+inline ULONGLONG MatchControlEmpty(LPBYTE pbGroup)
+{
+#if defined(__AVX2__)
+    return (DWORD)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)pbGroup));
+#elif defined(CASC_MAP_SSE2)
+    return (DWORD)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)pbGroup));
+#else
+    ULONGLONG Control;
+
+    memcpy(&Control, pbGroup, sizeof(ULONGLONG));
+    return BSWAP_INT64_UNSIGNED(Control) & 0x8080808080808080ULL;
+#endif
+}
+
+// Returns the index of the first slot in the match mask
+inline DWORD GetFirstMatchSlot(ULONGLONG Mask)
+{
+    return GetLowestBitIndex(Mask) >> CASC_MAP_SLOT_SHIFT;
+}
+
 //-----------------------------------------------------------------------------
 // Map implementation
 
+// A hash table as seen by lookups without a lock. See CASC_MAP::EnableConcurrentReads
+struct CASC_MAP_VIEW
+{
+    void ** HashTable;                          // The hash table. Never freed while the map exists
+    size_t HashTableSize;                       // Size of the hash table, in entries
+    CASC_MAP_VIEW * pPrevView;                  // View of the previous hash table, or NULL
+};
+
 class CASC_MAP
 {
     public:
@@ -81,7 +190,14 @@ class CASC_MAP
     {
         PfnCalcHashValue = NULL;
         m_HashTable = NULL;
+        m_Control = NULL;
         m_HashTableSize = 0;
+        m_OldHashTable = NULL;
+        m_OldControl = NULL;
+        m_OldHashTableSize = 0;
+        m_RehashIndex = 0;
+        m_pView = NULL;
+        m_RetiredBytes = 0;
         m_ItemCount = 0;
         m_KeyOffset = 0;
         m_KeyLength = 0;
@@ -93,6 +209,15 @@ class CASC_MAP
         Free();
     }
 
+    //
+    // Creates the map. For maps of objects, MaxItems is just the initial size,
+    // as the map grows when it gets full. Maps of strings can hold up to MaxItems.
+    //
+    // Note that growing the map reallocates the hash table. Maps that are searched
+    // by other threads without a lock while one thread inserts into them
+    // must either be created large enough so they never grow,
+    // or be searched with FindObjectConcurrent (see EnableConcurrentReads).
+    //
     DWORD Create(size_t MaxItems, size_t KeyLength, size_t KeyOffset, KEY_TYPE KeyType = KeyIsHash)
     {
         // Set the class variables
@@ -127,71 +252,118 @@ class CASC_MAP
         if(m_HashTableSize == 0)
             return ERROR_NOT_ENOUGH_MEMORY;
 
-        // Allocate new map for the objects
-        m_HashTable = (void **)CASC_ALLOC_ZERO<void *>(m_HashTableSize);
-        return (m_HashTable != NULL) ? ERROR_SUCCESS : ERROR_NOT_ENOUGH_MEMORY;
+        // Allocate new map for the objects and the control bytes
+        if(!AllocateTable(m_HashTable, m_Control, m_HashTableSize))
+        {
+            Free();
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        return ERROR_SUCCESS;
     }
 
+    //
+    // Searches the map. Doesn't change the map, so any number of threads may search it at once,
+    // as long as no thread inserts to it. The index for ItemAt is only valid if there is no pending rehash
+    //
     void * FindObject(void * pvKey, PDWORD PtrIndex = NULL)
     {
-        void * pvObject;
-        DWORD dwHashIndex;
+        void * pvObject = NULL;
+        DWORD dwHashValue;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
-            // Construct the hash index
-            dwHashIndex = HashToIndex(PfnCalcHashValue(pvKey, m_KeyLength));
+            // The index must point to the current hash table
+            assert(PtrIndex == NULL || m_OldHashTable == NULL);
+
+            // Reject absent keys before touching the hash table
+            if(m_Filter.IsInitialized() && !m_Filter.MayContain(KeyToFilterHash(pvKey)))
+                return NULL;
+
+            // Search the current hash table. During rehash, the object may still be only in the old one
+            dwHashValue = PfnCalcHashValue(pvKey, m_KeyLength);
+            pvObject = FindInTable(m_HashTable, m_Control, m_HashTableSize, dwHashValue, pvKey, PtrIndex);
+            if(pvObject == NULL && m_OldHashTable != NULL)
+                pvObject = FindInTable(m_OldHashTable, m_OldControl, m_OldHashTableSize, dwHashValue, pvKey, NULL);
+        }
 
-            // Search the hash table
-            while((pvObject = m_HashTable[dwHashIndex]) != NULL)
-            {
-                // Compare the hash
-                if(CompareObject_Key(pvObject, pvKey))
-                {
-                    if(PtrIndex != NULL)
-                        PtrIndex[0] = dwHashIndex;
-                    return pvObject;
-                }
+        return pvObject;
+    }
 
-                // Move to the next entry
-                dwHashIndex = HashToIndex(dwHashIndex + 1);
-            }
+    //
+    // Allows other threads to search the map with FindObjectConcurrent while one thread
+    // (holding a lock) inserts into it. The hash tables replaced by growing the map
+    // are then kept until the map is freed, as a search may still be going through them
+    //
+    DWORD EnableConcurrentReads()
+    {
+        CASC_MAP_VIEW * pNewView;
+
+        // Only maps of objects are supported
+        if(m_HashTable == NULL || PfnCalcHashValue == NULL)
+            return ERROR_NOT_SUPPORTED;
+
+        // The current hash table must be the only one
+        FinishRehash();
+
+        // Publish the view of the current hash table
+        if(m_pView == NULL)
+        {
+            if((pNewView = CASC_ALLOC<CASC_MAP_VIEW>(1)) == NULL)
+                return ERROR_NOT_ENOUGH_MEMORY;
+            PublishView(pNewView);
         }
+        return ERROR_SUCCESS;
+    }
 
-        // Not found, sorry
-        return NULL;
+    //
+    // Searches the map while another thread may be inserting into it. The map must have
+    // concurrent reads enabled. An object that is just being inserted may not be found,
+    // so the caller must repeat a failed search with the lock held
+    //
+    void * FindObjectConcurrent(void * pvKey)
+    {
+        CASC_MAP_VIEW * pView = (CASC_MAP_VIEW *)CascInterlockedLoadPointer((void **)(&m_pView));
+        void * pvObject = NULL;
+        DWORD dwHashValue;
+
+        if(pView != NULL)
+        {
+            // During rehash, the object may still be only in the previous hash table
+            dwHashValue = PfnCalcHashValue(pvKey, m_KeyLength);
+            if((pvObject = FindInView(pView, dwHashValue, pvKey)) == NULL && pView->pPrevView != NULL)
+                pvObject = FindInView(pView->pPrevView, dwHashValue, pvKey);
+        }
+        return pvObject;
     }
 
     bool InsertObject(void * pvNewObject, void * pvKey)
     {
-        void * pvExistingObject;
-        DWORD dwHashIndex;
+        DWORD dwHashValue;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
-            // Limit check
-            if((m_ItemCount + 1) >= m_HashTableSize)
-                return false;
-
-            // Construct the hash index
-            dwHashIndex = HashToIndex(PfnCalcHashValue(pvKey, m_KeyLength));
-
-            // Search the hash table
-            while((pvExistingObject = m_HashTable[dwHashIndex]) != NULL)
+            // Grow the map if it's getting full
+            if(((m_ItemCount + 1) * 8) > (m_HashTableSize * 7))
             {
-                // Check if hash being inserted conflicts with an existing hash
-                if(CompareObject_Key(pvExistingObject, pvKey))
+                if(!GrowTable())
                     return false;
-
-                // Move to the next entry
-                dwHashIndex = HashToIndex(dwHashIndex + 1);
             }
 
-            // Insert at that position
-            m_HashTable[dwHashIndex] = pvNewObject;
+            // Check if hash being inserted conflicts with an existing hash
+            dwHashValue = PfnCalcHashValue(pvKey, m_KeyLength);
+            if(FindInTable(m_HashTable, m_Control, m_HashTableSize, dwHashValue, pvKey, NULL))
+                return false;
+            if(m_OldHashTable && FindInTable(m_OldHashTable, m_OldControl, m_OldHashTableSize, dwHashValue, pvKey, NULL))
+                return false;
+
+            // Insert the object and move a few objects from the old hash table, if any
+            InsertNew(dwHashValue, pvNewObject);
+            if(m_Filter.IsInitialized())
+                m_Filter.Insert(KeyToFilterHash(pvKey));
             m_ItemCount++;
+            RehashStep(CASC_MAP_REHASH_STEP);
             return true;
         }
 
@@ -202,23 +374,28 @@ class CASC_MAP
     const char * FindString(const char * szString, const char * szStringEnd)
     {
         const char * szExistingString;
-        DWORD dwHashIndex;
+        DWORD dwHashValue;
+        DWORD dwGroupIndex;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
             // Construct the main index
-            dwHashIndex = HashToIndex(CalcHashValue_String(szString, szStringEnd));
+            dwHashValue = CalcHashValue_String(szString, szStringEnd);
+            dwGroupIndex = HashToGroupIndex(dwHashValue, m_HashTableSize);
 
-            // Search the hash table
-            while((szExistingString = (const char *)m_HashTable[dwHashIndex]) != NULL)
+            // Search the groups until we find one with an empty slot
+            for(;;)
             {
-                // Compare the hash
-                if(CompareObject_String(szExistingString, szString, szStringEnd))
+                if((szExistingString = FindInGroup_String(dwGroupIndex, dwHashValue, szString, szStringEnd)) != NULL)
                     return szExistingString;
 
-                // Move to the next entry
-                dwHashIndex = HashToIndex(dwHashIndex + 1);
+                // An empty slot terminates the search
+                if(MatchControlEmpty(m_Control + dwGroupIndex))
+                    break;
+
+                // Move to the next group
+                dwGroupIndex = HashToIndex(dwGroupIndex + CASC_MAP_GROUP_SIZE, m_HashTableSize);
             }
         }
 
@@ -228,14 +405,14 @@ class CASC_MAP
 
     bool InsertString(const char * szString, bool bCutExtension)
     {
-        const char * szExistingString;
         const char * szStringEnd = NULL;
-        DWORD dwHashIndex;
+        DWORD dwHashValue;
 
         // Verify pointer to the map
         if(m_HashTable != NULL)
         {
-            // Limit check
+            // Limit check. The string length may depend on bCutExtension,
+            // so the hash can't be recalculated and the map can't grow
             if((m_ItemCount + 1) >= m_HashTableSize)
                 return false;
 
@@ -245,22 +422,13 @@ class CASC_MAP
             else
                 szStringEnd = szString + strlen(szString);
 
-            // Construct the hash index
-            dwHashIndex = HashToIndex(CalcHashValue_String(szString, szStringEnd));
-
-            // Search the hash table
-            while((szExistingString = (const char *)m_HashTable[dwHashIndex]) != NULL)
-            {
-                // Check if hash being inserted conflicts with an existing hash
-                if(CompareObject_String(szExistingString, szString, szStringEnd))
-                    return false;
-
-                // Move to the next entry
-                dwHashIndex = HashToIndex(dwHashIndex + 1);
-            }
+            // Check if hash being inserted conflicts with an existing hash
+            if(FindString(szString, szStringEnd) != NULL)
+                return false;
 
-            // Insert at that position
-            m_HashTable[dwHashIndex] = (void *)szString;
+            // Insert at the first empty slot
+            dwHashValue = CalcHashValue_String(szString, szStringEnd);
+            InsertNew(dwHashValue, (void *)szString);
             m_ItemCount++;
             return true;
         }
@@ -269,14 +437,51 @@ class CASC_MAP
         return false;
     }
 
+    //
+    // Creates a Bloom filter that rejects most lookups of absent keys without
+    // touching the hash table. The objects already in the map are inserted to it.
+    // Only for maps with hash keys (KeyIsHash); the filter uses the first 8 bytes of the key.
+    // Inserting more than MaxItems objects increases the rate of false positives.
+    //
+    DWORD CreateFilter(size_t MaxItems)
+    {
+        void * pvObject;
+        DWORD dwErrCode;
+
+        // Only maps of objects with hash keys are supported
+        if(m_HashTable == NULL || PfnCalcHashValue != CalcHashValue_Hash)
+            return ERROR_NOT_SUPPORTED;
+
+        // All objects must be in the current hash table
+        FinishRehash();
+
+        // Create the filter
+        m_Filter.Free();
+        if((dwErrCode = m_Filter.Create(CASCLIB_MAX(MaxItems, m_ItemCount))) != ERROR_SUCCESS)
+            return dwErrCode;
+
+        // Insert the keys of all objects
+        for(size_t i = 0; i < HashTableSize(); i++)
+        {
+            if((pvObject = m_HashTable[i]) != NULL)
+            {
+                m_Filter.Insert(KeyToFilterHash((LPBYTE)pvObject + m_KeyOffset));
+            }
+        }
+        return ERROR_SUCCESS;
+    }
+
     void * ItemAt(size_t nIndex)
     {
         assert(nIndex < m_HashTableSize);
         return m_HashTable[nIndex];
     }
 
+    // Returns the size of the hash table for enumerating the objects with ItemAt.
+    // The pending rehash must be completed before, see FinishRehash
     size_t HashTableSize()
     {
+        assert(m_OldHashTable == NULL);
         return m_HashTableSize;
     }
 
@@ -285,23 +490,252 @@ class CASC_MAP
         return m_ItemCount;
     }
 
+    size_t BytesAllocated()
+    {
+        return (m_HashTableSize + m_OldHashTableSize) * (sizeof(void *) + sizeof(BYTE)) + m_RetiredBytes + m_Filter.BytesAllocated();
+    }
+
+    size_t HugePageAdvisedBytes()
+    {
+        return CascGetHugePageAdvisedBytes(m_HashTable) + CascGetHugePageAdvisedBytes(m_Control) + m_Filter.HugePageAdvisedBytes();
+    }
+
     bool IsInitialized()
     {
         return (m_HashTable && m_HashTableSize);
     }
 
+    // Moves all remaining objects from the old hash table to the current one.
+    // Called once the map is complete, so that it only has one hash table
+    void FinishRehash()
+    {
+        RehashStep(m_OldHashTableSize);
+    }
+
     void Free()
     {
+        CASC_MAP_VIEW * pPrevView;
+
+        // Free the views and the retired hash tables
+        while(m_pView != NULL)
+        {
+            pPrevView = m_pView->pPrevView;
+            if(m_pView->HashTable != m_HashTable && m_pView->HashTable != m_OldHashTable)
+                CASC_FREE(m_pView->HashTable);
+            CASC_FREE(m_pView);
+            m_pView = pPrevView;
+        }
+        m_RetiredBytes = 0;
+
         PfnCalcHashValue = NULL;
         CASC_FREE(m_HashTable);
+        CASC_FREE(m_Control);
+        CASC_FREE(m_OldHashTable);
+        CASC_FREE(m_OldControl);
+        m_OldHashTableSize = 0;
         m_HashTableSize = 0;
+        m_Filter.Free();
     }
 
     protected:
 
-    DWORD HashToIndex(DWORD HashValue)
+    static DWORD HashToIndex(DWORD HashValue, size_t TableSize)
+    {
+        return HashValue & (DWORD)(TableSize - 1);
+    }
+
+    // Index of the first slot of the group where the search for the hash begins
+    static DWORD HashToGroupIndex(DWORD HashValue, size_t TableSize)
+    {
+        return HashToIndex(HashValue, TableSize) & ~(CASC_MAP_GROUP_SIZE - 1);
+    }
+
+    // The tag is taken from the upper bits, which are not used by the index
+    // unless the hash table has more than 32M entries
+    static BYTE HashToTag(DWORD HashValue)
     {
-        return HashValue & (m_HashTableSize - 1);
+        return (BYTE)(HashValue >> 25);
+    }
+
+    // The hash keys are uniformly distributed, so their first 8 bytes will do
+    static ULONGLONG KeyToFilterHash(void * pvKey)
+    {
+        ULONGLONG HashValue;
+
+        memcpy(&HashValue, pvKey, sizeof(ULONGLONG));
+        return HashValue;
+    }
+
+    static bool AllocateTable(void ** & HashTable, LPBYTE & Control, size_t TableSize)
+    {
+        // All slots are empty
+        HashTable = CASC_ALLOC_ZERO<void *>(TableSize);
+        Control = CASC_ALLOC<BYTE>(TableSize);
+        if(Control != NULL)
+            memset(Control, CASC_MAP_EMPTY, TableSize);
+        return (HashTable != NULL && Control != NULL);
+    }
+
+    void * FindInTable(void ** HashTable, LPBYTE Control, size_t TableSize, DWORD dwHashValue, void * pvKey, PDWORD PtrIndex)
+    {
+        ULONGLONG Mask;
+        DWORD dwGroupIndex = HashToGroupIndex(dwHashValue, TableSize);
+        DWORD dwHashIndex;
+
+        // Search the groups until we find one with an empty slot
+        for(;;)
+        {
+            // Only compare the objects whose tag matches
+            for(Mask = MatchControlTag(Control + dwGroupIndex, HashToTag(dwHashValue)); Mask != 0; Mask &= (Mask - 1))
+            {
+                dwHashIndex = dwGroupIndex + GetFirstMatchSlot(Mask);
+                if(CompareObject_Key(HashTable[dwHashIndex], pvKey))
+                {
+                    if(PtrIndex != NULL)
+                        PtrIndex[0] = dwHashIndex;
+                    return HashTable[dwHashIndex];
+                }
+            }
+
+            // An empty slot terminates the search
+            if(MatchControlEmpty(Control + dwGroupIndex))
+                return NULL;
+
+            // Move to the next group
+            dwGroupIndex = HashToIndex(dwGroupIndex + CASC_MAP_GROUP_SIZE, TableSize);
+        }
+    }
+
+    // Searches a hash table while another thread may be inserting into it. The control bytes
+    // are not used, as they may be changing. The objects are never removed and each one
+    // is inserted to the first empty slot after the start of its group, so the slots
+    // are checked one by one until the first empty one
+    void * FindInView(CASC_MAP_VIEW * pView, DWORD dwHashValue, void * pvKey)
+    {
+        void * pvObject;
+        DWORD dwHashIndex = HashToGroupIndex(dwHashValue, pView->HashTableSize);
+
+        for(size_t i = 0; i < pView->HashTableSize; i++)
+        {
+            if((pvObject = CascInterlockedLoadPointer(&pView->HashTable[dwHashIndex])) == NULL)
+                break;
+            if(CompareObject_Key(pvObject, pvKey))
+                return pvObject;
+            dwHashIndex = HashToIndex(dwHashIndex + 1, pView->HashTableSize);
+        }
+        return NULL;
+    }
+
+    // Makes the current hash table visible to FindObjectConcurrent. The view is filled
+    // before it's published, so the searching threads see the table and its size together
+    void PublishView(CASC_MAP_VIEW * pNewView)
+    {
+        pNewView->HashTable = m_HashTable;
+        pNewView->HashTableSize = m_HashTableSize;
+        pNewView->pPrevView = m_pView;
+        CascInterlockedStorePointer((void **)(&m_pView), pNewView);
+    }
+
+    const char * FindInGroup_String(DWORD dwGroupIndex, DWORD dwHashValue, const char * szString, const char * szStringEnd)
+    {
+        const char * szExistingString;
+        ULONGLONG Mask;
+
+        for(Mask = MatchControlTag(m_Control + dwGroupIndex, HashToTag(dwHashValue)); Mask != 0; Mask &= (Mask - 1))
+        {
+            szExistingString = (const char *)m_HashTable[dwGroupIndex + GetFirstMatchSlot(Mask)];
+            if(CompareObject_String(szExistingString, szString, szStringEnd))
+                return szExistingString;
+        }
+        return NULL;
+    }
+
+    // Inserts the object to the first empty slot of the current hash table.
+    // The caller must make sure that the object is not in the map yet.
+    // The object pointer is stored first, for FindObjectConcurrent
+    void InsertNew(DWORD dwHashValue, void * pvNewObject)
+    {
+        ULONGLONG Mask;
+        DWORD dwGroupIndex = HashToGroupIndex(dwHashValue, m_HashTableSize);
+        DWORD dwHashIndex;
+
+        // Find the first group with an empty slot
+        while((Mask = MatchControlEmpty(m_Control + dwGroupIndex)) == 0)
+            dwGroupIndex = HashToIndex(dwGroupIndex + CASC_MAP_GROUP_SIZE, m_HashTableSize);
+
+        // Insert at the first empty slot
+        dwHashIndex = dwGroupIndex + GetFirstMatchSlot(Mask);
+        CascInterlockedStorePointer(&m_HashTable[dwHashIndex], pvNewObject);
+        m_Control[dwHashIndex] = HashToTag(dwHashValue);
+    }
+
+    // Replaces the hash table with one of double size. The objects are moved
+    // from the old table during the following inserts, a few at a time.
+    // The new table comes from the allocator of the current one, no matter which thread inserts
+    bool GrowTable()
+    {
+        CASC_ALLOCATOR_SCOPE AllocatorScope(CascGetBlockAllocator(m_HashTable));
+        CASC_MAP_VIEW * pNewView = NULL;
+        void ** NewHashTable = NULL;
+        LPBYTE NewControl = NULL;
+        size_t NewHashTableSize = m_HashTableSize << 1;
+
+        // The previous rehash must be complete
+        FinishRehash();
+
+        // Allocate the new hash table. With concurrent reads, it also needs a view
+        if(NewHashTableSize < m_HashTableSize || !AllocateTable(NewHashTable, NewControl, NewHashTableSize) ||
+           (m_pView != NULL && (pNewView = CASC_ALLOC<CASC_MAP_VIEW>(1)) == NULL))
+        {
+            CASC_FREE(NewHashTable);
+            CASC_FREE(NewControl);
+            return false;
+        }
+
+        // The current table becomes the old one
+        m_OldHashTable = m_HashTable;
+        m_OldControl = m_Control;
+        m_OldHashTableSize = m_HashTableSize;
+        m_HashTable = NewHashTable;
+        m_Control = NewControl;
+        m_HashTableSize = NewHashTableSize;
+        m_RehashIndex = 0;
+
+        // Let the searching threads see the new hash table
+        if(pNewView != NULL)
+            PublishView(pNewView);
+        return true;
+    }
+
+    // Moves objects from the given number of slots of the old hash table to the current one
+    void RehashStep(size_t nSlotCount)
+    {
+        void * pvObject;
+
+        if(m_OldHashTable != NULL)
+        {
+            // Move the objects. The old table is not changed, so lookups in it still work
+            while(nSlotCount-- > 0 && m_RehashIndex < m_OldHashTableSize)
+            {
+                if((pvObject = m_OldHashTable[m_RehashIndex++]) != NULL)
+                {
+                    InsertNew(PfnCalcHashValue((LPBYTE)pvObject + m_KeyOffset, m_KeyLength), pvObject);
+                }
+            }
+
+            // Free the old table once all objects have been moved. With concurrent reads,
+            // the old table stays in its view, as a search may still be going through it
+            if(m_RehashIndex >= m_OldHashTableSize)
+            {
+                if(m_pView != NULL)
+                    m_RetiredBytes += m_OldHashTableSize * sizeof(void *);
+                else
+                    CASC_FREE(m_OldHashTable);
+                m_OldHashTable = NULL;
+                CASC_FREE(m_OldControl);
+                m_OldHashTableSize = 0;
+            }
+        }
     }
 
     bool CompareObject_Key(void * pvObject, void * pvKey)
@@ -347,10 +781,18 @@ class CASC_MAP
 
     PFNHASHFUNC PfnCalcHashValue;
     void ** m_HashTable;                        // Hash table
+    LPBYTE m_Control;                           // Control byte for each slot of the hash table. See CASC_MAP_EMPTY
     size_t m_HashTableSize;                     // Size of the hash table, in entries. Always a power of two.
+    void ** m_OldHashTable;                     // Previous hash table, while its objects are being moved to the current one
+    LPBYTE m_OldControl;                        // Control bytes of the previous hash table
+    size_t m_OldHashTableSize;                  // Size of the previous hash table. Zero if there is none
+    size_t m_RehashIndex;                       // Next slot of the previous hash table to be moved
+    CASC_MAP_VIEW * m_pView;                    // View of the current hash table for FindObjectConcurrent. NULL if not enabled
+    size_t m_RetiredBytes;                      // Size of the hash tables that are only kept for FindObjectConcurrent
     size_t m_ItemCount;                         // Number of objects in the map
     size_t m_KeyOffset;                         // How far is the hash from the begin of the objects (in bytes)
     size_t m_KeyLength;                         // Length of the hash key, in bytes
+    CASC_BLOOM_FILTER m_Filter;                 // Optional filter for rejecting absent keys. See CreateFilter
     bool m_bKeyIsHash;                          // If set, then it means that the key is a hash of some sort.
                                                 // Will improve performance, as we will not hash a hash :-)
 };
@@ -363,15 +805,16 @@ class CASC_MAP
 #define CASC_KEY_TABLE_SIZE     0x100
 #define CASC_KEY_TABLE_MASK     (CASC_KEY_TABLE_SIZE - 1)
 
+// The key items are allocated from an arena and freed together with the arena
 class CASC_KEY_MAP
 {
     public:
 
     CASC_KEY_MAP();
-    ~CASC_KEY_MAP();
 
     LPBYTE FindKey(ULONGLONG KeyName);
-    bool AddKey(ULONGLONG KeyName, LPBYTE Key);
+    bool AddKey(CASC_ARENA & Arena, ULONGLONG KeyName, LPBYTE Key);
+    bool AddKeys(CASC_ARENA & Arena, CASC_KEY_MAP & Source);
 
     protected:
 
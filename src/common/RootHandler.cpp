@@ -80,7 +80,7 @@ PCASC_CKEY_ENTRY TFileTreeRoot::Search(TCascSearch * pSearch, PCASC_FIND_DATA pF
         //BREAKIF(pSearch->nFileIndex >= 2823765);
 
         // Retrieve the file item
-        pFileNode = FileTree.PathAt(pFindData->szFileName, _countof(pFindData->szFileName), pSearch->nFileIndex++);
+        pFileNode = FileTree.PathAt(pFindData->szFileName, _countof(pFindData->szFileName), pSearch->nFileIndex++, &pSearch->PathCache);
         if(pFileNode != NULL)
         {
             // Ignore folders, but report mount points. These can and should be able to open and read
@@ -148,3 +148,84 @@ size_t TFileTreeRoot::GetMaxFileIndex()
 {
     return FileTree.GetMaxFileIndex();
 }
+
+size_t TFileTreeRoot::GetNodeCount()
+{
+    return FileTree.GetCount();
+}
+
+DWORD TFileTreeRoot::CreateNameFilter()
+{
+    return FileTree.CreateNameFilter();
+}
+
+void TFileTreeRoot::GetMemoryUsage(struct _CASC_STORAGE_MEMORY_USAGE * pUsage)
+{
+    FileTree.GetMemoryUsage(pUsage);
+}
+
+DWORD TFileTreeRoot::SaveSnapshot(TCascStorage * hs, CASC_ARRAY & Snapshot)
+{
+    DWORD SnapshotHeader[2] = {CASC_FTREE_ROOT_SIGNATURE, dwFeatures};
+
+    // Insert the header of the root handler, followed by the file tree
+    if(Snapshot.Insert(SnapshotHeader, sizeof(SnapshotHeader)) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    return FileTree.Save(Snapshot, hs->CKeyArray);
+}
+
+DWORD TFileTreeRoot::LoadSnapshot(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd)
+{
+    DWORD SnapshotHeader[2];
+
+    // Capture the header of the root handler
+    if((pbDataPtr + sizeof(SnapshotHeader)) > pbDataEnd)
+        return ERROR_BAD_FORMAT;
+    memcpy(SnapshotHeader, pbDataPtr, sizeof(SnapshotHeader));
+    dwFeatures = SnapshotHeader[1];
+
+    // Load the file tree
+    return FileTree.Load(pbDataPtr + sizeof(SnapshotHeader), pbDataEnd, hs->CKeyArray);
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD RootHandler_LoadSnapshot(TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd)
+{
+    TFileTreeRoot * pRootHandler = NULL;
+    DWORD RootSignature;
+    DWORD dwErrCode = ERROR_BAD_FORMAT;
+
+    // Get the type of the root handler
+    if((pbDataPtr + sizeof(DWORD)) > pbDataEnd)
+        return ERROR_BAD_FORMAT;
+    memcpy(&RootSignature, pbDataPtr, sizeof(DWORD));
+
+    // Root handlers with handler-specific data
+    if(RootSignature == CASC_WOW_ROOT_SIGNATURE)
+        return RootHandler_LoadSnapshotWoW(hs, pbDataPtr, pbDataEnd);
+
+    // All other root handlers only need the file tree once they are loaded
+    if(RootSignature == CASC_FTREE_ROOT_SIGNATURE)
+    {
+        if((pRootHandler = new TFileTreeRoot(0)) != NULL)
+        {
+            // Load the root directory. If load failed, we free the object
+            dwErrCode = pRootHandler->LoadSnapshot(hs, pbDataPtr, pbDataEnd);
+            if(dwErrCode != ERROR_SUCCESS)
+            {
+                delete pRootHandler;
+                pRootHandler = NULL;
+            }
+        }
+        else
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    // Assign the root directory (or NULL) and return error
+    hs->pRootHandler = pRootHandler;
+    return dwErrCode;
+}
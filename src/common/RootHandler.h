@@ -18,6 +18,7 @@
 #define CASC_TVFS_ROOT_SIGNATURE        0x53465654  // 'TVFS'
 #define CASC_DIABLO3_ROOT_SIGNATURE     0x8007D0C4
 #define CASC_WOW_ROOT_SIGNATURE         0x4D465354  // 'TSFM', since WoW build 30080 (8.2.0)
+#define CASC_FTREE_ROOT_SIGNATURE       0x45455254  // 'TREE', only used in storage snapshots
 
 #define DUMP_LEVEL_ROOT_FILE                     1  // Dump root file
 #define DUMP_LEVEL_ENCODING_FILE                 2  // Dump root file + encoding file
@@ -98,6 +99,39 @@ struct TRootHandler
         return 0;
     }
 
+    // Returns the number of nodes in the file tree
+    virtual size_t GetNodeCount()
+    {
+        return 0;
+    }
+
+    // Creates a Bloom filter for rejecting lookups of names that are not in the root
+    virtual DWORD CreateNameFilter()
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    // Adds the memory held by the root handler to the storage memory usage
+    virtual void GetMemoryUsage(struct _CASC_STORAGE_MEMORY_USAGE * /* pUsage */)
+    {}
+
+    // Stores the content of the root handler to the storage snapshot
+    // hs         - Pointer to the storage structure
+    // Snapshot   - Array of bytes that receives the root handler data
+    virtual DWORD SaveSnapshot(struct TCascStorage * /* hs */, CASC_ARRAY & /* Snapshot */)
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    // Restores the content of the root handler from the storage snapshot
+    // hs         - Pointer to the storage structure
+    // pbDataPtr  - Pointer to the root handler data, as stored by SaveSnapshot
+    // pbDataEnd  - End of the root handler data
+    virtual DWORD LoadSnapshot(struct TCascStorage * /* hs */, LPBYTE /* pbDataPtr */, LPBYTE /* pbDataEnd */)
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
     // Returns the list of features
     DWORD GetFeatures()
     {
@@ -126,6 +160,11 @@ struct TFileTreeRoot : public TRootHandler
     bool GetInfo(PCASC_CKEY_ENTRY pCKeyEntry, struct _CASC_FILE_FULL_INFO * pFileInfo);
     size_t Copy(TRootHandler * pRoot);
     size_t GetMaxFileIndex();
+    size_t GetNodeCount();
+    DWORD CreateNameFilter();
+    void GetMemoryUsage(struct _CASC_STORAGE_MEMORY_USAGE * pUsage);
+    DWORD SaveSnapshot(struct TCascStorage * hs, CASC_ARRAY & Snapshot);
+    DWORD LoadSnapshot(struct TCascStorage * hs, LPBYTE pbDataPtr, LPBYTE pbDataEnd);
 
     protected:
 
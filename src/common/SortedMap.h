@@ -0,0 +1,154 @@
+/*****************************************************************************/
+/* SortedMap.h                            Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Immutable map over an array of objects sorted by an MD5-like key.         */
+/* Objects are found by interpolation search, no extra memory is needed.     */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of SortedMap.h                     */
+/*****************************************************************************/
+
+#ifndef __CASC_SORTED_MAP_H__
+#define __CASC_SORTED_MAP_H__
+
+//-----------------------------------------------------------------------------
+// Structures
+
+// Number of interpolation steps before falling back to binary search.
+// For uniformly distributed keys, the search ends much sooner than that.
+#define CASC_SORTED_MAP_MAX_GUESSES     8
+
+class CASC_SORTED_MAP
+{
+    public:
+
+    CASC_SORTED_MAP()
+    {
+        m_pbObjects = NULL;
+        m_ObjectCount = 0;
+        m_ObjectLength = 0;
+        m_KeyOffset = 0;
+        m_KeyLength = 0;
+    }
+
+    //
+    // Creates the map on top of an array of objects. The objects must be sorted
+    // by their keys (memcmp order) and must not change while the map is in use.
+    // The keys must be at least 8 bytes long and should be uniformly distributed,
+    // which is the case of CKeys and EKeys.
+    //
+    DWORD Create(void * pvObjects, size_t ObjectCount, size_t ObjectLength, size_t KeyLength, size_t KeyOffset)
+    {
+        // Sanity checks
+        assert(KeyLength >= sizeof(ULONGLONG));
+        assert(ObjectLength >= KeyOffset + KeyLength);
+
+        // Save the values
+        m_pbObjects = (LPBYTE)pvObjects;
+        m_ObjectCount = ObjectCount;
+        m_ObjectLength = ObjectLength;
+        m_KeyOffset = KeyOffset;
+        m_KeyLength = KeyLength;
+
+#ifdef CASCLIB_DEBUG
+        for(size_t i = 1; i < m_ObjectCount; i++)
+            assert(memcmp(KeyAt(i - 1), KeyAt(i), m_KeyLength) <= 0);
+#endif
+        return ERROR_SUCCESS;
+    }
+
+    // Returns the first object with the given key
+    void * FindObject(void * pvKey)
+    {
+        ULONGLONG KeyValue = KeyToInteger((LPBYTE)pvKey);
+        ULONGLONG LowValue;
+        ULONGLONG HighValue;
+        size_t nLow = 0;
+        size_t nHigh = m_ObjectCount;
+        size_t nIndex;
+        DWORD dwGuesses = 0;
+        int nResult;
+
+        // Search the range <nLow, nHigh)
+        while(nLow < nHigh)
+        {
+            // Guess the position from the leading 8 bytes of the keys at both ends of the range.
+            // If the guesses don't converge (the keys are not uniform), use the middle of the range.
+            LowValue = KeyToInteger(KeyAt(nLow));
+            HighValue = KeyToInteger(KeyAt(nHigh - 1));
+            if(KeyValue < LowValue || KeyValue > HighValue)
+                return NULL;
+
+            if(dwGuesses++ < CASC_SORTED_MAP_MAX_GUESSES && HighValue > LowValue)
+                nIndex = nLow + (size_t)((double)(KeyValue - LowValue) / (double)(HighValue - LowValue) * (double)(nHigh - 1 - nLow));
+            else
+                nIndex = nLow + (nHigh - nLow) / 2;
+            nIndex = CASCLIB_MIN(nIndex, nHigh - 1);
+
+            // Compare the full key
+            nResult = memcmp(KeyAt(nIndex), pvKey, m_KeyLength);
+            if(nResult < 0)
+            {
+                nLow = nIndex + 1;
+            }
+            else if(nResult > 0)
+            {
+                nHigh = nIndex;
+            }
+            else
+            {
+                // There may be more objects with the same key. Return the first one
+                while(nIndex > 0 && !memcmp(KeyAt(nIndex - 1), pvKey, m_KeyLength))
+                    nIndex--;
+                return m_pbObjects + (nIndex * m_ObjectLength);
+            }
+        }
+
+        // Not found
+        return NULL;
+    }
+
+    size_t ItemCount()
+    {
+        return m_ObjectCount;
+    }
+
+    // The map doesn't own the objects, so there is nothing allocated
+    size_t BytesAllocated()
+    {
+        return 0;
+    }
+
+    bool IsInitialized()
+    {
+        return (m_pbObjects != NULL);
+    }
+
+    void Free()
+    {
+        m_pbObjects = NULL;
+        m_ObjectCount = 0;
+    }
+
+    protected:
+
+    LPBYTE KeyAt(size_t nIndex)
+    {
+        return m_pbObjects + (nIndex * m_ObjectLength) + m_KeyOffset;
+    }
+
+    // Big-endian, so that integer order is the same as memcmp order
+    static ULONGLONG KeyToInteger(LPBYTE pbKey)
+    {
+        return ConvertBytesToInteger_8(pbKey);
+    }
+
+    LPBYTE m_pbObjects;                         // Sorted array of objects. Not owned by the map
+    size_t m_ObjectCount;                       // Number of objects in the array
+    size_t m_ObjectLength;                      // Length of the single object
+    size_t m_KeyOffset;                         // How far is the key from the begin of the object (in bytes)
+    size_t m_KeyLength;                         // Length of the key, in bytes
+};
+
+#endif // __CASC_SORTED_MAP_H__
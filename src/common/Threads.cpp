@@ -0,0 +1,379 @@
+/*****************************************************************************/
+/* Threads.cpp                            Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* System-dependent thread functions for CascLib                             */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of Threads.cpp                     */
+/*****************************************************************************/
+
+#define __CASCLIB_SELF__
+#include "../CascLib.h"
+#include "../CascCommon.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define CASC_MAX_WORKER_THREADS 0x20            // Upper limit for the number of threads in the pool
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+typedef CONDITION_VARIABLE CASC_CONDITION;
+#define CascInitCondition(Cond)         InitializeConditionVariable(&Cond);
+#define CascFreeCondition(Cond)         /* Nothing to free */
+#define CascWaitCondition(Cond, Lock)   SleepConditionVariableCS(&Cond, &Lock, INFINITE);
+#define CascWakeAllCondition(Cond)      WakeAllConditionVariable(&Cond);
+#else
+typedef pthread_cond_t CASC_CONDITION;
+#define CascInitCondition(Cond)         pthread_cond_init(&Cond, NULL);
+#define CascFreeCondition(Cond)         pthread_cond_destroy(&Cond);
+#define CascWaitCondition(Cond, Lock)   pthread_cond_wait(&Cond, &Lock);
+#define CascWakeAllCondition(Cond)      pthread_cond_broadcast(&Cond);
+#endif
+
+struct CASC_PARALLEL_LOOP
+{
+    CASC_PARALLEL_LOOP * pNext;                 // Next loop waiting for worker threads
+    PARALLEL_CALLBACK PfnCallback;              // Callback for each item
+    void * pvContext;                           // Caller-defined context
+    PCASC_ALLOCATOR pAllocator;                 // Allocator of the calling thread
+    DWORD NextItem;                             // Index of the next item to process (interlocked)
+    DWORD ItemCount;                            // Total number of items
+    DWORD dwErrCode;                            // The first error that occurred
+    DWORD WantedWorkers;                        // Number of worker threads the loop still wants (pool lock)
+    DWORD ActiveWorkers;                        // Number of worker threads working on the loop (pool lock)
+    CASC_LOCK Lock;                             // Protects dwErrCode
+};
+
+// The worker threads are shared by all parallel loops in the process and live as long
+// as any storage is open, so a loop does not pay for creating and joining its threads.
+// The loops that run at the same time share the threads, instead of each one creating
+// a thread per processor.
+struct CASC_WORKER_POOL
+{
+    CASC_WORKER_POOL()
+    {
+        CascInitLock(Lock);
+        CascInitCondition(WorkReady);
+        CascInitCondition(WorkDone);
+        pFirstLoop = NULL;
+        ThreadCount = 0;
+        Generation = 0;
+        dwRefCount = 0;
+    }
+
+    // If a storage was left open, the threads still use the lock at the process exit
+    ~CASC_WORKER_POOL()
+    {
+        if(ThreadCount != 0)
+            return;
+        CascFreeCondition(WorkDone);
+        CascFreeCondition(WorkReady);
+        CascFreeLock(Lock);
+    }
+
+    CASC_LOCK Lock;                             // Protects all members
+    CASC_CONDITION WorkReady;                   // Signaled when a loop wants workers or the threads shall stop
+    CASC_CONDITION WorkDone;                    // Signaled when a worker thread leaves a loop
+    CASC_PARALLEL_LOOP * pFirstLoop;            // Loops waiting for worker threads
+    CASC_THREAD Threads[CASC_MAX_WORKER_THREADS];
+    DWORD ThreadCount;                          // Number of running worker threads
+    DWORD Generation;                           // Incremented when the threads are stopped
+    DWORD dwRefCount;                           // Number of references to the pool
+};
+
+static CASC_WORKER_POOL WorkerPool;
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static void ParallelLoop_Worker(CASC_PARALLEL_LOOP * pLoop)
+{
+    DWORD dwErrCode;
+    DWORD ItemIndex;
+
+    // Allocate memory the same way as the calling thread
+    CASC_ALLOCATOR_SCOPE AllocatorScope(pLoop->pAllocator);
+
+    // Keep picking items until there are none left or an error occurred
+    while((ItemIndex = CascInterlockedIncrement(&pLoop->NextItem) - 1) < pLoop->ItemCount)
+    {
+        if((dwErrCode = pLoop->PfnCallback(pLoop->pvContext, ItemIndex)) != ERROR_SUCCESS)
+        {
+            CascLock(pLoop->Lock);
+            if(pLoop->dwErrCode == ERROR_SUCCESS)
+                pLoop->dwErrCode = dwErrCode;
+            CascUnlock(pLoop->Lock);
+
+            // Prevent other threads from starting new items. Must be interlocked,
+            // because the other threads increment the value at the same time
+            CascInterlockedExchange(&pLoop->NextItem, pLoop->ItemCount);
+            break;
+        }
+    }
+}
+
+// Removes the loop from the list of loops that wait for workers. Called under the pool lock
+static void UnlinkLoop(CASC_PARALLEL_LOOP * pLoop)
+{
+    CASC_PARALLEL_LOOP ** ppLoop;
+
+    for(ppLoop = &WorkerPool.pFirstLoop; ppLoop[0] != NULL; ppLoop = &ppLoop[0]->pNext)
+    {
+        if(ppLoop[0] == pLoop)
+        {
+            ppLoop[0] = pLoop->pNext;
+            break;
+        }
+    }
+    pLoop->WantedWorkers = 0;
+}
+
+// Serves the parallel loops until the pool is stopped
+static void WorkerPool_Worker(DWORD Generation)
+{
+    CASC_PARALLEL_LOOP * pLoop;
+
+    CascLock(WorkerPool.Lock);
+    for(;;)
+    {
+        // Wait for a loop that wants workers. Exit if the pool was stopped
+        while(WorkerPool.Generation == Generation && WorkerPool.pFirstLoop == NULL)
+            CascWaitCondition(WorkerPool.WorkReady, WorkerPool.Lock);
+        if(WorkerPool.Generation != Generation)
+            break;
+
+        // Join the loop. If it has enough workers now, remove it from the list
+        pLoop = WorkerPool.pFirstLoop;
+        pLoop->ActiveWorkers++;
+        if(--pLoop->WantedWorkers == 0)
+            UnlinkLoop(pLoop);
+        CascUnlock(WorkerPool.Lock);
+
+        ParallelLoop_Worker(pLoop);
+
+        // The loop must not be touched after the calling thread was woken up
+        CascLock(WorkerPool.Lock);
+        if(--pLoop->ActiveWorkers == 0)
+            CascWakeAllCondition(WorkerPool.WorkDone);
+    }
+    CascUnlock(WorkerPool.Lock);
+}
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+static DWORD WINAPI WorkerPool_ThreadProc(LPVOID lpParameter)
+{
+    WorkerPool_Worker((DWORD)(size_t)lpParameter);
+    return 0;
+}
+#else
+static void * WorkerPool_ThreadProc(void * lpParameter)
+{
+    WorkerPool_Worker((DWORD)(size_t)lpParameter);
+    return NULL;
+}
+#endif
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+static DWORD WINAPI Task_ThreadProc(LPVOID lpParameter)
+{
+    CASC_TASK * pTask = (CASC_TASK *)lpParameter;
+    CASC_ALLOCATOR_SCOPE AllocatorScope(pTask->pAllocator);
+
+    pTask->dwErrCode = pTask->PfnCallback(pTask->pvContext);
+    return 0;
+}
+#else
+static void * Task_ThreadProc(void * lpParameter)
+{
+    CASC_TASK * pTask = (CASC_TASK *)lpParameter;
+    CASC_ALLOCATOR_SCOPE AllocatorScope(pTask->pAllocator);
+
+    pTask->dwErrCode = pTask->PfnCallback(pTask->pvContext);
+    return NULL;
+}
+#endif
+
+static bool CreateWorkerThread(CASC_THREAD & Thread, DWORD Generation)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    Thread = CreateThread(NULL, 0, WorkerPool_ThreadProc, (LPVOID)(size_t)Generation, 0, NULL);
+    return (Thread != NULL);
+#else
+    return (pthread_create(&Thread, NULL, WorkerPool_ThreadProc, (void *)(size_t)Generation) == 0);
+#endif
+}
+
+static bool CreateTaskThread(CASC_TASK & Task)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    Task.Thread = CreateThread(NULL, 0, Task_ThreadProc, &Task, 0, NULL);
+    return (Task.Thread != NULL);
+#else
+    return (pthread_create(&Task.Thread, NULL, Task_ThreadProc, &Task) == 0);
+#endif
+}
+
+static void WaitForWorkerThread(CASC_THREAD & Thread)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+#else
+    pthread_join(Thread, NULL);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+size_t CascGetProcessorCount()
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    SYSTEM_INFO SystemInfo;
+
+    GetSystemInfo(&SystemInfo);
+    return CASCLIB_MAX(SystemInfo.dwNumberOfProcessors, 1);
+#else
+    long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (nProcessors > 0) ? (size_t)nProcessors : 1;
+#endif
+}
+
+CASC_THREAD_ID CascGetCurrentThreadId()
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return GetCurrentThreadId();
+#else
+    return pthread_self();
+#endif
+}
+
+bool CascIsCurrentThread(CASC_THREAD_ID ThreadId)
+{
+#ifdef CASCLIB_PLATFORM_WINDOWS
+    return (GetCurrentThreadId() == ThreadId);
+#else
+    return (pthread_equal(pthread_self(), ThreadId) != 0);
+#endif
+}
+
+void CascAddRefWorkerPool()
+{
+    CascLock(WorkerPool.Lock);
+    WorkerPool.dwRefCount++;
+    CascUnlock(WorkerPool.Lock);
+}
+
+void CascReleaseWorkerPool()
+{
+    CASC_THREAD Threads[CASC_MAX_WORKER_THREADS];
+    DWORD ThreadCount = 0;
+
+    // If this was the last reference, tell the threads to stop. The threads started
+    // after this point belong to the next generation and are not affected
+    CascLock(WorkerPool.Lock);
+    assert(WorkerPool.dwRefCount > 0);
+    if(--WorkerPool.dwRefCount == 0)
+    {
+        memcpy(Threads, WorkerPool.Threads, WorkerPool.ThreadCount * sizeof(CASC_THREAD));
+        ThreadCount = WorkerPool.ThreadCount;
+        WorkerPool.ThreadCount = 0;
+        WorkerPool.Generation++;
+        CascWakeAllCondition(WorkerPool.WorkReady);
+    }
+    CascUnlock(WorkerPool.Lock);
+
+    // Wait for the stopped threads
+    for(DWORD i = 0; i < ThreadCount; i++)
+        WaitForWorkerThread(Threads[i]);
+}
+
+DWORD CascParallelFor(PARALLEL_CALLBACK PfnCallback, void * pvContext, size_t nItemCount, size_t nMaxThreads)
+{
+    CASC_PARALLEL_LOOP Loop;
+    size_t nMaxWorkers = CASCLIB_MIN(CascGetProcessorCount() - 1, CASC_MAX_WORKER_THREADS);
+    size_t nThreads;
+
+    // Determine the number of threads. The calling thread is one of them
+    nThreads = (nMaxThreads != 0) ? nMaxThreads : CascGetProcessorCount();
+    nThreads = CASCLIB_MIN(nThreads, nItemCount);
+    nThreads = CASCLIB_MAX(nThreads, 1);
+
+    // Prepare the loop
+    Loop.pNext = NULL;
+    Loop.PfnCallback = PfnCallback;
+    Loop.pvContext = pvContext;
+    Loop.pAllocator = CascGetThreadAllocator();
+    Loop.NextItem = 0;
+    Loop.ItemCount = (DWORD)nItemCount;
+    Loop.dwErrCode = ERROR_SUCCESS;
+    Loop.WantedWorkers = (DWORD)CASCLIB_MIN(nThreads - 1, nMaxWorkers);
+    Loop.ActiveWorkers = 0;
+    CascInitLock(Loop.Lock);
+
+    // Offer the loop to the worker pool. Without a reference to the pool,
+    // the calling thread processes all items alone
+    CascLock(WorkerPool.Lock);
+    if(WorkerPool.dwRefCount != 0 && Loop.WantedWorkers != 0)
+    {
+        // Start the threads that the pool doesn't have yet. If a thread
+        // can't be created, we go on with those that we have
+        while(WorkerPool.ThreadCount < Loop.WantedWorkers)
+        {
+            if(!CreateWorkerThread(WorkerPool.Threads[WorkerPool.ThreadCount], WorkerPool.Generation))
+                break;
+            WorkerPool.ThreadCount++;
+        }
+
+        // Threads busy with other loops join this one when they are done
+        if(WorkerPool.ThreadCount != 0)
+        {
+            Loop.pNext = WorkerPool.pFirstLoop;
+            WorkerPool.pFirstLoop = &Loop;
+            CascWakeAllCondition(WorkerPool.WorkReady);
+        }
+    }
+    CascUnlock(WorkerPool.Lock);
+
+    // The calling thread participates on the work too
+    ParallelLoop_Worker(&Loop);
+
+    // No more workers may join. Wait for those that did
+    CascLock(WorkerPool.Lock);
+    UnlinkLoop(&Loop);
+    while(Loop.ActiveWorkers != 0)
+        CascWaitCondition(WorkerPool.WorkDone, WorkerPool.Lock);
+    CascUnlock(WorkerPool.Lock);
+
+    CascFreeLock(Loop.Lock);
+    return Loop.dwErrCode;
+}
+
+void CascStartTask(CASC_TASK & Task, TASK_CALLBACK PfnCallback, void * pvContext)
+{
+    // Prepare the task
+    Task.PfnCallback = PfnCallback;
+    Task.pvContext = pvContext;
+    Task.pAllocator = CascGetThreadAllocator();
+    Task.dwErrCode = ERROR_SUCCESS;
+
+    // Start the worker thread. If it can't be created, we do the work right away
+    Task.bHasThread = CreateTaskThread(Task);
+    if(Task.bHasThread == false)
+    {
+        Task.dwErrCode = PfnCallback(pvContext);
+    }
+}
+
+DWORD CascWaitForTask(CASC_TASK & Task)
+{
+    // Wait for the worker thread, if any
+    if(Task.bHasThread)
+    {
+        WaitForWorkerThread(Task.Thread);
+        Task.bHasThread = false;
+    }
+    return Task.dwErrCode;
+}
@@ -0,0 +1,91 @@
+/*****************************************************************************/
+/* Threads.h                              Copyright (c) Ladislav Zezula 2026 */
+/*---------------------------------------------------------------------------*/
+/* Parallel loop and background tasks for CascLib                            */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 18.10.26  1.00  Lad  The first version of Threads.h                       */
+/*****************************************************************************/
+
+#ifndef __CASC_THREADS_H__
+#define __CASC_THREADS_H__
+
+#ifdef CASCLIB_PLATFORM_WINDOWS
+typedef HANDLE CASC_THREAD;
+typedef DWORD CASC_THREAD_ID;
+#else
+typedef pthread_t CASC_THREAD;
+typedef pthread_t CASC_THREAD_ID;
+#endif
+
+//-----------------------------------------------------------------------------
+// Parallel loop
+
+// Processes one item of a parallel loop. Must be thread-safe with respect to other items.
+// If the callback returns an error, no more items are started and the error is returned
+typedef DWORD (*PARALLEL_CALLBACK)(void * pvContext, size_t nItemIndex);
+
+size_t CascGetProcessorCount(
+    );
+
+// Identifies the current thread, e.g. to find out whether a loop item runs on the calling thread
+CASC_THREAD_ID CascGetCurrentThreadId(
+    );
+
+bool CascIsCurrentThread(
+    CASC_THREAD_ID ThreadId
+    );
+
+// The worker threads of parallel loops are kept in a process-wide pool, which lives
+// as long as it has references. Each open storage holds one reference
+void CascAddRefWorkerPool(
+    );
+
+// Releases a reference to the worker pool. Stops the threads when the last reference is released
+void CascReleaseWorkerPool(
+    );
+
+// Calls the callback for each item in <0, nItemCount). The calling thread
+// also processes items. If nMaxThreads is 0, the number of processors is used.
+// The worker pool has one thread less than the number of processors. The threads busy
+// with other loops join when they are done; until then, the calling thread works alone.
+// Without a reference to the worker pool, the calling thread processes all items alone
+DWORD CascParallelFor(
+    PARALLEL_CALLBACK PfnCallback,
+    void * pvContext,
+    size_t nItemCount,
+    size_t nMaxThreads = 0
+    );
+
+//-----------------------------------------------------------------------------
+// Background task
+
+// Performs a single task on a worker thread
+typedef DWORD (*TASK_CALLBACK)(void * pvContext);
+
+struct CASC_TASK
+{
+    TASK_CALLBACK PfnCallback;                  // Callback performing the task
+    void * pvContext;                           // Caller-defined context
+    PCASC_ALLOCATOR pAllocator;                 // Allocator of the thread that started the task
+    CASC_THREAD Thread;                         // Thread running the task
+    DWORD dwErrCode;                            // Result of the task
+    bool bHasThread;                            // If true, the task runs on its own thread
+};
+
+// Starts the task on a worker thread. If the thread can't be created,
+// the task is performed synchronously before the function returns
+void CascStartTask(
+    CASC_TASK & Task,
+    TASK_CALLBACK PfnCallback,
+    void * pvContext
+    );
+
+// Waits until the task is complete and returns its result.
+// Can be called multiple times for the same task
+DWORD CascWaitForTask(
+    CASC_TASK & Task
+    );
+
+#endif // __CASC_THREADS_H__
@@ -122,6 +122,13 @@ typedef struct _CASC_FIND_DATA_ARRAY
 
 } CASC_FIND_DATA_ARRAY, *PCASC_FIND_DATA_ARRAY;
 
+// Object for testing the maps
+typedef struct _TEST_MAP_OBJECT
+{
+    BYTE Key[MD5_HASH_SIZE];                // Key of the object
+    DWORD dwIndex;                          // Index of the object in the array
+} TEST_MAP_OBJECT, *PTEST_MAP_OBJECT;
+
 typedef DWORD (*PFN_RUN_TEST)(TLogHelper & LogHelper, TEST_PARAMS & Params);
 
 //-----------------------------------------------------------------------------
@@ -581,6 +588,143 @@ static void RunExtractWorkers(PCASC_FIND_DATA_ARRAY pFiles)
 #endif
 }
 
+// Calculates the compound name hash and data hash of all files in the storage, without extracting them
+static DWORD GetStorageHashes(HANDLE hStorage, char * szNameHash, char * szDataHash)
+{
+    CASC_FIND_DATA cf;
+    MD5_CTX NameHashCtx;
+    MD5_CTX DataHashCtx;
+    HANDLE hFind;
+
+    // Init both hashers
+    MD5_Init(&NameHashCtx);
+    MD5_Init(&DataHashCtx);
+
+    // Hash the names and CKeys of all files, in the order of the search
+    hFind = CascFindFirstFile(hStorage, "*", &cf, GetTheProperListfile(hStorage, NULL));
+    if(hFind == INVALID_HANDLE_VALUE)
+        return GetCascError();
+
+    do
+    {
+        MD5_Update(&NameHashCtx, cf.szFileName, (unsigned long)(strlen(cf.szFileName) + 1));
+        MD5_Update(&DataHashCtx, cf.CKey, MD5_HASH_SIZE);
+    }
+    while(CascFindNextFile(hFind, &cf));
+    CascFindClose(hFind);
+
+    GetHash(NameHashCtx, szNameHash);
+    GetHash(DataHashCtx, szDataHash);
+    return ERROR_SUCCESS;
+}
+
+// Opens the storage and calculates the hashes of its files. If PtrStorage is NULL, the storage is closed
+static DWORD OpenAndHashStorage(LPCTSTR szFullPath, CASC_OPEN_STORAGE_ARGS & OpenArgs, char * szNameHash, char * szDataHash, HANDLE * PtrStorage = NULL)
+{
+    HANDLE hStorage = NULL;
+    DWORD dwErrCode;
+
+    if(!CascOpenStorageEx(szFullPath, &OpenArgs, false, &hStorage))
+        return GetCascError();
+
+    dwErrCode = GetStorageHashes(hStorage, szNameHash, szDataHash);
+    if(dwErrCode == ERROR_SUCCESS && PtrStorage != NULL)
+    {
+        PtrStorage[0] = hStorage;
+        return ERROR_SUCCESS;
+    }
+
+    CascCloseStorage(hStorage);
+    return dwErrCode;
+}
+
+// Opens the file and reads all of its data
+static DWORD ReadWholeFile(HANDLE hStorage, const void * pvFileName, DWORD dwOpenFlags)
+{
+    HANDLE hFile = NULL;
+    DWORD dwBytesRead = 1;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    BYTE Buffer[0x10000];
+
+    if(!CascOpenFile(hStorage, pvFileName, 0, dwOpenFlags | CASC_OVERCOME_ENCRYPTED, &hFile))
+        return GetCascError();
+
+    while(dwBytesRead != 0)
+    {
+        if(!CascReadFile(hFile, Buffer, sizeof(Buffer), &dwBytesRead))
+        {
+            dwErrCode = GetCascError();
+            break;
+        }
+    }
+
+    CascCloseFile(hFile);
+    return dwErrCode;
+}
+
+// Creates the key of the test object. The keys are uniformly distributed, like CKeys and EKeys.
+// With bSameHash, all keys have the same hash value in CASC_MAP, so they all end up in one probe chain
+static void MakeTestKey(LPBYTE Key, DWORD dwIndex, bool bSameHash = false)
+{
+    MD5_CTX md5_ctx;
+
+    MD5_Init(&md5_ctx);
+    MD5_Update(&md5_ctx, &dwIndex, sizeof(DWORD));
+    MD5_Final(Key, &md5_ctx);
+
+    if(bSameHash)
+        memset(Key, 0x5A, sizeof(DWORD));
+}
+
+static PTEST_MAP_OBJECT CreateTestObjects(DWORD dwObjectCount, bool bSameHash = false)
+{
+    PTEST_MAP_OBJECT pObjects;
+
+    if((pObjects = CASC_ALLOC<TEST_MAP_OBJECT>(dwObjectCount)) != NULL)
+    {
+        for(DWORD i = 0; i < dwObjectCount; i++)
+        {
+            MakeTestKey(pObjects[i].Key, i, bSameHash);
+            pObjects[i].dwIndex = i;
+        }
+    }
+    return pObjects;
+}
+
+// Checks that all objects are found in the map and that keys of other objects are not
+static DWORD VerifyMapObjects(TLogHelper & LogHelper, CASC_MAP & Map, PTEST_MAP_OBJECT pObjects, DWORD dwObjectCount, bool bSameHash = false)
+{
+    BYTE AbsentKey[MD5_HASH_SIZE];
+
+    for(DWORD i = 0; i < dwObjectCount; i++)
+    {
+        if(Map.FindObject(pObjects[i].Key) != &pObjects[i])
+        {
+            LogHelper.PrintMessage("Error: Object %u was not found in the map", i);
+            return ERROR_FILE_CORRUPT;
+        }
+
+        MakeTestKey(AbsentKey, dwObjectCount + i, bSameHash);
+        if(Map.FindObject(AbsentKey) != NULL)
+        {
+            LogHelper.PrintMessage("Error: Non-existing object %u was found in the map", dwObjectCount + i);
+            return ERROR_FILE_CORRUPT;
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+static int CompareTestObjects(const void * pvObject1, const void * pvObject2)
+{
+    return memcmp(((PTEST_MAP_OBJECT)pvObject1)->Key, ((PTEST_MAP_OBJECT)pvObject2)->Key, MD5_HASH_SIZE);
+}
+
+// Content of the test file for the block cache
+static BYTE TestFileByte(ULONGLONG ByteOffset)
+{
+    return (BYTE)((ByteOffset * 13) ^ (ByteOffset >> 12));
+}
+
 //-----------------------------------------------------------------------------
 // Testing functions
 
@@ -971,6 +1115,873 @@ static DWORD SpeedStorage_Test(PFN_RUN_TEST PfnRunTest, LPCSTR szStorage, LPCSTR
     return dwErrCode;
 }
 
+// Opens the storage with a snapshot twice. The first open creates the snapshot,
+// the second one loads the storage from it. Both must give the same files
+// as the storage that was opened without the snapshot
+static DWORD SnapshotStorage_Test(STORAGE_INFO & StorInfo)
+{
+    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    CASC_STORAGE_OPEN_STATS OpenStats;
+    TLogHelper LogHelper(StorInfo.szPath, _T("snapshot"));
+    HANDLE hStorage = NULL;
+    TCHAR szSnapshotPath[MAX_PATH];
+    TCHAR szFullPath[MAX_PATH];
+    DWORD dwErrCode;
+    char szNameHash1[MD5_STRING_SIZE+1];
+    char szDataHash1[MD5_STRING_SIZE+1];
+    char szNameHash2[MD5_STRING_SIZE+1];
+    char szDataHash2[MD5_STRING_SIZE+1];
+
+    // Prepare the full path of the storage and of the snapshot directory
+    MakeFullPath(szFullPath, _countof(szFullPath), StorInfo.szPath);
+    CopyPath(szSnapshotPath, szSnapshotPath + _countof(szSnapshotPath) - 1, CASC_WORK_ROOT);
+
+    // Open the storage without snapshot
+    LogHelper.PrintProgress("Opening storage ...");
+    OpenArgs.dwFlags = StorInfo.dwFeatures;
+    if((dwErrCode = OpenAndHashStorage(szFullPath, OpenArgs, szNameHash1, szDataHash1)) != ERROR_SUCCESS)
+    {
+        LogHelper.PrintError("Error: Failed to open storage %s", StorInfo.szPath);
+        return dwErrCode;
+    }
+
+    // The first open creates the snapshot, the second one loads the storage from it
+    OpenArgs.szSnapshotPath = szSnapshotPath;
+    for(int i = 0; i < 2 && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        LogHelper.PrintProgress((i == 0) ? "Creating snapshot ..." : "Opening storage from snapshot ...");
+        if((dwErrCode = OpenAndHashStorage(szFullPath, OpenArgs, szNameHash2, szDataHash2, &hStorage)) != ERROR_SUCCESS)
+        {
+            LogHelper.PrintError("Error: Failed to open storage %s", StorInfo.szPath);
+            break;
+        }
+
+        // The files must be the same like without snapshot
+        if(strcmp(szNameHash1, szNameHash2) || strcmp(szDataHash1, szDataHash2))
+        {
+            LogHelper.PrintMessage("Error: The files differ from the storage opened without snapshot");
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+
+        // The storage loaded from the snapshot must not have loaded the ENCODING manifest
+        memset(&OpenStats, 0, sizeof(CASC_STORAGE_OPEN_STATS));
+        CascGetStorageInfo(hStorage, CascStorageOpenStats, &OpenStats, sizeof(CASC_STORAGE_OPEN_STATS), NULL);
+        if(dwErrCode == ERROR_SUCCESS && i == 1 && OpenStats.Phases[CascOpenPhaseEncoding].WallTime != 0)
+        {
+            LogHelper.PrintMessage("Error: The storage was not loaded from the snapshot");
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+
+        // The example file must be readable
+        if(dwErrCode == ERROR_SUCCESS && StorInfo.szFileName != NULL)
+        {
+            if((dwErrCode = ReadWholeFile(hStorage, StorInfo.szFileName, 0)) != ERROR_SUCCESS)
+                LogHelper.PrintError("Error: Failed to read %s", StorInfo.szFileName);
+        }
+
+        CascCloseStorage(hStorage);
+        hStorage = NULL;
+    }
+
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Opens the storage with the given open flags and checks that the files can be opened
+// by CKey and EKey before anything else is loaded, and that the storage gives the same
+// files as the storage that was opened without the flags
+static DWORD LookupStorage_Test(STORAGE_INFO & StorInfo, DWORD dwOpenFlags, LPCTSTR szSubTitle)
+{
+    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    TLogHelper LogHelper(StorInfo.szPath, szSubTitle);
+    HANDLE hStorage = NULL;
+    HANDLE hFile = NULL;
+    TCHAR szFullPath[MAX_PATH];
+    DWORD dwErrCode;
+    BYTE AbsentEKey[MD5_HASH_SIZE];
+    BYTE CKey[MD5_HASH_SIZE];
+    BYTE EKey[MD5_HASH_SIZE];
+    char szNameHash1[MD5_STRING_SIZE+1];
+    char szDataHash1[MD5_STRING_SIZE+1];
+    char szNameHash2[MD5_STRING_SIZE+1];
+    char szDataHash2[MD5_STRING_SIZE+1];
+    bool bHasKeys = false;
+
+    // Open the storage without the flags. Remember the keys of the example file
+    LogHelper.PrintProgress("Opening storage ...");
+    MakeFullPath(szFullPath, _countof(szFullPath), StorInfo.szPath);
+    OpenArgs.dwFlags = StorInfo.dwFeatures;
+    if((dwErrCode = OpenAndHashStorage(szFullPath, OpenArgs, szNameHash1, szDataHash1, &hStorage)) != ERROR_SUCCESS)
+    {
+        LogHelper.PrintError("Error: Failed to open storage %s", StorInfo.szPath);
+        return dwErrCode;
+    }
+
+    if(StorInfo.szFileName != NULL && CascOpenFile(hStorage, StorInfo.szFileName, 0, CASC_OVERCOME_ENCRYPTED, &hFile))
+    {
+        bHasKeys = CascGetFileInfo(hFile, CascFileContentKey, CKey, sizeof(CKey), NULL) &&
+                   CascGetFileInfo(hFile, CascFileEncodedKey, EKey, sizeof(EKey), NULL);
+        CascCloseFile(hFile);
+    }
+    CascCloseStorage(hStorage);
+    hStorage = NULL;
+
+    // Open the storage with the flags
+    LogHelper.PrintProgress("Opening storage with the lookup flags ...");
+    OpenArgs.dwFlags = StorInfo.dwFeatures | dwOpenFlags;
+    if(!CascOpenStorageEx(szFullPath, &OpenArgs, false, &hStorage))
+    {
+        LogHelper.PrintError("Error: Failed to open storage %s", StorInfo.szPath);
+        return LogHelper.PrintVerdict(GetCascError());
+    }
+
+    // Open the file by CKey and by EKey. This is the first lookup in the storage
+    if(bHasKeys)
+    {
+        if((dwErrCode = ReadWholeFile(hStorage, CKey, CASC_OPEN_BY_CKEY)) != ERROR_SUCCESS)
+            LogHelper.PrintError("Error: Failed to read %s by CKey", StorInfo.szFileName);
+        if(dwErrCode == ERROR_SUCCESS && (dwErrCode = ReadWholeFile(hStorage, EKey, CASC_OPEN_BY_EKEY)) != ERROR_SUCCESS)
+            LogHelper.PrintError("Error: Failed to read %s by EKey", StorInfo.szFileName);
+    }
+
+    // With lazy ENCODING, the storage must report that it has no DOWNLOAD manifest
+    if(dwErrCode == ERROR_SUCCESS && (dwOpenFlags & CASC_FEATURE_LAZY_ENCODING))
+    {
+        DWORD dwFeatures = 0;
+
+        CascGetStorageInfo(hStorage, CascStorageFeatures, &dwFeatures, sizeof(dwFeatures), NULL);
+        if((dwFeatures & CASC_FEATURE_NO_DOWNLOAD) == 0 || (dwFeatures & CASC_FEATURE_TAGS))
+        {
+            LogHelper.PrintMessage("Error: The storage doesn't report that DOWNLOAD was not loaded");
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+    }
+
+    // An EKey that is not in the storage must not be found
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        memset(AbsentEKey, 0xFF, sizeof(AbsentEKey));
+        if(CascOpenFile(hStorage, AbsentEKey, 0, CASC_OPEN_BY_EKEY, &hFile))
+        {
+            LogHelper.PrintMessage("Error: A file with non-existing EKey was open");
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+            CascCloseFile(hFile);
+        }
+    }
+
+    // The storage must give the same files like without the flags
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        LogHelper.PrintProgress("Enumerating files ...");
+        if((dwErrCode = GetStorageHashes(hStorage, szNameHash2, szDataHash2)) == ERROR_SUCCESS)
+        {
+            if(strcmp(szNameHash1, szNameHash2) || strcmp(szDataHash1, szDataHash2))
+            {
+                LogHelper.PrintMessage("Error: The files differ from the storage opened without the flags");
+                dwErrCode = ERROR_FILE_CORRUPT;
+            }
+        }
+    }
+
+    // The example file must be readable by name
+    if(dwErrCode == ERROR_SUCCESS && StorInfo.szFileName != NULL)
+    {
+        if((dwErrCode = ReadWholeFile(hStorage, StorInfo.szFileName, 0)) != ERROR_SUCCESS)
+            LogHelper.PrintError("Error: Failed to read %s", StorInfo.szFileName);
+    }
+
+    CascCloseStorage(hStorage);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Refreshes a storage that did not change on disk. The refresh must report no change
+// and the storage must give the same files as before
+static DWORD RefreshStorage_Test(STORAGE_INFO & StorInfo, DWORD dwOpenFlags, LPCTSTR szSubTitle)
+{
+    CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
+    TLogHelper LogHelper(StorInfo.szPath, szSubTitle);
+    HANDLE hStorage = NULL;
+    TCHAR szFullPath[MAX_PATH];
+    DWORD dwRefreshFlags = 0;
+    DWORD dwErrCode;
+    char szNameHash1[MD5_STRING_SIZE+1];
+    char szDataHash1[MD5_STRING_SIZE+1];
+    char szNameHash2[MD5_STRING_SIZE+1];
+    char szDataHash2[MD5_STRING_SIZE+1];
+
+    // Open the storage and remember its files
+    LogHelper.PrintProgress("Opening storage ...");
+    MakeFullPath(szFullPath, _countof(szFullPath), StorInfo.szPath);
+    OpenArgs.dwFlags = StorInfo.dwFeatures | dwOpenFlags;
+    if((dwErrCode = OpenAndHashStorage(szFullPath, OpenArgs, szNameHash1, szDataHash1, &hStorage)) != ERROR_SUCCESS)
+    {
+        LogHelper.PrintError("Error: Failed to open storage %s", StorInfo.szPath);
+        return dwErrCode;
+    }
+
+    // Nothing changed on disk, so the refresh must not report any change
+    LogHelper.PrintProgress("Refreshing storage ...");
+    if(!CascRefreshStorage(hStorage, &dwRefreshFlags))
+    {
+        LogHelper.PrintMessage("Error: Failed to refresh the storage");
+        dwErrCode = GetCascError();
+    }
+    else if(dwRefreshFlags != 0)
+    {
+        LogHelper.PrintMessage("Error: Refresh reported a change in unchanged storage (flags %08X)", dwRefreshFlags);
+        dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    }
+
+    // The storage must give the same files like before the refresh
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        LogHelper.PrintProgress("Enumerating files ...");
+        if((dwErrCode = GetStorageHashes(hStorage, szNameHash2, szDataHash2)) == ERROR_SUCCESS)
+        {
+            if(strcmp(szNameHash1, szNameHash2) || strcmp(szDataHash1, szDataHash2))
+            {
+                LogHelper.PrintMessage("Error: The files differ from the files before refresh");
+                dwErrCode = ERROR_FILE_CORRUPT;
+            }
+        }
+    }
+
+    // The example file must be readable after the refresh
+    if(dwErrCode == ERROR_SUCCESS && StorInfo.szFileName != NULL)
+    {
+        if((dwErrCode = ReadWholeFile(hStorage, StorInfo.szFileName, 0)) != ERROR_SUCCESS)
+            LogHelper.PrintError("Error: Failed to read %s", StorInfo.szFileName);
+    }
+
+    CascCloseStorage(hStorage);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the lookup in CASC_MAP that is large enough for all objects:
+// all objects are found and their index points to them, absent keys and duplicates are rejected
+static DWORD Map_Test(DWORD dwObjectCount, bool bSameHash)
+{
+    PTEST_MAP_OBJECT pObjects;
+    TLogHelper LogHelper("MapTest", bSameHash ? _T("same hash") : _T("lookup"));
+    CASC_MAP Map;
+    DWORD dwIndex;
+    DWORD dwErrCode;
+
+    // Prepare the objects and the map
+    if((pObjects = CreateTestObjects(dwObjectCount, bSameHash)) == NULL)
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    if((dwErrCode = Map.Create(dwObjectCount, MD5_HASH_SIZE, FIELD_OFFSET(TEST_MAP_OBJECT, Key))) != ERROR_SUCCESS)
+    {
+        CASC_FREE(pObjects);
+        return LogHelper.PrintVerdict(dwErrCode);
+    }
+
+    // Insert all objects. Each object can only be inserted once
+    for(DWORD i = 0; i < dwObjectCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(!Map.InsertObject(&pObjects[i], pObjects[i].Key) || Map.InsertObject(&pObjects[i], pObjects[i].Key))
+        {
+            LogHelper.PrintMessage("Error: Failed to insert object %u", i);
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+    }
+
+    // Find all objects and check their index in the hash table
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = VerifyMapObjects(LogHelper, Map, pObjects, dwObjectCount, bSameHash);
+    for(DWORD i = 0; i < dwObjectCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(Map.FindObject(pObjects[i].Key, &dwIndex) == NULL || Map.ItemAt(dwIndex) != &pObjects[i])
+        {
+            LogHelper.PrintMessage("Error: Wrong index of object %u", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // The map must have all objects
+    if(dwErrCode == ERROR_SUCCESS && Map.ItemCount() != dwObjectCount)
+    {
+        LogHelper.PrintMessage("Error: The map has %u objects instead of %u", (DWORD)Map.ItemCount(), dwObjectCount);
+        dwErrCode = ERROR_FILE_CORRUPT;
+    }
+
+    CASC_FREE(pObjects);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the growth of CASC_MAP that is created much smaller than needed. The objects
+// must be found while the map is being rehashed, after the rehash and with the filter
+static DWORD MapGrow_Test(DWORD dwObjectCount)
+{
+    PTEST_MAP_OBJECT pObjects;
+    TLogHelper LogHelper("MapTest", _T("growth"));
+    CASC_MAP Map;
+    size_t nFoundCount = 0;
+    DWORD dwErrCode;
+
+    // Prepare the objects and the smallest possible map
+    if((pObjects = CreateTestObjects(dwObjectCount)) == NULL)
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    if((dwErrCode = Map.Create(1, MD5_HASH_SIZE, FIELD_OFFSET(TEST_MAP_OBJECT, Key))) != ERROR_SUCCESS)
+    {
+        CASC_FREE(pObjects);
+        return LogHelper.PrintVerdict(dwErrCode);
+    }
+
+    // Insert all objects. Every few inserts, check that all objects so far are found, even during rehash
+    for(DWORD i = 0; i < dwObjectCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(!Map.InsertObject(&pObjects[i], pObjects[i].Key))
+        {
+            LogHelper.PrintMessage("Error: Failed to insert object %u", i);
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+
+        if((i & 0xFFF) == 0)
+        {
+            for(DWORD j = 0; j <= i && dwErrCode == ERROR_SUCCESS; j++)
+            {
+                if(Map.FindObject(pObjects[j].Key) != &pObjects[j])
+                {
+                    LogHelper.PrintMessage("Error: Object %u was not found after inserting object %u", j, i);
+                    dwErrCode = ERROR_FILE_CORRUPT;
+                }
+            }
+        }
+    }
+
+    // Check the map before and after finishing the rehash
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = VerifyMapObjects(LogHelper, Map, pObjects, dwObjectCount);
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        Map.FinishRehash();
+        dwErrCode = VerifyMapObjects(LogHelper, Map, pObjects, dwObjectCount);
+    }
+
+    // The enumeration must give every object exactly once
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        for(size_t i = 0; i < Map.HashTableSize(); i++)
+        {
+            if(Map.ItemAt(i) != NULL)
+                nFoundCount++;
+        }
+
+        if(nFoundCount != dwObjectCount || Map.ItemCount() != dwObjectCount)
+        {
+            LogHelper.PrintMessage("Error: The map has %u objects instead of %u", (DWORD)nFoundCount, dwObjectCount);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // The filter must not reject any object
+    if(dwErrCode == ERROR_SUCCESS && (dwErrCode = Map.CreateFilter(dwObjectCount)) == ERROR_SUCCESS)
+        dwErrCode = VerifyMapObjects(LogHelper, Map, pObjects, dwObjectCount);
+
+    CASC_FREE(pObjects);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+struct MAP_CONCURRENT_TEST
+{
+    PTEST_MAP_OBJECT pObjects;                      // Objects to insert
+    CASC_MAP * pMap;                                // Map being filled
+    DWORD dwObjectCount;                            // Number of objects
+    DWORD dwInserted;                               // Number of objects inserted so far
+};
+
+static DWORD MapConcurrent_Insert(void * pvContext)
+{
+    MAP_CONCURRENT_TEST * pTest = (MAP_CONCURRENT_TEST *)pvContext;
+
+    for(DWORD i = 0; i < pTest->dwObjectCount; i++)
+    {
+        if(!pTest->pMap->InsertObject(&pTest->pObjects[i], pTest->pObjects[i].Key))
+            return ERROR_CAN_NOT_COMPLETE;
+        CascInterlockedStore(&pTest->dwInserted, i + 1);
+    }
+    return ERROR_SUCCESS;
+}
+
+// Tests the lookups in CASC_MAP while another thread inserts into it and the map grows.
+// Every object that was inserted before the lookup started must be found
+static DWORD MapConcurrent_Test(DWORD dwObjectCount)
+{
+    MAP_CONCURRENT_TEST Test;
+    TLogHelper LogHelper("MapTest", _T("concurrent"));
+    CASC_TASK Task;
+    CASC_MAP Map;
+    DWORD dwInserted = 0;
+    DWORD dwErrCode;
+
+    // Prepare the objects and the smallest possible map
+    if((Test.pObjects = CreateTestObjects(dwObjectCount)) == NULL)
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    if((dwErrCode = Map.Create(1, MD5_HASH_SIZE, FIELD_OFFSET(TEST_MAP_OBJECT, Key))) == ERROR_SUCCESS)
+        dwErrCode = Map.EnableConcurrentReads();
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        CASC_FREE(Test.pObjects);
+        return LogHelper.PrintVerdict(dwErrCode);
+    }
+
+    // Insert the objects on another thread
+    Test.pMap = &Map;
+    Test.dwObjectCount = dwObjectCount;
+    Test.dwInserted = 0;
+    CascStartTask(Task, MapConcurrent_Insert, &Test);
+
+    // Meanwhile, search for the newest object and for a few of the older ones
+    while(dwInserted < dwObjectCount && dwErrCode == ERROR_SUCCESS)
+    {
+        if((dwInserted = CascInterlockedLoad(&Test.dwInserted)) == 0)
+            continue;
+
+        for(DWORD j = dwInserted - 1, nStep = 1; j < dwInserted && dwErrCode == ERROR_SUCCESS; j -= nStep, nStep *= 2)
+        {
+            if(Map.FindObjectConcurrent(Test.pObjects[j].Key) != &Test.pObjects[j])
+            {
+                LogHelper.PrintMessage("Error: Object %u was not found after inserting %u objects", j, dwInserted);
+                dwErrCode = ERROR_FILE_CORRUPT;
+            }
+        }
+    }
+
+    // Check the result of the inserts and the complete map
+    if(CascWaitForTask(Task) != ERROR_SUCCESS && dwErrCode == ERROR_SUCCESS)
+        dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    for(DWORD i = 0; i < dwObjectCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(Map.FindObjectConcurrent(Test.pObjects[i].Key) != &Test.pObjects[i] || Map.FindObject(Test.pObjects[i].Key) != &Test.pObjects[i])
+        {
+            LogHelper.PrintMessage("Error: Object %u was not found", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    CASC_FREE(Test.pObjects);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the growth of CASC_CHUNKED_ARRAY from a first chunk of any size.
+// The items must never move and their indexes must be found back
+static DWORD ChunkedArray_Test(DWORD dwFirstChunkItems, DWORD dwItemCount)
+{
+    CASC_CHUNKED_ARRAY Array;
+    TLogHelper LogHelper("ChunkedArrayTest");
+    DWORD ** PtrItems;
+    DWORD * pdwCopy;
+    DWORD dwForeignItem = 0;
+    DWORD dwErrCode;
+
+    // Prepare the array and the buffers for checking
+    PtrItems = CASC_ALLOC<DWORD *>(dwItemCount);
+    pdwCopy = CASC_ALLOC<DWORD>(dwItemCount);
+    if(PtrItems == NULL || pdwCopy == NULL || (dwErrCode = Array.Create<DWORD>(dwFirstChunkItems)) != ERROR_SUCCESS)
+    {
+        CASC_FREE(PtrItems);
+        CASC_FREE(pdwCopy);
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    }
+
+    // Insert the items one by one, then a block that spans multiple chunks
+    for(DWORD i = 0; i < dwItemCount / 2 && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if((PtrItems[i] = (DWORD *)Array.Insert()) == NULL)
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        else
+            PtrItems[i][0] = i;
+    }
+    for(DWORD i = dwItemCount / 2; i < dwItemCount; i++)
+        pdwCopy[i] = i;
+    if(dwErrCode == ERROR_SUCCESS && Array.Insert(pdwCopy + dwItemCount / 2, dwItemCount - dwItemCount / 2) == NULL)
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+    // Verify the items, their pointers and their indexes
+    for(DWORD i = 0; i < dwItemCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        DWORD * PtrItem = (DWORD *)Array.ItemAt(i);
+
+        if(PtrItem == NULL || PtrItem[0] != i || (i < dwItemCount / 2 && PtrItem != PtrItems[i]) || Array.IndexOf(PtrItem) != i)
+        {
+            LogHelper.PrintMessage("Error: Item %u is wrong", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // Items out of the array must not be found
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        if(Array.ItemAt(dwItemCount) != NULL || Array.IndexOf(&dwForeignItem) != CASC_INVALID_INDEX || Array.ItemCount() != dwItemCount)
+        {
+            LogHelper.PrintMessage("Error: The array has items beyond its end");
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // The copy must have all items in order
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        Array.CopyTo(pdwCopy);
+        for(DWORD i = 0; i < dwItemCount && dwErrCode == ERROR_SUCCESS; i++)
+        {
+            if(pdwCopy[i] != i)
+            {
+                LogHelper.PrintMessage("Error: Item %u is wrong in the copy", i);
+                dwErrCode = ERROR_FILE_CORRUPT;
+            }
+        }
+    }
+
+    Array.Free();
+    CASC_FREE(PtrItems);
+    CASC_FREE(pdwCopy);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the lookup in CASC_SORTED_MAP. Every 100th key is there twice;
+// the lookup must return the first of them
+static DWORD SortedMap_Test(DWORD dwObjectCount, bool bSameHash)
+{
+    PTEST_MAP_OBJECT pObjects;
+    PTEST_MAP_OBJECT pObject;
+    TLogHelper LogHelper("SortedMapTest", bSameHash ? _T("same hash") : _T("lookup"));
+    CASC_SORTED_MAP Map;
+    BYTE AbsentKey[MD5_HASH_SIZE];
+    DWORD dwErrCode;
+
+    // Prepare the objects with a few duplicate keys and sort them by their keys
+    if((pObjects = CreateTestObjects(dwObjectCount, bSameHash)) == NULL)
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    for(DWORD i = 0; i + 1 < dwObjectCount; i += 100)
+        memcpy(pObjects[i + 1].Key, pObjects[i].Key, MD5_HASH_SIZE);
+    qsort(pObjects, dwObjectCount, sizeof(TEST_MAP_OBJECT), CompareTestObjects);
+
+    // Create the map on top of the objects
+    dwErrCode = Map.Create(pObjects, dwObjectCount, sizeof(TEST_MAP_OBJECT), MD5_HASH_SIZE, FIELD_OFFSET(TEST_MAP_OBJECT, Key));
+
+    // Find all objects. With duplicate keys, the first object must be found
+    for(DWORD i = 0; i < dwObjectCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        pObject = (PTEST_MAP_OBJECT)Map.FindObject(pObjects[i].Key);
+        if(pObject == NULL || memcmp(pObject->Key, pObjects[i].Key, MD5_HASH_SIZE) || (pObject > pObjects && !memcmp(pObject[-1].Key, pObject->Key, MD5_HASH_SIZE)))
+        {
+            LogHelper.PrintMessage("Error: Object %u was not found in the map", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // Keys that are not in the map must not be found, including those out of the key range
+    for(DWORD i = 0; i < dwObjectCount + 2 && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(i < dwObjectCount)
+            MakeTestKey(AbsentKey, dwObjectCount + i, bSameHash);
+        else
+            memset(AbsentKey, (i == dwObjectCount) ? 0x00 : 0xFF, MD5_HASH_SIZE);
+
+        if(Map.FindObject(AbsentKey) != NULL)
+        {
+            LogHelper.PrintMessage("Error: Non-existing object %u was found in the map", dwObjectCount + i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    CASC_FREE(pObjects);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the file tree with enough names to fill many chunks of the name table.
+// Every name must be found by its FileDataId and give back the same path
+static DWORD FileTree_Test(DWORD dwFileCount)
+{
+    CASC_CKEY_ENTRY CKeyEntry;
+    CASC_FILE_TREE FileTree;
+    PCASC_FILE_NODE pFileNode;
+    TLogHelper LogHelper("FileTreeTest");
+    char szExpected[MAX_PATH];
+    char szFileName[MAX_PATH];
+    DWORD dwErrCode;
+
+    // Insert the files. The FileDataIds have gaps, so the sparse array gets many sub-tables
+    dwErrCode = FileTree.Create(FTREE_FLAG_USE_DATA_ID);
+    for(DWORD i = 0; i < dwFileCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        CascStrPrintf(szExpected, _countof(szExpected), "folder%03u\\subfolder%02u\\file_with_a_long_name_%08u.dat", i % 100, i % 7, i);
+        if(FileTree.InsertByName(&CKeyEntry, szExpected, i * 37) == NULL)
+        {
+            LogHelper.PrintMessage("Error: Failed to insert file %u", i);
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    // Find all files and verify their names
+    for(DWORD i = 0; i < dwFileCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        CascStrPrintf(szExpected, _countof(szExpected), "folder%03u\\subfolder%02u\\file_with_a_long_name_%08u.dat", i % 100, i % 7, i);
+        if((pFileNode = FileTree.FindById(i * 37)) == NULL || FileTree.PathAt(szFileName, _countof(szFileName), pFileNode) == 0 || strcmp(szFileName, szExpected))
+        {
+            LogHelper.PrintMessage("Error: File %u was not found or has a wrong name", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    FileTree.Free();
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the cache of decoded frames: disabled by default, returns exactly what was put into it,
+// keeps within its size by evicting the least recently used frames
+static DWORD FrameCache_Test()
+{
+    CASC_FRAME_CACHE_STATS Stats;
+    CASC_FRAME_CACHE FrameCache;
+    TLogHelper LogHelper("FrameCacheTest");
+    BYTE EKey[MD5_HASH_SIZE];
+    BYTE Frame[0x400];
+    BYTE Buffer[0x400];
+    size_t cbCacheSize = CASC_FRAME_CACHE_SHARDS * 0x1000;
+    DWORD dwFrameCount = 0x400;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Prepare the frame data
+    MakeTestKey(EKey, 0);
+    for(size_t i = 0; i < sizeof(Frame); i++)
+        Frame[i] = (BYTE)(i * 7);
+
+    // The cache must be disabled by default
+    FrameCache.Put(EKey, 0, Frame, sizeof(Frame));
+    if(FrameCache.IsEnabled() || FrameCache.Get(EKey, 0, Buffer, sizeof(Buffer)))
+    {
+        LogHelper.PrintMessage("Error: The frame cache is not disabled by default");
+        return LogHelper.PrintVerdict(ERROR_CAN_NOT_COMPLETE);
+    }
+
+    // Enable the cache. A frame must be found only by the same EKey, frame index and size
+    FrameCache.SetSize(cbCacheSize);
+    FrameCache.Put(EKey, 0, Frame, sizeof(Frame));
+    if(!FrameCache.Get(EKey, 0, Buffer, sizeof(Buffer)) || memcmp(Buffer, Frame, sizeof(Frame)))
+    {
+        LogHelper.PrintMessage("Error: The cached frame was not found");
+        dwErrCode = ERROR_FILE_CORRUPT;
+    }
+    if(FrameCache.Get(EKey, 1, Buffer, sizeof(Buffer)) || FrameCache.Get(EKey, 0, Buffer, sizeof(Buffer) - 1))
+    {
+        LogHelper.PrintMessage("Error: A frame that is not cached was found");
+        dwErrCode = ERROR_FILE_CORRUPT;
+    }
+
+    // Put more frames than the cache can hold. The newest frame must stay there
+    for(DWORD i = 0; i < dwFrameCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        Frame[0] = (BYTE)i;
+        FrameCache.Put(EKey, i, Frame, sizeof(Frame));
+        if(!FrameCache.Get(EKey, i, Buffer, sizeof(Buffer)) || memcmp(Buffer, Frame, sizeof(Frame)))
+        {
+            LogHelper.PrintMessage("Error: The newest frame %u was not found", i);
+            dwErrCode = ERROR_FILE_CORRUPT;
+        }
+    }
+
+    // The cached data must be within the limit and some frames must have been evicted
+    FrameCache.GetStats(&Stats);
+    if(dwErrCode == ERROR_SUCCESS && (Stats.CacheSize != cbCacheSize || Stats.BytesCached > cbCacheSize || Stats.Evictions == 0 || Stats.Hits < dwFrameCount))
+    {
+        LogHelper.PrintMessage("Error: Wrong frame cache statistics");
+        dwErrCode = ERROR_FILE_CORRUPT;
+    }
+
+    // Disabling the cache must free all frames
+    FrameCache.SetSize(0);
+    FrameCache.GetStats(&Stats);
+    if(dwErrCode == ERROR_SUCCESS && (FrameCache.IsEnabled() || Stats.BytesCached != 0 || FrameCache.BytesAllocated() != 0))
+    {
+        LogHelper.PrintMessage("Error: The frame cache was not freed");
+        dwErrCode = ERROR_FILE_CORRUPT;
+    }
+
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+// Tests the cache of the stream blocks. The file is larger than the cache, so blocks get evicted.
+// All reads must give the same data like the file, before and after the cache is flushed
+static DWORD BlockCache_Test(DWORD dwReadCount)
+{
+    TStreamCache * pCache = NULL;
+    TFileStream * pStream = NULL;
+    TLogHelper LogHelper("BlockCacheTest");
+    ULONGLONG ByteOffset;
+    ULONGLONG FileSize = (STREAM_CACHE_BLOCK_SIZE * 8) + 0x123;
+    LPBYTE pbBuffer = NULL;
+    LPCTSTR szFileName = _T("CascTest-BlockCache.bin");
+    DWORD dwRandom = 0x12345678;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    DWORD cbToRead;
+
+    // Create the test file
+    if((pbBuffer = CASC_ALLOC<BYTE>(STREAM_CACHE_MAX_READ)) == NULL)
+        return LogHelper.PrintVerdict(ERROR_NOT_ENOUGH_MEMORY);
+    if((pStream = FileStream_CreateFile(szFileName, STREAM_PROVIDER_FLAT | BASE_PROVIDER_FILE)) != NULL)
+    {
+        for(ByteOffset = 0; ByteOffset < FileSize && dwErrCode == ERROR_SUCCESS; ByteOffset += cbToRead)
+        {
+            cbToRead = (DWORD)CASCLIB_MIN(FileSize - ByteOffset, STREAM_CACHE_MAX_READ);
+            for(DWORD i = 0; i < cbToRead; i++)
+                pbBuffer[i] = TestFileByte(ByteOffset + i);
+            if(!FileStream_Write(pStream, &ByteOffset, pbBuffer, cbToRead))
+                dwErrCode = GetCascError();
+        }
+        FileStream_Close(pStream);
+    }
+    else
+    {
+        dwErrCode = GetCascError();
+    }
+
+    // Open the file with a cache that is smaller than the file
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        pStream = FileStream_OpenFile(szFileName, STREAM_FLAG_READ_ONLY);
+        pCache = FileStream_CreateCache();
+        if(pStream != NULL && pCache != NULL && FileStream_SetCacheSize(pCache, STREAM_CACHE_BLOCK_SIZE * 4))
+            FileStream_SetCache(pStream, pCache);
+        else
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    }
+
+    // Read the file at random offsets. Flush the whole cache in the middle, then the blocks of the stream
+    for(DWORD i = 0; i < dwReadCount && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        if(i == dwReadCount / 2)
+            FileStream_FlushCache(pCache);
+        if(i == (dwReadCount / 4) * 3)
+            FileStream_FlushCacheStream(pStream);
+
+        dwRandom = dwRandom * 1103515245 + 12345;
+        ByteOffset = dwRandom % FileSize;
+        dwRandom = dwRandom * 1103515245 + 12345;
+        cbToRead = (i & 1) ? (dwRandom % 0x100) : (dwRandom % STREAM_CACHE_MAX_READ);
+        cbToRead = (DWORD)CASCLIB_MIN(FileSize - ByteOffset, cbToRead);
+
+        if(!FileStream_Read(pStream, &ByteOffset, pbBuffer, cbToRead))
+        {
+            LogHelper.PrintMessage("Error: Failed to read %u bytes at offset %llX", cbToRead, ByteOffset);
+            dwErrCode = GetCascError();
+            break;
+        }
+
+        for(DWORD j = 0; j < cbToRead; j++)
+        {
+            if(pbBuffer[j] != TestFileByte(ByteOffset + j))
+            {
+                LogHelper.PrintMessage("Error: Wrong data read at offset %llX", ByteOffset + j);
+                dwErrCode = ERROR_FILE_CORRUPT;
+                break;
+            }
+        }
+    }
+
+    // The cache must have been used. Reads beyond the end of the file must fail
+    if(dwErrCode == ERROR_SUCCESS && FileStream_GetCacheBytes(pCache) == 0)
+    {
+        LogHelper.PrintMessage("Error: The block cache was not used");
+        dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    }
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        ByteOffset = FileSize - 0x10;
+        if(FileStream_Read(pStream, &ByteOffset, pbBuffer, 0x20))
+        {
+            LogHelper.PrintMessage("Error: Read beyond the end of the file succeeded");
+            dwErrCode = ERROR_CAN_NOT_COMPLETE;
+        }
+    }
+
+    // Cleanup. The stream must be closed before the cache
+    FileStream_Close(pStream);
+    FileStream_FreeCache(pCache);
+    _tremove(szFileName);
+    CASC_FREE(pbBuffer);
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
+struct PARALLEL_TEST
+{
+    DWORD * ItemHits;                               // How many times each item was processed
+    DWORD ItemCount;                                // Number of items in each loop
+    DWORD FailItem;                                 // Index of the item that fails, or ItemCount
+    DWORD dwErrCode;                                // Result of the loop
+};
+
+static DWORD ParallelTest_Item(void * pvContext, size_t nItemIndex)
+{
+    PARALLEL_TEST * pTest = (PARALLEL_TEST *)pvContext;
+
+    CascInterlockedIncrement(&pTest->ItemHits[nItemIndex]);
+    return (nItemIndex == pTest->FailItem) ? ERROR_CAN_NOT_COMPLETE : ERROR_SUCCESS;
+}
+
+static DWORD ParallelTest_Task(void * pvContext)
+{
+    PARALLEL_TEST * pTest = (PARALLEL_TEST *)pvContext;
+
+    pTest->dwErrCode = CascParallelFor(ParallelTest_Item, pTest, pTest->ItemCount);
+    return pTest->dwErrCode;
+}
+
+// Tests the parallel loop on the worker pool. Multiple loops run at the same time and share the threads.
+// Each item must be processed exactly once, and a failed item must stop the loop with its error code
+static DWORD ParallelFor_Test(DWORD dwItemCount)
+{
+    PARALLEL_TEST Tests[4];
+    CASC_TASK Tasks[4];
+    TLogHelper LogHelper("ParallelForTest");
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Run the loops twice, so the second time runs on a restarted pool
+    for(DWORD dwPass = 0; dwPass < 2 && dwErrCode == ERROR_SUCCESS; dwPass++)
+    {
+        CascAddRefWorkerPool();
+
+        // Start the loops on multiple threads. The last one fails in the middle
+        for(DWORD i = 0; i < _countof(Tests); i++)
+        {
+            Tests[i].ItemHits = CASC_ALLOC_ZERO<DWORD>(dwItemCount);
+            Tests[i].ItemCount = dwItemCount;
+            Tests[i].FailItem = (i == _countof(Tests) - 1) ? (dwItemCount / 2) : dwItemCount;
+            Tests[i].dwErrCode = ERROR_SUCCESS;
+            CascStartTask(Tasks[i], ParallelTest_Task, &Tests[i]);
+        }
+
+        // Verify the results
+        for(DWORD i = 0; i < _countof(Tests); i++)
+        {
+            CascWaitForTask(Tasks[i]);
+            if(Tests[i].ItemHits == NULL)
+                dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+
+            for(DWORD j = 0; j < dwItemCount && dwErrCode == ERROR_SUCCESS; j++)
+            {
+                if(Tests[i].ItemHits[j] > 1 || (Tests[i].FailItem == dwItemCount && Tests[i].ItemHits[j] != 1))
+                {
+                    LogHelper.PrintMessage("Error: Item %u of loop %u was processed %u times", j, i, Tests[i].ItemHits[j]);
+                    dwErrCode = ERROR_FILE_CORRUPT;
+                }
+            }
+
+            if(dwErrCode == ERROR_SUCCESS && Tests[i].dwErrCode != ((Tests[i].FailItem == dwItemCount) ? ERROR_SUCCESS : ERROR_CAN_NOT_COMPLETE))
+            {
+                LogHelper.PrintMessage("Error: Loop %u returned wrong error code (%u)", i, Tests[i].dwErrCode);
+                dwErrCode = ERROR_FILE_CORRUPT;
+            }
+            CASC_FREE(Tests[i].ItemHits);
+        }
+
+        CascReleaseWorkerPool();
+    }
+
+    return LogHelper.PrintVerdict(dwErrCode);
+}
+
 // Get the English version of the progress message
 static LPCSTR GetProgressMessageAsText(CASC_PROGRESS_MSG Message)
 {
@@ -1229,6 +2240,8 @@ static STORAGE_INFO StorageInfo2[] =
 //#define LOAD_STORAGES_CMD_LINE
 #define LOAD_STORAGES_LOCAL
 #define LOAD_STORAGES_ONLINE
+#define TEST_STORAGE_FEATURES
+#define TEST_INTERNAL_STRUCTURES
 
 int main(int argc, char * argv[])
 {
@@ -1245,6 +2258,70 @@ int main(int argc, char * argv[])
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif  // defined(_MSC_VER) && defined(_DEBUG)
 
+#ifdef TEST_INTERNAL_STRUCTURES
+    //
+    // Test the internal structures of the library
+    //
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = Map_Test(100000, false);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = Map_Test(1000, true);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = MapGrow_Test(100000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = MapConcurrent_Test(100000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = ChunkedArray_Test(3, 100000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = ChunkedArray_Test(1000, 100000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = SortedMap_Test(100000, false);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = SortedMap_Test(100000, true);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = FileTree_Test(100000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = FrameCache_Test();
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = BlockCache_Test(2000);
+    if(dwErrCode == ERROR_SUCCESS)
+        dwErrCode = ParallelFor_Test(100000);
+#endif
+
+#ifdef TEST_STORAGE_FEATURES
+    //
+    // Run the tests of the optional storage features for every local storage
+    //
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        for(size_t i = 0; i < _countof(StorageInfo1); i++)
+        {
+            // Snapshot must give the same storage as the normal open
+            dwErrCode = SnapshotStorage_Test(StorageInfo1[i]);
+            if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+                break;
+
+            // Lazy ENCODING must give the same storage as the normal open
+            dwErrCode = LookupStorage_Test(StorageInfo1[i], CASC_FEATURE_LAZY_ENCODING, _T("lazy encoding"));
+            if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+                break;
+
+            // Deferred ROOT must give the same storage as the normal open
+            dwErrCode = LookupStorage_Test(StorageInfo1[i], CASC_FEATURE_LAZY_ENCODING | CASC_FEATURE_DEFERRED_ROOT, _T("deferred root"));
+            if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+                break;
+
+            // Refresh of unchanged storage must keep the files, also with lazy ENCODING
+            dwErrCode = RefreshStorage_Test(StorageInfo1[i], 0, _T("refresh"));
+            if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+                break;
+            dwErrCode = RefreshStorage_Test(StorageInfo1[i], CASC_FEATURE_LAZY_ENCODING, _T("lazy refresh"));
+            if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
+                break;
+        }
+    }
+#endif
+
 #ifdef LOAD_STORAGES_SINGLE_DEV
     {
         CASC_OPEN_STORAGE_ARGS OpenArgs = {sizeof(CASC_OPEN_STORAGE_ARGS)};
@@ -1320,12 +2397,10 @@ int main(int argc, char * argv[])
     //
     // Run the tests for every local storage in my collection
     //
-    for(size_t i = 0; i < _countof(StorageInfo1); i++)
+    for(size_t i = 0; i < _countof(StorageInfo1) && (dwErrCode == ERROR_SUCCESS || dwErrCode == ERROR_FILE_NOT_FOUND); i++)
     {
         // Attempt to open the storage and extract single file
         dwErrCode = LocalStorage_Test(Storage_ReadFiles, StorageInfo1[i]);
-        if(dwErrCode != ERROR_SUCCESS && dwErrCode != ERROR_FILE_NOT_FOUND)
-            break;
     }
 #endif
 
@@ -1333,7 +2408,7 @@ int main(int argc, char * argv[])
     //
     // Run the tests for every available online storage in my collection
     //
-    for(size_t i = 0; i < _countof(StorageInfo2); i++)
+    for(size_t i = 0; i < _countof(StorageInfo2) && (dwErrCode == ERROR_SUCCESS || dwErrCode == ERROR_FILE_NOT_FOUND); i++)
     {
         // Attempt to open the storage and extract single file
         dwErrCode = OnlineStorage_Test(Storage_EnumFiles, StorageInfo2[i]);